@@ -22,20 +22,34 @@
  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
  * SOFTWARE.
  */
-#include "targa.h"
+#include "targa_private.h"
 #include <stdio.h>
+#include <string.h>
 #include <inttypes.h>
 
-#define CMT_TRUE_COLOR   0
-#define CMT_COLOR_MAPPED 1
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define TGA_MMAP
+#endif
 
-#define IMG_TYPE_NO_IMAGE_DATA                0
-#define IMG_TYPE_UNCOMPRESSED_COLOR_MAPPED    1
-#define IMG_TYPE_UNCOMPRESSED_TRUE_COLOR      2
-#define IMG_TYPE_UNCOMPRESSED_BLACK_AND_WHITE 3
-#define IMG_TYPE_RLE_COLOR_MAPPED             9
-#define IMG_TYPE_RLE_TRUE_COLOR               10
-#define IMG_TYPE_RLE_BLACK_AND_WHITE          11 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#ifdef TARGA_HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+/*
+ * Pixel data is read by blocks of this size, a multiple of every pixel
+ * size (2, 3 and 4 bytes) small enough to stay in cache while swizzled.
+ */
+#define TGA_BLOCK_SIZE (64 * 1024 - (64 * 1024) % 12)
 
 
 typedef struct {
@@ -64,185 +78,3845 @@ typedef struct {
 } TGA_FILE_HEADER;
 
 
-void targaLoad24bits(
-        FILE*               TGA_file, 
-        TGA_FILE_HEADER*    TGA_header, 
-        uint8_t*            texture)
+static uint16_t targaGet16(const uint8_t* p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+
+static uint32_t targaGet32(const uint8_t* p)
 {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8)
+        | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+static void targaParseHeader(const uint8_t* buf, TGA_FILE_HEADER* header)
+{
+    header->idLength                     = buf[0];
+    header->colorMapType                 = buf[1];
+    header->imageType                    = buf[2];
+    header->colorMapSpec.firstEntryIndex = targaGet16(buf + 3);
+    header->colorMapSpec.mapLenght       = targaGet16(buf + 5);
+    header->colorMapSpec.mapEntrySize    = buf[7];
+    header->imageSpec.xOriginOfImage     = targaGet16(buf + 8);
+    header->imageSpec.yOriginOfImage     = targaGet16(buf + 10);
+    header->imageSpec.imageWidth         = targaGet16(buf + 12);
+    header->imageSpec.imageHeight        = targaGet16(buf + 14);
+    header->imageSpec.pixelDepth         = buf[16];
+    header->imageSpec.imageDescriptor    = buf[17];
+}
+
+
+/*
+ * Kernel converting file pixels (srcBpp bytes) to output pixels (dstBpp
+ * bytes). key is the 0xRRGGBB color made transparent by
+ * TARGA_FORMAT_RGBA8_KEYED, lut the expanded color map of color mapped
+ * images (NULL otherwise).
+ */
+struct TGA_CONVERTER {
+    TGA_SWIZZLE_FN swizzle;
+    size_t         srcBpp;
+    size_t         dstBpp;
+    uint32_t       key;
+    uint32_t*      lut;
+};
 
-    int pixelCount =
-          TGA_header->imageSpec.imageWidth 
-        * TGA_header->imageSpec.imageHeight;
 
-    unsigned char r, g, b;
-    int i;
-    for (i = 0; i < pixelCount; i++)
+/*
+ * Scalar kernels
+ */
+static void targaSwizzleBgr16(
+        uint8_t* dst, const uint8_t* src, size_t count, const TGA_CONVERTER* converter)
+{
+    size_t i;
+    (void)converter;
+    for (i = 0; i < count; i++, src += 2, dst += 3)
     {
-        b = fgetc(TGA_file);
-        g = fgetc(TGA_file);
-        r = fgetc(TGA_file);
+        unsigned int color = targaGet16(src);
+        unsigned int r = (color >> 10) & 0x1F;
+        unsigned int g = (color >>  5) & 0x1F;
+        unsigned int b =  color        & 0x1F;
 
-        texture[(i * 3) + 0] = r;
-        texture[(i * 3) + 1] = g;
-        texture[(i * 3) + 2] = b;
-        printf("%d %d %d\n", r, g, b);
+        /* replicate the high bits so that 0x1F maps to 0xFF */
+        dst[0] = (uint8_t)((r << 3) | (r >> 2));
+        dst[1] = (uint8_t)((g << 3) | (g >> 2));
+        dst[2] = (uint8_t)((b << 3) | (b >> 2));
+    }
+}
 
+static void targaSwizzleBgr24(
+        uint8_t* dst, const uint8_t* src, size_t count, const TGA_CONVERTER* converter)
+{
+    size_t i;
+    (void)converter;
+    for (i = 0; i < count; i++, src += 3, dst += 3)
+    {
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = src[0];
     }
-    
 }
 
-void* targaLoad(
-        const char* fileName,
-        int* status,
-        unsigned int* width,
-        unsigned int* height)
+static void targaSwizzleBgra32(
+        uint8_t* dst, const uint8_t* src, size_t count, const TGA_CONVERTER* converter)
+{
+    size_t i;
+    (void)converter;
+    for (i = 0; i < count; i++, src += 4, dst += 4)
+    {
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = src[0];
+        dst[3] = src[3];
+    }
+}
+
+
+#ifdef TGA_X86
+/*
+ * SSSE3 and AVX2 kernels. Loads and stores are 16 or 32 bytes wide, the
+ * remaining pixels go through the scalar kernels.
+ */
+TGA_TARGET("ssse3")
+static void targaSwizzleBgr24Ssse3(
+        uint8_t* dst, const uint8_t* src, size_t count, const TGA_CONVERTER* converter)
 {
+    const __m128i mask = _mm_setr_epi8(
+            2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 12, 13, 14, 15);
+    size_t i;
 
-    FILE* TGA_file = fopen(fileName, "rb");
+    /* 4 pixels per iteration, the 4 extra bytes are rewritten by the next one */
+    for (i = 0; i + 6 <= count; i += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i * 3));
+        _mm_storeu_si128((__m128i*)(dst + i * 3), _mm_shuffle_epi8(v, mask));
+    }
 
-    if (!TGA_file) {
+    targaSwizzleBgr24(dst + i * 3, src + i * 3, count - i, converter);
+}
 
-        printf("openfile failed\n");
-        return;
+TGA_TARGET("ssse3")
+static void targaSwizzleBgra32Ssse3(
+        uint8_t* dst, const uint8_t* src, size_t count, const TGA_CONVERTER* converter)
+{
+    const __m128i mask = _mm_setr_epi8(
+            2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    size_t i;
 
+    for (i = 0; i + 4 <= count; i += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i * 4));
+        _mm_storeu_si128((__m128i*)(dst + i * 4), _mm_shuffle_epi8(v, mask));
     }
 
-    /*
-     * Read TGA header
-     */
-    TGA_FILE_HEADER TGA_header;
-    if (fread(&TGA_header.idLength, sizeof(uint8_t), 1, TGA_file) < 1) return;
-    fread(&TGA_header.colorMapType, sizeof(uint8_t), 1, TGA_file);
-    fread(&TGA_header.imageType, sizeof(uint8_t), 1, TGA_file);
-    fread(&TGA_header.colorMapSpec.firstEntryIndex, sizeof(uint16_t), 1, TGA_file);
-    fread(&TGA_header.colorMapSpec.mapLenght, sizeof(uint16_t), 1, TGA_file);
-    fread(&TGA_header.colorMapSpec.mapEntrySize, sizeof(uint8_t), 1, TGA_file);
-    fread(&TGA_header.imageSpec.xOriginOfImage, sizeof(uint16_t), 1, TGA_file);
-    fread(&TGA_header.imageSpec.yOriginOfImage, sizeof(uint16_t), 1, TGA_file);
-    fread(&TGA_header.imageSpec.imageWidth, sizeof(uint16_t), 1, TGA_file);
-    fread(&TGA_header.imageSpec.imageHeight, sizeof(uint16_t), 1, TGA_file);
-    fread(&TGA_header.imageSpec.pixelDepth, sizeof(uint8_t), 1, TGA_file);
-    fread(&TGA_header.imageSpec.imageDescriptor, sizeof(uint8_t), 1, TGA_file);
-
-    *width  = TGA_header.imageSpec.imageWidth;
-    *height = TGA_header.imageSpec.imageHeight;
+    targaSwizzleBgra32(dst + i * 4, src + i * 4, count - i, converter);
+}
+
+TGA_TARGET("avx2")
+static void targaSwizzleBgr24Avx2(
+        uint8_t* dst, const uint8_t* src, size_t count, const TGA_CONVERTER* converter)
+{
+    const __m256i mask = _mm256_setr_epi8(
+            2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 12, 13, 14, 15,
+            2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 12, 13, 14, 15);
+    const __m256i pack = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+    size_t i;
 
     /*
-     * Skipp image id
+     * 8 pixels per iteration: each lane shuffles 4 pixels, then the two
+     * 12 bytes results are packed together at the bottom of the register.
      */
-    fseek(TGA_file, TGA_header.idLength, SEEK_CUR);
+    for (i = 0; i + 11 <= count; i += 8)
+    {
+        __m128i lo = _mm_loadu_si128((const __m128i*)(src + i * 3));
+        __m128i hi = _mm_loadu_si128((const __m128i*)(src + i * 3 + 12));
+        __m256i v  = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+        v = _mm256_shuffle_epi8(v, mask);
+        v = _mm256_permutevar8x32_epi32(v, pack);
+        _mm256_storeu_si256((__m256i*)(dst + i * 3), v);
+    }
 
+    targaSwizzleBgr24(dst + i * 3, src + i * 3, count - i, converter);
+}
 
-    /*
-     * Read color map
-     */
-    char *TGA_colorMap = NULL;
-    if (TGA_header.colorMapType == CMT_COLOR_MAPPED)
+TGA_TARGET("avx2")
+static void targaSwizzleBgra32Avx2(
+        uint8_t* dst, const uint8_t* src, size_t count, const TGA_CONVERTER* converter)
+{
+    const __m256i mask = _mm256_setr_epi8(
+            2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+            2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    size_t i;
+
+    for (i = 0; i + 8 <= count; i += 8)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i * 4));
+        _mm256_storeu_si256((__m256i*)(dst + i * 4), _mm256_shuffle_epi8(v, mask));
+    }
+
+    targaSwizzleBgra32(dst + i * 4, src + i * 4, count - i, converter);
+}
+#endif // TGA_X86
+
+
+unsigned int targaCpuFeatures(void)
+{
+    unsigned int features = 0;
+
+#if defined(TGA_X86) && defined(_MSC_VER)
+    int info[4];
+
+    __cpuid(info, 1);
+    if (info[2] & (1 << 9))
+        features |= CPU_SSSE3;
+
+    /* AVX2 also needs the OS to save the ymm registers (OSXSAVE, XCR0) */
+    if ((info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6)
     {
+        __cpuidex(info, 7, 0);
+        if (info[1] & (1 << 5))
+            features |= CPU_AVX2;
+    }
+#elif defined(TGA_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3"))
+        features |= CPU_SSSE3;
+    if (__builtin_cpu_supports("avx2"))
+        features |= CPU_AVX2;
+#endif
+
+    return features;
+}
+
 
-        TGA_colorMap = malloc(
-                  sizeof(char)
-                * TGA_header.colorMapSpec.mapLenght
-                * (TGA_header.colorMapSpec.mapEntrySize >> 3));
+static void targaCopy24(
+        uint8_t* dst, const uint8_t* src, size_t count, const TGA_CONVERTER* converter)
+{
+    (void)converter;
+    memcpy(dst, src, count * 3);
+}
+
+static void targaCopy32(
+        uint8_t* dst, const uint8_t* src, size_t count, const TGA_CONVERTER* converter)
+{
+    (void)converter;
+    memcpy(dst, src, count * 4);
+}
+
+static void targaGray8ToRgb(
+        uint8_t* dst, const uint8_t* src, size_t count, const TGA_CONVERTER* converter)
+{
+    size_t i;
+    (void)converter;
+    for (i = 0; i < count; i++, dst += 3)
+        dst[0] = dst[1] = dst[2] = src[i];
+}
 
-        fread(TGA_colorMap, sizeof(char), 
-                  TGA_header.colorMapSpec.mapLenght 
-                * (TGA_header.colorMapSpec.mapEntrySize >> 3), TGA_file);
+static void targaGray16ToRgba(
+        uint8_t* dst, const uint8_t* src, size_t count, const TGA_CONVERTER* converter)
+{
+    size_t i;
+    (void)converter;
+    for (i = 0; i < count; i++, src += 2, dst += 4)
+    {
+        dst[0] = dst[1] = dst[2] = src[0];
+        dst[3] = src[1];
     }
+}
 
-    /*
-     * Read image data
-     */
-    uint8_t *texture = malloc(sizeof(char) *
-              TGA_header.imageSpec.imageWidth
-            * TGA_header.imageSpec.imageHeight
-            * 4);
- 
 
-    switch (TGA_header.imageType)
+/*
+ * Generic kernels, one per source layout and output format. A source
+ * pixel is loaded into r, g, b, a and stored straight in the output
+ * format, in the same loop.
+ */
+#define TGA_LOAD_BGR16 \
+    unsigned int color = targaGet16(src); \
+    r = (color >> 10) & 0x1F; r = (r << 3) | (r >> 2); \
+    g = (color >>  5) & 0x1F; g = (g << 3) | (g >> 2); \
+    b =  color        & 0x1F; b = (b << 3) | (b >> 2); \
+    a = 0xFF;
+
+/* ARGB1555: the attribute bit is a one bit alpha */
+#define TGA_LOAD_BGRA16 \
+    TGA_LOAD_BGR16 \
+    a = color & 0x8000 ? 0xFF : 0;
+
+#define TGA_LOAD_BGR24   b = src[0]; g = src[1]; r = src[2]; a = 0xFF;
+#define TGA_LOAD_BGRA32  b = src[0]; g = src[1]; r = src[2]; a = src[3];
+#define TGA_LOAD_GRAY8   r = g = b = src[0]; a = 0xFF;
+#define TGA_LOAD_GRAY16  r = g = b = src[0]; a = src[1];
+
+/* x * a / 255 rounded, exact for every 8 bits x and a */
+#define TGA_MUL255(x, a) \
+    ((((x) * (a) + 128) + (((x) * (a) + 128) >> 8)) >> 8)
+
+#define TGA_STORE_RGB8   dst[0] = r; dst[1] = g; dst[2] = b;
+#define TGA_STORE_RGBA8  dst[0] = r; dst[1] = g; dst[2] = b; dst[3] = a;
+#define TGA_STORE_BGR8   dst[0] = b; dst[1] = g; dst[2] = r;
+#define TGA_STORE_BGRA8  dst[0] = b; dst[1] = g; dst[2] = r; dst[3] = a;
+
+/* ITU-R BT.601 luma, gray sources are kept exact */
+#define TGA_STORE_GRAY8  dst[0] = (77 * r + 150 * g + 29 * b + 128) >> 8;
+
+#define TGA_STORE_PREMULTIPLIED \
+    dst[0] = TGA_MUL255(r, a); dst[1] = TGA_MUL255(g, a); \
+    dst[2] = TGA_MUL255(b, a); dst[3] = a;
+
+#define TGA_STORE_KEYED \
+    dst[0] = r; dst[1] = g; dst[2] = b; \
+    dst[3] = ((r << 16) | (g << 8) | b) == converter->key ? 0 : a;
+
+#define TGA_KERNEL(name, srcBpp, dstBpp, LOAD, STORE) \
+static void name( \
+        uint8_t* dst, const uint8_t* src, size_t count, const TGA_CONVERTER* converter) \
+{ \
+    size_t i; \
+    (void)converter; \
+    for (i = 0; i < count; i++, src += srcBpp, dst += dstBpp) \
+    { \
+        unsigned int r, g, b, a; \
+        LOAD \
+        STORE \
+        (void)a; \
+    } \
+}
+
+TGA_KERNEL(targaBgr16ToRgba,       2, 4, TGA_LOAD_BGR16, TGA_STORE_RGBA8)
+TGA_KERNEL(targaBgr16ToBgr,        2, 3, TGA_LOAD_BGR16, TGA_STORE_BGR8)
+TGA_KERNEL(targaBgr16ToBgra,       2, 4, TGA_LOAD_BGR16, TGA_STORE_BGRA8)
+TGA_KERNEL(targaBgr16ToGray,       2, 1, TGA_LOAD_BGR16, TGA_STORE_GRAY8)
+TGA_KERNEL(targaBgr16ToKeyed,      2, 4, TGA_LOAD_BGR16, TGA_STORE_KEYED)
+
+TGA_KERNEL(targaBgra16ToRgba,      2, 4, TGA_LOAD_BGRA16, TGA_STORE_RGBA8)
+TGA_KERNEL(targaBgra16ToBgra,      2, 4, TGA_LOAD_BGRA16, TGA_STORE_BGRA8)
+TGA_KERNEL(targaBgra16ToPremul,    2, 4, TGA_LOAD_BGRA16, TGA_STORE_PREMULTIPLIED)
+TGA_KERNEL(targaBgra16ToKeyed,     2, 4, TGA_LOAD_BGRA16, TGA_STORE_KEYED)
+
+TGA_KERNEL(targaBgr24ToRgba,       3, 4, TGA_LOAD_BGR24, TGA_STORE_RGBA8)
+TGA_KERNEL(targaBgr24ToBgra,       3, 4, TGA_LOAD_BGR24, TGA_STORE_BGRA8)
+TGA_KERNEL(targaBgr24ToGray,       3, 1, TGA_LOAD_BGR24, TGA_STORE_GRAY8)
+TGA_KERNEL(targaBgr24ToKeyed,      3, 4, TGA_LOAD_BGR24, TGA_STORE_KEYED)
+
+TGA_KERNEL(targaBgra32ToRgb,       4, 3, TGA_LOAD_BGRA32, TGA_STORE_RGB8)
+TGA_KERNEL(targaBgra32ToBgr,       4, 3, TGA_LOAD_BGRA32, TGA_STORE_BGR8)
+TGA_KERNEL(targaBgra32ToGray,      4, 1, TGA_LOAD_BGRA32, TGA_STORE_GRAY8)
+TGA_KERNEL(targaBgra32ToPremul,    4, 4, TGA_LOAD_BGRA32, TGA_STORE_PREMULTIPLIED)
+TGA_KERNEL(targaBgra32ToKeyed,     4, 4, TGA_LOAD_BGRA32, TGA_STORE_KEYED)
+
+TGA_KERNEL(targaGray8ToRgba,       1, 4, TGA_LOAD_GRAY8, TGA_STORE_RGBA8)
+TGA_KERNEL(targaGray8ToKeyed,      1, 4, TGA_LOAD_GRAY8, TGA_STORE_KEYED)
+
+TGA_KERNEL(targaGray16ToRgb,       2, 3, TGA_LOAD_GRAY16, TGA_STORE_RGB8)
+TGA_KERNEL(targaGray16ToGray,      2, 1, TGA_LOAD_GRAY16, TGA_STORE_GRAY8)
+TGA_KERNEL(targaGray16ToPremul,    2, 4, TGA_LOAD_GRAY16, TGA_STORE_PREMULTIPLIED)
+TGA_KERNEL(targaGray16ToKeyed,     2, 4, TGA_LOAD_GRAY16, TGA_STORE_KEYED)
+
+static void targaGray8Copy(
+        uint8_t* dst, const uint8_t* src, size_t count, const TGA_CONVERTER* converter)
+{
+    (void)converter;
+    memcpy(dst, src, count);
+}
+
+
+#ifdef TGA_X86
+/*
+ * Premultiplied alpha from 32 bits pixels, 8 pixels per iteration: the
+ * channels are widened to 16 bits, multiplied by the broadcast alpha and
+ * divided by 255 with the same rounding as TGA_MUL255 (x * a + 128 fits
+ * in 16 bits).
+ */
+TGA_TARGET("avx2")
+static void targaBgra32ToPremulAvx2(
+        uint8_t* dst, const uint8_t* src, size_t count, const TGA_CONVERTER* converter)
+{
+    const __m256i swizzle = _mm256_setr_epi8(
+            2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+            2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    /* alpha words of the two pixels of each half, 0 for the alpha itself */
+    const __m256i alpha = _mm256_setr_epi8(
+            6, 7, 6, 7, 6, 7, -1, -1, 14, 15, 14, 15, 14, 15, -1, -1,
+            6, 7, 6, 7, 6, 7, -1, -1, 14, 15, 14, 15, 14, 15, -1, -1);
+    const __m256i round = _mm256_set1_epi16(128);
+    const __m256i keep  = _mm256_set1_epi32((int)0xFF000000);
+    const __m256i zero  = _mm256_setzero_si256();
+    size_t i;
+
+    for (i = 0; i + 8 <= count; i += 8)
     {
-        case IMG_TYPE_NO_IMAGE_DATA:
-            printf("no data\n"); // TODO
-            return;
-        case IMG_TYPE_UNCOMPRESSED_COLOR_MAPPED:
-            printf("unsuported format color mapped\n"); // TODO
-            return;
-        case IMG_TYPE_UNCOMPRESSED_TRUE_COLOR:
-            switch (TGA_header.imageSpec.pixelDepth)
-            {
-                case 16:
-                    printf("unsuported 16 true color\n"); // TODO
-                    return;
-                case 24: 
-                         targaLoad24bits(TGA_file, &TGA_header, texture);
-                         break;
-                case 32:
-                    printf("unsuported 32 true color\n"); // TODO
-                    return;
-            }
+        __m256i v  = _mm256_loadu_si256((const __m256i*)(src + i * 4));
+        v = _mm256_shuffle_epi8(v, swizzle);
+
+        __m256i lo = _mm256_unpacklo_epi8(v, zero);
+        __m256i hi = _mm256_unpackhi_epi8(v, zero);
+
+        lo = _mm256_mullo_epi16(lo, _mm256_shuffle_epi8(lo, alpha));
+        hi = _mm256_mullo_epi16(hi, _mm256_shuffle_epi8(hi, alpha));
+        lo = _mm256_add_epi16(lo, round);
+        hi = _mm256_add_epi16(hi, round);
+        lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+        hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+
+        /* the alpha bytes are taken back from the source */
+        __m256i out = _mm256_packus_epi16(lo, hi);
+        out = _mm256_or_si256(_mm256_andnot_si256(keep, out), _mm256_and_si256(keep, v));
+        _mm256_storeu_si256((__m256i*)(dst + i * 4), out);
+    }
+
+    targaBgra32ToPremul(dst + i * 4, src + i * 4, count - i, converter);
+}
+
+
+/*
+ * 16 bits pixels, 8 per iteration: each 5 bits channel is shifted to the
+ * top of its output byte, then its 3 high bits are replicated below it so
+ * that 0x1F gives 0xFF exactly as the scalar kernels. bgr puts blue in the
+ * first byte, alpha takes the attribute bit instead of 0xFF. The result
+ * is 8 RGBA (or BGRA) words.
+ */
+TGA_TARGET("avx2")
+static inline __m256i targaExpand16Avx2(const uint8_t* src, int bgr, int alpha)
+{
+    __m256i c = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)src));
+    __m256i r = _mm256_and_si256(_mm256_srli_epi32(c, 7), _mm256_set1_epi32(0xF8));
+    __m256i g = _mm256_and_si256(_mm256_slli_epi32(c, 6), _mm256_set1_epi32(0xF800));
+    __m256i b = _mm256_and_si256(_mm256_slli_epi32(c, 19), _mm256_set1_epi32(0xF80000));
+    __m256i a = _mm256_set1_epi32((int)0xFF000000);
+
+    if (bgr)
+    {
+        r = _mm256_and_si256(_mm256_slli_epi32(c, 9), _mm256_set1_epi32(0xF80000));
+        b = _mm256_and_si256(_mm256_slli_epi32(c, 3), _mm256_set1_epi32(0xF8));
+    }
+
+    __m256i v = _mm256_or_si256(_mm256_or_si256(r, g), b);
+    v = _mm256_or_si256(v, _mm256_and_si256(_mm256_srli_epi32(v, 5),
+            _mm256_set1_epi32(0x070707)));
+
+    if (alpha)
+        a = _mm256_and_si256(a, _mm256_srai_epi32(_mm256_slli_epi32(c, 16), 31));
+
+    return _mm256_or_si256(v, a);
+}
+
+#define TGA_EXPAND16_AVX2(name, bgr, alpha, tail) \
+TGA_TARGET("avx2") \
+static void name( \
+        uint8_t* dst, const uint8_t* src, size_t count, const TGA_CONVERTER* converter) \
+{ \
+    size_t i; \
+    for (i = 0; i + 8 <= count; i += 8) \
+        _mm256_storeu_si256((__m256i*)(dst + i * 4), \
+                targaExpand16Avx2(src + i * 2, bgr, alpha)); \
+    tail(dst + i * 4, src + i * 2, count - i, converter); \
+}
+
+/* 3 bytes outputs: the words are packed like in targaSwizzleBgr24Avx2() */
+#define TGA_EXPAND16_AVX2_24(name, bgr, tail) \
+TGA_TARGET("avx2") \
+static void name( \
+        uint8_t* dst, const uint8_t* src, size_t count, const TGA_CONVERTER* converter) \
+{ \
+    const __m256i mask = _mm256_setr_epi8( \
+            0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1, \
+            0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1); \
+    const __m256i pack = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7); \
+    size_t i; \
+    for (i = 0; i + 11 <= count; i += 8) \
+    { \
+        __m256i v = _mm256_shuffle_epi8(targaExpand16Avx2(src + i * 2, bgr, 0), mask); \
+        _mm256_storeu_si256((__m256i*)(dst + i * 3), _mm256_permutevar8x32_epi32(v, pack)); \
+    } \
+    tail(dst + i * 3, src + i * 2, count - i, converter); \
+}
+
+TGA_EXPAND16_AVX2(targaBgr16ToRgbaAvx2,   0, 0, targaBgr16ToRgba)
+TGA_EXPAND16_AVX2(targaBgr16ToBgraAvx2,   1, 0, targaBgr16ToBgra)
+TGA_EXPAND16_AVX2(targaBgra16ToRgbaAvx2,  0, 1, targaBgra16ToRgba)
+TGA_EXPAND16_AVX2(targaBgra16ToBgraAvx2,  1, 1, targaBgra16ToBgra)
+TGA_EXPAND16_AVX2_24(targaBgr16ToRgbAvx2, 0, targaSwizzleBgr16)
+TGA_EXPAND16_AVX2_24(targaBgr16ToBgrAvx2, 1, targaBgr16ToBgr)
+#endif // TGA_X86
+
+
+/*
+ * Color mapped kernels. converter->lut holds one 32 bits slot per index
+ * value, the output pixel in its first dstBpp bytes, so that every index
+ * is a single load and store. 3 bytes pixels are stored 4 bytes at a
+ * time, the extra byte being rewritten by the next pixel.
+ */
+#define TGA_INDEX8   src[i]
+#define TGA_INDEX16  targaGet16(src + i * 2)
+
+#define TGA_LUT_KERNEL(name, INDEX, dstBpp) \
+static void name( \
+        uint8_t* dst, const uint8_t* src, size_t count, const TGA_CONVERTER* converter) \
+{ \
+    const uint32_t* lut = converter->lut; \
+    size_t i = 0; \
+    if (dstBpp == 3) \
+        for (; i + 1 < count; i++) \
+            memcpy(dst + i * 3, lut + INDEX, 4); \
+    for (; i < count; i++) \
+        memcpy(dst + i * dstBpp, lut + INDEX, dstBpp); \
+}
+
+TGA_LUT_KERNEL(targaIndex8To8,   TGA_INDEX8,  1)
+TGA_LUT_KERNEL(targaIndex8To24,  TGA_INDEX8,  3)
+TGA_LUT_KERNEL(targaIndex8To32,  TGA_INDEX8,  4)
+TGA_LUT_KERNEL(targaIndex16To8,  TGA_INDEX16, 1)
+TGA_LUT_KERNEL(targaIndex16To24, TGA_INDEX16, 3)
+TGA_LUT_KERNEL(targaIndex16To32, TGA_INDEX16, 4)
+
+
+#ifdef TGA_X86
+/*
+ * 32 bits output: 8 indices are widened to 32 bits and their slots
+ * gathered in a single instruction.
+ */
+TGA_TARGET("avx2")
+static void targaIndex8To32Avx2(
+        uint8_t* dst, const uint8_t* src, size_t count, const TGA_CONVERTER* converter)
+{
+    const int* lut = (const int*)converter->lut;
+    size_t i;
+
+    for (i = 0; i + 8 <= count; i += 8)
+    {
+        __m128i index = _mm_loadl_epi64((const __m128i*)(src + i));
+        __m256i v = _mm256_i32gather_epi32(lut, _mm256_cvtepu8_epi32(index), 4);
+        _mm256_storeu_si256((__m256i*)(dst + i * 4), v);
+    }
+
+    targaIndex8To32(dst + i * 4, src + i, count - i, converter);
+}
+
+TGA_TARGET("avx2")
+static void targaIndex16To32Avx2(
+        uint8_t* dst, const uint8_t* src, size_t count, const TGA_CONVERTER* converter)
+{
+    const int* lut = (const int*)converter->lut;
+    size_t i;
+
+    for (i = 0; i + 8 <= count; i += 8)
+    {
+        __m128i index = _mm_loadu_si128((const __m128i*)(src + i * 2));
+        __m256i v = _mm256_i32gather_epi32(lut, _mm256_cvtepu16_epi32(index), 4);
+        _mm256_storeu_si256((__m256i*)(dst + i * 4), v);
+    }
+
+    targaIndex16To32(dst + i * 4, src + i * 2, count - i, converter);
+}
+#endif // TGA_X86
+
+
+/*
+ * Source layouts and the kernel for every output format, in the order
+ * of the TARGA_FORMAT_* values.
+ */
+#define TGA_SOURCE_BGR16   0
+#define TGA_SOURCE_BGRA16  1
+#define TGA_SOURCE_BGR24   2
+#define TGA_SOURCE_BGRA32  3
+#define TGA_SOURCE_GRAY8   4
+#define TGA_SOURCE_GRAY16  5
+
+#define TGA_FORMAT_COUNT   7
+
+static const TGA_SWIZZLE_FN targaKernels[6][TGA_FORMAT_COUNT] = {
+    { targaSwizzleBgr16, targaBgr16ToRgba, targaBgr16ToBgr, targaBgr16ToBgra,
+      targaBgr16ToGray, targaBgr16ToRgba, targaBgr16ToKeyed },
+    { targaSwizzleBgr16, targaBgra16ToRgba, targaBgr16ToBgr, targaBgra16ToBgra,
+      targaBgr16ToGray, targaBgra16ToPremul, targaBgra16ToKeyed },
+    { targaSwizzleBgr24, targaBgr24ToRgba, targaCopy24, targaBgr24ToBgra,
+      targaBgr24ToGray, targaBgr24ToRgba, targaBgr24ToKeyed },
+    { targaBgra32ToRgb, targaSwizzleBgra32, targaBgra32ToBgr, targaCopy32,
+      targaBgra32ToGray, targaBgra32ToPremul, targaBgra32ToKeyed },
+    { targaGray8ToRgb, targaGray8ToRgba, targaGray8ToRgb, targaGray8ToRgba,
+      targaGray8Copy, targaGray8ToRgba, targaGray8ToKeyed },
+    { targaGray16ToRgb, targaGray16ToRgba, targaGray16ToRgb, targaGray16ToRgba,
+      targaGray16ToGray, targaGray16ToPremul, targaGray16ToKeyed },
+};
+
+
+static int targaIsGray(const TGA_FILE_HEADER* TGA_header)
+{
+    return TGA_header->imageType == IMG_TYPE_UNCOMPRESSED_BLACK_AND_WHITE
+        || TGA_header->imageType == IMG_TYPE_RLE_BLACK_AND_WHITE;
+}
+
+
+static int targaIsMapped(const TGA_FILE_HEADER* TGA_header)
+{
+    return TGA_header->imageType == IMG_TYPE_UNCOMPRESSED_COLOR_MAPPED
+        || TGA_header->imageType == IMG_TYPE_RLE_COLOR_MAPPED;
+}
+
+
+/*
+ * 16 bits true color pixels whose attribute bit is an alpha bit (the
+ * descriptor announces 1 attribute bit), otherwise they are opaque.
+ */
+static int targaHasAlphaBit(const TGA_FILE_HEADER* TGA_header)
+{
+    return !targaIsGray(TGA_header) && !targaIsMapped(TGA_header)
+        && TGA_header->imageSpec.pixelDepth == 16
+        && (TGA_header->imageSpec.imageDescriptor & 0x0F) == 1;
+}
+
+
+/*
+ * Output format when none is requested.
+ */
+static unsigned int targaAutoFormat(const TGA_FILE_HEADER* TGA_header)
+{
+    unsigned int alphaDepth = targaIsGray(TGA_header) ? 16 : 32;
+    unsigned int depth = targaIsMapped(TGA_header)
+        ? TGA_header->colorMapSpec.mapEntrySize
+        : TGA_header->imageSpec.pixelDepth;
+
+    return depth == alphaDepth || targaHasAlphaBit(TGA_header)
+        ? TARGA_FORMAT_RGBA8 : TARGA_FORMAT_RGB8;
+}
+
+
+/*
+ * Source layout of the color map entries, -1 if not supported.
+ */
+static int targaColorMapSource(const TGA_FILE_HEADER* TGA_header)
+{
+    switch (TGA_header->colorMapSpec.mapEntrySize)
+    {
+        case 15:
+        case 16:
+            return TGA_SOURCE_BGR16;
+        case 24:
+            return TGA_SOURCE_BGR24;
+        case 32:
+            return TGA_SOURCE_BGRA32;
+        default:
+            return -1;
+    }
+}
+
+
+size_t targaFormatBpp(unsigned int format)
+{
+    switch (format)
+    {
+        case TARGA_FORMAT_GRAY8:
+        case TARGA_FORMAT_INDEX8:
+            return 1;
+        case TARGA_FORMAT_RGB8:
+        case TARGA_FORMAT_BGR8:
+            return 3;
+        default:
+            return 4;
+    }
+}
+
+
+/*
+ * Format the pixels are decoded to: the block formats are encoded from
+ * RGBA8.
+ */
+static unsigned int targaPixelFormat(unsigned int format)
+{
+    return targaBlockSize(format) ? TARGA_FORMAT_RGBA8 : format;
+}
+
+
+TGA_SWIZZLE_FN targaSwapKernel(size_t bpp)
+{
+    unsigned int features = targaCpuFeatures();
+    TGA_SWIZZLE_FN swap = bpp == 3 ? targaSwizzleBgr24 : targaSwizzleBgra32;
+
+#ifdef TGA_X86
+    if (features & CPU_SSSE3)
+        swap = bpp == 3 ? targaSwizzleBgr24Ssse3 : targaSwizzleBgra32Ssse3;
+    if (features & CPU_AVX2)
+        swap = bpp == 3 ? targaSwizzleBgr24Avx2 : targaSwizzleBgra32Avx2;
+#else
+    (void)features;
+#endif
+
+    return swap;
+}
+
+
+/*
+ * Color mapped images: the indices are looked up in the table built by
+ * targaReadColorMap(), or copied as they are for TARGA_FORMAT_INDEX8.
+ */
+static int targaSelectLutConverter(
+        const TGA_FILE_HEADER*  TGA_header,
+        unsigned int            format,
+        uint32_t                key,
+        TGA_CONVERTER*          converter)
+{
+    unsigned int features = targaCpuFeatures();
+    unsigned int depth = TGA_header->imageSpec.pixelDepth;
+
+    if (format == TARGA_FORMAT_AUTO || format > TARGA_FORMAT_INDEX8)
+        return TARGA_ERR_ARGUMENT;
+
+    if (TGA_header->colorMapType != CMT_COLOR_MAPPED)
+        return TARGA_ERR_FORMAT;
+
+    if ((depth != 8 && depth != 16) || targaColorMapSource(TGA_header) < 0 ||
+        (format == TARGA_FORMAT_INDEX8 && depth != 8))
+        return TARGA_ERR_UNSUPPORTED;
+
+    converter->srcBpp = depth >> 3;
+    converter->dstBpp = targaFormatBpp(format);
+    converter->key    = key & 0xFFFFFF;
+    converter->lut    = NULL;
+
+    switch (converter->dstBpp)
+    {
+        case 1:
+            converter->swizzle = depth == 8 ? targaIndex8To8 : targaIndex16To8;
+            break;
+        case 3:
+            converter->swizzle = depth == 8 ? targaIndex8To24 : targaIndex16To24;
+            break;
+        default:
+            converter->swizzle = depth == 8 ? targaIndex8To32 : targaIndex16To32;
+#ifdef TGA_X86
+            if (features & CPU_AVX2)
+                converter->swizzle = depth == 8 ? targaIndex8To32Avx2 : targaIndex16To32Avx2;
+#endif
             break;
-        case IMG_TYPE_UNCOMPRESSED_BLACK_AND_WHITE:
-            printf("unsuported format black and white\n"); // TODO
-            return;
-        case IMG_TYPE_RLE_COLOR_MAPPED:
-            printf("unsuported format RLE color mapped\n"); // TODO
-            return;
-        case IMG_TYPE_RLE_TRUE_COLOR:
-            printf("unsuported format RLE true color\n"); // TODO
-            return;
-        case IMG_TYPE_RLE_BLACK_AND_WHITE:
-            printf("unsuported format RLE black and white\n"); // TODO
-            return;
     }
 
+    if (format == TARGA_FORMAT_INDEX8)
+        converter->swizzle = targaGray8Copy;
 
+    (void)features;
+    return TARGA_OK;
+}
 
-    /*
-     * Image data
-     *
-     *  Bits 3-0 - number of attribute bits associated with each pixel. 
-     */
-    //uint8_t TGA_imgAttribNum = TGA_header.imageSpec.imageDescriptor & 0x0F;
 
-    /*  Bit 4    - reserved.  Must be set to 0. */
+/*
+ * Pick the fastest kernel converting the image pixels to format.
+ */
+static int targaSelectConverter(
+        const TGA_FILE_HEADER*  TGA_header,
+        unsigned int            format,
+        uint32_t                key,
+        TGA_CONVERTER*          converter)
+{
+    unsigned int features = targaCpuFeatures();
+    int source;
 
-    /*  Bit 5    - screen origin bit.
-     *      0 = Origin in lower left-hand corner.
-     *      1 = Origin in upper left-hand corner.
-     */
-    //uint8_t TGA_imgScrOriginBit = TGA_header.imageSpec.imageDescriptor & 0x20 >> 5;
+    if (targaIsMapped(TGA_header))
+        return targaSelectLutConverter(TGA_header, format, key, converter);
 
-    /*  Bits 7-6 - Data storage interleaving flag.
-     *      00 = non-interleaved.
-     *      01 = two-way (even/odd) interleaving.
-     *      10 = four way interleaving.
-     *      11 = reserved.
-     */
-    //uint8_t TGA_imgInterleaving = TGA_header.imageSpec.imageDescriptor & 0xC0 >> 6;
+    if (format == TARGA_FORMAT_AUTO || format > TGA_FORMAT_COUNT)
+        return TARGA_ERR_ARGUMENT;
 
+    switch (TGA_header->imageSpec.pixelDepth)
+    {
+        case 8:
+            source = TGA_SOURCE_GRAY8;
+            break;
+        case 15:
+        case 16:
+            source = targaIsGray(TGA_header) ? TGA_SOURCE_GRAY16
+                   : targaHasAlphaBit(TGA_header) ? TGA_SOURCE_BGRA16 : TGA_SOURCE_BGR16;
+            break;
+        case 24:
+            source = TGA_SOURCE_BGR24;
+            break;
+        case 32:
+            source = TGA_SOURCE_BGRA32;
+            break;
+        default:
+            return TARGA_ERR_UNSUPPORTED;
+    }
 
-    /*
-    int TGA_pixsize;
-    if (TGA_imgAttribNum % 8 != 0)
-        TGA_pixsize = TGA_imgAttribNum / 8 + 3 + 1;
+    /* 8 bits true color and 24/32 bits gray are not TGA layouts */
+    if (targaIsGray(TGA_header) != (source >= TGA_SOURCE_GRAY8)
+        || (source == TGA_SOURCE_GRAY16 && TGA_header->imageSpec.pixelDepth != 16))
+        return TARGA_ERR_UNSUPPORTED;
+
+    converter->swizzle = targaKernels[source][format - 1];
+    converter->srcBpp  = (TGA_header->imageSpec.pixelDepth + 7) >> 3;
+    converter->dstBpp  = targaFormatBpp(format);
+    converter->key     = key & 0xFFFFFF;
+    converter->lut     = NULL;
+
+    if ((source == TGA_SOURCE_BGR24 && format == TARGA_FORMAT_RGB8) ||
+        (source == TGA_SOURCE_BGRA32 && format == TARGA_FORMAT_RGBA8))
+        converter->swizzle = targaSwapKernel(converter->srcBpp);
+
+#ifdef TGA_X86
+    if (source == TGA_SOURCE_BGRA32 && format == TARGA_FORMAT_RGBA8_PREMULTIPLIED &&
+        (features & CPU_AVX2))
+        converter->swizzle = targaBgra32ToPremulAvx2;
+
+    if (source <= TGA_SOURCE_BGRA16 && (features & CPU_AVX2))
+    {
+        int alpha = source == TGA_SOURCE_BGRA16;
+
+        switch (format)
+        {
+            case TARGA_FORMAT_RGB8:
+                converter->swizzle = targaBgr16ToRgbAvx2;
+                break;
+            case TARGA_FORMAT_BGR8:
+                converter->swizzle = targaBgr16ToBgrAvx2;
+                break;
+            case TARGA_FORMAT_RGBA8:
+                converter->swizzle = alpha ? targaBgra16ToRgbaAvx2 : targaBgr16ToRgbaAvx2;
+                break;
+            case TARGA_FORMAT_BGRA8:
+                converter->swizzle = alpha ? targaBgra16ToBgraAvx2 : targaBgr16ToBgraAvx2;
+                break;
+        }
+    }
+#else
+    (void)features;
+#endif
+
+    return TARGA_OK;
+}
+
+
+/*
+ * Statistics
+ *
+ * A load counts into options->stats, or into a struct of its own when only
+ * the aggregate wants them. When neither does its stats pointer is NULL
+ * and every counter update and clock read below is skipped.
+ */
+static TARGA_STATS targaStatsTotal;
+static uint64_t    targaStatsOn;
+
+#define TGA_STATS_FIELDS (sizeof(TARGA_STATS) / sizeof(uint64_t))
+
+
+uint64_t targaNanoseconds(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+#endif
+}
+
+
+/*
+ * Add the time elapsed since mark to stats->field and move mark to now.
+ */
+#define TGA_STATS_PHASE(stats, field, mark) \
+    do { \
+        if (stats) \
+        { \
+            uint64_t now_ = targaNanoseconds(); \
+            (stats)->field += now_ - (mark); \
+            (mark) = now_; \
+        } \
+    } while (0)
+
+
+/*
+ * Add every field of stats to total, which other threads may update.
+ */
+static void targaStatsAdd(TARGA_STATS* total, const TARGA_STATS* stats)
+{
+    uint64_t* dst = (uint64_t*)total;
+    const uint64_t* src = (const uint64_t*)stats;
+    size_t i;
+
+    for (i = 0; i < TGA_STATS_FIELDS; i++)
+        if (src[i])
+            TGA_ATOMIC_ADD(dst + i, src[i]);
+}
+
+
+/*
+ * Statistics of a load starting: options->stats, local when only the
+ * aggregate is on, else NULL.
+ */
+static TARGA_STATS* targaStatsBegin(
+        const TARGA_LOAD_OPTIONS*   options,
+        TARGA_STATS*                local)
+{
+
+    TARGA_STATS* stats = options && options->stats ? options->stats
+        : TGA_ATOMIC_LOAD(&targaStatsOn) ? local : NULL;
+
+    if (stats)
+    {
+        memset(stats, 0, sizeof(TARGA_STATS));
+        stats->loads = 1;
+    }
+
+    return stats;
+
+}
+
+
+/*
+ * Close the statistics of a load that ended with result and add them to
+ * the aggregate. Return result.
+ */
+static int targaStatsEnd(TARGA_STATS* stats, int result)
+{
+
+    if (!stats)
+        return result;
+
+    stats->failures = result != TARGA_OK;
+
+    if (TGA_ATOMIC_LOAD(&targaStatsOn))
+        targaStatsAdd(&targaStatsTotal, stats);
+
+    return result;
+
+}
+
+
+void targaStatsEnable(int enable)
+{
+    TGA_ATOMIC_STORE(&targaStatsOn, (uint64_t)(enable != 0));
+}
+
+
+void targaStatsGlobal(TARGA_STATS* stats)
+{
+    uint64_t* dst = (uint64_t*)stats;
+    uint64_t* src = (uint64_t*)&targaStatsTotal;
+    size_t i;
+
+    for (i = 0; i < TGA_STATS_FIELDS; i++)
+        dst[i] = TGA_ATOMIC_LOAD(src + i);
+}
+
+
+void targaStatsReset(void)
+{
+    uint64_t* total = (uint64_t*)&targaStatsTotal;
+    size_t i;
+
+    for (i = 0; i < TGA_STATS_FIELDS; i++)
+        TGA_ATOMIC_STORE(total + i, 0);
+}
+
+
+/*
+ * Pipelined reads
+ *
+ * A reader thread fills a ring of chunks from the file while the decoder
+ * consumes the previous ones, so that storage and decoding overlap. The
+ * thread waits while the ring is full: the memory used stays bounded
+ * whatever the file size.
+ */
+#define TGA_PIPE_CHUNK  (1024 * 1024)
+#define TGA_PIPE_CHUNKS 4
+
+#ifdef TARGA_HAVE_PTHREAD
+
+typedef struct {
+    FILE*           file;
+    uint8_t*        chunks;
+    size_t          sizes[TGA_PIPE_CHUNKS];
+    unsigned int    filled;         /* chunks ready, from first */
+    unsigned int    first;
+    size_t          offset;         /* consumed bytes of the first chunk */
+    int             eof;            /* no chunk will be added */
+    int             stop;
+    uint64_t        position;       /* of the next byte to consume */
+    uint64_t        fileSize;
+
+    uint64_t        readCalls;      /* by the thread */
+    uint64_t        bytesRead;
+
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  ready;          /* a chunk was filled, or eof */
+    pthread_cond_t  room;           /* a chunk was consumed, or stop */
+} TGA_PIPE;
+
+
+static void* targaPipeThread(void* arg)
+{
+
+    TGA_PIPE* pipe = arg;
+    unsigned int next = 0;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&pipe->lock);
+        while (!pipe->stop && pipe->filled == TGA_PIPE_CHUNKS)
+            pthread_cond_wait(&pipe->room, &pipe->lock);
+        int stop = pipe->stop;
+        pthread_mutex_unlock(&pipe->lock);
+
+        if (stop)
+            break;
+
+        /* the slot is free: only this thread writes it until it is filled */
+        size_t got = fread(pipe->chunks + next * TGA_PIPE_CHUNK, 1,
+                TGA_PIPE_CHUNK, pipe->file);
+
+        pthread_mutex_lock(&pipe->lock);
+        pipe->readCalls++;
+        pipe->bytesRead += got;
+        pipe->sizes[next] = got;
+        pipe->filled++;
+        pipe->eof = got < TGA_PIPE_CHUNK;
+        pthread_cond_signal(&pipe->ready);
+        pthread_mutex_unlock(&pipe->lock);
+
+        if (got < TGA_PIPE_CHUNK)
+            break;
+
+        next = (next + 1) % TGA_PIPE_CHUNKS;
+    }
+
+    return NULL;
+
+}
+
+
+/*
+ * Start reading file from its current position. Return TARGA_OK, or an
+ * error when the pipeline could not start and file is left untouched.
+ */
+static int targaPipeStart(TGA_PIPE* pipe, FILE* file)
+{
+
+    memset(pipe, 0, sizeof(*pipe));
+
+    long here = ftell(file);
+    if (here < 0 || fseek(file, 0, SEEK_END) != 0)
+        return TARGA_ERR_READ;
+
+    long end = ftell(file);
+    if (end < here || fseek(file, here, SEEK_SET) != 0)
+        return TARGA_ERR_READ;
+
+    pipe->file     = file;
+    pipe->position = (uint64_t)here;
+    pipe->fileSize = (uint64_t)end;
+    pipe->chunks   = malloc((size_t)TGA_PIPE_CHUNKS * TGA_PIPE_CHUNK);
+    if (!pipe->chunks)
+        return TARGA_ERR_NO_MEMORY;
+
+    pthread_mutex_init(&pipe->lock, NULL);
+    pthread_cond_init(&pipe->ready, NULL);
+    pthread_cond_init(&pipe->room, NULL);
+
+    if (pthread_create(&pipe->thread, NULL, targaPipeThread, pipe) != 0)
+    {
+        pthread_cond_destroy(&pipe->room);
+        pthread_cond_destroy(&pipe->ready);
+        pthread_mutex_destroy(&pipe->lock);
+        free(pipe->chunks);
+        return TARGA_ERR_NO_MEMORY;
+    }
+
+    return TARGA_OK;
+
+}
+
+
+static void targaPipeStop(TGA_PIPE* pipe)
+{
+
+    pthread_mutex_lock(&pipe->lock);
+    pipe->stop = 1;
+    pthread_cond_signal(&pipe->room);
+    pthread_mutex_unlock(&pipe->lock);
+
+    pthread_join(pipe->thread, NULL);
+
+    pthread_cond_destroy(&pipe->room);
+    pthread_cond_destroy(&pipe->ready);
+    pthread_mutex_destroy(&pipe->lock);
+    free(pipe->chunks);
+
+}
+
+
+/*
+ * Copy the next size bytes into dst, or drop them when dst is NULL.
+ * Return the number of bytes consumed, less than size at the end of the
+ * file.
+ */
+static size_t targaPipeRead(TGA_PIPE* pipe, uint8_t* dst, size_t size)
+{
+
+    size_t done = 0;
+
+    while (done < size)
+    {
+        pthread_mutex_lock(&pipe->lock);
+        while (!pipe->filled && !pipe->eof)
+            pthread_cond_wait(&pipe->ready, &pipe->lock);
+        unsigned int filled = pipe->filled;
+        pthread_mutex_unlock(&pipe->lock);
+
+        if (!filled)
+            break;
+
+        /* the first chunk stays put until it is released below */
+        size_t chunkSize = pipe->sizes[pipe->first];
+        size_t count = chunkSize - pipe->offset;
+        if (count > size - done)
+            count = size - done;
+
+        if (dst)
+            memcpy(dst + done, pipe->chunks + pipe->first * TGA_PIPE_CHUNK + pipe->offset, count);
+
+        pipe->offset   += count;
+        pipe->position += count;
+        done           += count;
+
+        if (pipe->offset == chunkSize)
+        {
+            int last = chunkSize < TGA_PIPE_CHUNK;
+
+            pthread_mutex_lock(&pipe->lock);
+            pipe->filled--;
+            pipe->first  = (pipe->first + 1) % TGA_PIPE_CHUNKS;
+            pipe->offset = 0;
+            pthread_cond_signal(&pipe->room);
+            pthread_mutex_unlock(&pipe->lock);
+
+            if (last)
+                break;
+        }
+    }
+
+    return done;
+
+}
+
+#else
+
+typedef struct TGA_PIPE TGA_PIPE;
+
+#endif // TARGA_HAVE_PTHREAD
+
+
+/*
+ * Byte source: either a FILE read by blocks into a scratch buffer, or a
+ * memory range (a file mapping) read in place. The unread bytes are
+ * data[pos..size[. A pipelined FILE is only read through its pipe. Only
+ * file reads are counted in stats, the bytes consumed from memory are
+ * counted by the caller from pos.
+ */
+typedef struct {
+    FILE*          file;
+    const uint8_t* data;
+    size_t         size;
+    size_t         pos;
+    uint8_t*       block;
+    TARGA_STATS*   stats;
+    TGA_PIPE*      pipe;
+} TGA_READER;
+
+
+/*
+ * Read from the file, or from its pipe where waiting for the reader thread
+ * counts as read time: its read calls are counted once it stopped.
+ */
+static size_t targaReadFile(TGA_READER* reader, uint8_t* dst, size_t size)
+{
+
+#ifdef TARGA_HAVE_PTHREAD
+    if (reader->pipe)
+    {
+        if (!reader->stats)
+            return targaPipeRead(reader->pipe, dst, size);
+
+        uint64_t start = targaNanoseconds();
+        size_t got = targaPipeRead(reader->pipe, dst, size);
+
+        reader->stats->readNs += targaNanoseconds() - start;
+        return got;
+    }
+#endif
+
+    if (!reader->stats)
+        return fread(dst, 1, size, reader->file);
+
+    uint64_t start = targaNanoseconds();
+    size_t got = fread(dst, 1, size, reader->file);
+
+    reader->stats->readCalls++;
+    reader->stats->bytesRead += got;
+    reader->stats->readNs    += targaNanoseconds() - start;
+    return got;
+
+}
+
+
+/*
+ * Try to make want bytes available, refilling the block from the file
+ * (want must not exceed TGA_BLOCK_SIZE). Return the available size.
+ */
+static size_t targaFillReader(TGA_READER* reader, size_t want)
+{
+
+    size_t available = reader->size - reader->pos;
+
+    if (!reader->file || available >= want)
+        return available;
+
+    if (!reader->block)
+    {
+        reader->block = malloc(TGA_BLOCK_SIZE);
+        if (!reader->block)
+            return available;
+
+        if (reader->stats)
+            reader->stats->allocations++;
+    }
+
+    /* the unread tail moves to the start of the block */
+    if (available)
+        memmove(reader->block, reader->data + reader->pos, available);
+
+    available += targaReadFile(reader, reader->block + available,
+            TGA_BLOCK_SIZE - available);
+
+    reader->data = reader->block;
+    reader->size = available;
+    reader->pos  = 0;
+    return available;
+
+}
+
+
+/*
+ * Return the next size bytes of the source, NULL if it is too short. For
+ * files size must not exceed TGA_BLOCK_SIZE and the data is only valid
+ * until the next call.
+ */
+static const uint8_t* targaRead(TGA_READER* reader, size_t size)
+{
+
+    if (targaFillReader(reader, size) < size)
+        return NULL;
+
+    const uint8_t* data = reader->data + reader->pos;
+    reader->pos += size;
+    return data;
+
+}
+
+
+static int targaSkip(TGA_READER* reader, size_t size)
+{
+
+    size_t available = reader->size - reader->pos;
+
+    if (size <= available)
+    {
+        reader->pos += size;
+        return TARGA_OK;
+    }
+
+    if (!reader->file)
+        return TARGA_ERR_READ;
+
+#ifdef TARGA_HAVE_PTHREAD
+    if (reader->pipe)
+    {
+        if (targaPipeRead(reader->pipe, NULL, size - available) != size - available)
+            return TARGA_ERR_READ;
+
+        reader->pos = reader->size;
+        return TARGA_OK;
+    }
+#endif
+
+    if (fseek(reader->file, (long)(size - available), SEEK_CUR) != 0)
+        return TARGA_ERR_READ;
+
+    reader->pos = reader->size;
+    return TARGA_OK;
+
+}
+
+
+/*
+ * Where decoded rows go: row y of the file is stored at pixels + y * pitch,
+ * or at row height - 1 - y when flipped, its pixels reversed when
+ * mirrored. Packed images that are neither are seen as a single long row.
+ *
+ * For a region, skipRows file rows come first and every file row holds
+ * skipBefore + width + skipAfter pixels, of which only width are stored.
+ */
+typedef struct {
+    uint8_t*    pixels;
+    size_t      pitch;
+    size_t      width;
+    size_t      height;
+    int         flip;
+    int         mirror;
+
+    size_t      skipRows;
+    size_t      skipBefore;
+    size_t      skipAfter;
+
+    TGA_MIP*    mip;            /* given every row once complete, or NULL */
+    TGA_BC*     bc;             /* rows go to its bands instead of pixels, or NULL */
+} TGA_OUTPUT;
+
+
+static uint8_t* targaOutputRow(const TGA_OUTPUT* output, size_t y)
+{
+    if (output->bc)
+        return targaBcBand(output->bc, y);
+
+    if (output->flip)
+        y = output->height - 1 - y;
+
+    return output->pixels + y * output->pitch;
+}
+
+
+/*
+ * Reverse the pixels of a row that was just decoded, while it is still
+ * in cache.
+ */
+static void targaMirrorRow(uint8_t* row, size_t bpp, size_t width)
+{
+    uint8_t* left = row;
+    uint8_t* right = row + (width ? width - 1 : 0) * bpp;
+    uint8_t pixel[4];
+
+    for (; left < right; left += bpp, right -= bpp)
+    {
+        memcpy(pixel, left, bpp);
+        memcpy(left, right, bpp);
+        memcpy(right, pixel, bpp);
+    }
+}
+
+
+/*
+ * Uncompressed images: the pixel data is read by large blocks (or
+ * straight from the mapping) and converted into the rows.
+ */
+static int targaLoadRaw(
+        TGA_READER*             reader,
+        const TGA_CONVERTER*    converter,
+        const TGA_OUTPUT*       output)
+{
+
+    size_t srcBpp = converter->srcBpp;
+    size_t blockPixels = reader->file
+        ? TGA_BLOCK_SIZE / srcBpp : output->width;
+    size_t rowPixels = output->skipBefore + output->width + output->skipAfter;
+    size_t y;
+
+    if (targaSkip(reader, output->skipRows * rowPixels * srcBpp) != TARGA_OK)
+        return TARGA_ERR_READ;
+
+    for (y = 0; y < output->height; y++)
+    {
+        uint8_t* row = targaOutputRow(output, y);
+        size_t x = 0;
+
+        if (targaSkip(reader, output->skipBefore * srcBpp) != TARGA_OK)
+            return TARGA_ERR_READ;
+
+        while (x < output->width)
+        {
+            size_t count = output->width - x;
+            if (count > blockPixels)
+                count = blockPixels;
+
+            const uint8_t* block = targaRead(reader, count * srcBpp);
+            if (!block)
+                return TARGA_ERR_READ;
+
+            converter->swizzle(row + x * converter->dstBpp, block, count, converter);
+            x += count;
+        }
+
+        if (output->mirror)
+            targaMirrorRow(row, converter->dstBpp, output->width);
+
+        if (output->mip)
+            targaMipRow(output->mip, y);
+
+        if (output->bc)
+            targaBcRow(output->bc, y);
+
+        if (y + 1 < output->height &&
+            targaSkip(reader, output->skipAfter * srcBpp) != TARGA_OK)
+            return TARGA_ERR_READ;
+    }
+
+    return TARGA_OK;
+
+}
+
+
+/*
+ * Store count copies of a bpp bytes pixel.
+ */
+static void targaFill(uint8_t* dst, const uint8_t* pixel, size_t bpp, size_t count)
+{
+
+    size_t i = 0;
+
+    if (bpp == 4)
+    {
+        uint32_t value;
+        memcpy(&value, pixel, 4);
+#if defined(__SSE2__) || defined(_M_X64)
+        __m128i v = _mm_set1_epi32((int)value);
+        for (; i + 4 <= count; i += 4)
+            _mm_storeu_si128((__m128i*)(dst + i * 4), v);
+#endif
+        for (; i < count; i++)
+            memcpy(dst + i * 4, &value, 4);
+        return;
+    }
+
+    if (bpp == 1)
+    {
+        memset(dst, pixel[0], count);
+        return;
+    }
+
+    /* 2 and 3 bytes: short runs pixel by pixel, long runs by doubling */
+    if (count <= 8)
+    {
+        for (; i < count; i++)
+            memcpy(dst + i * bpp, pixel, bpp);
+        return;
+    }
+
+    size_t size   = count * bpp;
+    size_t filled = bpp;
+
+    memcpy(dst, pixel, bpp);
+    while (filled < size)
+    {
+        size_t chunk = filled < size - filled ? filled : size - filled;
+        memcpy(dst + filled, dst, chunk);
+        filled += chunk;
+    }
+
+}
+
+
+/*
+ * Position in the RLE stream: the packet being expanded.
+ */
+typedef struct {
+    unsigned int remaining;     /* pixels left in the current packet */
+    int          run;           /* it is a run-length packet */
+    uint8_t      pixel[4];      /* converted run pixel */
+    uint64_t     packets[2];    /* raw and run packets parsed */
+} TGA_RLE_STATE;
+
+
+/*
+ * Expand at most count pixels from the RLE data src into dst, runs are
+ * converted once and broadcast, raw packets converted in bulk. Packets
+ * never write past count pixels: the rest of a packet is kept in state
+ * for the next call. Return the number of bytes of src consumed, the
+ * number of pixels written is stored in produced. Decoding stops early
+ * when src ends in the middle of a packet.
+ */
+static size_t targaRlePacket(
+        TGA_RLE_STATE*          state,
+        const TGA_CONVERTER*    converter,
+        const uint8_t*          src,
+        size_t                  size)
+{
+
+    uint8_t packet = src[0];
+
+    if (packet & 0x80)
+    {
+        if (size < 1 + converter->srcBpp)
+            return 0;
+
+        converter->swizzle(state->pixel, src + 1, 1, converter);
+    }
+
+    state->run = packet & 0x80;
+    state->remaining = (packet & 0x7F) + 1;
+    state->packets[packet >> 7]++;
+    return state->run ? 1 + converter->srcBpp : 1;
+
+}
+
+
+static size_t targaRleDecode(
+        TGA_RLE_STATE*          state,
+        const TGA_CONVERTER*    converter,
+        const uint8_t*          src,
+        size_t                  size,
+        uint8_t*                dst,
+        size_t                  count,
+        size_t*                 produced)
+{
+
+    size_t srcBpp = converter->srcBpp;
+    size_t dstBpp = converter->dstBpp;
+    size_t pos = 0;
+    size_t done = 0;
+
+    while (done < count)
+    {
+        if (state->remaining == 0)
+        {
+            size_t header = pos < size
+                ? targaRlePacket(state, converter, src + pos, size - pos)
+                : 0;
+            if (header == 0)
+                break;
+
+            pos += header;
+        }
+
+        size_t n = state->remaining;
+        if (n > count - done)
+            n = count - done;
+
+        if (state->run)
+        {
+            targaFill(dst, state->pixel, dstBpp, n);
+        }
+        else
+        {
+            size_t available = (size - pos) / srcBpp;
+            if (n > available)
+                n = available;
+            if (n == 0)
+                break;
+
+            converter->swizzle(dst, src + pos, n, converter);
+            pos += n * srcBpp;
+        }
+
+        dst += n * dstBpp;
+        done += n;
+        state->remaining -= (unsigned int)n;
+    }
+
+    *produced = done;
+    return pos;
+
+}
+
+
+/*
+ * Same as targaRleDecode() without storing anything: skip at most count
+ * pixels. Raw packets are jumped over, only the pixel of run packets is
+ * converted in case the run goes on into the pixels that are kept.
+ */
+static size_t targaRleSkip(
+        TGA_RLE_STATE*          state,
+        const TGA_CONVERTER*    converter,
+        const uint8_t*          src,
+        size_t                  size,
+        size_t                  count,
+        size_t*                 skipped)
+{
+
+    size_t srcBpp = converter->srcBpp;
+    size_t pos = 0;
+    size_t done = 0;
+
+    while (done < count)
+    {
+        if (state->remaining == 0)
+        {
+            size_t header = pos < size
+                ? targaRlePacket(state, converter, src + pos, size - pos)
+                : 0;
+            if (header == 0)
+                break;
+
+            pos += header;
+        }
+
+        size_t n = state->remaining;
+        if (n > count - done)
+            n = count - done;
+
+        if (!state->run)
+        {
+            size_t available = (size - pos) / srcBpp;
+            if (n > available)
+                n = available;
+            if (n == 0)
+                break;
+
+            pos += n * srcBpp;
+        }
+
+        done += n;
+        state->remaining -= (unsigned int)n;
+    }
+
+    *skipped = done;
+    return pos;
+
+}
+
+
+static int targaRleSkipReader(
+        TGA_READER*             reader,
+        const TGA_CONVERTER*    converter,
+        TGA_RLE_STATE*          state,
+        size_t                  count)
+{
+
+    while (count)
+    {
+        size_t available = targaFillReader(reader, TGA_BLOCK_SIZE);
+        size_t skipped;
+        size_t used = targaRleSkip(state, converter,
+                reader->data + reader->pos, available, count, &skipped);
+
+        if (skipped == 0 && used == 0)
+            return TARGA_ERR_READ;
+
+        reader->pos += used;
+        count -= skipped;
+    }
+
+    return TARGA_OK;
+
+}
+
+
+static int targaLoadRleRows(
+        TGA_READER*             reader,
+        const TGA_CONVERTER*    converter,
+        const TGA_OUTPUT*       output,
+        TGA_RLE_STATE*          state)
+{
+
+    size_t rowPixels = output->skipBefore + output->width + output->skipAfter;
+    size_t y;
+
+    if (targaRleSkipReader(reader, converter, state,
+                output->skipRows * rowPixels) != TARGA_OK)
+        return TARGA_ERR_READ;
+
+    for (y = 0; y < output->height; y++)
+    {
+        uint8_t* row = targaOutputRow(output, y);
+        size_t x = 0;
+
+        if (targaRleSkipReader(reader, converter, state,
+                    output->skipBefore) != TARGA_OK)
+            return TARGA_ERR_READ;
+
+        while (x < output->width)
+        {
+            /* a whole packet is at most 1 + 128 * 4 bytes */
+            size_t available = targaFillReader(reader, TGA_BLOCK_SIZE);
+            size_t produced;
+            size_t used = targaRleDecode(state, converter,
+                    reader->data + reader->pos, available,
+                    row + x * converter->dstBpp, output->width - x, &produced);
+
+            if (produced == 0 && used == 0)
+                return TARGA_ERR_READ;
+
+            reader->pos += used;
+            x += produced;
+        }
+
+        if (output->mirror)
+            targaMirrorRow(row, converter->dstBpp, output->width);
+
+        if (output->mip)
+            targaMipRow(output->mip, y);
+
+        if (output->bc)
+            targaBcRow(output->bc, y);
+
+        /* not past the last row: the rest of the file is never read */
+        if (y + 1 < output->height &&
+            targaRleSkipReader(reader, converter, state,
+                    output->skipAfter) != TARGA_OK)
+            return TARGA_ERR_READ;
+    }
+
+    return TARGA_OK;
+
+}
+
+
+static int targaLoadRle(
+        TGA_READER*             reader,
+        const TGA_CONVERTER*    converter,
+        const TGA_OUTPUT*       output)
+{
+
+    TGA_RLE_STATE state = {0};
+    int result = targaLoadRleRows(reader, converter, output, &state);
+
+    if (reader->stats)
+    {
+        reader->stats->rawPackets += state.packets[0];
+        reader->stats->runPackets += state.packets[1];
+    }
+
+    return result;
+
+}
+
+
+/*
+ * Parallel RLE decode
+ *
+ * A pre-pass walks the packet headers only and records, for every chunk
+ * of rows, the packet holding its first pixel and how many pixels of that
+ * packet belong to the previous chunk. Each chunk then resumes in the
+ * middle of its first packet and decodes into its own part of the
+ * texture, so packets crossing the split points need no serial decode.
+ */
+#define TGA_RLE_CHUNK_PIXELS (64 * 1024)
+
+typedef struct {
+    size_t   offset;        /* packet holding the first pixel of the chunk */
+    size_t   skip;          /* pixels of that packet before the chunk */
+    int      result;
+    uint64_t packets[2];    /* packets parsed by the chunk, see TGA_RLE_STATE */
+} TGA_RLE_CHUNK;
+
+
+typedef struct {
+    const TGA_CONVERTER*    converter;
+    const uint8_t*          src;
+    size_t                  size;
+    const TGA_OUTPUT*       output;
+    size_t                  chunkRows;
+    size_t                  chunkPixels;
+    TGA_RLE_CHUNK*          chunks;
+} TGA_RLE_JOB;
+
+
+static int targaRleSplit(TGA_RLE_JOB* job, size_t chunkCount)
+{
+
+    size_t srcBpp = job->converter->srcBpp;
+    size_t pos    = 0;
+    size_t pixel  = 0;
+    size_t next   = 1;
+
+    job->chunks[0].offset = 0;
+    job->chunks[0].skip   = 0;
+
+    while (next < chunkCount)
+    {
+        if (pos >= job->size)
+            return TARGA_ERR_READ;
+
+        uint8_t packet = job->src[pos];
+        size_t count = (packet & 0x7F) + 1;
+
+        for (; next < chunkCount && next * job->chunkPixels < pixel + count; next++)
+        {
+            job->chunks[next].offset = pos;
+            job->chunks[next].skip   = next * job->chunkPixels - pixel;
+        }
+
+        pos   += 1 + (packet & 0x80 ? 1 : count) * srcBpp;
+        pixel += count;
+    }
+
+    return TARGA_OK;
+
+}
+
+
+static void targaRleChunk(void* context, size_t index)
+{
+
+    TGA_RLE_JOB* job = context;
+    TGA_RLE_CHUNK* chunk = &job->chunks[index];
+    const TGA_CONVERTER* converter = job->converter;
+    TGA_RLE_STATE state = {0};
+
+    const TGA_OUTPUT* output = job->output;
+    size_t first = index * job->chunkRows;
+    size_t last  = first + job->chunkRows;
+    size_t pos   = chunk->offset;
+    size_t y;
+
+    if (last > output->height)
+        last = output->height;
+
+    chunk->result = TARGA_ERR_READ;
+
+    if (chunk->skip)
+    {
+        uint8_t packet = job->src[pos];
+
+        if (packet & 0x80)
+        {
+            if (job->size - pos < 1 + converter->srcBpp)
+                return;
+
+            converter->swizzle(state.pixel, job->src + pos + 1, 1, converter);
+            pos += 1 + converter->srcBpp;
+        }
+        else
+        {
+            if (job->size - pos < 1 + chunk->skip * converter->srcBpp)
+                return;
+
+            pos += 1 + chunk->skip * converter->srcBpp;
+        }
+
+        state.run = packet & 0x80;
+        state.remaining = (unsigned int)((packet & 0x7F) + 1 - chunk->skip);
+    }
+
+    for (y = first; y < last; y++)
+    {
+        uint8_t* row = targaOutputRow(output, y);
+        size_t produced;
+
+        pos += targaRleDecode(&state, converter, job->src + pos, job->size - pos,
+                row, output->width, &produced);
+
+        if (produced != output->width)
+            return;
+
+        if (output->mirror)
+            targaMirrorRow(row, converter->dstBpp, output->width);
+    }
+
+    chunk->packets[0] = state.packets[0];
+    chunk->packets[1] = state.packets[1];
+    chunk->result = TARGA_OK;
+
+}
+
+
+/*
+ * Give access to the rest of the source as one memory range. File data
+ * is read into *owned, to be freed by the caller.
+ */
+static int targaReadRemaining(
+        TGA_READER*         reader,
+        const uint8_t**     data,
+        size_t*             size,
+        uint8_t**           owned)
+{
+
+    size_t available = reader->size - reader->pos;
+
+    *owned = NULL;
+
+    if (!reader->file)
+    {
+        *data = reader->data + reader->pos;
+        *size = available;
+        return TARGA_OK;
+    }
+
+    size_t rest;
+
+#ifdef TARGA_HAVE_PTHREAD
+    if (reader->pipe)
+        rest = (size_t)(reader->pipe->fileSize - reader->pipe->position);
+    else
+#endif
+    {
+        long here = ftell(reader->file);
+        if (here < 0 || fseek(reader->file, 0, SEEK_END) != 0)
+            return TARGA_ERR_READ;
+
+        long end = ftell(reader->file);
+        if (end < here || fseek(reader->file, here, SEEK_SET) != 0)
+            return TARGA_ERR_READ;
+
+        rest = (size_t)(end - here);
+    }
+
+    *owned = malloc(available + rest + 1);
+    if (!*owned)
+        return TARGA_ERR_NO_MEMORY;
+
+    if (reader->stats)
+        reader->stats->allocations++;
+
+    if (available)
+        memcpy(*owned, reader->data + reader->pos, available);
+
+    rest = targaReadFile(reader, *owned + available, rest);
+    reader->pos = reader->size;
+
+    *data = *owned;
+    *size = available + rest;
+    return TARGA_OK;
+
+}
+
+
+static int targaLoadRleParallel(
+        TGA_READER*             reader,
+        const TGA_CONVERTER*    converter,
+        const TGA_OUTPUT*       output,
+        unsigned int            threads)
+{
+
+    TGA_RLE_JOB job;
+    uint8_t* owned;
+
+    /* no pixel to split */
+    if (output->width == 0 || output->height == 0)
+        return targaLoadRle(reader, converter, output);
+
+    /* a few chunks per thread for balance, whole rows per chunk */
+    size_t rows = (output->height + threads * 4 - 1) / (threads * 4);
+    size_t minRows = (TGA_RLE_CHUNK_PIXELS + output->width - 1) / output->width;
+    if (rows < minRows)
+        rows = minRows;
+
+    size_t chunkCount = (output->height + rows - 1) / rows;
+
+    if (chunkCount < 2)
+        return targaLoadRle(reader, converter, output);
+
+    int result = targaReadRemaining(reader, &job.src, &job.size, &owned);
+    if (result != TARGA_OK)
+        return result;
+
+    job.converter   = converter;
+    job.output      = output;
+    job.chunkRows   = rows;
+    job.chunkPixels = rows * output->width;
+    job.chunks      = calloc(chunkCount, sizeof(TGA_RLE_CHUNK));
+
+    if (!job.chunks)
+    {
+        free(owned);
+        return TARGA_ERR_NO_MEMORY;
+    }
+
+    if (reader->stats)
+        reader->stats->allocations++;
+
+    result = targaRleSplit(&job, chunkCount);
+    if (result == TARGA_OK)
+    {
+        size_t i;
+
+        targaParallelFor(threads, chunkCount, targaRleChunk, &job);
+
+        for (i = 0; i < chunkCount; i++)
+        {
+            if (job.chunks[i].result != TARGA_OK)
+                result = job.chunks[i].result;
+
+            if (reader->stats)
+            {
+                reader->stats->rawPackets += job.chunks[i].packets[0];
+                reader->stats->runPackets += job.chunks[i].packets[1];
+            }
+        }
+    }
+
+    free(job.chunks);
+    free(owned);
+    return result;
+
+}
+
+
+/*
+ * Size of the image id and color map between the header and the pixels.
+ */
+static size_t targaSkipSize(const TGA_FILE_HEADER* TGA_header)
+{
+    size_t skip = TGA_header->idLength;
+
+    if (TGA_header->colorMapType == CMT_COLOR_MAPPED)
+        skip += (size_t)TGA_header->colorMapSpec.mapLenght
+              * ((TGA_header->colorMapSpec.mapEntrySize + 7) >> 3);
+
+    return skip;
+}
+
+
+/*
+ * Read the color map following the image id and expand it into
+ * converter->lut in the output format: slot firstEntryIndex + i holds entry
+ * i, the indices outside of the map give zero pixels. The map is skipped
+ * when there is no table to build.
+ */
+static int targaReadColorMap(
+        TGA_READER*             reader,
+        const TGA_FILE_HEADER*  TGA_header,
+        unsigned int            format,
+        TGA_CONVERTER*          converter)
+{
+
+    size_t entryBpp = (TGA_header->colorMapSpec.mapEntrySize + 7) >> 3;
+    size_t left     = TGA_header->colorMapSpec.mapLenght;
+
+    if (!targaIsMapped(TGA_header) || format == TARGA_FORMAT_INDEX8)
+        return targaSkip(reader, targaSkipSize(TGA_header) - TGA_header->idLength);
+
+    size_t slots  = (size_t)1 << TGA_header->imageSpec.pixelDepth;
+    size_t index  = TGA_header->colorMapSpec.firstEntryIndex;
+    TGA_SWIZZLE_FN expand = targaKernels[targaColorMapSource(TGA_header)][format - 1];
+
+    converter->lut = calloc(slots, sizeof(uint32_t));
+    if (!converter->lut)
+        return TARGA_ERR_NO_MEMORY;
+
+    if (reader->stats)
+        reader->stats->allocations++;
+
+    while (left)
+    {
+        size_t count = TGA_BLOCK_SIZE / entryBpp;
+        if (count > left)
+            count = left;
+
+        const uint8_t* entries = targaRead(reader, count * entryBpp);
+        if (!entries)
+        {
+            free(converter->lut);
+            converter->lut = NULL;
+            return TARGA_ERR_READ;
+        }
+
+        size_t i;
+        for (i = 0; i < count && index < slots; i++, index++)
+            expand((uint8_t*)(converter->lut + index), entries + i * entryBpp, 1, converter);
+
+        left -= count;
+    }
+
+    return TARGA_OK;
+
+}
+
+
+/*
+ * 16 bits true color images left with a scalar kernel are decoded through
+ * a table of the 65536 pixel values once they are large enough for it to
+ * pay off: filling the table costs about as much as converting 65536
+ * pixels, every pixel then is a single lookup, 2 to 10 times faster than
+ * the scalar kernels. The table uses the color mapped kernels.
+ */
+#define TGA_TABLE16_PIXELS (2 * 65536)
+
+static int targaBuildTable16(
+        const TGA_FILE_HEADER*  TGA_header,
+        const TARGA_IMAGE*      image,
+        TGA_CONVERTER*          converter,
+        TARGA_STATS*            stats)
+{
+
+    if (targaIsGray(TGA_header) || targaIsMapped(TGA_header) || converter->srcBpp != 2 ||
+        (size_t)image->width * image->height < TGA_TABLE16_PIXELS)
+        return TARGA_OK;
+
+    int source = targaHasAlphaBit(TGA_header) ? TGA_SOURCE_BGRA16 : TGA_SOURCE_BGR16;
+    TGA_SWIZZLE_FN kernel = targaKernels[source][targaPixelFormat(image->format) - 1];
+
+    if (converter->swizzle != kernel)
+        return TARGA_OK;
+
+    unsigned int wide;
+    uint8_t* values = malloc(65536 * 2 + 65536);
+    converter->lut  = malloc(65536 * sizeof(uint32_t));
+    if (!values || !converter->lut)
+    {
+        free(values);
+        free(converter->lut);
+        converter->lut = NULL;
+        return TARGA_ERR_NO_MEMORY;
+    }
+
+    if (stats)
+        stats->allocations += 2;
+
+    size_t i;
+    for (i = 0; i < 65536; i++)
+    {
+        values[i * 2]     = (uint8_t)i;
+        values[i * 2 + 1] = (uint8_t)(i >> 8);
+    }
+
+    /* 3 bytes formats use the slots of their 4 bytes sibling, RGBA8 or BGRA8 */
+    switch (converter->dstBpp)
+    {
+        case 1:
+            kernel(values + 65536 * 2, values, 65536, converter);
+            for (i = 0; i < 65536; i++)
+                memcpy(converter->lut + i, values + 65536 * 2 + i, 1);
+            converter->swizzle = targaIndex16To8;
+            break;
+        case 3:
+            wide = image->format == TARGA_FORMAT_RGB8 ? TARGA_FORMAT_RGBA8 : TARGA_FORMAT_BGRA8;
+            targaKernels[source][wide - 1]((uint8_t*)converter->lut, values, 65536, converter);
+            converter->swizzle = targaIndex16To24;
+            break;
+        default:
+            kernel((uint8_t*)converter->lut, values, 65536, converter);
+            converter->swizzle = targaIndex16To32;
+#ifdef TGA_X86
+            if (targaCpuFeatures() & CPU_AVX2)
+                converter->swizzle = targaIndex16To32Avx2;
+#endif
+            break;
+    }
+
+    free(values);
+    return TARGA_OK;
+
+}
+
+
+/*
+ * Check the image type, pick the converter for the requested format and
+ * fill the geometry of image.
+ */
+static int targaPrepare(
+        const TGA_FILE_HEADER*      TGA_header,
+        const TARGA_LOAD_OPTIONS*   options,
+        TGA_CONVERTER*              converter,
+        int*                        rle,
+        TARGA_IMAGE*                image)
+{
+
+    *rle = 0;
+    switch (TGA_header->imageType)
+    {
+        case IMG_TYPE_NO_IMAGE_DATA:
+        case IMG_TYPE_UNCOMPRESSED_COLOR_MAPPED:
+        case IMG_TYPE_UNCOMPRESSED_TRUE_COLOR:
+        case IMG_TYPE_UNCOMPRESSED_BLACK_AND_WHITE:
+            break;
+        case IMG_TYPE_RLE_TRUE_COLOR:
+        case IMG_TYPE_RLE_BLACK_AND_WHITE:
+        case IMG_TYPE_RLE_COLOR_MAPPED:
+            *rle = 1;
+            break;
+        default:
+            return TARGA_ERR_FORMAT;
+    }
+
+    unsigned int format = options ? options->format : TARGA_FORMAT_AUTO;
+    if (format == TARGA_FORMAT_AUTO)
+        format = targaAutoFormat(TGA_header);
+
+    size_t blockSize = targaBlockSize(format);
+
+    image->width  = TGA_header->imageSpec.imageWidth;
+    image->height = TGA_header->imageSpec.imageHeight;
+    image->format = format;
+
+    if (TGA_header->imageType == IMG_TYPE_NO_IMAGE_DATA)
+    {
+        /* a header alone: an empty image, no pixel to convert */
+        if (format > TARGA_FORMAT_BC7)
+            return TARGA_ERR_ARGUMENT;
+
+        memset(converter, 0, sizeof(*converter));
+        converter->swizzle = targaGray8Copy;
+        converter->srcBpp  = targaFormatBpp(targaPixelFormat(format));
+        converter->dstBpp  = converter->srcBpp;
+
+        image->width  = 0;
+        image->height = 0;
+    }
+    else
+    {
+        int result = targaSelectConverter(TGA_header, targaPixelFormat(format),
+                options ? options->colorKey : 0, converter);
+        if (result != TARGA_OK)
+            return result;
+    }
+
+    /*
+     * Origin: the file one unless a corner is forced
+     */
+    unsigned int flags = options ? options->flags : 0;
+
+    if ((flags & TARGA_LOAD_TOP_LEFT) && (flags & TARGA_LOAD_BOTTOM_LEFT))
+        return TARGA_ERR_ARGUMENT;
+
+    if (flags & TARGA_LOAD_TOP_LEFT)
+        image->origin = TARGA_ORIGIN_TOP_LEFT;
+    else if (flags & TARGA_LOAD_BOTTOM_LEFT)
+        image->origin = TARGA_ORIGIN_BOTTOM_LEFT;
+    else
+        image->origin = TGA_header->imageSpec.imageDescriptor & TGA_ORIGIN_MASK;
+
+    /*
+     * Region, in the image as it is returned
+     */
+    if (options && options->region.width && options->region.height)
+    {
+        const TARGA_RECT* region = &options->region;
+
+        if (region->width > image->width || region->x > image->width - region->width ||
+            region->height > image->height || region->y > image->height - region->height)
+            return TARGA_ERR_ARGUMENT;
+
+        image->width  = region->width;
+        image->height = region->height;
+    }
+
+    /*
+     * Row pitch: requested, or packed rows rounded up to the alignment
+     */
+    size_t packed    = blockSize
+        ? (image->width + 3) / 4 * blockSize : image->width * converter->dstBpp;
+    size_t alignment = options ? options->alignment : 0;
+
+    if (alignment & (alignment - 1))
+        return TARGA_ERR_ARGUMENT;
+
+    if (options && options->pitch)
+        image->pitch = options->pitch;
+    else if (alignment > 1)
+        image->pitch = (packed + alignment - 1) & ~(alignment - 1);
+    else
+        image->pitch = packed;
+
+    if (image->pitch < packed || (alignment > 1 && image->pitch % alignment))
+        return TARGA_ERR_ARGUMENT;
+
+    if (image->height && image->pitch > ((size_t)-1 - alignment) / image->height)
+        return TARGA_ERR_NO_MEMORY;
+
+    /*
+     * Mip chain, about a third more
+     */
+    image->levels = 1;
+
+    if (flags & TARGA_LOAD_MIPMAPS)
+    {
+        if (format == TARGA_FORMAT_INDEX8 || blockSize || options->mipFilter > TARGA_MIP_LANCZOS)
+            return TARGA_ERR_ARGUMENT;
+
+        if (image->width && image->height)
+            image->levels = targaMipLevels(image->width, image->height);
+
+        if (image->pitch * image->height > ((size_t)-1 - alignment) / 2)
+            return TARGA_ERR_NO_MEMORY;
+    }
+
+    return TARGA_OK;
+
+}
+
+
+/*
+ * Descriptor origin bits that differ between the file and the image:
+ * TGA_ORIGIN_TOP set means the rows are flipped, TGA_ORIGIN_RIGHT that
+ * the rows are mirrored.
+ */
+static unsigned int targaFlipBits(
+        const TGA_FILE_HEADER*  TGA_header,
+        const TARGA_IMAGE*      image)
+{
+    return (TGA_header->imageSpec.imageDescriptor ^ image->origin) & TGA_ORIGIN_MASK;
+}
+
+
+/*
+ * Decode an image from reader, into buffer if not NULL. When view is set
+ * and the pixels of a memory source already have the requested layout,
+ * image->pixels points into the source. image->memory is left NULL in both
+ * cases.
+ */
+static int targaDecode(
+        TGA_READER*                 reader,
+        const TARGA_LOAD_OPTIONS*   options,
+        int                         view,
+        uint8_t*                    buffer,
+        size_t                      bufferSize,
+        TARGA_IMAGE*                image)
+{
+
+    TARGA_STATS* stats = reader->stats;
+    uint64_t mark = stats ? targaNanoseconds() : 0;
+
+    /*
+     * Read TGA header
+     */
+    const uint8_t* buf = targaRead(reader, TGA_HEADER_SIZE);
+    if (!buf)
+        return TARGA_ERR_READ;
+
+    TGA_FILE_HEADER TGA_header;
+    targaParseHeader(buf, &TGA_header);
+
+    /*
+     * Skipp image id, read the color map
+     */
+    if (targaSkip(reader, TGA_header.idLength) != TARGA_OK)
+        return TARGA_ERR_READ;
+
+    TGA_CONVERTER converter;
+    int rle;
+    int result = targaPrepare(&TGA_header, options, &converter, &rle, image);
+    if (result != TARGA_OK)
+        return result;
+
+    TGA_STATS_PHASE(stats, headerNs, mark);
+
+    result = targaReadColorMap(reader, &TGA_header,
+            targaPixelFormat(image->format), &converter);
+    if (result == TARGA_OK)
+        result = targaBuildTable16(&TGA_header, image, &converter, stats);
+    if (result != TARGA_OK)
+    {
+        free(converter.lut);
+        return result;
+    }
+
+    TGA_STATS_PHASE(stats, colorMapNs, mark);
+
+    size_t blockSize = targaBlockSize(image->format);
+    size_t packed = blockSize
+        ? (image->width + 3) / 4 * blockSize : image->width * converter.dstBpp;
+    size_t rows = blockSize ? (image->height + 3) / 4 : image->height;
+    size_t size = targaImageSize(image);
+    unsigned int flip = targaFlipBits(&TGA_header, image);
+    int region = options && options->region.width && options->region.height &&
+        (image->width != TGA_header.imageSpec.imageWidth ||
+         image->height != TGA_header.imageSpec.imageHeight);
+
+    /*
+     * Zero copy: the mapped pixels are handed back as they are
+     */
+    if (view && !buffer && !rle && !reader->file && !flip && !region && !blockSize &&
+        image->pitch == packed && image->levels == 1 &&
+        (converter.swizzle == targaCopy24 || converter.swizzle == targaCopy32))
+    {
+        if (size > reader->size - reader->pos)
+            return TARGA_ERR_READ;
+
+        image->pixels = (uint8_t*)reader->data + reader->pos;
+        image->memory = NULL;
+        reader->pos += size;
+        return TARGA_OK;
+    }
+
+    size_t alignment = options && options->alignment ? options->alignment : 1;
+    uint8_t* memory = NULL;
+
+    if (buffer)
+    {
+        /* the last row needs its pixels only: buffer may be a part of a larger image */
+        size_t needed = image->levels == 1 && rows
+            ? image->pitch * (rows - 1) + packed : size;
+
+        if (bufferSize < needed || (uintptr_t)buffer % alignment)
+        {
+            free(converter.lut);
+            return TARGA_ERR_ARGUMENT;
+        }
+    }
+    else
+    {
+        memory = malloc(size ? size + alignment - 1 : 1);
+        if (!memory)
+        {
+            free(converter.lut);
+            return TARGA_ERR_NO_MEMORY;
+        }
+
+        if (stats)
+            stats->allocations++;
+
+        buffer = (uint8_t*)(((uintptr_t)memory + alignment - 1) & ~(uintptr_t)(alignment - 1));
+    }
+
+    /*
+     * Read image data
+     */
+    TGA_OUTPUT output;
+    unsigned int threads = options ? options->threads : 0;
+
+    output.pixels = buffer;
+    output.pitch  = image->pitch;
+    output.width  = image->width;
+    output.height = image->height;
+    output.flip   = (flip & TGA_ORIGIN_TOP) != 0;
+    output.mirror = (flip & TGA_ORIGIN_RIGHT) != 0;
+    output.skipRows   = 0;
+    output.skipBefore = 0;
+    output.skipAfter  = 0;
+    output.mip        = NULL;
+    output.bc         = NULL;
+
+    if (region)
+    {
+        /* the file rows and columns holding the region */
+        size_t fullWidth  = TGA_header.imageSpec.imageWidth;
+        size_t fullHeight = TGA_header.imageSpec.imageHeight;
+        size_t x = options->region.x;
+        size_t y = options->region.y;
+
+        output.skipRows   = output.flip ? fullHeight - y - image->height : y;
+        output.skipBefore = output.mirror ? fullWidth - x - image->width : x;
+        output.skipAfter  = fullWidth - output.skipBefore - image->width;
+    }
+
+    TGA_MIP* mip = NULL;
+
+    if (image->levels > 1)
+    {
+        image->pixels = buffer;
+        result = targaMipCreate(image, options, output.flip, stats, &mip);
+        if (result != TARGA_OK)
+        {
+            image->pixels = NULL;
+            free(converter.lut);
+            free(memory);
+            return result;
+        }
+    }
+
+    TGA_BC* bc = NULL;
+
+    if (blockSize)
+    {
+        image->pixels = buffer;
+        result = targaBcCreate(image, threads, output.flip, &bc);
+        if (result != TARGA_OK)
+        {
+            image->pixels = NULL;
+            free(converter.lut);
+            free(memory);
+            return result;
+        }
+    }
+
+    if (rle && threads > 1 && !region && !bc)
+    {
+        /* the chunks end in any order: the levels are built afterwards */
+        result = targaLoadRleParallel(reader, &converter, &output, threads);
+
+        size_t y;
+        for (y = 0; mip && result == TARGA_OK && y < image->height; y++)
+            targaMipRow(mip, y);
+    }
+    else
+    {
+        output.mip = mip;
+        output.bc  = bc;
+
+        if (image->pitch == packed && !flip && !region && !mip && !bc)
+        {
+            output.width *= output.height;
+            output.height = output.width ? 1 : 0;
+        }
+
+        if (rle)
+            result = targaLoadRle(reader, &converter, &output);
+        else
+            result = targaLoadRaw(reader, &converter, &output);
+    }
+
+    free(converter.lut);
+    targaMipDestroy(mip);
+    targaBcDestroy(bc);
+    TGA_STATS_PHASE(stats, pixelsNs, mark);
+
+    if (result != TARGA_OK)
+    {
+        image->pixels = NULL;
+        free(memory);
+        return result;
+    }
+
+    if (stats)
+        stats->pixels += (uint64_t)image->width * image->height;
+
+    image->pixels = buffer;
+    image->memory = memory;
+    return TARGA_OK;
+
+}
+
+
+/*
+ * Probe
+ *
+ * Sources are read at given offsets through a small callback so that
+ * paths, file descriptors and memory share the same parser. Only the
+ * header is read unless the TGA 2.0 footer is asked for.
+ */
+typedef int (*TGA_READ_AT_FN)(void* source, uint64_t offset, void* buf, size_t size);
+
+typedef struct {
+    const uint8_t* data;
+    size_t         size;
+} TGA_MEMORY_SOURCE;
+
+
+static int targaReadAtMemory(void* source, uint64_t offset, void* buf, size_t size)
+{
+    TGA_MEMORY_SOURCE* memory = source;
+
+    if (offset > memory->size || size > memory->size - offset)
+        return TARGA_ERR_READ;
+
+    memcpy(buf, memory->data + offset, size);
+    return TARGA_OK;
+}
+
+
+#ifdef TGA_MMAP
+static int targaReadAtFd(void* source, uint64_t offset, void* buf, size_t size)
+{
+    int fd = *(int*)source;
+
+    while (size)
+    {
+        ssize_t n = pread(fd, buf, size, (off_t)offset);
+        if (n <= 0)
+            return TARGA_ERR_READ;
+
+        buf = (uint8_t*)buf + n;
+        offset += (uint64_t)n;
+        size -= (size_t)n;
+    }
+
+    return TARGA_OK;
+}
+#else
+static int targaReadAtFile(void* source, uint64_t offset, void* buf, size_t size)
+{
+    FILE* file = source;
+
+    if (fseek(file, (long)offset, SEEK_SET) != 0 || fread(buf, 1, size, file) != size)
+        return TARGA_ERR_READ;
+
+    return TARGA_OK;
+}
+#endif
+
+
+static int targaProbeSource(
+        TGA_READ_AT_FN  readAt,
+        void*           source,
+        uint64_t        fileSize,
+        unsigned int    flags,
+        TARGA_INFO*     info)
+{
+
+    uint8_t buf[TGA_EXTENSION_SIZE];
+    TGA_FILE_HEADER TGA_header;
+
+    memset(info, 0, sizeof(*info));
+
+    int result = readAt(source, 0, buf, TGA_HEADER_SIZE);
+    if (result != TARGA_OK)
+        return result;
+
+    targaParseHeader(buf, &TGA_header);
+
+    info->width             = TGA_header.imageSpec.imageWidth;
+    info->height            = TGA_header.imageSpec.imageHeight;
+    info->imageType         = TGA_header.imageType;
+    info->pixelDepth        = TGA_header.imageSpec.pixelDepth;
+    info->alphaBits         = TGA_header.imageSpec.imageDescriptor & 0x0F;
+    info->origin            = TGA_header.imageSpec.imageDescriptor & 0x30;
+    info->xOrigin           = TGA_header.imageSpec.xOriginOfImage;
+    info->yOrigin           = TGA_header.imageSpec.yOriginOfImage;
+    info->idLength          = TGA_header.idLength;
+    info->colorMapType      = TGA_header.colorMapType;
+    info->colorMapFirst     = TGA_header.colorMapSpec.firstEntryIndex;
+    info->colorMapLength    = TGA_header.colorMapSpec.mapLenght;
+    info->colorMapEntrySize = TGA_header.colorMapSpec.mapEntrySize;
+    info->dataOffset        = TGA_HEADER_SIZE + targaSkipSize(&TGA_header);
+
+    switch (info->imageType)
+    {
+        case IMG_TYPE_NO_IMAGE_DATA:
+        case IMG_TYPE_UNCOMPRESSED_COLOR_MAPPED:
+        case IMG_TYPE_UNCOMPRESSED_TRUE_COLOR:
+        case IMG_TYPE_UNCOMPRESSED_BLACK_AND_WHITE:
+        case IMG_TYPE_RLE_COLOR_MAPPED:
+        case IMG_TYPE_RLE_TRUE_COLOR:
+        case IMG_TYPE_RLE_BLACK_AND_WHITE:
+            break;
+        default:
+            return TARGA_ERR_FORMAT;
+    }
+
+    if (!(flags & TARGA_PROBE_EXTENSION) || fileSize < TGA_HEADER_SIZE + TGA_FOOTER_SIZE)
+        return TARGA_OK;
+
+    /*
+     * TGA 2.0 footer, then extension area
+     */
+    result = readAt(source, fileSize - TGA_FOOTER_SIZE, buf, TGA_FOOTER_SIZE);
+    if (result != TARGA_OK)
+        return result;
+
+    if (memcmp(buf + 8, TGA_SIGNATURE, sizeof(TGA_SIGNATURE)) != 0)
+        return TARGA_OK;
+
+    info->version           = 2;
+    info->extensionOffset   = targaGet32(buf);
+    info->developerOffset   = targaGet32(buf + 4);
+
+    if (info->extensionOffset == 0 ||
+        info->extensionOffset + (uint64_t)TGA_EXTENSION_SIZE > fileSize)
+        return TARGA_OK;
+
+    result = readAt(source, info->extensionOffset, buf, TGA_EXTENSION_SIZE);
+    if (result != TARGA_OK)
+        return result;
+
+    if (targaGet16(buf) < TGA_EXTENSION_SIZE)
+        return TARGA_OK;
+
+    info->keyColor          = targaGet32(buf + TGA_EXT_KEY_COLOR);
+    info->stampOffset       = targaGet32(buf + TGA_EXT_STAMP_OFFSET);
+    info->scanLineOffset    = targaGet32(buf + TGA_EXT_SCANLINE_OFFSET);
+    info->attributesType    = buf[TGA_EXT_ATTRIBUTES_TYPE];
+    return TARGA_OK;
+
+}
+
+
+int targaProbeMemory(
+        const void*     data,
+        size_t          size,
+        unsigned int    flags,
+        TARGA_INFO*     info)
+{
+
+    TGA_MEMORY_SOURCE memory;
+
+    memory.data = data;
+    memory.size = size;
+    return targaProbeSource(targaReadAtMemory, &memory, size, flags, info);
+
+}
+
+
+int targaProbeFd(int fd, unsigned int flags, TARGA_INFO* info)
+{
+
+#ifdef TGA_MMAP
+    struct stat st;
+    uint64_t fileSize = 0;
+
+    if ((flags & TARGA_PROBE_EXTENSION) && fstat(fd, &st) == 0)
+        fileSize = (uint64_t)st.st_size;
+
+    return targaProbeSource(targaReadAtFd, &fd, fileSize, flags, info);
+#else
+    (void)fd;
+    (void)flags;
+    memset(info, 0, sizeof(*info));
+    return TARGA_ERR_UNSUPPORTED;
+#endif
+
+}
+
+
+int targaProbe(const char* fileName, unsigned int flags, TARGA_INFO* info)
+{
+
+#ifdef TGA_MMAP
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0)
+    {
+        memset(info, 0, sizeof(*info));
+        return TARGA_ERR_OPEN;
+    }
+
+    int result = targaProbeFd(fd, flags, info);
+    close(fd);
+    return result;
+#else
+    FILE* file = fopen(fileName, "rb");
+    uint64_t fileSize = 0;
+
+    if (!file)
+    {
+        memset(info, 0, sizeof(*info));
+        return TARGA_ERR_OPEN;
+    }
+
+    if ((flags & TARGA_PROBE_EXTENSION) && fseek(file, 0, SEEK_END) == 0)
+        fileSize = (uint64_t)ftell(file);
+
+    int result = targaProbeSource(targaReadAtFile, file, fileSize, flags, info);
+    fclose(file);
+    return result;
+#endif
+
+}
+
+
+/*
+ * Thumbnails
+ *
+ * The file is mapped and only the pixels kept are read: those of the
+ * postage stamp when there is one, else those of the image. Uncompressed
+ * pixels are indexed directly. RLE rows start at their entry of the scan
+ * line table when the file has one, else the packets before them are
+ * walked; either way only the headers are read up to the pixels kept.
+ */
+unsigned int targaDecimateStep(unsigned int width, unsigned int height, unsigned int maxSize)
+{
+    unsigned int side = width > height ? width : height;
+
+    return side > maxSize ? (side + maxSize - 1) / maxSize : 1;
+}
+
+
+size_t targaDecimate(size_t i, unsigned int step, size_t size)
+{
+    size_t pixel = i * step + step / 2;
+
+    return pixel < size ? pixel : size - 1;
+}
+
+
+/*
+ * Packet of an RLE stream holding pixels first to first + count - 1, the
+ * next one at pos.
+ */
+typedef struct {
+    size_t  pos;
+    size_t  first;
+    size_t  count;
+    size_t  pixels;         /* offset of the run pixel or of the first raw pixel */
+    int     run;
+} TGA_RLE_CURSOR;
+
+
+/*
+ * Offset in data of pixel target, in the current packet or a later one,
+ * 0 if the data ends first.
+ */
+static size_t targaRleSeek(
+        TGA_RLE_CURSOR* cursor,
+        const uint8_t*  data,
+        size_t          size,
+        size_t          bpp,
+        size_t          target)
+{
+
+    while (target >= cursor->first + cursor->count)
+    {
+        if (cursor->pos >= size)
+            return 0;
+
+        uint8_t packet = data[cursor->pos];
+
+        cursor->first += cursor->count;
+        cursor->count  = (packet & 0x7F) + 1;
+        cursor->run    = packet & 0x80;
+        cursor->pixels = cursor->pos + 1;
+        cursor->pos   += 1 + (cursor->run ? 1 : cursor->count) * bpp;
+    }
+
+    if (cursor->pos > size)
+        return 0;
+
+    return cursor->run ? cursor->pixels : cursor->pixels + (target - cursor->first) * bpp;
+
+}
+
+
+static int targaThumbnail(
+        const uint8_t*              data,
+        size_t                      size,
+        unsigned int                maxSize,
+        const TARGA_LOAD_OPTIONS*   options,
+        TARGA_IMAGE*                image)
+{
+
+    TARGA_LOAD_OPTIONS thumbnail = {0};
+    TGA_FILE_HEADER TGA_header;
+    TGA_CONVERTER converter;
+    TGA_MEMORY_SOURCE memory;
+    TGA_READER reader = {0};
+    TARGA_INFO info;
+    int rle;
+
+    if (size < TGA_HEADER_SIZE)
+        return TARGA_ERR_READ;
+
+    targaParseHeader(data, &TGA_header);
+
+    /* the whole image in the requested format and origin */
+    if (options)
+    {
+        thumbnail.format   = options->format;
+        thumbnail.flags    = options->flags & (TARGA_LOAD_TOP_LEFT | TARGA_LOAD_BOTTOM_LEFT);
+        thumbnail.colorKey = options->colorKey;
+    }
+
+    int result = targaPrepare(&TGA_header, &thumbnail, &converter, &rle, image);
+    if (result != TARGA_OK)
+        return result;
+
+    if (targaBlockSize(image->format))
+        return TARGA_ERR_ARGUMENT;
+
+    memory.data = data;
+    memory.size = size;
+    result = targaProbeSource(targaReadAtMemory, &memory, size, TARGA_PROBE_EXTENSION, &info);
+    if (result != TARGA_OK)
+        return result;
+
+    /*
+     * Pixels to decimate: the stamp, a byte of width, a byte of height and
+     * uncompressed pixels, else the image
+     */
+    size_t bpp    = converter.srcBpp;
+    size_t width  = image->width;
+    size_t height = image->height;
+    size_t offset = info.dataOffset;
+    size_t stamp  = info.stampOffset;
+    const uint8_t* table = NULL;
+
+    if (stamp && stamp < size - 2 && data[stamp] && data[stamp + 1] &&
+        (size - stamp - 2) / bpp >= (size_t)data[stamp] * data[stamp + 1])
+    {
+        width  = data[stamp];
+        height = data[stamp + 1];
+        offset = stamp + 2;
+        rle    = 0;
+    }
+    else if (rle && info.scanLineOffset && info.scanLineOffset < size &&
+             (size - info.scanLineOffset) / 4 >= height)
+    {
+        table = data + info.scanLineOffset;
+    }
+
+    unsigned int step = targaDecimateStep((unsigned int)width, (unsigned int)height,
+            maxSize ? maxSize : TARGA_STAMP_SIZE);
+
+    image->width  = (unsigned int)((width + step - 1) / step);
+    image->height = (unsigned int)((height + step - 1) / step);
+    image->pitch  = image->width * converter.dstBpp;
+
+    reader.data = data;
+    reader.size = size;
+    reader.pos  = TGA_HEADER_SIZE;
+
+    result = targaSkip(&reader, TGA_header.idLength);
+    if (result == TARGA_OK)
+        result = targaReadColorMap(&reader, &TGA_header, image->format, &converter);
+    if (result != TARGA_OK)
+        return result;
+
+    /* the source pixels of a row are gathered after the image */
+    size_t pixels = image->pitch * image->height;
+    uint8_t* buffer = malloc(pixels + image->width * bpp + 1);
+    if (!buffer)
+    {
+        free(converter.lut);
+        return TARGA_ERR_NO_MEMORY;
+    }
+
+    uint8_t* gather = buffer + pixels;
+    unsigned int flip = targaFlipBits(&TGA_header, image);
+    TGA_RLE_CURSOR cursor = {0};
+    size_t x, y;
+
+    cursor.pos = offset;
+
+    for (y = 0; y < image->height && result == TARGA_OK; y++)
+    {
+        size_t line  = targaDecimate(y, step, height);
+        size_t first = line * width;
+        uint8_t* row = buffer + (flip & TGA_ORIGIN_TOP ? image->height - 1 - y : y) * image->pitch;
+
+        if (table)
+        {
+            memset(&cursor, 0, sizeof(cursor));
+            cursor.pos   = targaGet32(table + line * 4);
+            cursor.first = first;
+        }
+
+        for (x = 0; x < image->width; x++)
+        {
+            size_t target = first + targaDecimate(x, step, width);
+            size_t at = rle
+                ? targaRleSeek(&cursor, data, size, bpp, target)
+                : offset + target * bpp;
+
+            if (at == 0 || at > size - bpp)
+            {
+                result = TARGA_ERR_READ;
+                break;
+            }
+
+            memcpy(gather + x * bpp, data + at, bpp);
+        }
+
+        converter.swizzle(row, gather, image->width, &converter);
+
+        if (flip & TGA_ORIGIN_RIGHT)
+            targaMirrorRow(row, converter.dstBpp, image->width);
+    }
+
+    free(converter.lut);
+
+    if (result != TARGA_OK)
+    {
+        free(buffer);
+        return result;
+    }
+
+    image->pixels = buffer;
+    image->memory = buffer;
+    return TARGA_OK;
+
+}
+
+
+int targaLoadThumbnailMemory(
+        const void*                 data,
+        size_t                      size,
+        unsigned int                maxSize,
+        const TARGA_LOAD_OPTIONS*   options,
+        TARGA_IMAGE*                image)
+{
+
+    TARGA_STATS local;
+    TARGA_STATS* stats = targaStatsBegin(options, &local);
+    uint64_t start = stats ? targaNanoseconds() : 0;
+    uint64_t mark = start;
+
+    memset(image, 0, sizeof(*image));
+
+    int result = targaThumbnail(data, size, maxSize, options, image);
+
+    if (stats && result == TARGA_OK)
+        stats->pixels += (uint64_t)image->width * image->height;
+
+    TGA_STATS_PHASE(stats, pixelsNs, mark);
+    TGA_STATS_PHASE(stats, totalNs, start);
+    return targaStatsEnd(stats, result);
+
+}
+
+
+int targaLoadThumbnail(
+        const char*                 fileName,
+        unsigned int                maxSize,
+        const TARGA_LOAD_OPTIONS*   options,
+        TARGA_IMAGE*                image)
+{
+
+    TARGA_STATS local;
+    TARGA_STATS* stats = targaStatsBegin(options, &local);
+    uint64_t start = stats ? targaNanoseconds() : 0;
+    uint64_t mark = start;
+    void* mapping;
+    size_t mappingSize;
+
+    memset(image, 0, sizeof(*image));
+
+    int result = targaMapFile(fileName, &mapping, &mappingSize);
+    TGA_STATS_PHASE(stats, openNs, mark);
+    if (result != TARGA_OK)
+        return targaStatsEnd(stats, result);
+
+#ifdef TGA_MMAP
+    /* a few scattered pages are read, not the whole file */
+    madvise(mapping, mappingSize, MADV_RANDOM);
+#endif
+
+    result = targaThumbnail(mapping, mappingSize, maxSize, options, image);
+    targaUnmapFile(mapping, mappingSize);
+
+    if (stats && result == TARGA_OK)
+        stats->pixels += (uint64_t)image->width * image->height;
+
+    TGA_STATS_PHASE(stats, pixelsNs, mark);
+    TGA_STATS_PHASE(stats, totalNs, start);
+    return targaStatsEnd(stats, result);
+
+}
+
+
+/*
+ * Push decoder
+ *
+ * Input bytes go through a small state machine: header, then image id
+ * (skipped) and color map (gathered then expanded, or skipped), then pixels decoded by the RLE engine into a single
+ * row buffer. Uncompressed images are decoded as one raw packet covering
+ * the whole image. Bytes of a pixel or packet split between two feeds wait
+ * in pending.
+ */
+#define TGA_DECODER_HEADER 0
+#define TGA_DECODER_SKIP   1
+#define TGA_DECODER_MAP    2
+#define TGA_DECODER_PIXELS 3
+#define TGA_DECODER_DONE   4
+
+struct TARGA_DECODER {
+    TARGA_LOAD_OPTIONS  options;
+    int                 state;          /* TGA_DECODER_* */
+    int                 status;         /* first error met */
+
+    uint8_t             header[TGA_HEADER_SIZE];
+    size_t              headerSize;
+    size_t              skip;           /* id and color map bytes left */
+    uint8_t*            map;            /* color map being gathered */
+    size_t              mapSize;
+    size_t              mapFill;
+
+    TARGA_IMAGE         image;
+    TGA_CONVERTER       converter;
+    TGA_RLE_STATE       rle;
+    uint8_t             pending[8];
+    size_t              pendingSize;
+
+    uint8_t*            row;
+    unsigned int        rowFill;        /* pixels decoded in row */
+    unsigned int        y;              /* rows handed out */
+    int                 rowReady;
+    unsigned int        flip;           /* see targaFlipBits() */
+
+    TARGA_STATS*        stats;          /* NULL when not counted */
+    TARGA_STATS         localStats;
+};
+
+
+TARGA_DECODER* targaDecoderCreate(const TARGA_LOAD_OPTIONS* options)
+{
+
+    TARGA_DECODER* decoder = calloc(1, sizeof(TARGA_DECODER));
+
+    if (decoder && options)
+    {
+        decoder->options = *options;
+        decoder->options.flags &= ~(unsigned int)TARGA_LOAD_MIPMAPS;
+        memset(&decoder->options.region, 0, sizeof(TARGA_RECT));
+    }
+
+    if (decoder)
+    {
+        decoder->stats = targaStatsBegin(options, &decoder->localStats);
+        if (decoder->stats)
+            decoder->stats->allocations++;
+    }
+
+    return decoder;
+
+}
+
+
+void targaDecoderDestroy(TARGA_DECODER* decoder)
+{
+
+    if (!decoder)
+        return;
+
+    free(decoder->converter.lut);
+    free(decoder->map);
+    free(decoder->row);
+    free(decoder);
+
+}
+
+
+static int targaDecoderStart(TARGA_DECODER* decoder)
+{
+
+    TGA_FILE_HEADER TGA_header;
+    int rle;
+
+    targaParseHeader(decoder->header, &TGA_header);
+
+    int result = targaPrepare(&TGA_header, &decoder->options,
+            &decoder->converter, &rle, &decoder->image);
+    if (result != TARGA_OK)
+        return result;
+
+    /* rows of pixels only */
+    if (targaBlockSize(decoder->image.format))
+        return TARGA_ERR_ARGUMENT;
+
+    /* no 16 bits table either: a row and the color map is all it holds */
+    decoder->row = malloc(decoder->image.pitch ? decoder->image.pitch : 1);
+    if (!decoder->row)
+        return TARGA_ERR_NO_MEMORY;
+
+    if (decoder->stats)
+        decoder->stats->allocations++;
+
+    if (!rle)
+        decoder->rle.remaining =
+            (unsigned int)((size_t)decoder->image.width * decoder->image.height);
+
+    decoder->skip  = targaSkipSize(&TGA_header);
+    decoder->flip  = targaFlipBits(&TGA_header, &decoder->image);
+
+    if (targaIsMapped(&TGA_header) && decoder->image.format != TARGA_FORMAT_INDEX8)
+    {
+        decoder->mapSize = decoder->skip - TGA_header.idLength;
+        decoder->skip    = TGA_header.idLength;
+        decoder->map     = malloc(decoder->mapSize ? decoder->mapSize : 1);
+        if (!decoder->map)
+            return TARGA_ERR_NO_MEMORY;
+
+        if (decoder->stats)
+            decoder->stats->allocations++;
+    }
+    decoder->state = TGA_DECODER_SKIP;
+
+    if (decoder->image.width == 0 || decoder->image.height == 0)
+        decoder->state = TGA_DECODER_DONE;
+
+    return TARGA_OK;
+
+}
+
+
+/*
+ * Expand the gathered color map, then go on with the pixels.
+ */
+static int targaDecoderMap(TARGA_DECODER* decoder)
+{
+
+    TGA_FILE_HEADER TGA_header;
+    TGA_READER reader = {0};
+
+    reader.data  = decoder->map;
+    reader.size  = decoder->mapSize;
+    reader.stats = decoder->stats;
+
+    targaParseHeader(decoder->header, &TGA_header);
+
+    int result = targaReadColorMap(&reader, &TGA_header,
+            decoder->image.format, &decoder->converter);
+
+    free(decoder->map);
+    decoder->map   = NULL;
+    decoder->state = TGA_DECODER_PIXELS;
+    return result;
+
+}
+
+
+/*
+ * Decode pixels from data until the row is complete or data is exhausted.
+ * Return the number of bytes consumed.
+ */
+static size_t targaDecoderPixels(
+        TARGA_DECODER*  decoder,
+        const uint8_t*  data,
+        size_t          size)
+{
+
+    const TGA_CONVERTER* converter = &decoder->converter;
+    unsigned int width = decoder->image.width;
+    size_t used = 0;
+
+    while (decoder->rowFill < width)
+    {
+        uint8_t* dst = decoder->row + decoder->rowFill * converter->dstBpp;
+        size_t produced, consumed;
+
+        if (decoder->pendingSize)
+        {
+            /* complete the split unit with the new bytes */
+            size_t before = decoder->pendingSize;
+            size_t added  = sizeof(decoder->pending) - before;
+            if (added > size - used)
+                added = size - used;
+
+            memcpy(decoder->pending + before, data + used, added);
+            consumed = targaRleDecode(&decoder->rle, converter,
+                    decoder->pending, before + added,
+                    dst, width - decoder->rowFill, &produced);
+
+            if (consumed == 0 && produced == 0)
+            {
+                /* still not a whole unit: data is exhausted */
+                decoder->pendingSize = before + added;
+                used += added;
+                break;
+            }
+
+            decoder->rowFill += (unsigned int)produced;
+
+            if (consumed >= before)
+            {
+                used += consumed - before;
+                decoder->pendingSize = 0;
+            }
+            else
+            {
+                memmove(decoder->pending, decoder->pending + consumed,
+                        before - consumed);
+                decoder->pendingSize = before - consumed;
+            }
+
+            continue;
+        }
+
+        consumed = targaRleDecode(&decoder->rle, converter,
+                data + used, size - used,
+                dst, width - decoder->rowFill, &produced);
+
+        used += consumed;
+        decoder->rowFill += (unsigned int)produced;
+
+        if (decoder->rowFill < width)
+        {
+            /* the rest is less than a pixel or a run packet */
+            decoder->pendingSize = size - used;
+            memcpy(decoder->pending, data + used, decoder->pendingSize);
+            used = size;
+            break;
+        }
+    }
+
+    if (decoder->rowFill == width)
+    {
+        if (decoder->flip & TGA_ORIGIN_RIGHT)
+            targaMirrorRow(decoder->row, converter->dstBpp, width);
+        decoder->rowReady = 1;
+    }
+
+    return used;
+
+}
+
+
+size_t targaDecoderFeed(
+        TARGA_DECODER*  decoder,
+        const void*     data,
+        size_t          size,
+        int*            status)
+{
+
+    const uint8_t* bytes = data;
+    size_t used = 0;
+    uint64_t start = decoder->stats ? targaNanoseconds() : 0;
+
+    while (decoder->status == TARGA_OK && !decoder->rowReady && used < size)
+    {
+        size_t n;
+
+        switch (decoder->state)
+        {
+            case TGA_DECODER_HEADER:
+                n = TGA_HEADER_SIZE - decoder->headerSize;
+                if (n > size - used)
+                    n = size - used;
+
+                memcpy(decoder->header + decoder->headerSize, bytes + used, n);
+                decoder->headerSize += n;
+                used += n;
+
+                if (decoder->headerSize == TGA_HEADER_SIZE)
+                    decoder->status = targaDecoderStart(decoder);
+                break;
+
+            case TGA_DECODER_SKIP:
+                n = decoder->skip;
+                if (n > size - used)
+                    n = size - used;
+
+                decoder->skip -= n;
+                used += n;
+
+                if (decoder->skip == 0)
+                    decoder->state = decoder->map ? TGA_DECODER_MAP : TGA_DECODER_PIXELS;
+                break;
+
+            case TGA_DECODER_MAP:
+                n = decoder->mapSize - decoder->mapFill;
+                if (n > size - used)
+                    n = size - used;
+
+                memcpy(decoder->map + decoder->mapFill, bytes + used, n);
+                decoder->mapFill += n;
+                used += n;
+
+                if (decoder->mapFill == decoder->mapSize)
+                    decoder->status = targaDecoderMap(decoder);
+                break;
+
+            case TGA_DECODER_PIXELS:
+                used += targaDecoderPixels(decoder, bytes + used, size - used);
+                break;
+
+            case TGA_DECODER_DONE:
+                /* footer and extension area */
+                used = size;
+                break;
+        }
+    }
+
+    if (decoder->stats)
+        decoder->stats->bytesRead += used;
+
+    TGA_STATS_PHASE(decoder->stats, totalNs, start);
+
+    if (status)
+        *status = decoder->status;
+
+    return used;
+
+}
+
+
+int targaDecoderImage(const TARGA_DECODER* decoder, TARGA_IMAGE* image)
+{
+
+    if (decoder->status != TARGA_OK)
+        return decoder->status;
+
+    if (decoder->state == TGA_DECODER_HEADER)
+        return TARGA_PENDING;
+
+    *image = decoder->image;
+    return TARGA_OK;
+
+}
+
+
+const uint8_t* targaDecoderRow(TARGA_DECODER* decoder, unsigned int* y)
+{
+
+    if (!decoder->rowReady)
+        return NULL;
+
+    *y = decoder->flip & TGA_ORIGIN_TOP
+        ? decoder->image.height - 1 - decoder->y
+        : decoder->y;
+
+    decoder->y++;
+    decoder->rowReady = 0;
+    decoder->rowFill  = 0;
+
+    if (decoder->y == decoder->image.height)
+        decoder->state = TGA_DECODER_DONE;
+
+    return decoder->row;
+
+}
+
+
+int targaDecoderFinish(TARGA_DECODER* decoder)
+{
+
+    int result = decoder->status;
+
+    if (result == TARGA_OK &&
+        (decoder->state != TGA_DECODER_DONE || decoder->rowReady))
+        result = TARGA_ERR_READ;
+
+    /* the statistics are closed by the first call */
+    if (decoder->stats)
+    {
+        decoder->stats->rawPackets = decoder->rle.packets[0];
+        decoder->stats->runPackets = decoder->rle.packets[1];
+        decoder->stats->pixels     = (uint64_t)decoder->y * decoder->image.width;
+        targaStatsEnd(decoder->stats, result);
+        decoder->stats = NULL;
+    }
+
+    return result;
+
+}
+
+
+/*
+ * Map a whole file read only (copy on write). Without mmap the file is
+ * read into a plain allocation.
+ */
+int targaMapFile(const char* fileName, void** data, size_t* size)
+{
+
+#ifdef TGA_MMAP
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0)
+        return TARGA_ERR_OPEN;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return TARGA_ERR_READ;
+    }
+
+    void* mapping = mmap(NULL, (size_t)st.st_size,
+            PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED)
+        return TARGA_ERR_READ;
+
+    madvise(mapping, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    *data = mapping;
+    *size = (size_t)st.st_size;
+    return TARGA_OK;
+#else
+    FILE* file = fopen(fileName, "rb");
+    if (!file)
+        return TARGA_ERR_OPEN;
+
+    long length = -1;
+    if (fseek(file, 0, SEEK_END) == 0)
+        length = ftell(file);
+
+    if (length <= 0 || fseek(file, 0, SEEK_SET) != 0)
+    {
+        fclose(file);
+        return TARGA_ERR_READ;
+    }
+
+    *data = malloc((size_t)length);
+    if (!*data)
+    {
+        fclose(file);
+        return TARGA_ERR_NO_MEMORY;
+    }
+
+    if (fread(*data, 1, (size_t)length, file) != (size_t)length)
+    {
+        free(*data);
+        fclose(file);
+        return TARGA_ERR_READ;
+    }
+
+    fclose(file);
+    *size = (size_t)length;
+    return TARGA_OK;
+#endif
+
+}
+
+
+void targaUnmapFile(void* data, size_t size)
+{
+
+#ifdef TGA_MMAP
+    munmap(data, size);
+#else
+    (void)size;
+    free(data);
+#endif
+
+}
+
+
+/*
+ * Load fileName counting into stats, begun by the caller, who also times
+ * the whole load and ends them.
+ */
+static int targaLoadFile(
+        const char*                 fileName,
+        const TARGA_LOAD_OPTIONS*   options,
+        uint8_t*                    buffer,
+        size_t                      bufferSize,
+        TARGA_STATS*                stats,
+        TARGA_IMAGE*                image)
+{
+
+    TGA_READER reader = {0};
+    uint64_t mark = stats ? targaNanoseconds() : 0;
+    int result;
+
+    memset(image, 0, sizeof(*image));
+    reader.stats = stats;
+
+    if (options && (options->flags & TARGA_LOAD_MAPPED))
+    {
+        void*  mapping;
+        size_t mappingSize;
+
+        result = targaMapFile(fileName, &mapping, &mappingSize);
+        TGA_STATS_PHASE(stats, openNs, mark);
+        if (result != TARGA_OK)
+            return result;
+
+        reader.data = mapping;
+        reader.size = mappingSize;
+
+        result = targaDecode(&reader, options, 1, buffer, bufferSize, image);
+        if (stats)
+            stats->bytesRead += reader.pos;
+
+        if (result == TARGA_OK && image->pixels != buffer && !image->memory)
+        {
+            /* the image keeps the mapping alive */
+            image->memory     = mapping;
+            image->memorySize = mappingSize;
+            image->mapped     = 1;
+        }
+        else
+        {
+            targaUnmapFile(mapping, mappingSize);
+        }
+
+        return result;
+    }
+
+    reader.file = fopen(fileName, "rb");
+    TGA_STATS_PHASE(stats, openNs, mark);
+    if (!reader.file)
+        return TARGA_ERR_OPEN;
+
+#ifdef TARGA_HAVE_PTHREAD
+    TGA_PIPE pipe;
+
+    /* without a reader thread the file is read on this one */
+    if (options && (options->flags & TARGA_LOAD_PIPELINED) &&
+        targaPipeStart(&pipe, reader.file) == TARGA_OK)
+        reader.pipe = &pipe;
+#endif
+
+    result = targaDecode(&reader, options, 0, buffer, bufferSize, image);
+
+#ifdef TARGA_HAVE_PTHREAD
+    if (reader.pipe)
+    {
+        targaPipeStop(&pipe);
+
+        if (stats)
+        {
+            stats->readCalls   += pipe.readCalls;
+            stats->bytesRead   += pipe.bytesRead;
+            stats->allocations += 1;
+        }
+    }
+#endif
+
+    free(reader.block);
+    fclose(reader.file);
+    return result;
+
+}
+
+
+int targaLoadImage(
+        const char*                 fileName,
+        const TARGA_LOAD_OPTIONS*   options,
+        TARGA_IMAGE*                image)
+{
+
+    TARGA_STATS local;
+    TARGA_STATS* stats = targaStatsBegin(options, &local);
+    uint64_t start = stats ? targaNanoseconds() : 0;
+    uint64_t mark = start;
+    TGA_FILE_ID id;
+    int result;
+
+    memset(image, 0, sizeof(*image));
+
+    /* looking up and storing the sidecar count as opening the file */
+    if (options && options->cacheDir)
+    {
+        result = targaSidecarLoad(fileName, options, &id, stats, image);
+        TGA_STATS_PHASE(stats, openNs, mark);
+        if (result == TARGA_OK)
+        {
+            TGA_STATS_PHASE(stats, totalNs, start);
+            return targaStatsEnd(stats, TARGA_OK);
+        }
+    }
+
+    result = targaLoadFile(fileName, options, NULL, 0, stats, image);
+
+    /* id is left zero when the source could not be looked up */
+    if (result == TARGA_OK && options && options->cacheDir && id.size)
+    {
+        if (stats)
+            mark = targaNanoseconds();
+        targaSidecarStore(fileName, options, &id, stats, image);
+        TGA_STATS_PHASE(stats, openNs, mark);
+    }
+
+    TGA_STATS_PHASE(stats, totalNs, start);
+    return targaStatsEnd(stats, result);
+
+}
+
+
+int targaLoadInto(
+        const char*                 fileName,
+        const TARGA_LOAD_OPTIONS*   options,
+        void*                       buffer,
+        size_t                      bufferSize,
+        TARGA_IMAGE*                image)
+{
+
+    if (!buffer)
+        return TARGA_ERR_ARGUMENT;
+
+    TARGA_STATS local;
+    TARGA_STATS* stats = targaStatsBegin(options, &local);
+    uint64_t start = stats ? targaNanoseconds() : 0;
+
+    int result = targaLoadFile(fileName, options, buffer, bufferSize, stats, image);
+
+    TGA_STATS_PHASE(stats, totalNs, start);
+    return targaStatsEnd(stats, result);
+
+}
+
+
+int targaLoadMemory(
+        const void*                 data,
+        size_t                      size,
+        const TARGA_LOAD_OPTIONS*   options,
+        TARGA_IMAGE*                image)
+{
+
+    TGA_READER reader = {0};
+    TARGA_STATS local;
+    TARGA_STATS* stats = targaStatsBegin(options, &local);
+    uint64_t start = stats ? targaNanoseconds() : 0;
+
+    memset(image, 0, sizeof(*image));
+
+    reader.data  = data;
+    reader.size  = size;
+    reader.stats = stats;
+
+    int result = targaDecode(&reader, options, 0, NULL, 0, image);
+
+    if (stats)
+        stats->bytesRead += reader.pos;
+
+    TGA_STATS_PHASE(stats, totalNs, start);
+    return targaStatsEnd(stats, result);
+
+}
+
+
+int targaQueryImage(
+        const char*                 fileName,
+        const TARGA_LOAD_OPTIONS*   options,
+        TARGA_IMAGE*                image,
+        size_t*                     size)
+{
+
+    uint8_t buf[TGA_HEADER_SIZE];
+    TGA_FILE_HEADER TGA_header;
+    TGA_CONVERTER converter;
+    int rle;
+
+    memset(image, 0, sizeof(*image));
+
+    FILE* file = fopen(fileName, "rb");
+    if (!file)
+        return TARGA_ERR_OPEN;
+
+    size_t got = fread(buf, 1, TGA_HEADER_SIZE, file);
+    fclose(file);
+
+    if (got != TGA_HEADER_SIZE)
+        return TARGA_ERR_READ;
+
+    targaParseHeader(buf, &TGA_header);
+
+    int result = targaPrepare(&TGA_header, options, &converter, &rle, image);
+    if (result != TARGA_OK)
+        return result;
+
+    *size = targaImageSize(image);
+    return TARGA_OK;
+
+}
+
+
+void targaImageFree(TARGA_IMAGE* image)
+{
+
+    if (image->mapped)
+        targaUnmapFile(image->memory, image->memorySize);
+    else
+        free(image->memory);
+
+    memset(image, 0, sizeof(*image));
+
+}
+
+
+/*
+ * Batch loading
+ *
+ * The items are started largest first (by pixel count, read from the
+ * headers) so that the long decodes do not end up last on a single
+ * worker; the pool steals the rest of the imbalance.
+ */
+typedef struct {
+    TARGA_BATCH_ITEM*           items;
+    const TARGA_LOAD_OPTIONS*   options;
+} TGA_BATCH;
+
+
+typedef struct {
+    uint64_t    cost;
+    size_t      index;
+} TGA_BATCH_ORDER;
+
+
+static void targaBatchTask(void* context, size_t index)
+{
+
+    TGA_BATCH* batch = context;
+    TARGA_BATCH_ITEM* item = &batch->items[index];
+    const TARGA_LOAD_OPTIONS* options = batch->options;
+    TARGA_LOAD_OPTIONS counted;
+    TARGA_STATS stats;
+
+    /* the items count apart, then add up into the batch statistics */
+    if (options && options->stats)
+    {
+        counted = *options;
+        counted.stats = &stats;
+        options = &counted;
+    }
+
+    if (item->fileName)
+        item->status = targaLoadImage(item->fileName, options, &item->image);
     else
-        TGA_pixsize = TGA_imgAttribNum / 8 + 3;
+        item->status = targaLoadMemory(item->data, item->size, options, &item->image);
+
+    if (options == &counted)
+        targaStatsAdd(batch->options->stats, &stats);
+
+}
+
+
+static int targaCompareCost(const void* a, const void* b)
+{
+
+    const TGA_BATCH_ORDER* orderA = a;
+    const TGA_BATCH_ORDER* orderB = b;
+
+    if (orderA->cost != orderB->cost)
+        return orderA->cost < orderB->cost ? 1 : -1;
+
+    /* equal costs keep the item order */
+    return orderA->index < orderB->index ? -1 : 1;
+
+}
+
+
+int targaLoadBatch(
+        TARGA_POOL*                 pool,
+        TARGA_BATCH_ITEM*           items,
+        size_t                      count,
+        const TARGA_LOAD_OPTIONS*   options)
+{
+
+    TGA_BATCH batch = { items, options };
+    TGA_BATCH_ORDER* sorted;
+    TARGA_POOL* own = NULL;
+    size_t* order;
+    size_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        memset(&items[i].image, 0, sizeof(items[i].image));
+        items[i].status = TARGA_ERR_NO_MEMORY;
+    }
+
+    if (options && options->stats)
+        memset(options->stats, 0, sizeof(TARGA_STATS));
+
+    if (count == 0)
+        return TARGA_OK;
+
+    sorted = malloc(sizeof(TGA_BATCH_ORDER) * count);
+    order  = malloc(sizeof(size_t) * count);
+    if (!pool)
+        own = pool = targaPoolCreate(0, 0);
+
+    if (!sorted || !order || !pool)
+    {
+        free(sorted);
+        free(order);
+        targaPoolDestroy(own);
+        return TARGA_ERR_NO_MEMORY;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        TARGA_INFO info;
+        int probed = items[i].fileName
+            ? targaProbe(items[i].fileName, 0, &info)
+            : targaProbeMemory(items[i].data, items[i].size, 0, &info);
+
+        sorted[i].cost  = probed == TARGA_OK
+            ? (uint64_t)info.width * info.height
+            : 0;
+        sorted[i].index = i;
+    }
+
+    qsort(sorted, count, sizeof(TGA_BATCH_ORDER), targaCompareCost);
+
+    for (i = 0; i < count; i++)
+        order[i] = sorted[i].index;
+    free(sorted);
+
+    targaPoolRun(pool, count, order, targaBatchTask, &batch);
+
+    free(order);
+    targaPoolDestroy(own);
+
+    for (i = 0; i < count; i++)
+    {
+        if (items[i].status != TARGA_OK)
+            return items[i].status;
+    }
+
+    return TARGA_OK;
+
+}
+
+
+void* targaLoad(
+        const char* fileName,
+        int* status,
+        unsigned int* width,
+        unsigned int* height)
+{
 
-    printf("will have %d bits attributes per pixels\n", TGA_imgAttribNum);
-    printf("will have %d screen origin bit\n", TGA_imgScrOriginBit);
-    printf("will have %d interleaving\n", TGA_imgInterleaving);
-    printf("will have %d pix size\n", TGA_pixsize);
-    printf("will have %d pix depth\n", TGA_header.imageSpec.pixelDepth);
-    printf("sizeof map spec %zu \n",sizeof(TGA_COLOR_MAP_SPEC));
-    printf("sizeof image spec %zu \n",sizeof(TGA_H_IMAGE_SPEC));
-    printf("sizeof file header spec %zu \n",sizeof(TGA_FILE_HEADER));
+    TARGA_IMAGE image;
 
-    */
+    *status = targaLoadImage(fileName, NULL, &image);
+    if (*status != TARGA_OK)
+        return NULL;
 
-    if (TGA_file != NULL)
-        fclose(TGA_file);
+    *width  = image.width;
+    *height = image.height;
 
-    return texture;
+    return image.pixels;
 
 }
 
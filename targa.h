@@ -35,12 +35,718 @@
 extern "C" {
 #endif // __cplusplus
 
+/*
+ * Status codes
+ */
+#define TARGA_PENDING            1  /* more input is needed */
+#define TARGA_OK                 0
+#define TARGA_ERR_OPEN          -1  /* the file could not be opened */
+#define TARGA_ERR_READ          -2  /* read error or truncated image data */
+#define TARGA_ERR_FORMAT        -3  /* malformed header */
+#define TARGA_ERR_UNSUPPORTED   -4  /* image type or depth not handled yet */
+#define TARGA_ERR_NO_MEMORY     -5
+#define TARGA_ERR_ARGUMENT      -6  /* bad option, buffer too small or misaligned */
+#define TARGA_ERR_WRITE         -7  /* the file could not be written */
+
+/*
+ * Output pixel formats, 8 bits per channel, packed pixels
+ */
+#define TARGA_FORMAT_AUTO        0  /* RGB, or RGBA when the image has alpha */
+#define TARGA_FORMAT_RGB8        1
+#define TARGA_FORMAT_RGBA8       2
+#define TARGA_FORMAT_BGR8        3  /* 24 bits TGA layout */
+#define TARGA_FORMAT_BGRA8       4  /* 32 bits TGA layout */
+#define TARGA_FORMAT_GRAY8       5  /* luma, alpha dropped */
+#define TARGA_FORMAT_RGBA8_PREMULTIPLIED 6  /* color multiplied by alpha */
+#define TARGA_FORMAT_RGBA8_KEYED 7  /* RGBA, alpha 0 where the color is the key */
+#define TARGA_FORMAT_INDEX8      8  /* color map indices, written with a palette */
+
+/*
+ * Block compressed output formats, rows of 4x4 pixels blocks (loads only)
+ */
+#define TARGA_FORMAT_BC1         9  /* RGB, 8 bytes blocks, alpha dropped */
+#define TARGA_FORMAT_BC3        10  /* RGBA, 16 bytes blocks */
+#define TARGA_FORMAT_BC4        11  /* red (gray) only, 8 bytes blocks */
+#define TARGA_FORMAT_BC5        12  /* red and green, 16 bytes blocks */
+#define TARGA_FORMAT_BC7        13  /* RGBA, 16 bytes blocks, mode 6 only: fast rather than best */
+
+/*
+ * Screen origin, image descriptor bits 4 and 5
+ */
+#define TARGA_ORIGIN_BOTTOM_LEFT  0x00
+#define TARGA_ORIGIN_BOTTOM_RIGHT 0x10
+#define TARGA_ORIGIN_TOP_LEFT     0x20
+#define TARGA_ORIGIN_TOP_RIGHT    0x30
+
+/*
+ * Load flags
+ */
+#define TARGA_LOAD_MAPPED        0x1  /* mmap the file instead of reading it */
+#define TARGA_LOAD_TOP_LEFT      0x2  /* first row at the top, whatever the file origin */
+#define TARGA_LOAD_BOTTOM_LEFT   0x4  /* first row at the bottom (OpenGL) */
+#define TARGA_LOAD_PIPELINED     0x8  /* read on a thread while decoding, for large files */
+#define TARGA_LOAD_MIPMAPS       0x10 /* also build the mip chain, see targaImageLevel() */
+#define TARGA_LOAD_SRGB          0x20 /* color is sRGB: mip levels are filtered in linear light */
+
+/*
+ * Mip filters
+ */
+#define TARGA_MIP_BOX            0  /* mean of the pixels covered */
+#define TARGA_MIP_KAISER         1  /* Kaiser windowed sinc, sharper */
+#define TARGA_MIP_LANCZOS        2  /* Lanczos 3, sharpest, may ring */
+
+
+/**
+ * A rectangle of pixels, x and y from the first pixel of the image.
+ */
+typedef struct {
+    unsigned int x;
+    unsigned int y;
+    unsigned int width;
+    unsigned int height;
+} TARGA_RECT;
+
+
+/**
+ * Load statistics. Every field is a uint64_t counter, times are
+ * nanoseconds of a monotonic clock. The phases are nested in totalNs and
+ * readNs is the part of them spent in read calls, or with
+ * TARGA_LOAD_PIPELINED waiting for the reader thread. RLE expansion and
+ * conversion run in the same loop, both are in pixelsNs.
+ */
+typedef struct {
+    uint64_t     loads;         /* 1 for a load, loads seen by the aggregate */
+    uint64_t     failures;
+    uint64_t     bytesRead;     /* file bytes read, or consumed from memory */
+    uint64_t     readCalls;     /* read calls, 0 for memory and mappings */
+    uint64_t     runPackets;    /* RLE packets */
+    uint64_t     rawPackets;
+    uint64_t     pixels;        /* pixels written */
+    uint64_t     allocations;
+
+    uint64_t     openNs;        /* opening or mapping the file */
+    uint64_t     headerNs;      /* header and image id */
+    uint64_t     colorMapNs;    /* color map, or the 16 bits table */
+    uint64_t     pixelsNs;      /* pixel decoding */
+    uint64_t     readNs;
+    uint64_t     totalNs;
+} TARGA_STATS;
+
+
+typedef struct {
+    unsigned int format;        /* TARGA_FORMAT_* */
+    unsigned int flags;         /* TARGA_LOAD_* */
+    unsigned int threads;       /* RLE decode or block encode threads, 0 or 1 is serial */
+    size_t       pitch;         /* bytes between rows (of blocks), 0 for packed rows */
+    size_t       alignment;     /* row alignment, a power of two, 0 for none */
+    uint32_t     colorKey;      /* 0xRRGGBB, TARGA_FORMAT_RGBA8_KEYED only */
+    TARGA_RECT   region;        /* part of the image to decode, empty for all */
+    TARGA_STATS* stats;         /* filled by the load, NULL for none */
+    const char*  cacheDir;      /* decoded copies are kept there, NULL for none */
+    unsigned int mipFilter;     /* TARGA_MIP_*, with TARGA_LOAD_MIPMAPS */
+} TARGA_LOAD_OPTIONS;
+
+
+/**
+ * Process-wide aggregate of the load statistics, off by default: once
+ * enabled every load adds its statistics to it, whether it was given
+ * options->stats or not. Loads pay nothing for statistics while the
+ * aggregate is off and they have no options->stats.
+ */
+void targaStatsEnable(int enable);
+
+/**
+ * Copy the aggregate into stats. The fields are read one by one, loads
+ * running meanwhile may be counted in some of them only.
+ */
+void targaStatsGlobal(TARGA_STATS* stats);
+
+void targaStatsReset(void);
+
+
+/**
+ * A decoded image. Release it with targaImageFree().
+ */
+typedef struct {
+    unsigned int width;
+    unsigned int height;
+    unsigned int format;        /* TARGA_FORMAT_* */
+    unsigned int origin;        /* TARGA_ORIGIN_*, corner of the first pixel */
+    size_t       pitch;         /* bytes between two rows, of blocks for BC formats */
+    uint8_t*     pixels;
+
+    int          mapped;        /* pixels point into a mapping of the file */
+    void*        memory;        /* allocation or mapping owning the pixels */
+    size_t       memorySize;
+
+    unsigned int levels;        /* mip levels, 1 without TARGA_LOAD_MIPMAPS */
+} TARGA_IMAGE;
+
+
+
+/**
+ * Load a TGA image.
+ *
+ * 16 and 24 bits true color images and 8 bits grayscale images are
+ * returned as packed RGB, 32 bits images, 16 bits images with an alpha bit
+ * (1 attribute bit in the descriptor) and 16 bits grayscale (gray and
+ * alpha) images as packed RGBA, rows in file order. The returned buffer must be
+ * released with free(). On failure NULL is returned and status is set to
+ * one of the TARGA_ERR_* codes.
+ */
 void* targaLoad(
         const char* fileName,
         int* status,
         unsigned int* width,
         unsigned int* height);
 
+/**
+ * Load a TGA image into image, with options (NULL for defaults).
+ *
+ * With TARGA_LOAD_MAPPED the file is mapped and decoded from the mapped
+ * pages. If the requested format is the file layout (TARGA_FORMAT_BGR8 for
+ * a 24 bits image, TARGA_FORMAT_BGRA8 for 32 bits) image->pixels is a copy
+ * on write view of the mapping and no pixel is copied.
+ *
+ * With TARGA_LOAD_PIPELINED (and without TARGA_LOAD_MAPPED) a thread reads
+ * the file by chunks of 1 MB, up to 4 ahead, while the calling thread
+ * decodes. It pays off for large images on storage with real latency;
+ * without thread support the flag is ignored.
+ *
+ * Color mapped images (8 or 16 bits indices) are looked up in their color
+ * map, TARGA_FORMAT_AUTO giving RGBA for 32 bits entries and RGB for the
+ * others; indices outside of the map give zero pixels. TARGA_FORMAT_INDEX8
+ * returns the 8 bits indices themselves.
+ *
+ * Files without image data (type 0, a header alone) give an empty image:
+ * width and height 0, whatever the header announces.
+ *
+ * Rows and pixels are stored in file order, image->origin telling which
+ * corner comes first. TARGA_LOAD_TOP_LEFT or TARGA_LOAD_BOTTOM_LEFT put
+ * them in that order instead, as they are decoded.
+ *
+ * With options->region only that rectangle of the image (as it would be
+ * returned, origin included) is decoded and returned: uncompressed files
+ * seek past the other pixels, RLE packets outside of it are skipped
+ * without being expanded and reading stops after its last row.
+ *
+ * With TARGA_LOAD_MIPMAPS the whole mip chain, down to 1x1, follows the
+ * image in the same allocation (image->levels levels, see
+ * targaImageLevel()). Each level halves the one above, rounding down,
+ * with options->mipFilter; odd sizes are filtered over the three pixels
+ * each one covers rather than dropping one. The first level is built from
+ * the rows as they are decoded, the next ones as soon as enough rows of
+ * the level above are done. With TARGA_LOAD_SRGB the color channels are
+ * averaged in linear light, alpha as it is. TARGA_FORMAT_INDEX8 has no
+ * mip chain.
+ *
+ * The block formats (TARGA_FORMAT_BC1 to TARGA_FORMAT_BC7) decode the
+ * image to RGBA8 by bands of 4 rows and encode each band into a row of
+ * blocks as soon as it is decoded: no more than a band of pixels is held,
+ * or with options->threads > 1 a slab of 32 bands encoded in parallel.
+ * Blocks over the right and bottom edges repeat the last column and row.
+ * They have no mip chain and neither the push decoder nor the
+ * asynchronous loader produce them.
+ *
+ * With options->cacheDir (an existing directory) the decoded image is
+ * written there once, in a raw layout; later loads of the same file with
+ * the same options map that copy and return its pixels without decoding,
+ * image->mapped set. Changing the source invalidates its copy: a file of
+ * another size or whose bytes differ is decoded and stored again. Failing
+ * to write the copy does not fail the load.
+ *
+ * Return TARGA_OK or one of the TARGA_ERR_* codes.
+ */
+int targaLoadImage(
+        const char* fileName,
+        const TARGA_LOAD_OPTIONS* options,
+        TARGA_IMAGE* image);
+
+/**
+ * Decode into a caller supplied buffer of bufferSize bytes, at least the
+ * size reported by targaQueryImage(). Without mip chain the last row only
+ * needs its pixels, not the whole pitch: with options->pitch the buffer
+ * can be a rectangle of a larger image. With options->alignment the
+ * buffer must be aligned on it. The image does not own the buffer.
+ */
+int targaLoadInto(
+        const char* fileName,
+        const TARGA_LOAD_OPTIONS* options,
+        void* buffer,
+        size_t bufferSize,
+        TARGA_IMAGE* image);
+
+/**
+ * Same as targaLoadImage() on a file held in memory. The pixels are always
+ * copied out of data, TARGA_LOAD_MAPPED and TARGA_LOAD_PIPELINED are
+ * ignored.
+ */
+int targaLoadMemory(
+        const void*                 data,
+        size_t                      size,
+        const TARGA_LOAD_OPTIONS*   options,
+        TARGA_IMAGE*                image);
+
+/**
+ * Read the header only and report the geometry, format and pitch the
+ * image would get with options (pixels stays NULL), and the size of the
+ * buffer needed to hold it, mip chain included.
+ */
+int targaQueryImage(
+        const char* fileName,
+        const TARGA_LOAD_OPTIONS* options,
+        TARGA_IMAGE* image,
+        size_t* size);
+
+/**
+ * Release the pixels of an image loaded by targaLoadImage().
+ */
+void targaImageFree(TARGA_IMAGE* image);
+
+/**
+ * Fill view with mip level level of image (0 is the image itself): its
+ * size, pitch (packed rows but for level 0) and pixels, owned by image.
+ * Levels start 16 bytes aligned from image->pixels. Return
+ * TARGA_ERR_ARGUMENT if image has no such level.
+ */
+int targaImageLevel(const TARGA_IMAGE* image, unsigned int level, TARGA_IMAGE* view);
+
+/*
+ * Writer
+ *
+ * Images are written as true color (types 2 and 10, 24 or 32 bits from
+ * the RGB and BGR formats), grayscale (types 3 and 11, TARGA_FORMAT_GRAY8)
+ * or color mapped (types 1 and 9, TARGA_FORMAT_INDEX8 with a palette).
+ * Rows are written in the order of image->pixels and image->origin is
+ * stored in the header.
+ *
+ * With threads, bands of rows are RLE encoded in parallel into separate
+ * buffers, written to the file with a single gathered write.
+ */
+#define TARGA_WRITE_RLE            0x1  /* run-length encode, packets never cross rows */
+#define TARGA_WRITE_FOOTER         0x2  /* TGA 2.0 extension area and footer */
+#define TARGA_WRITE_SCANLINE_TABLE 0x4  /* and a scan line offset table */
+#define TARGA_WRITE_STAMP          0x8  /* and a postage stamp, see targaLoadThumbnail() */
+
+#define TARGA_STAMP_SIZE          64    /* largest side of the stamps written */
+
+
+typedef struct {
+    unsigned int   flags;           /* TARGA_WRITE_* */
+    const uint8_t* palette;         /* TARGA_FORMAT_INDEX8 images */
+    unsigned int   paletteFormat;   /* RGB8, RGBA8, BGR8 or BGRA8 */
+    unsigned int   paletteSize;     /* entries, 1 to 256 */
+    unsigned int   threads;         /* RLE encode threads, 0 or 1 is serial */
+} TARGA_WRITE_OPTIONS;
+
+
+/**
+ * Write image to fileName with options (NULL for an uncompressed file
+ * without footer). Return TARGA_OK or one of the TARGA_ERR_* codes.
+ */
+int targaWriteImage(
+        const char*                 fileName,
+        const TARGA_IMAGE*          image,
+        const TARGA_WRITE_OPTIONS*  options);
+
+/**
+ * Same as targaWriteImage() into memory: *data receives the file, to be
+ * released with free(), and *size its size.
+ */
+int targaWriteMemory(
+        const TARGA_IMAGE*          image,
+        const TARGA_WRITE_OPTIONS*  options,
+        void**                      data,
+        size_t*                     size);
+
+/*
+ * Thread pool
+ *
+ * A set of worker threads, each with its own queue of tasks, that steal
+ * from each other once their queue is empty. Without thread support the
+ * pool runs every task on the calling thread.
+ */
+typedef struct TARGA_POOL TARGA_POOL;
+
+#define TARGA_POOL_PIN           0x1  /* pin worker i to CPU i, Linux only */
+
+/**
+ * Create a pool of threads workers, 0 for one per online CPU. Return NULL
+ * if no thread could be started.
+ */
+TARGA_POOL* targaPoolCreate(unsigned int threads, unsigned int flags);
+
+unsigned int targaPoolThreads(const TARGA_POOL* pool);
+
+void targaPoolDestroy(TARGA_POOL* pool);
+
+/**
+ * One image of a batch: a file name, or when fileName is NULL a file held
+ * in memory (data, size). image and status receive the result.
+ */
+typedef struct {
+    const char*  fileName;
+    const void*  data;
+    size_t       size;
+
+    TARGA_IMAGE  image;
+    int          status;
+} TARGA_BATCH_ITEM;
+
+/**
+ * Load count images concurrently on pool (NULL for a temporary pool of
+ * one thread per CPU), with options (NULL for defaults). The largest
+ * images are started first. Every item gets its own status and image,
+ * the items that failed have no pixels. options->stats receives the sum
+ * of the statistics of the items. Return TARGA_OK if every image loaded,
+ * else the status of the first item that failed.
+ */
+int targaLoadBatch(
+        TARGA_POOL*                 pool,
+        TARGA_BATCH_ITEM*           items,
+        size_t                      count,
+        const TARGA_LOAD_OPTIONS*   options);
+
+/*
+ * Texture atlas
+ *
+ * Many small images packed into one. The sizes are read from the headers
+ * only, the images packed by a skyline packer (tallest first, each at the
+ * lowest place it fits) and decoded in parallel straight into their place
+ * in the atlas: no image is allocated on its own.
+ */
+#define TARGA_ATLAS_TRIM         0x1  /* cut the fully transparent borders */
+
+
+typedef struct {
+    unsigned int format;        /* TARGA_FORMAT_*, AUTO gives RGBA8 */
+    unsigned int flags;         /* TARGA_ATLAS_* */
+    unsigned int padding;       /* empty pixels around every image */
+    unsigned int maxWidth;      /* widest atlas, 0 for 16384 */
+} TARGA_ATLAS_OPTIONS;
+
+/**
+ * One image of an atlas. rect receives its pixels in the atlas, empty if
+ * it failed or was fully transparent, and (trimX, trimY) the position of
+ * rect in the image, width and height being its size before trimming.
+ */
+typedef struct {
+    const char*  fileName;
+
+    TARGA_RECT   rect;
+    unsigned int trimX;
+    unsigned int trimY;
+    unsigned int width;
+    unsigned int height;
+    int          status;
+} TARGA_ATLAS_ITEM;
+
+/**
+ * Pack the count images of items into atlas, top left origin, on pool
+ * (NULL for a temporary pool of one thread per CPU), with options (NULL
+ * for defaults). The atlas is as narrow as it can be among the powers of
+ * two up to options->maxWidth for the smallest area, as high as needed
+ * (at most 65535); the pixels between images are zero. Trimming decodes
+ * the images that may have alpha twice: once to find their borders, once
+ * into the atlas. Release the atlas with targaImageFree(). Return
+ * TARGA_OK if every image was placed, else the status of the first item
+ * that failed; the others are in the atlas all the same.
+ */
+int targaAtlasBuild(
+        TARGA_POOL*                 pool,
+        TARGA_ATLAS_ITEM*           items,
+        size_t                      count,
+        const TARGA_ATLAS_OPTIONS*  options,
+        TARGA_IMAGE*                atlas);
+
+/*
+ * Probe flags
+ */
+#define TARGA_PROBE_EXTENSION    0x1  /* also read the TGA 2.0 footer and extension area */
+
+
+/**
+ * Header fields of a TGA file, as returned by the probe functions.
+ */
+typedef struct {
+    unsigned int width;
+    unsigned int height;
+    unsigned int imageType;         /* 0, 1, 2, 3, 9, 10 or 11 */
+    unsigned int pixelDepth;        /* bits per pixel */
+    unsigned int alphaBits;         /* attribute bits per pixel */
+    unsigned int origin;            /* TARGA_ORIGIN_* */
+    unsigned int xOrigin;
+    unsigned int yOrigin;
+    unsigned int idLength;
+    unsigned int colorMapType;      /* 1 if the file has a color map */
+    unsigned int colorMapFirst;     /* index of the first color map entry */
+    unsigned int colorMapLength;
+    unsigned int colorMapEntrySize; /* bits per color map entry */
+    uint32_t     dataOffset;        /* file offset of the pixel data */
+
+    /* TARGA_PROBE_EXTENSION only, 0 when absent */
+    unsigned int version;           /* 2 if the file has a TGA 2.0 footer */
+    uint32_t     extensionOffset;
+    uint32_t     developerOffset;
+    uint32_t     keyColor;          /* A:R:G:B */
+    uint32_t     stampOffset;       /* postage stamp */
+    uint32_t     scanLineOffset;    /* scan line table */
+    unsigned int attributesType;    /* meaning of the alpha bits */
+} TARGA_INFO;
+
+/**
+ * Read the header of a file (and its footer with TARGA_PROBE_EXTENSION)
+ * without decoding any pixel: one small read, or three with the footer.
+ */
+int targaProbe(const char* fileName, unsigned int flags, TARGA_INFO* info);
+
+/**
+ * Same as targaProbe() on an open file descriptor, read with pread() so
+ * the file offset is left untouched. POSIX only.
+ */
+int targaProbeFd(int fd, unsigned int flags, TARGA_INFO* info);
+
+/**
+ * Same as targaProbe() on a file held in memory.
+ */
+int targaProbeMemory(
+        const void* data,
+        size_t size,
+        unsigned int flags,
+        TARGA_INFO* info);
+
+/**
+ * Load a preview of fileName no larger than maxSize pixels on either side
+ * (0 for TARGA_STAMP_SIZE), with the format, origin flags and color key
+ * of options (NULL for defaults); the other options are ignored and the
+ * block formats are rejected.
+ *
+ * The postage stamp of the TGA 2.0 extension area is returned when the
+ * file has one, decimated further if it is larger than maxSize. Otherwise
+ * the image is decimated: the middle pixel of every step x step square is
+ * kept, step the smallest for the preview to fit. The file is mapped and
+ * only the pixels kept are read, so stamps and uncompressed images cost
+ * the same whatever their size. The rows of RLE images are found through
+ * the scan line table when the file has one, else by walking the packet
+ * headers, raw packets jumped over without reading their pixels.
+ *
+ * Return TARGA_OK or one of the TARGA_ERR_* codes.
+ */
+int targaLoadThumbnail(
+        const char*                 fileName,
+        unsigned int                maxSize,
+        const TARGA_LOAD_OPTIONS*   options,
+        TARGA_IMAGE*                image);
+
+/**
+ * Same as targaLoadThumbnail() on a file held in memory.
+ */
+int targaLoadThumbnailMemory(
+        const void*                 data,
+        size_t                      size,
+        unsigned int                maxSize,
+        const TARGA_LOAD_OPTIONS*   options,
+        TARGA_IMAGE*                image);
+
+/*
+ * Image cache
+ *
+ * Decoded images shared by every thread of the process, keyed by path and
+ * load options and checked against the file device, inode, size and
+ * modification time on every request. Concurrent requests for an image
+ * not in the cache load it once. Unused images are evicted, least
+ * recently used first, once the cache holds more than its budget.
+ *
+ *     const TARGA_IMAGE* image;
+ *
+ *     if (targaCacheGet(cache, "grass.tga", &options, &image) == TARGA_OK) {
+ *         draw(image);
+ *         targaCacheRelease(cache, image);
+ *     }
+ */
+typedef struct TARGA_CACHE TARGA_CACHE;
+
+
+typedef struct {
+    uint64_t     hits;
+    uint64_t     misses;        /* loads */
+    uint64_t     waits;         /* requests that waited for a load in progress */
+    uint64_t     evictions;
+    uint64_t     stale;         /* entries dropped because their file changed */
+    uint64_t     entries;
+    uint64_t     bytes;         /* pixel bytes of the entries */
+} TARGA_CACHE_STATS;
+
+
+/**
+ * Create a cache keeping up to budget bytes of pixels, more while the
+ * images in use exceed it. Return NULL if out of memory.
+ */
+TARGA_CACHE* targaCacheCreate(size_t budget);
+
+/**
+ * Return in *image the image of fileName decoded with options (NULL for
+ * defaults), loading it if it is not cached yet. The image stays valid
+ * until it is handed back with targaCacheRelease(). Only the options
+ * changing the pixels tell entries apart: format, origin flags, pitch,
+ * alignment, color key and region. Return TARGA_OK or one of the
+ * TARGA_ERR_* codes, failed loads are not cached.
+ */
+int targaCacheGet(
+        TARGA_CACHE*                cache,
+        const char*                 fileName,
+        const TARGA_LOAD_OPTIONS*   options,
+        const TARGA_IMAGE**         image);
+
+void targaCacheRelease(TARGA_CACHE* cache, const TARGA_IMAGE* image);
+
+void targaCacheStats(TARGA_CACHE* cache, TARGA_CACHE_STATS* stats);
+
+/**
+ * Release the cache and its images, none of which may be in use.
+ */
+void targaCacheDestroy(TARGA_CACHE* cache);
+
+/*
+ * Asynchronous loading
+ *
+ * Many files are loaded from one thread: on Linux their reads go through
+ * io_uring, several chunks in flight, and each chunk is decoded as soon as
+ * it arrives, by the thread calling targaAsyncWait(). Where io_uring is
+ * not available a few threads run blocking loads instead.
+ *
+ *     TARGA_ASYNC* async = targaAsyncCreate(0, 0);
+ *
+ *     for (i = 0; i < count; i++)
+ *         targaAsyncSubmit(async, fileNames[i], &options, &textures[i]);
+ *
+ *     while (targaAsyncPending(async)) {
+ *         n = targaAsyncWait(async, results, 16);
+ *         for (i = 0; i < n; i++)
+ *             upload(results[i].user, results[i].status, &results[i].image);
+ *     }
+ *
+ *     targaAsyncDestroy(async);
+ */
+typedef struct TARGA_ASYNC TARGA_ASYNC;
+
+#define TARGA_ASYNC_URING        1  /* backends */
+#define TARGA_ASYNC_THREADS      2
+
+#define TARGA_ASYNC_NO_URING     0x1  /* use the threads, even with io_uring */
+
+
+typedef struct {
+    void*        user;          /* as submitted */
+    int          status;
+    TARGA_IMAGE  image;         /* no pixels on failure, release it with targaImageFree() */
+} TARGA_ASYNC_RESULT;
+
+
+/**
+ * Create a loader keeping up to depth files in flight (0 for 8). Return
+ * NULL if out of memory.
+ */
+TARGA_ASYNC* targaAsyncCreate(unsigned int depth, unsigned int flags);
+
+/**
+ * TARGA_ASYNC_URING or TARGA_ASYNC_THREADS.
+ */
+int targaAsyncBackend(const TARGA_ASYNC* async);
+
+/**
+ * Queue the load of fileName with options (NULL for defaults), as for
+ * targaDecoderCreate(): the threads and region options,
+ * TARGA_LOAD_MAPPED and TARGA_LOAD_PIPELINED are ignored. Its result
+ * carries user.
+ */
+int targaAsyncSubmit(
+        TARGA_ASYNC*                async,
+        const char*                 fileName,
+        const TARGA_LOAD_OPTIONS*   options,
+        void*                       user);
+
+/**
+ * Number of loads submitted whose result was not returned yet.
+ */
+size_t targaAsyncPending(const TARGA_ASYNC* async);
+
+/**
+ * Wait until at least one load completed, run the loads meanwhile, and
+ * store up to max results. Return their count, 0 when nothing is pending.
+ */
+size_t targaAsyncWait(TARGA_ASYNC* async, TARGA_ASYNC_RESULT* results, size_t max);
+
+/**
+ * Cancel the loads still pending, release their images and the loader.
+ */
+void targaAsyncDestroy(TARGA_ASYNC* async);
+
+/*
+ * Push decoder
+ *
+ * For images arriving in pieces (sockets, pipes): bytes are fed as they
+ * come and decoded rows pulled as soon as they are complete. The decoder
+ * only holds the header, one row and the packet being decoded.
+ *
+ *     TARGA_DECODER* decoder = targaDecoderCreate(NULL);
+ *
+ *     while ((size = receive(buffer)) > 0) {
+ *         size_t used = 0;
+ *         while (used < size && status == TARGA_OK) {
+ *             used += targaDecoderFeed(decoder, buffer + used, size - used, &status);
+ *             while ((row = targaDecoderRow(decoder, &y)))
+ *                 consume(row, y);
+ *         }
+ *     }
+ *
+ *     status = targaDecoderFinish(decoder);
+ *     targaDecoderDestroy(decoder);
+ */
+typedef struct TARGA_DECODER TARGA_DECODER;
+
+/**
+ * Create a decoder, with options (NULL for defaults). The threads and
+ * region options, TARGA_LOAD_MAPPED, TARGA_LOAD_PIPELINED and
+ * TARGA_LOAD_MIPMAPS are ignored. options->stats is complete once
+ * targaDecoderFinish() returned; only its totalNs is timed, the time spent
+ * in targaDecoderFeed().
+ */
+TARGA_DECODER* targaDecoderCreate(const TARGA_LOAD_OPTIONS* options);
+
+/**
+ * Feed size bytes of the file. Feeding stops when a row is complete and
+ * resumes once it has been pulled with targaDecoderRow(). Return the number
+ * of bytes consumed; status receives TARGA_OK or the first error met.
+ */
+size_t targaDecoderFeed(
+        TARGA_DECODER* decoder,
+        const void* data,
+        size_t size,
+        int* status);
+
+/**
+ * Once the header has been fed, fill the geometry and format of image
+ * (pixels stays NULL) and return TARGA_OK. Return TARGA_PENDING before.
+ */
+int targaDecoderImage(const TARGA_DECODER* decoder, TARGA_IMAGE* image);
+
+/**
+ * Return the next complete row and its index in y. Rows come in file
+ * order; with a forced origin y is the row index from that origin. The
+ * row is valid until the next call to targaDecoderFeed(). Return NULL if
+ * no row is ready.
+ */
+const uint8_t* targaDecoderRow(TARGA_DECODER* decoder, unsigned int* y);
+
+/**
+ * Return TARGA_OK if the whole image was decoded and pulled, TARGA_ERR_READ
+ * if the input ended early, or the first error met.
+ */
+int targaDecoderFinish(TARGA_DECODER* decoder);
+
+void targaDecoderDestroy(TARGA_DECODER* decoder);
+
 #ifdef __cplusplus
 }
 #endif // __cplusplus
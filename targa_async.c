@@ -0,0 +1,956 @@
+/*
+ * MIT License
+ *
+ * TARGA Copyright (c) 2016 Sebastien Serre <ssbx@sysmo.io>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "targa_private.h"
+#include <string.h>
+#include <errno.h>
+
+#ifdef TARGA_HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#ifdef TARGA_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define TGA_URING
+#endif
+#endif
+
+
+/*
+ * Asynchronous loading
+ *
+ * With io_uring every file being loaded owns a slot of two chunk buffers:
+ * while one chunk is decoded the read of the next one is in flight, and
+ * so are the reads of the other slots. The thread calling targaAsyncWait()
+ * submits the reads, reaps their completions and feeds the chunks to a push
+ * decoder per file, in file order. Without io_uring a few threads run
+ * blocking loads.
+ */
+#define TGA_ASYNC_DEPTH   8             /* files in flight by default */
+#define TGA_ASYNC_CHUNK   (256 * 1024)  /* bytes per read */
+#define TGA_ASYNC_BUFFERS 2             /* reads in flight per file */
+
+
+/*
+ * A load request, queued, then running, then completed.
+ */
+typedef struct TGA_ASYNC_JOB {
+    struct TGA_ASYNC_JOB*   next;
+    char*                   fileName;
+    TARGA_LOAD_OPTIONS      options;
+    TARGA_ASYNC_RESULT      result;
+} TGA_ASYNC_JOB;
+
+
+typedef struct {
+    TGA_ASYNC_JOB*  first;
+    TGA_ASYNC_JOB*  last;
+} TGA_ASYNC_QUEUE;
+
+
+static void targaQueuePush(TGA_ASYNC_QUEUE* queue, TGA_ASYNC_JOB* job)
+{
+    job->next = NULL;
+
+    if (queue->last)
+        queue->last->next = job;
+    else
+        queue->first = job;
+
+    queue->last = job;
+}
+
+
+static TGA_ASYNC_JOB* targaQueuePop(TGA_ASYNC_QUEUE* queue)
+{
+    TGA_ASYNC_JOB* job = queue->first;
+
+    if (job)
+    {
+        queue->first = job->next;
+        if (!queue->first)
+            queue->last = NULL;
+    }
+
+    return job;
+}
+
+
+#ifdef TGA_URING
+
+#define TGA_BUFFER_FREE    0
+#define TGA_BUFFER_READING 1
+#define TGA_BUFFER_READY   2
+
+typedef struct {
+    uint8_t*        data;
+    struct iovec    iov;
+    int             state;          /* TGA_BUFFER_* */
+    int             size;           /* bytes read, negative errno on error */
+} TGA_ASYNC_BUFFER;
+
+
+/*
+ * A file being read: job is NULL once it completed, the slot is free again
+ * when its last read came back too.
+ */
+typedef struct {
+    TGA_ASYNC_JOB*      job;
+    int                 fd;
+    uint64_t            offset;         /* of the next read */
+    unsigned int        reading;        /* reads in flight */
+    unsigned int        next;           /* buffer to decode next */
+
+    TARGA_DECODER*      decoder;
+    uint8_t*            memory;
+    unsigned int        rows;           /* rows pulled */
+    TGA_ASYNC_BUFFER    buffers[TGA_ASYNC_BUFFERS];
+} TGA_ASYNC_SLOT;
+
+
+/*
+ * The rings shared with the kernel, see io_uring_setup(2).
+ */
+typedef struct {
+    int                     fd;
+    void*                   sqRing;
+    size_t                  sqRingSize;
+    void*                   cqRing;
+    size_t                  cqRingSize;
+    struct io_uring_sqe*    sqes;
+    size_t                  sqesSize;
+
+    unsigned int*           sqHead;
+    unsigned int*           sqTail;
+    unsigned int*           sqMask;
+    unsigned int*           sqArray;
+    unsigned int*           cqHead;
+    unsigned int*           cqTail;
+    unsigned int*           cqMask;
+    struct io_uring_cqe*    cqes;
+
+    unsigned int            queued;         /* entries not submitted yet */
+} TGA_URING_RINGS;
+
+#endif // TGA_URING
+
+
+struct TARGA_ASYNC {
+    int                 backend;        /* TARGA_ASYNC_* */
+    unsigned int        depth;
+    size_t              pending;        /* submitted and not returned */
+
+    TGA_ASYNC_QUEUE     queued;
+    TGA_ASYNC_QUEUE     completed;
+
+#ifdef TGA_URING
+    TGA_URING_RINGS     ring;
+    TGA_ASYNC_SLOT*     slots;
+    uint8_t*            chunks;
+#endif
+
+#ifdef TARGA_HAVE_PTHREAD
+    pthread_t*          threads;
+    unsigned int        threadCount;
+    pthread_mutex_t     lock;
+    pthread_cond_t      wake;           /* a job was queued, or stop */
+    pthread_cond_t      done;           /* a job completed */
+    int                 stop;
+#endif
+};
+
+
+#ifdef TGA_URING
+static void targaSlotComplete(TARGA_ASYNC* async, TGA_ASYNC_SLOT* slot, int status);
+#endif
+#ifdef TARGA_HAVE_PTHREAD
+static void targaThreadsCreate(TARGA_ASYNC* async);
+#endif
+
+
+/*
+ * io_uring backend
+ */
+#ifdef TGA_URING
+
+static int targaUringSetup(TGA_URING_RINGS* ring, unsigned int entries)
+{
+
+    struct io_uring_params params;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0)
+        return TARGA_ERR_UNSUPPORTED;
+
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqesSize   = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cqRingSize > ring->sqRingSize)
+            ring->sqRingSize = ring->cqRingSize;
+        ring->cqRingSize = 0;
+    }
+
+    ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cqRing = ring->cqRingSize
+        ? mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING)
+        : ring->sqRing;
+    ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+    if (ring->sqRing == MAP_FAILED || ring->cqRing == MAP_FAILED ||
+        ring->sqes == MAP_FAILED)
+    {
+        if (ring->sqRing != MAP_FAILED)
+            munmap(ring->sqRing, ring->sqRingSize);
+        if (ring->cqRingSize && ring->cqRing != MAP_FAILED)
+            munmap(ring->cqRing, ring->cqRingSize);
+        if (ring->sqes != MAP_FAILED)
+            munmap(ring->sqes, ring->sqesSize);
+        close(ring->fd);
+        return TARGA_ERR_UNSUPPORTED;
+    }
+
+    uint8_t* sq = ring->sqRing;
+    uint8_t* cq = ring->cqRing;
+
+    ring->sqHead  = (unsigned int*)(sq + params.sq_off.head);
+    ring->sqTail  = (unsigned int*)(sq + params.sq_off.tail);
+    ring->sqMask  = (unsigned int*)(sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned int*)(sq + params.sq_off.array);
+    ring->cqHead  = (unsigned int*)(cq + params.cq_off.head);
+    ring->cqTail  = (unsigned int*)(cq + params.cq_off.tail);
+    ring->cqMask  = (unsigned int*)(cq + params.cq_off.ring_mask);
+    ring->cqes    = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return TARGA_OK;
+
+}
+
+
+static void targaUringClose(TGA_URING_RINGS* ring)
+{
+    munmap(ring->sqes, ring->sqesSize);
+    if (ring->cqRingSize)
+        munmap(ring->cqRing, ring->cqRingSize);
+    munmap(ring->sqRing, ring->sqRingSize);
+    close(ring->fd);
+}
+
+
+/*
+ * Queue the read of buffer index of slot. The ring has an entry for every
+ * buffer, it never overflows.
+ */
+static void targaUringRead(TARGA_ASYNC* async, size_t slotIndex, unsigned int index)
+{
+
+    TGA_URING_RINGS* ring = &async->ring;
+    TGA_ASYNC_SLOT* slot = &async->slots[slotIndex];
+    TGA_ASYNC_BUFFER* buffer = &slot->buffers[index];
+    unsigned int tail = *ring->sqTail;
+    unsigned int entry = tail & *ring->sqMask;
+    struct io_uring_sqe* sqe = &ring->sqes[entry];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode    = IORING_OP_READV;
+    sqe->fd        = slot->fd;
+    sqe->off       = slot->offset;
+    sqe->addr      = (uint64_t)(uintptr_t)&buffer->iov;
+    sqe->len       = 1;
+    sqe->user_data = slotIndex * TGA_ASYNC_BUFFERS + index;
+
+    ring->sqArray[entry] = entry;
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+    ring->queued++;
+
+    buffer->state  = TGA_BUFFER_READING;
+    slot->offset  += TGA_ASYNC_CHUNK;
+    slot->reading++;
+
+}
+
+
+/*
+ * The ring failed: fail the running jobs, drop the ring and hand the
+ * queued jobs over to the thread backend.
+ */
+static void targaUringFallback(TARGA_ASYNC* async)
+{
+
+    size_t i;
+
+    for (i = 0; i < async->depth; i++)
+    {
+        TGA_ASYNC_SLOT* slot = &async->slots[i];
+
+        if (slot->job)
+            targaSlotComplete(async, slot, TARGA_ERR_READ);
+        if (slot->fd >= 0)
+            close(slot->fd);
+        slot->fd = -1;
+        slot->reading = 0;
+    }
+
+    async->ring.queued = 0;
+    targaUringClose(&async->ring);
+    free(async->slots);
+    free(async->chunks);
+    async->slots  = NULL;
+    async->chunks = NULL;
+
+#ifdef TARGA_HAVE_PTHREAD
+    targaThreadsCreate(async);
+#else
+    async->backend = TARGA_ASYNC_THREADS;
+#endif
+
+}
+
+
+/*
+ * Submit the queued reads, wait for one completion if wait is set, and
+ * mark the buffers of the completed reads ready. When the ring fails the
+ * backend falls back to threads and TARGA_ERR_READ is returned.
+ */
+static int targaUringReap(TARGA_ASYNC* async, int wait)
+{
+
+    TGA_URING_RINGS* ring = &async->ring;
+
+    while (ring->queued || wait)
+    {
+        int submitted = (int)syscall(__NR_io_uring_enter, ring->fd, ring->queued,
+                wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+
+        if (submitted >= 0)
+        {
+            ring->queued -= (unsigned int)submitted;
+            break;
+        }
+
+        if (errno != EINTR && errno != EAGAIN)
+        {
+            targaUringFallback(async);
+            return TARGA_ERR_READ;
+        }
+    }
+
+    unsigned int head = *ring->cqHead;
+    unsigned int tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++)
+    {
+        struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cqMask];
+        TGA_ASYNC_SLOT* slot = &async->slots[cqe->user_data / TGA_ASYNC_BUFFERS];
+        TGA_ASYNC_BUFFER* buffer = &slot->buffers[cqe->user_data % TGA_ASYNC_BUFFERS];
+
+        buffer->state = TGA_BUFFER_READY;
+        buffer->size  = cqe->res;
+        slot->reading--;
+    }
+
+    __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+    return TARGA_OK;
+
+}
+
+
+/*
+ * Hand the job of slot over to the completed queue, with status.
+ */
+static void targaSlotComplete(TARGA_ASYNC* async, TGA_ASYNC_SLOT* slot, int status)
+{
+
+    TGA_ASYNC_JOB* job = slot->job;
+
+    if (slot->decoder)
+    {
+        if (status == TARGA_OK)
+            status = targaDecoderFinish(slot->decoder);
+        targaDecoderDestroy(slot->decoder);
+        slot->decoder = NULL;
+    }
+
+    /* the rows were copied as they came: the levels are built now */
+    if (status == TARGA_OK && job->result.image.levels > 1)
+        status = targaMipBuild(&job->result.image, &job->options);
+
+    if (status != TARGA_OK)
+    {
+        free(slot->memory);
+        memset(&job->result.image, 0, sizeof(TARGA_IMAGE));
+    }
+
+    job->result.status = status;
+    targaQueuePush(&async->completed, job);
+
+    slot->job    = NULL;
+    slot->memory = NULL;
+
+}
+
+
+static void targaSlotStart(TARGA_ASYNC* async, TGA_ASYNC_SLOT* slot, TGA_ASYNC_JOB* job)
+{
+
+    unsigned int i;
+
+    slot->job     = job;
+    slot->offset  = 0;
+    slot->next    = 0;
+    slot->rows    = 0;
+    slot->memory  = NULL;
+    slot->decoder = targaDecoderCreate(&job->options);
+    slot->fd      = open(job->fileName, O_RDONLY | O_CLOEXEC);
+
+    for (i = 0; i < TGA_ASYNC_BUFFERS; i++)
+        slot->buffers[i].state = TGA_BUFFER_FREE;
+
+    if (slot->fd < 0)
+        targaSlotComplete(async, slot, TARGA_ERR_OPEN);
+    else if (!slot->decoder)
+        targaSlotComplete(async, slot, TARGA_ERR_NO_MEMORY);
+    else
+        posix_fadvise(slot->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+}
+
+
+/*
+ * Once the header is known, allocate the image the rows are copied into.
+ */
+static int targaSlotImage(TGA_ASYNC_SLOT* slot)
+{
+
+    TARGA_IMAGE* image = &slot->job->result.image;
+
+    if (slot->memory || targaDecoderImage(slot->decoder, image) != TARGA_OK)
+        return TARGA_OK;
+
+    size_t alignment = slot->job->options.alignment ? slot->job->options.alignment : 1;
+
+    if ((slot->job->options.flags & TARGA_LOAD_MIPMAPS) && image->width && image->height)
+        image->levels = targaMipLevels(image->width, image->height);
+
+    size_t size = targaImageSize(image);
+
+    slot->memory = malloc(size ? size + alignment - 1 : 1);
+    if (!slot->memory)
+        return TARGA_ERR_NO_MEMORY;
+
+    image->memory = slot->memory;
+    image->pixels = (uint8_t*)(((uintptr_t)slot->memory + alignment - 1)
+            & ~(uintptr_t)(alignment - 1));
+    return TARGA_OK;
+
+}
+
+
+/*
+ * Decode the chunk of buffer into the image. Return 1 once the image is
+ * complete.
+ */
+static int targaSlotDecode(TGA_ASYNC_SLOT* slot, TGA_ASYNC_BUFFER* buffer, int* status)
+{
+
+    TARGA_IMAGE* image = &slot->job->result.image;
+    size_t size = (size_t)buffer->size;
+    size_t used = 0;
+
+    while (used < size)
+    {
+        const uint8_t* row;
+        unsigned int y;
+
+        used += targaDecoderFeed(slot->decoder, buffer->data + used, size - used, status);
+        if (*status == TARGA_OK)
+            *status = targaSlotImage(slot);
+        if (*status != TARGA_OK)
+            return 1;
+
+        while ((row = targaDecoderRow(slot->decoder, &y)))
+        {
+            memcpy(image->pixels + (size_t)y * image->pitch, row, image->pitch);
+            slot->rows++;
+        }
+
+        /* the footer is never read */
+        if (slot->memory && (slot->rows == image->height || image->width == 0))
+            return 1;
+    }
+
+    return 0;
+
+}
+
+
+/*
+ * Decode the chunks of slot that arrived in order, then queue the reads
+ * of its free buffers.
+ */
+static void targaSlotRun(TARGA_ASYNC* async, size_t slotIndex)
+{
+
+    TGA_ASYNC_SLOT* slot = &async->slots[slotIndex];
+    unsigned int i;
+
+    while (slot->job && slot->buffers[slot->next].state == TGA_BUFFER_READY)
+    {
+        TGA_ASYNC_BUFFER* buffer = &slot->buffers[slot->next];
+        int status = TARGA_OK;
+
+        buffer->state = TGA_BUFFER_FREE;
+        slot->next = (slot->next + 1) % TGA_ASYNC_BUFFERS;
+
+        if (buffer->size < 0)
+        {
+            targaSlotComplete(async, slot, TARGA_ERR_READ);
+            break;
+        }
+
+        if (targaSlotDecode(slot, buffer, &status))
+        {
+            targaSlotComplete(async, slot, status);
+            break;
+        }
+
+        /* a short read is the end of the file */
+        if (buffer->size < TGA_ASYNC_CHUNK)
+        {
+            targaSlotComplete(async, slot, TARGA_ERR_READ);
+            break;
+        }
+    }
+
+    for (i = 0; slot->job && i < TGA_ASYNC_BUFFERS; i++)
+    {
+        unsigned int index = (slot->next + i) % TGA_ASYNC_BUFFERS;
+
+        if (slot->buffers[index].state != TGA_BUFFER_FREE)
+            break;
+
+        targaUringRead(async, slotIndex, index);
+    }
+
+    if (!slot->job && slot->fd >= 0 && slot->reading == 0)
+    {
+        close(slot->fd);
+        slot->fd = -1;
+    }
+
+}
+
+
+/*
+ * Start the queued jobs on the free slots, decode what arrived and submit
+ * the next reads. With wait, block for a read when nothing completed.
+ */
+static int targaUringStep(TARGA_ASYNC* async)
+{
+
+    size_t i;
+    int busy = 0;
+
+    for (i = 0; i < async->depth; i++)
+    {
+        TGA_ASYNC_SLOT* slot = &async->slots[i];
+
+        if (!slot->job && slot->fd < 0 && async->queued.first)
+            targaSlotStart(async, slot, targaQueuePop(&async->queued));
+
+        targaSlotRun(async, i);
+        busy |= slot->reading != 0;
+    }
+
+    return targaUringReap(async, busy && !async->completed.first);
+
+}
+
+
+static int targaUringCreate(TARGA_ASYNC* async)
+{
+
+    size_t i, buffers = (size_t)async->depth * TGA_ASYNC_BUFFERS;
+
+    if (targaUringSetup(&async->ring, (unsigned int)buffers) != TARGA_OK)
+        return TARGA_ERR_UNSUPPORTED;
+
+    async->slots  = calloc(async->depth, sizeof(TGA_ASYNC_SLOT));
+    async->chunks = malloc(buffers * TGA_ASYNC_CHUNK);
+    if (!async->slots || !async->chunks)
+    {
+        free(async->slots);
+        free(async->chunks);
+        targaUringClose(&async->ring);
+        return TARGA_ERR_NO_MEMORY;
+    }
+
+    for (i = 0; i < buffers; i++)
+    {
+        TGA_ASYNC_SLOT* slot = &async->slots[i / TGA_ASYNC_BUFFERS];
+        TGA_ASYNC_BUFFER* buffer = &slot->buffers[i % TGA_ASYNC_BUFFERS];
+
+        slot->fd = -1;
+        buffer->data = async->chunks + i * TGA_ASYNC_CHUNK;
+        buffer->iov.iov_base = buffer->data;
+        buffer->iov.iov_len  = TGA_ASYNC_CHUNK;
+    }
+
+    async->backend = TARGA_ASYNC_URING;
+    return TARGA_OK;
+
+}
+
+
+/*
+ * Fail the running jobs and wait for their reads: the kernel writes into
+ * the chunks until then.
+ */
+static void targaUringDestroy(TARGA_ASYNC* async)
+{
+
+    size_t i;
+    int busy;
+
+    do
+    {
+        busy = 0;
+        for (i = 0; i < async->depth; i++)
+        {
+            TGA_ASYNC_SLOT* slot = &async->slots[i];
+
+            if (slot->job)
+                targaSlotComplete(async, slot, TARGA_ERR_READ);
+            if (slot->fd >= 0 && slot->reading == 0)
+            {
+                close(slot->fd);
+                slot->fd = -1;
+            }
+            busy |= slot->reading != 0;
+        }
+
+        /* on failure the ring is already gone */
+        if (busy && targaUringReap(async, 1) != TARGA_OK)
+            return;
+    }
+    while (busy);
+
+    targaUringClose(&async->ring);
+    free(async->slots);
+    free(async->chunks);
+
+}
+
+#endif // TGA_URING
+
+
+/*
+ * Thread backend
+ */
+#ifdef TARGA_HAVE_PTHREAD
+
+static void* targaAsyncWorker(void* arg)
+{
+
+    TARGA_ASYNC* async = arg;
+
+    pthread_mutex_lock(&async->lock);
+    for (;;)
+    {
+        TGA_ASYNC_JOB* job;
+
+        while (!async->stop && !async->queued.first)
+            pthread_cond_wait(&async->wake, &async->lock);
+
+        if (async->stop)
+            break;
+
+        job = targaQueuePop(&async->queued);
+        pthread_mutex_unlock(&async->lock);
+
+        job->result.status = targaLoadImage(job->fileName, &job->options,
+                &job->result.image);
+
+        pthread_mutex_lock(&async->lock);
+        targaQueuePush(&async->completed, job);
+        pthread_cond_signal(&async->done);
+    }
+    pthread_mutex_unlock(&async->lock);
+
+    return NULL;
+
+}
+
+
+static void targaThreadsCreate(TARGA_ASYNC* async)
+{
+
+    /* the threads mostly wait for reads: more of them than of CPUs */
+    unsigned int count = 2 * targaCpuCount();
+    if (count > async->depth)
+        count = async->depth;
+
+    pthread_mutex_init(&async->lock, NULL);
+    pthread_cond_init(&async->wake, NULL);
+    pthread_cond_init(&async->done, NULL);
+
+    async->threads = malloc(sizeof(pthread_t) * count);
+    if (!async->threads)
+        count = 0;
+
+    for (; async->threadCount < count; async->threadCount++)
+        if (pthread_create(&async->threads[async->threadCount], NULL,
+                    targaAsyncWorker, async) != 0)
+            break;
+
+    /* without any thread the jobs run in targaAsyncWait() */
+    async->backend = TARGA_ASYNC_THREADS;
+
+}
+
+
+static void targaThreadsDestroy(TARGA_ASYNC* async)
+{
+
+    unsigned int i;
+
+    pthread_mutex_lock(&async->lock);
+    async->stop = 1;
+    pthread_cond_broadcast(&async->wake);
+    pthread_mutex_unlock(&async->lock);
+
+    for (i = 0; i < async->threadCount; i++)
+        pthread_join(async->threads[i], NULL);
+
+    pthread_cond_destroy(&async->done);
+    pthread_cond_destroy(&async->wake);
+    pthread_mutex_destroy(&async->lock);
+    free(async->threads);
+
+}
+
+#endif // TARGA_HAVE_PTHREAD
+
+
+TARGA_ASYNC* targaAsyncCreate(unsigned int depth, unsigned int flags)
+{
+
+    TARGA_ASYNC* async = calloc(1, sizeof(TARGA_ASYNC));
+    if (!async)
+        return NULL;
+
+    async->depth = depth ? depth : TGA_ASYNC_DEPTH;
+
+#ifdef TGA_URING
+    if (!(flags & TARGA_ASYNC_NO_URING) && targaUringCreate(async) == TARGA_OK)
+        return async;
+#else
+    (void)flags;
+#endif
+
+#ifdef TARGA_HAVE_PTHREAD
+    targaThreadsCreate(async);
+#else
+    async->backend = TARGA_ASYNC_THREADS;
+#endif
+
+    return async;
+
+}
+
+
+int targaAsyncBackend(const TARGA_ASYNC* async)
+{
+    return async->backend;
+}
+
+
+int targaAsyncSubmit(
+        TARGA_ASYNC*                async,
+        const char*                 fileName,
+        const TARGA_LOAD_OPTIONS*   options,
+        void*                       user)
+{
+
+    TGA_ASYNC_JOB* job = calloc(1, sizeof(TGA_ASYNC_JOB));
+    size_t length = strlen(fileName);
+
+    if (!job || !(job->fileName = malloc(length + 1)))
+    {
+        free(job);
+        return TARGA_ERR_NO_MEMORY;
+    }
+
+    memcpy(job->fileName, fileName, length + 1);
+    job->result.user = user;
+
+    /* the same options on both backends: those of the push decoder */
+    if (options)
+        job->options = *options;
+    job->options.flags  &= ~(unsigned int)(TARGA_LOAD_MAPPED | TARGA_LOAD_PIPELINED);
+    job->options.threads = 0;
+    memset(&job->options.region, 0, sizeof(TARGA_RECT));
+
+#ifdef TARGA_HAVE_PTHREAD
+    if (async->backend == TARGA_ASYNC_THREADS)
+    {
+        pthread_mutex_lock(&async->lock);
+        targaQueuePush(&async->queued, job);
+        async->pending++;
+        pthread_cond_signal(&async->wake);
+        pthread_mutex_unlock(&async->lock);
+        return TARGA_OK;
+    }
+#endif
+
+    targaQueuePush(&async->queued, job);
+    async->pending++;
+    return TARGA_OK;
+
+}
+
+
+size_t targaAsyncPending(const TARGA_ASYNC* async)
+{
+    return async->pending;
+}
+
+
+/*
+ * Move up to max completed jobs into results.
+ */
+static size_t targaAsyncCollect(TARGA_ASYNC* async, TARGA_ASYNC_RESULT* results, size_t max)
+{
+
+    size_t count = 0;
+    TGA_ASYNC_JOB* job;
+
+    while (count < max && (job = targaQueuePop(&async->completed)))
+    {
+        results[count++] = job->result;
+        free(job->fileName);
+        free(job);
+    }
+
+    async->pending -= count;
+    return count;
+
+}
+
+
+size_t targaAsyncWait(TARGA_ASYNC* async, TARGA_ASYNC_RESULT* results, size_t max)
+{
+
+    size_t count = 0;
+
+    if (max == 0)
+        return 0;
+
+#ifdef TGA_URING
+    if (async->backend == TARGA_ASYNC_URING)
+    {
+        int status = TARGA_OK;
+
+        while (status == TARGA_OK && async->pending && !async->completed.first)
+            status = targaUringStep(async);
+
+        /* otherwise the ring failed: the threads take over */
+        if (status == TARGA_OK)
+            return targaAsyncCollect(async, results, max);
+    }
+#endif
+
+#ifdef TARGA_HAVE_PTHREAD
+    if (async->threadCount)
+    {
+        pthread_mutex_lock(&async->lock);
+        while (async->pending && !async->completed.first)
+            pthread_cond_wait(&async->done, &async->lock);
+
+        count = targaAsyncCollect(async, results, max);
+        pthread_mutex_unlock(&async->lock);
+        return count;
+    }
+#endif
+
+    /* no thread: the next job is loaded here */
+    TGA_ASYNC_JOB* job = targaQueuePop(&async->queued);
+    if (job)
+    {
+        job->result.status = targaLoadImage(job->fileName, &job->options,
+                &job->result.image);
+        targaQueuePush(&async->completed, job);
+    }
+
+    count = targaAsyncCollect(async, results, max);
+    return count;
+
+}
+
+
+void targaAsyncDestroy(TARGA_ASYNC* async)
+{
+
+    TGA_ASYNC_JOB* job;
+
+    if (!async)
+        return;
+
+#ifdef TGA_URING
+    if (async->backend == TARGA_ASYNC_URING)
+        targaUringDestroy(async);
+#endif
+
+#ifdef TARGA_HAVE_PTHREAD
+    if (async->backend == TARGA_ASYNC_THREADS)
+        targaThreadsDestroy(async);
+#endif
+
+    while ((job = targaQueuePop(&async->queued)) ||
+           (job = targaQueuePop(&async->completed)))
+    {
+        targaImageFree(&job->result.image);
+        free(job->fileName);
+        free(job);
+    }
+
+    free(async);
+
+}
@@ -0,0 +1,495 @@
+/*
+ * MIT License
+ *
+ * TARGA Copyright (c) 2016 Sebastien Serre <ssbx@sysmo.io>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Texture atlas
+ *
+ * Every image is probed for its size, trimmed if asked (a first decode
+ * finding the rows and columns that are not fully transparent), then the
+ * rectangles are packed on a skyline: the top edge of what was placed so
+ * far, as segments from left to right. Each rectangle, tallest first,
+ * goes where its bottom would be the highest, leftmost on ties, and
+ * raises the skyline under it. Holes left below the skyline are lost,
+ * which costs little with rectangles sorted by height.
+ *
+ * The images are then decoded on the pool with options->pitch set to the
+ * pitch of the atlas and the buffer pointing at their place, trimmed ones
+ * through options->region.
+ */
+#include "targa_private.h"
+#include <string.h>
+
+#define TGA_ATLAS_WIDTH      16384  /* default options->maxWidth */
+#define TGA_ATLAS_MAX_WIDTH  65535  /* the largest a TGA header holds */
+#define TGA_ATLAS_MAX_HEIGHT 65535
+
+
+typedef struct {
+    unsigned int x;
+    unsigned int y;             /* top of the placed rectangles */
+    unsigned int width;
+} TGA_SKYLINE;
+
+
+typedef struct {
+    TARGA_ATLAS_ITEM*   items;
+    unsigned int        format;
+    TARGA_IMAGE*        atlas;
+} TGA_ATLAS;
+
+
+/*
+ * Fully transparent borders: decoded once to RGBA, rect gets what is left.
+ */
+static void targaAtlasTrim(void* context, size_t index)
+{
+
+    TGA_ATLAS* job = context;
+    TARGA_ATLAS_ITEM* item = &job->items[index];
+    TARGA_LOAD_OPTIONS options = {0};
+    TARGA_IMAGE image;
+    unsigned int left, right, top, bottom, x, y;
+
+    options.format = TARGA_FORMAT_RGBA8;
+    options.flags  = TARGA_LOAD_TOP_LEFT;
+
+    item->status = targaLoadImage(item->fileName, &options, &image);
+    if (item->status != TARGA_OK)
+        return;
+
+    left = image.width;
+    right = 0;
+    top = image.height;
+    bottom = 0;
+
+    for (y = 0; y < image.height; y++)
+    {
+        const uint8_t* row = image.pixels + y * image.pitch;
+
+        for (x = 0; x < image.width; x++)
+        {
+            if (row[x * 4 + 3] == 0)
+                continue;
+
+            left   = x < left ? x : left;
+            right  = x + 1 > right ? x + 1 : right;
+            top    = y < top ? y : top;
+            bottom = y + 1;
+        }
+    }
+
+    targaImageFree(&image);
+
+    if (left >= right)
+    {
+        /* nothing visible */
+        item->rect.width  = 0;
+        item->rect.height = 0;
+        return;
+    }
+
+    item->trimX       = left;
+    item->trimY       = top;
+    item->rect.width  = right - left;
+    item->rect.height = bottom - top;
+
+}
+
+
+static void targaAtlasDecode(void* context, size_t index)
+{
+
+    TGA_ATLAS* job = context;
+    TARGA_ATLAS_ITEM* item = &job->items[index];
+    TARGA_IMAGE* atlas = job->atlas;
+    TARGA_LOAD_OPTIONS options = {0};
+    TARGA_IMAGE image;
+
+    if (item->status != TARGA_OK || item->rect.width == 0 || item->rect.height == 0)
+        return;
+
+    options.format = job->format;
+    options.flags  = TARGA_LOAD_TOP_LEFT;
+    options.pitch  = atlas->pitch;
+
+    if (item->rect.width != item->width || item->rect.height != item->height)
+    {
+        options.region.x      = item->trimX;
+        options.region.y      = item->trimY;
+        options.region.width  = item->rect.width;
+        options.region.height = item->rect.height;
+    }
+
+    size_t offset = item->rect.y * atlas->pitch + item->rect.x * targaFormatBpp(job->format);
+
+    item->status = targaLoadInto(item->fileName, &options,
+            atlas->pixels + offset, atlas->pitch * atlas->height - offset, &image);
+
+}
+
+
+/*
+ * Tallest first, then widest, then in the given order.
+ */
+typedef struct {
+    unsigned int    height;
+    unsigned int    width;
+    size_t          index;
+} TGA_ATLAS_ORDER;
+
+
+static int targaAtlasCompare(const void* a, const void* b)
+{
+
+    const TGA_ATLAS_ORDER* oa = a;
+    const TGA_ATLAS_ORDER* ob = b;
+
+    if (oa->height != ob->height)
+        return oa->height > ob->height ? -1 : 1;
+    if (oa->width != ob->width)
+        return oa->width > ob->width ? -1 : 1;
+
+    return oa->index < ob->index ? -1 : 1;
+
+}
+
+
+/*
+ * Place a width x height rectangle on the skyline of a bin binWidth wide.
+ * Return 0 if it is wider than the bin.
+ */
+static int targaSkylinePlace(
+        TGA_SKYLINE*    line,
+        size_t*         count,
+        unsigned int    binWidth,
+        unsigned int    width,
+        unsigned int    height,
+        unsigned int*   x,
+        unsigned int*   y)
+{
+
+    size_t best = *count, i, j;
+    unsigned int bestTop = 0;
+
+    for (i = 0; i < *count && line[i].x + (uint64_t)width <= binWidth; i++)
+    {
+        unsigned int top = 0;
+        unsigned int covered = 0;
+
+        /* the rectangle rests on the highest segment under it */
+        for (j = i; covered < width; j++)
+        {
+            top = line[j].y > top ? line[j].y : top;
+            covered += line[j].width;
+        }
+
+        if (best == *count || top < bestTop)
+        {
+            best = i;
+            bestTop = top;
+        }
+    }
+
+    if (best == *count)
+        return 0;
+
+    *x = line[best].x;
+    *y = bestTop;
+
+    /* the segments under the rectangle are cut or removed */
+    unsigned int end = *x + width;
+
+    for (j = best; j < *count && line[j].x < end; j++)
+    {
+        unsigned int segmentEnd = line[j].x + line[j].width;
+
+        if (segmentEnd > end)
+        {
+            line[j].width = segmentEnd - end;
+            line[j].x = end;
+            break;
+        }
+    }
+
+    /* line[best, j[ is replaced by the top of the rectangle */
+    memmove(line + best + 1, line + j, (*count - j) * sizeof(TGA_SKYLINE));
+    *count = *count - (j - best) + 1;
+    line[best].x = *x;
+    line[best].y = bestTop + height;
+    line[best].width = width;
+
+    /* merge with the neighbours at the same height */
+    if (best + 1 < *count && line[best + 1].y == line[best].y)
+    {
+        line[best].width += line[best + 1].width;
+        memmove(line + best + 1, line + best + 2, (*count - best - 2) * sizeof(TGA_SKYLINE));
+        (*count)--;
+    }
+    if (best > 0 && line[best - 1].y == line[best].y)
+    {
+        line[best - 1].width += line[best].width;
+        memmove(line + best, line + best + 1, (*count - best - 1) * sizeof(TGA_SKYLINE));
+        (*count)--;
+    }
+
+    return 1;
+
+}
+
+
+/*
+ * Pack the sorted items in a bin binWidth wide, return the height used
+ * or 0 if one does not fit. With place set, the rectangles are stored.
+ */
+static unsigned int targaAtlasPack(
+        TARGA_ATLAS_ITEM*   items,
+        const size_t*       order,
+        size_t              count,
+        unsigned int        binWidth,
+        unsigned int        padding,
+        TGA_SKYLINE*        line,
+        int                 place)
+{
+
+    size_t segments = 1;
+    unsigned int height = 0;
+    size_t i;
+
+    line[0].x = 0;
+    line[0].y = 0;
+    line[0].width = binWidth;
+
+    for (i = 0; i < count; i++)
+    {
+        TARGA_ATLAS_ITEM* item = &items[order[i]];
+        unsigned int x, y;
+
+        if (!targaSkylinePlace(line, &segments, binWidth,
+                    item->rect.width + padding, item->rect.height + padding, &x, &y))
+            return 0;
+
+        if (y + item->rect.height + padding > height)
+            height = y + item->rect.height + padding;
+
+        if (place)
+        {
+            item->rect.x = x + padding;
+            item->rect.y = y + padding;
+        }
+    }
+
+    return height + padding;
+
+}
+
+
+int targaAtlasBuild(
+        TARGA_POOL*                 pool,
+        TARGA_ATLAS_ITEM*           items,
+        size_t                      count,
+        const TARGA_ATLAS_OPTIONS*  options,
+        TARGA_IMAGE*                atlas)
+{
+
+    TGA_ATLAS job;
+    TARGA_POOL* own = NULL;
+    unsigned int format = options ? options->format : TARGA_FORMAT_AUTO;
+    unsigned int padding = options ? options->padding : 0;
+    unsigned int maxWidth = options && options->maxWidth ? options->maxWidth : TGA_ATLAS_WIDTH;
+    size_t i, placed = 0;
+
+    memset(atlas, 0, sizeof(*atlas));
+
+    if (format == TARGA_FORMAT_AUTO)
+        format = TARGA_FORMAT_RGBA8;
+
+    if (format > TARGA_FORMAT_RGBA8_KEYED || maxWidth > TGA_ATLAS_MAX_WIDTH ||
+        padding > maxWidth / 2)
+        return TARGA_ERR_ARGUMENT;
+
+    /*
+     * Sizes, from the headers
+     */
+    size_t* order = malloc((count ? count : 1) * sizeof(size_t));
+    TGA_ATLAS_ORDER* sorted = malloc((count ? count : 1) * sizeof(TGA_ATLAS_ORDER));
+    TGA_SKYLINE* line = malloc((count + 2) * sizeof(TGA_SKYLINE));
+    if (!order || !sorted || !line)
+    {
+        free(order);
+        free(sorted);
+        free(line);
+        return TARGA_ERR_NO_MEMORY;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        TARGA_ATLAS_ITEM* item = &items[i];
+        TARGA_INFO info;
+
+        memset(&item->rect, 0, sizeof(item->rect));
+        item->trimX  = 0;
+        item->trimY  = 0;
+        item->width  = 0;
+        item->height = 0;
+        item->status = targaProbe(item->fileName, 0, &info);
+
+        if (item->status != TARGA_OK)
+            continue;
+
+        item->width       = info.width;
+        item->height      = info.height;
+        item->rect.width  = info.width;
+        item->rect.height = info.height;
+
+        /* the images without alpha keep their borders */
+        if ((options && (options->flags & TARGA_ATLAS_TRIM)) &&
+            (info.alphaBits || info.pixelDepth == 32 || info.colorMapEntrySize == 32))
+            order[placed++] = i;
+    }
+
+    job.items  = items;
+    job.format = format;
+    job.atlas  = atlas;
+
+    if (!pool && count)
+        own = pool = targaPoolCreate(0, 0);
+
+    if (!pool && count)
+    {
+        free(order);
+        free(sorted);
+        free(line);
+        return TARGA_ERR_NO_MEMORY;
+    }
+
+    if (placed)
+        targaPoolRun(pool, placed, order, targaAtlasTrim, &job);
+
+    /*
+     * Packing, for every power of two width
+     */
+    unsigned int widest = 0;
+
+    placed = 0;
+    for (i = 0; i < count; i++)
+    {
+        TARGA_ATLAS_ITEM* item = &items[i];
+
+        if (item->status != TARGA_OK || item->rect.width == 0 || item->rect.height == 0)
+            continue;
+
+        if (item->rect.width + 2 * padding > maxWidth)
+        {
+            item->status = TARGA_ERR_ARGUMENT;
+            memset(&item->rect, 0, sizeof(item->rect));
+            continue;
+        }
+
+        if (item->rect.width > widest)
+            widest = item->rect.width;
+
+        sorted[placed].height = item->rect.height;
+        sorted[placed].width  = item->rect.width;
+        sorted[placed].index  = i;
+        placed++;
+    }
+
+    qsort(sorted, placed, sizeof(TGA_ATLAS_ORDER), targaAtlasCompare);
+
+    for (i = 0; i < placed; i++)
+        order[i] = sorted[i].index;
+    free(sorted);
+
+    unsigned int bestWidth = 0, bestHeight = 0, width = 1;
+
+    while (width < widest + 2 * padding)
+        width *= 2;
+
+    for (; placed; width *= 2)
+    {
+        unsigned int binWidth = width < maxWidth ? width : maxWidth;
+        unsigned int height = targaAtlasPack(items, order, placed,
+                binWidth - padding, padding, line, 0);
+
+        if (height && height <= TGA_ATLAS_MAX_HEIGHT &&
+            (!bestWidth || (uint64_t)binWidth * height < (uint64_t)bestWidth * bestHeight))
+        {
+            bestWidth = binWidth;
+            bestHeight = height;
+        }
+
+        if (binWidth == maxWidth)
+            break;
+    }
+
+    int result = TARGA_OK;
+
+    if (placed && !bestWidth)
+        result = TARGA_ERR_ARGUMENT;
+
+    /*
+     * Decoding into place
+     */
+    if (result == TARGA_OK && placed)
+    {
+        targaAtlasPack(items, order, placed, bestWidth - padding, padding, line, 1);
+
+        atlas->width  = bestWidth;
+        atlas->height = bestHeight;
+        atlas->format = format;
+        atlas->origin = TARGA_ORIGIN_TOP_LEFT;
+        atlas->pitch  = bestWidth * targaFormatBpp(format);
+        atlas->levels = 1;
+        atlas->memory = calloc(atlas->pitch * atlas->height, 1);
+        atlas->pixels = atlas->memory;
+
+        if (atlas->memory)
+            targaPoolRun(pool, placed, order, targaAtlasDecode, &job);
+        else
+            result = TARGA_ERR_NO_MEMORY;
+    }
+
+    free(order);
+    free(line);
+    targaPoolDestroy(own);
+
+    if (result != TARGA_OK)
+    {
+        memset(atlas, 0, sizeof(*atlas));
+        return result;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (items[i].status != TARGA_OK)
+        {
+            memset(&items[i].rect, 0, sizeof(items[i].rect));
+            if (result == TARGA_OK)
+                result = items[i].status;
+        }
+    }
+
+    return result;
+
+}
@@ -0,0 +1,990 @@
+/*
+ * MIT License
+ *
+ * TARGA Copyright (c) 2016 Sebastien Serre <ssbx@sysmo.io>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Block compression
+ *
+ * Block formats are decoded to RGBA8 into bands of 4 rows, each band
+ * encoded into a row of blocks as soon as its last row is decoded. With
+ * threads the bands are gathered into a slab of TGA_BC_SLAB_BANDS and the
+ * slab is encoded in parallel once full, so the decoder never holds more
+ * than a slab of pixels whatever the size of the image.
+ *
+ * Every encoder fits a line through the colors of the block: its axis is
+ * the principal axis of their covariance (a few power iterations), the
+ * endpoints the two pixels lying furthest along it. Pixels are given the
+ * palette entry nearest along the line, then the endpoints are refitted
+ * by least squares over those indices and kept if the error drops. The
+ * projections on the line are the inner loop, in AVX2 where available.
+ *
+ * BC1 always uses the 4 colors mode, BC4 and BC5 the 8 values mode. BC7
+ * only uses mode 6 (one subset, RGBA endpoints with a p-bit each, 16
+ * weights): a fraction of what the format can do, at the speed of BC1.
+ */
+#include "targa_private.h"
+#include <string.h>
+
+#define TGA_BC_SLAB_BANDS 32
+
+
+/*
+ * The loops over the 16 pixels of a 4x4 RGBA block.
+ *
+ * project: dot[i], the projection of pixel i on dir.
+ * assign: steps[i], the palette entry nearest to pixel i along dir,
+ * round((dot[i] - start) * scale) within [0, last]. Return the squared
+ * error of the first channels of the pixels against palette[channel][step].
+ */
+typedef struct {
+    void (*project)(const uint8_t* block, const int* dir, int* dot);
+    int  (*assign)(const uint8_t* block, const int* dir, int start, float scale,
+                   int last, const int (*palette)[16], int channels, int* steps);
+} TGA_BC_KERNELS;
+
+typedef void (*TGA_BLOCK_FN)(const uint8_t* block, const TGA_BC_KERNELS* kernels, uint8_t* out);
+
+
+struct TGA_BC {
+    uint8_t*        blocks;
+    size_t          pitch;          /* bytes between rows of blocks */
+    size_t          width;
+    size_t          height;
+    size_t          blockSize;
+    int             flip;
+    unsigned int    threads;
+
+    uint8_t*        slab;           /* bands of 4 RGBA rows */
+    size_t          rowPitch;
+    size_t          bands;          /* of the slab */
+    size_t*         pending;        /* complete bands not encoded yet */
+    size_t          count;
+
+    TGA_BLOCK_FN    encode;
+    TGA_BC_KERNELS  kernels;
+};
+
+
+static void targaBcProject(const uint8_t* block, const int* dir, int* dot)
+{
+
+    int i;
+
+    for (i = 0; i < 16; i++)
+        dot[i] = block[i * 4] * dir[0] + block[i * 4 + 1] * dir[1]
+               + block[i * 4 + 2] * dir[2] + block[i * 4 + 3] * dir[3];
+
+}
+
+
+static int targaBcClamp(int value, int low, int high)
+{
+    return value < low ? low : value > high ? high : value;
+}
+
+
+static int targaBcAssign(
+        const uint8_t* block,
+        const int* dir,
+        int start,
+        float scale,
+        int last,
+        const int (*palette)[16],
+        int channels,
+        int* steps)
+{
+
+    int dot[16], i, k, error = 0;
+
+    targaBcProject(block, dir, dot);
+
+    for (i = 0; i < 16; i++)
+    {
+        int step = targaBcClamp((int)((float)(dot[i] - start) * scale + 1.5f) - 1, 0, last);
+
+        for (k = 0; k < channels; k++)
+        {
+            int difference = block[i * 4 + k] - palette[k][step];
+            error += difference * difference;
+        }
+
+        steps[i] = step;
+    }
+
+    return error;
+
+}
+
+
+#ifdef TGA_X86
+TGA_TARGET("avx2")
+static void targaBcProjectAvx2(const uint8_t* block, const int* dir, int* dot)
+{
+
+    /* 4 pixels as 16 bits per register, channel pairs summed by madd */
+    const __m256i weights = _mm256_setr_epi16(
+            (short)dir[0], (short)dir[1], (short)dir[2], (short)dir[3],
+            (short)dir[0], (short)dir[1], (short)dir[2], (short)dir[3],
+            (short)dir[0], (short)dir[1], (short)dir[2], (short)dir[3],
+            (short)dir[0], (short)dir[1], (short)dir[2], (short)dir[3]);
+    const __m256i order = _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7);
+    int i;
+
+    for (i = 0; i < 2; i++)
+    {
+        const __m128i* src = (const __m128i*)(block + i * 32);
+        __m256i a = _mm256_madd_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128(src)), weights);
+        __m256i b = _mm256_madd_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128(src + 1)), weights);
+
+        /* pixels 0 1 4 5 2 3 6 7 */
+        __m256i sums = _mm256_hadd_epi32(a, b);
+        _mm256_storeu_si256((__m256i*)(dot + i * 8), _mm256_permutevar8x32_epi32(sums, order));
+    }
+
+}
+
+
+TGA_TARGET("avx2")
+static int targaBcAssignAvx2(
+        const uint8_t* block,
+        const int* dir,
+        int start,
+        float scale,
+        int last,
+        const int (*palette)[16],
+        int channels,
+        int* steps)
+{
+
+    const __m256i mask = _mm256_set1_epi32(0xFF);
+    const __m256i seven = _mm256_set1_epi32(7);
+    __m256i error = _mm256_setzero_si256();
+    int dot[16], i, k;
+
+    targaBcProjectAvx2(block, dir, dot);
+
+    for (i = 0; i < 2; i++)
+    {
+        __m256 t = _mm256_cvtepi32_ps(_mm256_sub_epi32(
+                    _mm256_loadu_si256((const __m256i*)(dot + i * 8)), _mm256_set1_epi32(start)));
+        t = _mm256_add_ps(_mm256_mul_ps(t, _mm256_set1_ps(scale)), _mm256_set1_ps(1.5f));
+
+        __m256i step = _mm256_sub_epi32(_mm256_cvttps_epi32(t), _mm256_set1_epi32(1));
+        step = _mm256_min_epi32(_mm256_max_epi32(step, _mm256_setzero_si256()), _mm256_set1_epi32(last));
+        _mm256_storeu_si256((__m256i*)(steps + i * 8), step);
+
+        /* entries 0 to 7 and 8 to 15 of the palette, picked by the steps */
+        __m256i upper = _mm256_cmpgt_epi32(step, seven);
+        __m256i pixels = _mm256_loadu_si256((const __m256i*)(block + i * 32));
+
+        for (k = 0; k < channels; k++)
+        {
+            __m256i channel = _mm256_and_si256(
+                    _mm256_srl_epi32(pixels, _mm_cvtsi32_si128(8 * k)), mask);
+            __m256i entry = _mm256_blendv_epi8(
+                    _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i*)palette[k]), step),
+                    _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i*)(palette[k] + 8)), step),
+                    upper);
+            __m256i difference = _mm256_sub_epi32(channel, entry);
+
+            error = _mm256_add_epi32(error, _mm256_mullo_epi32(difference, difference));
+        }
+    }
+
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(error), _mm256_extracti128_si256(error, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+    return _mm_cvtsi128_si32(sum);
+
+}
+#endif // TGA_X86
+
+
+static int targaBcRound(float value)
+{
+    return (int)(value < 0 ? value - 0.5f : value + 0.5f);
+}
+
+
+/*
+ * Principal axis of the first channels of the pixels of block, and the
+ * pixels lo and hi with the lowest and highest projection on it. Return
+ * 0, lo and hi 0, if the pixels are all the same.
+ */
+static int targaBcAxis(
+        const uint8_t* block,
+        int channels,
+        const TGA_BC_KERNELS* kernels,
+        int* lo,
+        int* hi)
+{
+
+    int low[4] = { 255, 255, 255, 255 }, high[4] = { 0, 0, 0, 0 };
+    int sum[4] = { 0, 0, 0, 0 }, dir[4] = { 0, 0, 0, 0 };
+    int rr = 0, rg = 0, rb = 0, ra = 0, gg = 0, gb = 0, ga = 0, bb = 0, ba = 0, aa = 0;
+    float cov[4][4], axis[4];
+    int dot[16];
+    int i, j, k, solid = 1;
+
+    *lo = 0;
+    *hi = 0;
+
+    /* all 4 channels: straight line code the compiler vectorizes */
+    for (i = 0; i < 16; i++)
+    {
+        int r = block[i * 4], g = block[i * 4 + 1], b = block[i * 4 + 2], a = block[i * 4 + 3];
+
+        sum[0] += r;
+        sum[1] += g;
+        sum[2] += b;
+        sum[3] += a;
+        rr += r * r;
+        rg += r * g;
+        rb += r * b;
+        ra += r * a;
+        gg += g * g;
+        gb += g * b;
+        ga += g * a;
+        bb += b * b;
+        ba += b * a;
+        aa += a * a;
+    }
+
+    for (i = 0; i < 16; i++)
+    {
+        for (k = 0; k < 4; k++)
+        {
+            low[k] = block[i * 4 + k] < low[k] ? block[i * 4 + k] : low[k];
+            high[k] = block[i * 4 + k] > high[k] ? block[i * 4 + k] : high[k];
+        }
+    }
+
+    /* channels left out weigh nothing, the loops below stay 4 wide */
+    for (k = 0; k < 4; k++)
+    {
+        if (k < channels)
+            solid &= low[k] == high[k];
+        axis[k] = k < channels ? (float)(high[k] - low[k]) : 0;
+    }
+
+    if (solid)
+        return 0;
+
+    {
+        const int products[4][4] = {
+            { rr, rg, rb, ra }, { rg, gg, gb, ga }, { rb, gb, bb, ba }, { ra, ga, ba, aa }
+        };
+
+        for (j = 0; j < 4; j++)
+            for (k = 0; k < 4; k++)
+                cov[j][k] = j < channels && k < channels
+                    ? products[j][k] - sum[j] * (float)sum[k] / 16 : 0;
+    }
+
+    /* power iterations from the diagonal of the bounding box */
+    for (i = 0; i < 4; i++)
+    {
+        float next[4], scale = 0;
+
+        /* rows of the symmetric matrix as columns: 4 wide vector code */
+        for (j = 0; j < 4; j++)
+            next[j] = (cov[0][j] * axis[0] + cov[1][j] * axis[1])
+                    + (cov[2][j] * axis[2] + cov[3][j] * axis[3]);
+
+        for (j = 0; j < 4; j++)
+            scale = next[j] > scale ? next[j] : -next[j] > scale ? -next[j] : scale;
+
+        if (scale <= 0)
+            break;
+
+        scale = 1 / scale;
+        for (j = 0; j < 4; j++)
+            axis[j] = next[j] * scale;
+    }
+
+    float scale = 0;
+    for (k = 0; k < 4; k++)
+        scale = axis[k] > scale ? axis[k] : -axis[k] > scale ? -axis[k] : scale;
+
+    scale = 255 / scale;
+    for (k = 0; k < 4; k++)
+        dir[k] = targaBcRound(axis[k] * scale);
+
+    kernels->project(block, dir, dot);
+
+    int first = 0, last = 0;
+    for (i = 1; i < 16; i++)
+    {
+        first = dot[i] < dot[first] ? i : first;
+        last = dot[i] > dot[last] ? i : last;
+    }
+
+    *lo = first;
+    *hi = last;
+    return 1;
+
+}
+
+
+/*
+ * BC1, and the color of BC3
+ */
+static void targaBc1Expand(unsigned int color, int* rgb)
+{
+    int r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+
+    rgb[0] = (r << 3) | (r >> 2);
+    rgb[1] = (g << 2) | (g >> 4);
+    rgb[2] = (b << 3) | (b >> 2);
+}
+
+
+static unsigned int targaBc1Pack(const int* rgb)
+{
+    int r = targaBcClamp(rgb[0], 0, 255);
+    int g = targaBcClamp(rgb[1], 0, 255);
+    int b = targaBcClamp(rgb[2], 0, 255);
+
+    return (unsigned int)((r * 31 + 127) / 255) << 11
+         | (unsigned int)((g * 63 + 127) / 255) << 5
+         | (unsigned int)((b * 31 + 127) / 255);
+}
+
+
+/*
+ * Indices of the palette of c0 and c1 nearest along the line between
+ * them, steps[i] the position of pixel i on the line (0 at c0, 3 at c1).
+ * Return the squared error.
+ */
+static int targaBc1Indices(
+        const uint8_t* block,
+        unsigned int c0,
+        unsigned int c1,
+        const TGA_BC_KERNELS* kernels,
+        int* steps,
+        uint32_t* bits)
+{
+
+    static const int stepIndex[4] = { 0, 2, 3, 1 };
+    int palette[4][16] = { { 0 } }, e0[3], e1[3], dir[4] = { 0, 0, 0, 0 };
+    int i, k, start = 0, length = 0;
+
+    targaBc1Expand(c0, e0);
+    targaBc1Expand(c1, e1);
+
+    for (k = 0; k < 3; k++)
+    {
+        palette[k][0] = e0[k];
+        palette[k][1] = (2 * e0[k] + e1[k]) / 3;
+        palette[k][2] = (e0[k] + 2 * e1[k]) / 3;
+        palette[k][3] = e1[k];
+
+        dir[k] = e1[k] - e0[k];
+        start += e0[k] * dir[k];
+        length += dir[k] * dir[k];
+    }
+
+    int error = kernels->assign(block, dir, start,
+            length > 0 ? 3.0f / length : 0, 3, palette, 3, steps);
+
+    *bits = 0;
+    for (i = 0; i < 16; i++)
+        *bits |= (uint32_t)stepIndex[steps[i]] << (2 * i);
+
+    return error;
+
+}
+
+
+/*
+ * Least squares endpoints for the steps of the pixels. Return 0 if the
+ * steps do not determine them.
+ */
+static int targaBc1Refit(
+        const uint8_t* block,
+        const int* steps,
+        unsigned int* c0,
+        unsigned int* c1)
+{
+
+    int aa = 0, bb = 0, ab = 0, ax[3] = { 0, 0, 0 }, bx[3] = { 0, 0, 0 };
+    int i, k, e0[3], e1[3];
+
+    for (i = 0; i < 16; i++)
+    {
+        int a = 3 - steps[i], b = steps[i];
+
+        aa += a * a;
+        bb += b * b;
+        ab += a * b;
+        for (k = 0; k < 3; k++)
+        {
+            ax[k] += a * block[i * 4 + k];
+            bx[k] += b * block[i * 4 + k];
+        }
+    }
+
+    int det = aa * bb - ab * ab;
+    if (det == 0)
+        return 0;
+
+    float scale = 3.0f / det;
+    for (k = 0; k < 3; k++)
+    {
+        e0[k] = targaBcRound((ax[k] * bb - bx[k] * ab) * scale);
+        e1[k] = targaBcRound((bx[k] * aa - ax[k] * ab) * scale);
+    }
+
+    *c0 = targaBc1Pack(e0);
+    *c1 = targaBc1Pack(e1);
+    return 1;
+
+}
+
+
+static void targaBc1Store(uint8_t* out, unsigned int c0, unsigned int c1, uint32_t bits)
+{
+
+    /* c0 > c1 selects the 4 colors mode: swapping swaps 0 with 1, 2 with 3 */
+    if (c0 < c1)
+    {
+        unsigned int swap = c0;
+        c0 = c1;
+        c1 = swap;
+        bits ^= 0x55555555;
+    }
+    else if (c0 == c1)
+        bits = 0;
+
+    out[0] = (uint8_t)c0;
+    out[1] = (uint8_t)(c0 >> 8);
+    out[2] = (uint8_t)c1;
+    out[3] = (uint8_t)(c1 >> 8);
+    out[4] = (uint8_t)bits;
+    out[5] = (uint8_t)(bits >> 8);
+    out[6] = (uint8_t)(bits >> 16);
+    out[7] = (uint8_t)(bits >> 24);
+
+}
+
+
+/*
+ * A single color: every channel is the 2/3 point of the pair of 5 or 6
+ * bits values closest to it, nearer than the rounded value alone.
+ */
+static void targaBc1Solid(const uint8_t* pixel, uint8_t* out)
+{
+
+    static const int bits[3] = { 5, 6, 5 };
+    unsigned int c0 = 0, c1 = 0;
+    int k;
+
+    for (k = 0; k < 3; k++)
+    {
+        int top = (1 << bits[k]) - 1;
+        int q = (pixel[k] * top + 127) / 255;
+        int best = 256, a, b, bestA = q, bestB = q;
+
+        for (a = q - 2; a <= q + 2; a++)
+        {
+            for (b = q - 2; b <= q + 2; b++)
+            {
+                if (a < 0 || b < 0 || a > top || b > top)
+                    continue;
+
+                int ea = bits[k] == 5 ? (a << 3) | (a >> 2) : (a << 2) | (a >> 4);
+                int eb = bits[k] == 5 ? (b << 3) | (b >> 2) : (b << 2) | (b >> 4);
+                int error = (2 * ea + eb) / 3 - pixel[k];
+
+                error = error < 0 ? -error : error;
+                if (error < best)
+                {
+                    best  = error;
+                    bestA = a;
+                    bestB = b;
+                }
+            }
+        }
+
+        c0 = (c0 << bits[k]) | (unsigned int)bestA;
+        c1 = (c1 << bits[k]) | (unsigned int)bestB;
+    }
+
+    targaBc1Store(out, c0, c1, 0xAAAAAAAA);
+
+}
+
+
+static void targaBc1Color(const uint8_t* block, const TGA_BC_KERNELS* kernels, uint8_t* out)
+{
+
+    int lo, hi, k, e0[3], e1[3], steps[16];
+    unsigned int c0, c1, r0, r1;
+    uint32_t bits, refitBits;
+
+    if (!targaBcAxis(block, 3, kernels, &lo, &hi))
+    {
+        targaBc1Solid(block, out);
+        return;
+    }
+
+    for (k = 0; k < 3; k++)
+    {
+        e0[k] = block[lo * 4 + k];
+        e1[k] = block[hi * 4 + k];
+    }
+
+    c0 = targaBc1Pack(e0);
+    c1 = targaBc1Pack(e1);
+
+    int error = targaBc1Indices(block, c0, c1, kernels, steps, &bits);
+
+    if (targaBc1Refit(block, steps, &r0, &r1) &&
+        targaBc1Indices(block, r0, r1, kernels, steps, &refitBits) < error)
+    {
+        c0   = r0;
+        c1   = r1;
+        bits = refitBits;
+    }
+
+    targaBc1Store(out, c0, c1, bits);
+
+}
+
+
+/*
+ * BC4, BC5 and the alpha of BC3: the 8 values mode, from the highest
+ * value (e0) to the lowest (e1).
+ */
+static void targaBc4Channel(const uint8_t* block, int channel, uint8_t* out)
+{
+
+    int low = 255, high = 0, i;
+    uint64_t bits = 0;
+
+    for (i = 0; i < 16; i++)
+    {
+        int value = block[i * 4 + channel];
+
+        low = value < low ? value : low;
+        high = value > high ? value : high;
+    }
+
+    if (high > low)
+    {
+        float scale = 7.0f / (high - low);
+
+        for (i = 0; i < 16; i++)
+        {
+            /* step s of 7 from e0 is index s + 1, e1 is index 1 */
+            int step = (int)((high - block[i * 4 + channel]) * scale + 0.5f);
+            int index = step == 0 ? 0 : step == 7 ? 1 : step + 1;
+
+            bits |= (uint64_t)index << (3 * i);
+        }
+    }
+
+    out[0] = (uint8_t)high;
+    out[1] = (uint8_t)low;
+    for (i = 0; i < 6; i++)
+        out[2 + i] = (uint8_t)(bits >> (8 * i));
+
+}
+
+
+/*
+ * BC7 mode 6
+ */
+static const int targaBc7Weights[16] = {
+    0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64
+};
+
+typedef struct {
+    int     value[2][4];        /* 7 bits endpoints */
+    int     pbit[2];
+    int     index[16];
+    int     error;
+} TGA_BC7_FIT;
+
+
+/*
+ * 7 bits and p-bit of an RGBA endpoint, the p-bit with the least error.
+ */
+static void targaBc7Quantize(const int* endpoint, int* value, int* pbit)
+{
+
+    int best = -1, p, k;
+
+    for (p = 0; p < 2; p++)
+    {
+        int q[4], error = 0;
+
+        for (k = 0; k < 4; k++)
+        {
+            int v = targaBcClamp(endpoint[k], 0, 255);
+
+            q[k] = targaBcClamp((v - p + 1) >> 1, 0, 127);
+            error += (v - (q[k] * 2 + p)) * (v - (q[k] * 2 + p));
+        }
+
+        if (best < 0 || error < best)
+        {
+            best = error;
+            *pbit = p;
+            memcpy(value, q, sizeof(q));
+        }
+    }
+
+}
+
+
+/*
+ * Quantize the endpoints e0 and e1 and give every pixel the weight
+ * nearest along the line between them: the weights are close enough to
+ * i * 64 / 15 for the rounded position to be the nearest one.
+ */
+static void targaBc7Fit(
+        const uint8_t* block,
+        const int* e0,
+        const int* e1,
+        const TGA_BC_KERNELS* kernels,
+        TGA_BC7_FIT* fit)
+{
+
+    int ends[2][4], palette[4][16], dir[4];
+    int i, k, start = 0, length = 0;
+
+    targaBc7Quantize(e0, fit->value[0], &fit->pbit[0]);
+    targaBc7Quantize(e1, fit->value[1], &fit->pbit[1]);
+
+    for (k = 0; k < 4; k++)
+    {
+        ends[0][k] = fit->value[0][k] * 2 + fit->pbit[0];
+        ends[1][k] = fit->value[1][k] * 2 + fit->pbit[1];
+        dir[k] = ends[1][k] - ends[0][k];
+        start += ends[0][k] * dir[k];
+        length += dir[k] * dir[k];
+
+        for (i = 0; i < 16; i++)
+            palette[k][i] = (ends[0][k] * (64 - targaBc7Weights[i])
+                    + ends[1][k] * targaBc7Weights[i] + 32) >> 6;
+    }
+
+    fit->error = kernels->assign(block, dir, start,
+            length > 0 ? 15.0f / length : 0, 15, palette, 4, fit->index);
+
+}
+
+
+static void targaBc7Put(uint64_t* words, unsigned int* position, uint64_t value, unsigned int count)
+{
+
+    unsigned int shift = *position & 63;
+
+    words[*position >> 6] |= value << shift;
+    if (shift + count > 64)
+        words[(*position >> 6) + 1] |= value >> (64 - shift);
+
+    *position += count;
+
+}
+
+
+static void targaBc7Block(const uint8_t* block, const TGA_BC_KERNELS* kernels, uint8_t* out)
+{
+
+    TGA_BC7_FIT fit, refit;
+    int e0[4], e1[4], lo, hi, i, k;
+
+    targaBcAxis(block, 4, kernels, &lo, &hi);
+
+    for (k = 0; k < 4; k++)
+    {
+        e0[k] = block[lo * 4 + k];
+        e1[k] = block[hi * 4 + k];
+    }
+
+    targaBc7Fit(block, e0, e1, kernels, &fit);
+
+    /* least squares endpoints for the weights found */
+    float aa = 0, bb = 0, ab = 0, ax[4] = { 0 }, bx[4] = { 0 };
+
+    for (i = 0; i < 16; i++)
+    {
+        float b = targaBc7Weights[fit.index[i]] / 64.0f, a = 1 - b;
+
+        aa += a * a;
+        bb += b * b;
+        ab += a * b;
+        for (k = 0; k < 4; k++)
+        {
+            ax[k] += a * block[i * 4 + k];
+            bx[k] += b * block[i * 4 + k];
+        }
+    }
+
+    float det = aa * bb - ab * ab;
+    if (det > 1e-6f)
+    {
+        for (k = 0; k < 4; k++)
+        {
+            e0[k] = targaBcRound((ax[k] * bb - bx[k] * ab) / det);
+            e1[k] = targaBcRound((bx[k] * aa - ax[k] * ab) / det);
+        }
+
+        targaBc7Fit(block, e0, e1, kernels, &refit);
+        if (refit.error < fit.error)
+            fit = refit;
+    }
+
+    /* the first index has an implicit 0 high bit */
+    if (fit.index[0] >= 8)
+    {
+        for (k = 0; k < 4; k++)
+        {
+            int swap = fit.value[0][k];
+            fit.value[0][k] = fit.value[1][k];
+            fit.value[1][k] = swap;
+        }
+
+        int swap = fit.pbit[0];
+        fit.pbit[0] = fit.pbit[1];
+        fit.pbit[1] = swap;
+
+        for (i = 0; i < 16; i++)
+            fit.index[i] = 15 - fit.index[i];
+    }
+
+    uint64_t words[2] = { 0, 0 };
+    unsigned int position = 0;
+
+    targaBc7Put(words, &position, 1 << 6, 7);
+    for (k = 0; k < 4; k++)
+    {
+        targaBc7Put(words, &position, (uint64_t)fit.value[0][k], 7);
+        targaBc7Put(words, &position, (uint64_t)fit.value[1][k], 7);
+    }
+    targaBc7Put(words, &position, (uint64_t)fit.pbit[0], 1);
+    targaBc7Put(words, &position, (uint64_t)fit.pbit[1], 1);
+
+    targaBc7Put(words, &position, (uint64_t)fit.index[0], 3);
+    for (i = 1; i < 16; i++)
+        targaBc7Put(words, &position, (uint64_t)fit.index[i], 4);
+
+    for (i = 0; i < 16; i++)
+        out[i] = (uint8_t)(words[i >> 3] >> (8 * (i & 7)));
+
+}
+
+
+static void targaBc1Block(const uint8_t* block, const TGA_BC_KERNELS* kernels, uint8_t* out)
+{
+    targaBc1Color(block, kernels, out);
+}
+
+static void targaBc3Block(const uint8_t* block, const TGA_BC_KERNELS* kernels, uint8_t* out)
+{
+    targaBc4Channel(block, 3, out);
+    targaBc1Color(block, kernels, out + 8);
+}
+
+static void targaBc4Block(const uint8_t* block, const TGA_BC_KERNELS* kernels, uint8_t* out)
+{
+    (void)kernels;
+    targaBc4Channel(block, 0, out);
+}
+
+static void targaBc5Block(const uint8_t* block, const TGA_BC_KERNELS* kernels, uint8_t* out)
+{
+    (void)kernels;
+    targaBc4Channel(block, 0, out);
+    targaBc4Channel(block, 1, out + 8);
+}
+
+
+size_t targaBlockSize(unsigned int format)
+{
+    switch (format)
+    {
+        case TARGA_FORMAT_BC1:
+        case TARGA_FORMAT_BC4:
+            return 8;
+        case TARGA_FORMAT_BC3:
+        case TARGA_FORMAT_BC5:
+        case TARGA_FORMAT_BC7:
+            return 16;
+        default:
+            return 0;
+    }
+}
+
+
+/*
+ * Bands
+ */
+static void targaBcBandTask(void* context, size_t index)
+{
+
+    TGA_BC* bc = context;
+    size_t band = bc->pending[index];
+    size_t rows = bc->height - band * 4 < 4 ? bc->height - band * 4 : 4;
+    const uint8_t* src = bc->slab + (band % bc->bands) * 4 * bc->rowPitch;
+    uint8_t* dst = bc->blocks + band * bc->pitch;
+    uint8_t block[64];
+    size_t x, r, c;
+
+    for (x = 0; x < bc->width; x += 4)
+    {
+        /* blocks over the edges repeat the last row and column */
+        for (r = 0; r < 4; r++)
+        {
+            const uint8_t* row = src + (r < rows ? r : rows - 1) * bc->rowPitch;
+
+            if (x + 4 <= bc->width)
+                memcpy(block + r * 16, row + x * 4, 16);
+            else
+                for (c = 0; c < 4; c++)
+                    memcpy(block + r * 16 + c * 4,
+                            row + (x + c < bc->width ? x + c : bc->width - 1) * 4, 4);
+        }
+
+        bc->encode(block, &bc->kernels, dst + x / 4 * bc->blockSize);
+    }
+
+}
+
+
+int targaBcCreate(
+        const TARGA_IMAGE*  image,
+        unsigned int        threads,
+        int                 flip,
+        TGA_BC**            bc)
+{
+
+    TGA_BC* self = calloc(1, sizeof(TGA_BC));
+    size_t bands = (image->height + 3) / 4;
+
+    *bc = NULL;
+    if (!self)
+        return TARGA_ERR_NO_MEMORY;
+
+    self->blocks    = image->pixels;
+    self->pitch     = image->pitch;
+    self->width     = image->width;
+    self->height    = image->height;
+    self->blockSize = targaBlockSize(image->format);
+    self->flip      = flip;
+    self->threads   = threads;
+    self->rowPitch  = (image->width + 3) / 4 * 16;
+    self->bands     = threads > 1 && bands > 1
+        ? (bands < TGA_BC_SLAB_BANDS ? bands : TGA_BC_SLAB_BANDS) : 1;
+    self->kernels.project = targaBcProject;
+    self->kernels.assign  = targaBcAssign;
+
+#ifdef TGA_X86
+    if (targaCpuFeatures() & CPU_AVX2)
+    {
+        self->kernels.project = targaBcProjectAvx2;
+        self->kernels.assign  = targaBcAssignAvx2;
+    }
+#endif
+
+    switch (image->format)
+    {
+        case TARGA_FORMAT_BC1:
+            self->encode = targaBc1Block;
+            break;
+        case TARGA_FORMAT_BC3:
+            self->encode = targaBc3Block;
+            break;
+        case TARGA_FORMAT_BC4:
+            self->encode = targaBc4Block;
+            break;
+        case TARGA_FORMAT_BC5:
+            self->encode = targaBc5Block;
+            break;
+        default:
+            self->encode = targaBc7Block;
+            break;
+    }
+
+    self->slab    = malloc(self->bands * 4 * self->rowPitch + 1);
+    self->pending = malloc(self->bands * sizeof(size_t));
+    if (!self->slab || !self->pending)
+    {
+        targaBcDestroy(self);
+        return TARGA_ERR_NO_MEMORY;
+    }
+
+    *bc = self;
+    return TARGA_OK;
+
+}
+
+
+uint8_t* targaBcBand(TGA_BC* bc, size_t y)
+{
+
+    if (bc->flip)
+        y = bc->height - 1 - y;
+
+    return bc->slab + ((y / 4 % bc->bands) * 4 + y % 4) * bc->rowPitch;
+
+}
+
+
+void targaBcRow(TGA_BC* bc, size_t y)
+{
+
+    if (bc->flip)
+        y = bc->height - 1 - y;
+
+    /* the last row of its band to be decoded */
+    int complete = bc->flip ? y % 4 == 0 : y % 4 == 3 || y == bc->height - 1;
+    if (!complete)
+        return;
+
+    size_t band = y / 4;
+    int last = bc->flip ? band == 0 : y == bc->height - 1;
+
+    bc->pending[bc->count++] = band;
+    if (bc->count == bc->bands || last)
+    {
+        targaParallelFor(bc->threads, bc->count, targaBcBandTask, bc);
+        bc->count = 0;
+    }
+
+}
+
+
+void targaBcDestroy(TGA_BC* bc)
+{
+
+    if (!bc)
+        return;
+
+    free(bc->slab);
+    free(bc->pending);
+    free(bc);
+
+}
@@ -0,0 +1,590 @@
+/*
+ * MIT License
+ *
+ * TARGA Copyright (c) 2016 Sebastien Serre <ssbx@sysmo.io>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Decoding benchmark
+ *
+ * A synthetic image is generated in memory for every kind (image type and
+ * depth), size and entropy, then timed in three phases:
+ *
+ *   parse    targaProbeMemory(), the header alone
+ *   decode   targaLoadMemory() to the file layout (a plain copy of the
+ *            pixels, after RLE expansion or color map lookup for 8 bits
+ *            indices), when the kind has one
+ *   load     targaLoadMemory() to the requested format
+ *
+ * convert is load - decode. Every time is the best of the runs made
+ * within --min-time. Results are written as JSON.
+ *
+ * Entropy is the probability for a pixel to differ from the previous one:
+ * 1 gives noise (raw packets only), 0.01 runs of about 100 pixels.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <targa.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+
+/*
+ * Allocations made by the library, counted when the build wraps malloc
+ * (see CMakeLists.txt), -1 otherwise.
+ */
+#ifdef TARGA_BENCH_WRAP_MALLOC
+static long benchAllocations = 0;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* p, size_t size);
+
+void* __wrap_malloc(size_t size)
+{
+    __atomic_fetch_add(&benchAllocations, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size)
+{
+    __atomic_fetch_add(&benchAllocations, 1, __ATOMIC_RELAXED);
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* p, size_t size)
+{
+    __atomic_fetch_add(&benchAllocations, 1, __ATOMIC_RELAXED);
+    return __real_realloc(p, size);
+}
+
+static long benchAllocationCount(void)
+{
+    return __atomic_load_n(&benchAllocations, __ATOMIC_RELAXED);
+}
+#else
+static long benchAllocationCount(void)
+{
+    return -1;
+}
+#endif
+
+
+static double benchNow(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+#endif
+}
+
+
+/*
+ * Corpus
+ */
+typedef struct {
+    const char*  name;
+    uint8_t      imageType;
+    uint8_t      pixelDepth;
+    uint8_t      mapEntrySize;      /* color mapped kinds */
+    uint16_t     mapLength;
+    uint8_t      descriptor;        /* attribute bits */
+    unsigned int fileFormat;        /* format decoded as a copy, AUTO if none */
+} BENCH_KIND;
+
+static const BENCH_KIND benchKinds[] = {
+    { "raw15",     2, 15,  0,    0, 0, TARGA_FORMAT_AUTO },
+    { "raw16",     2, 16,  0,    0, 1, TARGA_FORMAT_AUTO },
+    { "raw24",     2, 24,  0,    0, 0, TARGA_FORMAT_BGR8 },
+    { "raw32",     2, 32,  0,    0, 8, TARGA_FORMAT_BGRA8 },
+    { "rle16",    10, 16,  0,    0, 1, TARGA_FORMAT_AUTO },
+    { "rle24",    10, 24,  0,    0, 0, TARGA_FORMAT_BGR8 },
+    { "rle32",    10, 32,  0,    0, 8, TARGA_FORMAT_BGRA8 },
+    { "gray8",     3,  8,  0,    0, 0, TARGA_FORMAT_GRAY8 },
+    { "gray16",    3, 16,  0,    0, 8, TARGA_FORMAT_AUTO },
+    { "rlegray8", 11,  8,  0,    0, 0, TARGA_FORMAT_GRAY8 },
+    { "rlegray16",11, 16,  0,    0, 8, TARGA_FORMAT_AUTO },
+    { "map8",      1,  8, 24,  256, 0, TARGA_FORMAT_INDEX8 },
+    { "map16",     1, 16, 32, 4096, 0, TARGA_FORMAT_AUTO },
+    { "rlemap8",   9,  8, 24,  256, 0, TARGA_FORMAT_INDEX8 },
+    { "rlemap16",  9, 16, 32, 4096, 0, TARGA_FORMAT_AUTO },
+};
+
+#define BENCH_KIND_COUNT (sizeof(benchKinds) / sizeof(benchKinds[0]))
+
+
+typedef struct {
+    uint8_t* data;
+    size_t   size;
+    size_t   capacity;
+} BENCH_BUFFER;
+
+
+static void benchPut(BENCH_BUFFER* buffer, const void* data, size_t size)
+{
+    if (buffer->size + size > buffer->capacity)
+    {
+        buffer->capacity = (buffer->size + size) * 2;
+        buffer->data = realloc(buffer->data, buffer->capacity);
+        if (!buffer->data)
+        {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+}
+
+
+static uint32_t benchRandom(uint32_t* seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 8;
+}
+
+
+/*
+ * RLE compress count pixels of bpp bytes, packets do not cross rows.
+ */
+static void benchPutRle(
+        BENCH_BUFFER*   buffer,
+        const uint8_t*  pixels,
+        size_t          width,
+        size_t          height,
+        size_t          bpp)
+{
+    size_t y;
+
+    for (y = 0; y < height; y++)
+    {
+        const uint8_t* row = pixels + y * width * bpp;
+        size_t i = 0;
+
+        while (i < width)
+        {
+            size_t n = 1;
+            uint8_t packet;
+
+            while (i + n < width && n < 128 &&
+                   memcmp(row + (i + n) * bpp, row + i * bpp, bpp) == 0)
+                n++;
+
+            if (n > 1)
+            {
+                packet = (uint8_t)(0x80 | (n - 1));
+                benchPut(buffer, &packet, 1);
+                benchPut(buffer, row + i * bpp, bpp);
+            }
+            else
+            {
+                while (i + n < width && n < 128 &&
+                       memcmp(row + (i + n) * bpp, row + (i + n - 1) * bpp, bpp) != 0)
+                    n++;
+
+                packet = (uint8_t)(n - 1);
+                benchPut(buffer, &packet, 1);
+                benchPut(buffer, row + i * bpp, n * bpp);
+            }
+
+            i += n;
+        }
+    }
+}
+
+
+/*
+ * Generate a width x height image of the given kind into buffer.
+ */
+static void benchGenerate(
+        BENCH_BUFFER*       buffer,
+        const BENCH_KIND*   kind,
+        size_t              width,
+        size_t              height,
+        double              entropy)
+{
+    size_t bpp = (kind->pixelDepth + 7) >> 3;
+    size_t count = width * height, i, j;
+    size_t entryBpp = (kind->mapEntrySize + 7) >> 3;
+    uint32_t threshold = (uint32_t)(entropy * 0xFFFFFF);
+    uint32_t seed = 12345;
+    uint8_t header[18] = {0};
+
+    uint8_t* pixels = malloc(count * bpp);
+    if (!pixels)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (i > 0 && benchRandom(&seed) >= threshold)
+        {
+            memcpy(pixels + i * bpp, pixels + (i - 1) * bpp, bpp);
+            continue;
+        }
+
+        if (kind->mapLength)
+        {
+            uint32_t index = benchRandom(&seed) % kind->mapLength;
+            pixels[i * bpp] = (uint8_t)index;
+            if (bpp == 2)
+                pixels[i * bpp + 1] = (uint8_t)(index >> 8);
+            continue;
+        }
+
+        for (j = 0; j < bpp; j++)
+            pixels[i * bpp + j] = (uint8_t)benchRandom(&seed);
+    }
+
+    header[1]  = kind->mapLength ? 1 : 0;
+    header[2]  = kind->imageType;
+    header[5]  = kind->mapLength & 0xFF;
+    header[6]  = kind->mapLength >> 8;
+    header[7]  = kind->mapEntrySize;
+    header[12] = width & 0xFF;
+    header[13] = (uint8_t)(width >> 8);
+    header[14] = height & 0xFF;
+    header[15] = (uint8_t)(height >> 8);
+    header[16] = kind->pixelDepth;
+    header[17] = kind->descriptor;
+
+    buffer->size = 0;
+    benchPut(buffer, header, sizeof(header));
+
+    for (i = 0; i < (size_t)kind->mapLength * entryBpp; i++)
+    {
+        uint8_t entry = (uint8_t)benchRandom(&seed);
+        benchPut(buffer, &entry, 1);
+    }
+
+    if (kind->imageType >= 9)
+        benchPutRle(buffer, pixels, width, height, bpp);
+    else
+        benchPut(buffer, pixels, count * bpp);
+
+    free(pixels);
+}
+
+
+/*
+ * Timing
+ */
+typedef struct {
+    double minTime;         /* seconds spent on each measure */
+    unsigned int threads;
+    unsigned int format;
+} BENCH_CONFIG;
+
+
+/*
+ * Best time of a load of data to format, -1 on failure. allocations is
+ * set to the allocations made by one load, bytes to the size of the
+ * pixels.
+ */
+static double benchLoad(
+        const BENCH_CONFIG* config,
+        const BENCH_BUFFER* buffer,
+        unsigned int        format,
+        long*               allocations,
+        size_t*             bytes)
+{
+    TARGA_LOAD_OPTIONS options = {0};
+    TARGA_IMAGE image;
+    double best = -1, start = benchNow();
+    int runs = 0;
+
+    options.format  = format;
+    options.threads = config->threads;
+
+    while (runs < 3 || benchNow() - start < config->minTime)
+    {
+        long before = benchAllocationCount();
+        double t = benchNow();
+
+        if (targaLoadMemory(buffer->data, buffer->size, &options, &image) != TARGA_OK)
+            return -1;
+
+        t = benchNow() - t;
+        if (allocations)
+            *allocations = before < 0 ? -1 : benchAllocationCount() - before;
+        if (bytes)
+            *bytes = image.pitch * image.height;
+
+        targaImageFree(&image);
+
+        if (best < 0 || t < best)
+            best = t;
+        runs++;
+    }
+
+    return best;
+}
+
+
+static double benchParse(const BENCH_CONFIG* config, const BENCH_BUFFER* buffer)
+{
+    TARGA_INFO info;
+    double best = -1, start = benchNow();
+    int runs = 0, i;
+
+    while (runs < 3 || benchNow() - start < config->minTime / 10)
+    {
+        double t = benchNow();
+
+        for (i = 0; i < 1000; i++)
+            targaProbeMemory(buffer->data, buffer->size, 0, &info);
+
+        t = (benchNow() - t) / 1000;
+        if (best < 0 || t < best)
+            best = t;
+        runs++;
+    }
+
+    return best;
+}
+
+
+static void benchJsonTime(FILE* out, const char* name, double seconds)
+{
+    if (seconds < 0)
+        fprintf(out, "\"%s\": null, ", name);
+    else
+        fprintf(out, "\"%s\": %.6f, ", name, seconds * 1e3);
+}
+
+
+/*
+ * Options
+ */
+static size_t benchList(const char* text, double* values, size_t max)
+{
+    size_t count = 0;
+    char* end;
+
+    while (*text && count < max)
+    {
+        values[count++] = strtod(text, &end);
+        if (end == text)
+            return 0;
+        text = *end == ',' ? end + 1 : end;
+    }
+
+    return count;
+}
+
+
+static const char* benchFormatNames[] = {
+    "auto", "rgb8", "rgba8", "bgr8", "bgra8", "gray8", "premultiplied", "keyed", "index8"
+};
+
+
+static void benchUsage(const char* program)
+{
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  --sizes 64,256,...     square image sizes (64 to 16384)\n"
+        "  --entropy 0.01,1,...   probability for a pixel to differ from the previous one\n"
+        "  --kinds raw24,rle32,... image kinds, all by default:\n"
+        "                         raw15 raw16 raw24 raw32 rle16 rle24 rle32 gray8 gray16\n"
+        "                         rlegray8 rlegray16 map8 map16 rlemap8 rlemap16\n"
+        "  --format rgba8         auto, rgb8, rgba8, bgr8, bgra8, gray8, premultiplied, keyed\n"
+        "  --threads n            decoding threads\n"
+        "  --min-time seconds     time spent on each measure (0.2)\n"
+        "  --output file.json     standard output by default\n",
+        program);
+}
+
+
+int main(int argc, char* argv[])
+{
+
+    BENCH_CONFIG config = { 0.2, 0, TARGA_FORMAT_RGBA8 };
+    double sizes[16] = { 64, 256, 1024, 4096 };
+    double entropies[16] = { 0.01, 0.3, 1 };
+    size_t sizeCount = 4, entropyCount = 3;
+    const char* kinds = NULL;
+    const char* output = NULL;
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        size_t f;
+
+        if (!value)
+        {
+            benchUsage(argv[0]);
+            return 1;
+        }
+
+        if (strcmp(argv[i], "--sizes") == 0)
+            sizeCount = benchList(value, sizes, 16);
+        else if (strcmp(argv[i], "--entropy") == 0)
+            entropyCount = benchList(value, entropies, 16);
+        else if (strcmp(argv[i], "--kinds") == 0)
+            kinds = value;
+        else if (strcmp(argv[i], "--threads") == 0)
+            config.threads = (unsigned int)atoi(value);
+        else if (strcmp(argv[i], "--min-time") == 0)
+            config.minTime = atof(value);
+        else if (strcmp(argv[i], "--output") == 0)
+            output = value;
+        else if (strcmp(argv[i], "--format") == 0)
+        {
+            for (f = 0; f < TARGA_FORMAT_INDEX8; f++)
+                if (strcmp(value, benchFormatNames[f]) == 0)
+                    break;
+            if (f == TARGA_FORMAT_INDEX8)
+            {
+                benchUsage(argv[0]);
+                return 1;
+            }
+            config.format = (unsigned int)f;
+        }
+        else
+        {
+            benchUsage(argv[0]);
+            return 1;
+        }
+
+        i++;
+    }
+
+    if (sizeCount == 0 || entropyCount == 0)
+    {
+        benchUsage(argv[0]);
+        return 1;
+    }
+
+    FILE* out = output ? fopen(output, "w") : stdout;
+    if (!out)
+    {
+        fprintf(stderr, "cannot write %s\n", output);
+        return 1;
+    }
+
+    fprintf(out, "{\n  \"format\": \"%s\",\n  \"threads\": %u,\n"
+            "  \"minTime\": %g,\n  \"allocationsCounted\": %s,\n  \"results\": [",
+            benchFormatNames[config.format], config.threads, config.minTime,
+            benchAllocationCount() < 0 ? "false" : "true");
+
+    BENCH_BUFFER buffer = { NULL, 0, 0 };
+    const char* separator = "\n";
+    size_t k, s, e;
+    int failed = 0;
+
+    for (k = 0; k < BENCH_KIND_COUNT; k++)
+    {
+        const BENCH_KIND* kind = &benchKinds[k];
+
+        if (kinds)
+        {
+            /* whole names of the comma separated list */
+            size_t length = strlen(kind->name);
+            const char* found = kinds;
+
+            while ((found = strstr(found, kind->name)) != NULL)
+            {
+                if ((found == kinds || found[-1] == ',') &&
+                    (found[length] == '\0' || found[length] == ','))
+                    break;
+                found += length;
+            }
+
+            if (!found)
+                continue;
+        }
+
+        for (s = 0; s < sizeCount; s++)
+        {
+            size_t size = (size_t)sizes[s];
+
+            if (size < 1 || size > 65535)
+                continue;
+
+            for (e = 0; e < entropyCount; e++)
+            {
+                /* runs make no sense without RLE, one entropy is enough */
+                if (kind->imageType < 9 && e > 0)
+                    break;
+
+                double entropy = kind->imageType < 9 ? 1 : entropies[e];
+
+                benchGenerate(&buffer, kind, size, size, entropy);
+
+                long allocations = -1;
+                size_t bytes = 0;
+                double parse  = benchParse(&config, &buffer);
+                double load   = benchLoad(&config, &buffer, config.format, &allocations, &bytes);
+                double decode = kind->fileFormat == TARGA_FORMAT_AUTO ? -1
+                              : benchLoad(&config, &buffer, kind->fileFormat, NULL, NULL);
+                double pixels = (double)size * size;
+
+                if (load < 0)
+                {
+                    fprintf(stderr, "%s %zux%zu failed to load\n", kind->name, size, size);
+                    failed = 1;
+                    continue;
+                }
+
+                fprintf(out, "%s    { \"kind\": \"%s\", \"imageType\": %u, \"pixelDepth\": %u, "
+                        "\"width\": %zu, \"height\": %zu, \"entropy\": %g, \"fileBytes\": %zu, ",
+                        separator, kind->name, kind->imageType, kind->pixelDepth,
+                        size, size, entropy, buffer.size);
+                fprintf(out, "\"parseNs\": %.1f, ", parse * 1e9);
+                benchJsonTime(out, "decodeMs", decode);
+                benchJsonTime(out, "loadMs", load);
+                benchJsonTime(out, "convertMs",
+                        decode < 0 ? -1 : load > decode ? load - decode : 0);
+                fprintf(out, "\"inputMBps\": %.1f, \"outputMBps\": %.1f, "
+                        "\"nsPerPixel\": %.3f, \"allocations\": %ld }",
+                        buffer.size / load / 1e6, bytes / load / 1e6,
+                        load * 1e9 / pixels, allocations);
+                separator = ",\n";
+            }
+        }
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+
+    free(buffer.data);
+    if (out != stdout)
+        fclose(out);
+
+    return failed;
+
+}
@@ -0,0 +1,912 @@
+/*
+ * MIT License
+ *
+ * TARGA Copyright (c) 2016 Sebastien Serre <ssbx@sysmo.io>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "targa_private.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#define TGA_PID ((unsigned long)getpid())
+#else
+#define TGA_PID 0ul
+#endif
+
+#ifdef TARGA_HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+
+/*
+ * Decoded image cache
+ *
+ * The entries are spread over shards by the hash of their path and load
+ * options, every shard with its own lock, hash chains and LRU list, so
+ * that hits on different files do not contend. The first request for an
+ * entry loads it outside of the lock while the next ones wait for it on
+ * the shard. Eviction compares the oldest unreferenced entry of every
+ * shard, by time of last use, and evicts the oldest of all.
+ */
+#define TGA_CACHE_SHARDS  16
+#define TGA_CACHE_BUCKETS 256         /* per shard */
+
+#define TGA_ENTRY_LOADING 0
+#define TGA_ENTRY_READY   1
+#define TGA_ENTRY_FAILED  2
+
+typedef struct TGA_CACHE_ENTRY {
+    TARGA_IMAGE                 image;      /* first: handed out to the users */
+    struct TGA_CACHE_ENTRY*     next;       /* hash chain */
+    struct TGA_CACHE_ENTRY*     newer;      /* LRU list */
+    struct TGA_CACHE_ENTRY*     older;
+
+    char*                       fileName;
+    TARGA_LOAD_OPTIONS          options;    /* those changing the pixels */
+    TGA_FILE_ID                 id;
+    uint64_t                    hash;
+    unsigned int                shard;
+    int                         linked;     /* in the hash chains and LRU list */
+
+    int                         state;      /* TGA_ENTRY_* */
+    int                         status;
+    unsigned int                refs;
+    size_t                      bytes;
+    uint64_t                    lastUse;    /* targaNanoseconds() */
+} TGA_CACHE_ENTRY;
+
+
+typedef struct {
+#ifdef TARGA_HAVE_PTHREAD
+    pthread_mutex_t             lock;
+    pthread_cond_t              loaded;
+#endif
+    TGA_CACHE_ENTRY*            buckets[TGA_CACHE_BUCKETS];
+    TGA_CACHE_ENTRY*            newest;
+    TGA_CACHE_ENTRY*            oldest;
+
+    uint64_t                    hits;
+    uint64_t                    misses;
+    uint64_t                    waits;
+    uint64_t                    evictions;
+    uint64_t                    stale;
+    uint64_t                    entries;
+} TGA_CACHE_SHARD;
+
+
+struct TARGA_CACHE {
+    size_t                      budget;
+    uint64_t                    bytes;      /* of the linked entries */
+    TGA_CACHE_SHARD             shards[TGA_CACHE_SHARDS];
+};
+
+
+#ifdef TARGA_HAVE_PTHREAD
+#define TGA_SHARD_LOCK(shard)   pthread_mutex_lock(&(shard)->lock)
+#define TGA_SHARD_UNLOCK(shard) pthread_mutex_unlock(&(shard)->lock)
+#else
+#define TGA_SHARD_LOCK(shard)   ((void)(shard))
+#define TGA_SHARD_UNLOCK(shard) ((void)(shard))
+#endif
+
+
+int targaFileIdentity(const char* fileName, TGA_FILE_ID* id)
+{
+
+    struct stat st;
+
+    if (stat(fileName, &st) != 0)
+        return TARGA_ERR_OPEN;
+
+    id->device = (uint64_t)st.st_dev;
+    id->inode  = (uint64_t)st.st_ino;
+    id->size   = (uint64_t)st.st_size;
+#if defined(__linux__)
+    id->mtime  = (uint64_t)st.st_mtim.tv_sec * 1000000000u + (uint64_t)st.st_mtim.tv_nsec;
+#elif defined(__APPLE__)
+    id->mtime  = (uint64_t)st.st_mtimespec.tv_sec * 1000000000u + (uint64_t)st.st_mtimespec.tv_nsec;
+#else
+    id->mtime  = (uint64_t)st.st_mtime * 1000000000u;
+#endif
+    return TARGA_OK;
+
+}
+
+
+/*
+ * The options an entry is decoded with: only those that change the pixels
+ * are kept, the others share the entry.
+ */
+static void targaCacheOptions(const TARGA_LOAD_OPTIONS* options, TARGA_LOAD_OPTIONS* key)
+{
+
+    memset(key, 0, sizeof(*key));
+
+    if (!options)
+        return;
+
+    key->format    = options->format;
+    key->flags     = options->flags & (TARGA_LOAD_TOP_LEFT | TARGA_LOAD_BOTTOM_LEFT |
+            TARGA_LOAD_MIPMAPS | TARGA_LOAD_SRGB);
+    key->pitch     = options->pitch;
+    key->alignment = options->alignment;
+    key->colorKey  = options->colorKey;
+    key->region    = options->region;
+
+    if (options->flags & TARGA_LOAD_MIPMAPS)
+        key->mipFilter = options->mipFilter;
+
+}
+
+
+/*
+ * FNV-1a of the path and the key options.
+ */
+static uint64_t targaCacheHash(const char* fileName, const TARGA_LOAD_OPTIONS* key)
+{
+
+    const uint8_t* bytes = (const uint8_t*)fileName;
+    uint64_t hash = 14695981039346656037u;
+    uint64_t fields[8];
+    size_t i;
+
+    for (; *bytes; bytes++)
+        hash = (hash ^ *bytes) * 1099511628211u;
+
+    fields[0] = key->format;
+    fields[1] = key->flags;
+    fields[2] = key->pitch;
+    fields[3] = key->alignment;
+    fields[4] = key->colorKey;
+    fields[5] = ((uint64_t)key->region.x << 32) | key->region.y;
+    fields[6] = ((uint64_t)key->region.width << 32) | key->region.height;
+    fields[7] = key->mipFilter;
+
+    for (i = 0; i < sizeof(fields); i++)
+        hash = (hash ^ ((const uint8_t*)fields)[i]) * 1099511628211u;
+
+    return hash;
+
+}
+
+
+static int targaCacheSameKey(
+        const TGA_CACHE_ENTRY*      entry,
+        uint64_t                    hash,
+        const char*                 fileName,
+        const TARGA_LOAD_OPTIONS*   key)
+{
+
+    return entry->hash == hash &&
+        strcmp(entry->fileName, fileName) == 0 &&
+        entry->options.format    == key->format &&
+        entry->options.flags     == key->flags &&
+        entry->options.pitch     == key->pitch &&
+        entry->options.alignment == key->alignment &&
+        entry->options.colorKey  == key->colorKey &&
+        entry->options.mipFilter == key->mipFilter &&
+        memcmp(&entry->options.region, &key->region, sizeof(TARGA_RECT)) == 0;
+
+}
+
+
+static TGA_CACHE_ENTRY** targaCacheBucket(TGA_CACHE_SHARD* shard, uint64_t hash)
+{
+    return &shard->buckets[(hash / TGA_CACHE_SHARDS) % TGA_CACHE_BUCKETS];
+}
+
+
+static void targaCacheTouch(TGA_CACHE_SHARD* shard, TGA_CACHE_ENTRY* entry)
+{
+
+    entry->lastUse = targaNanoseconds();
+
+    if (shard->newest == entry)
+        return;
+
+    /* unlink */
+    if (entry->newer)
+        entry->newer->older = entry->older;
+    if (entry->older)
+        entry->older->newer = entry->newer;
+    if (shard->oldest == entry)
+        shard->oldest = entry->newer;
+
+    /* push front */
+    entry->newer = NULL;
+    entry->older = shard->newest;
+    if (shard->newest)
+        shard->newest->newer = entry;
+    shard->newest = entry;
+    if (!shard->oldest)
+        shard->oldest = entry;
+
+}
+
+
+static void targaCacheFree(TGA_CACHE_ENTRY* entry)
+{
+    targaImageFree(&entry->image);
+    free(entry->fileName);
+    free(entry);
+}
+
+
+/*
+ * Remove entry from the chains and the LRU list. It is freed by its last
+ * user, or here when it has none.
+ */
+static void targaCacheUnlink(TARGA_CACHE* cache, TGA_CACHE_SHARD* shard, TGA_CACHE_ENTRY* entry)
+{
+
+    TGA_CACHE_ENTRY** link = targaCacheBucket(shard, entry->hash);
+
+    while (*link != entry)
+        link = &(*link)->next;
+    *link = entry->next;
+
+    if (entry->newer)
+        entry->newer->older = entry->older;
+    else
+        shard->newest = entry->older;
+
+    if (entry->older)
+        entry->older->newer = entry->newer;
+    else
+        shard->oldest = entry->newer;
+
+    entry->linked = 0;
+    shard->entries--;
+    TGA_ATOMIC_ADD(&cache->bytes, (uint64_t)0 - entry->bytes);
+
+    if (entry->refs == 0)
+        targaCacheFree(entry);
+
+}
+
+
+/*
+ * Drop a reference, the shard being locked.
+ */
+static void targaCacheUnref(TGA_CACHE_ENTRY* entry)
+{
+    if (--entry->refs == 0 && !entry->linked)
+        targaCacheFree(entry);
+}
+
+
+/*
+ * Least recently used entry of shard that can be evicted, the shard being
+ * locked.
+ */
+static TGA_CACHE_ENTRY* targaCacheVictim(TGA_CACHE_SHARD* shard)
+{
+
+    TGA_CACHE_ENTRY* entry;
+
+    for (entry = shard->oldest; entry; entry = entry->newer)
+        if (entry->refs == 0 && entry->state == TGA_ENTRY_READY)
+            break;
+
+    return entry;
+
+}
+
+
+/*
+ * Evict the least recently used unreferenced entries until the cache fits
+ * its budget or nothing can go. The shards are locked one at a time: an
+ * entry used meanwhile may still go, as if it were used just before.
+ */
+static void targaCacheTrim(TARGA_CACHE* cache)
+{
+
+    while (TGA_ATOMIC_LOAD(&cache->bytes) > cache->budget)
+    {
+        TGA_CACHE_SHARD* oldest = NULL;
+        TGA_CACHE_ENTRY* entry;
+        uint64_t lastUse = UINT64_MAX;
+        size_t i;
+
+        for (i = 0; i < TGA_CACHE_SHARDS; i++)
+        {
+            TGA_CACHE_SHARD* shard = &cache->shards[i];
+
+            TGA_SHARD_LOCK(shard);
+            entry = targaCacheVictim(shard);
+            if (entry && entry->lastUse < lastUse)
+            {
+                lastUse = entry->lastUse;
+                oldest  = shard;
+            }
+            TGA_SHARD_UNLOCK(shard);
+        }
+
+        if (!oldest)
+            break;
+
+        TGA_SHARD_LOCK(oldest);
+        entry = targaCacheVictim(oldest);
+        if (entry)
+        {
+            targaCacheUnlink(cache, oldest, entry);
+            oldest->evictions++;
+        }
+        TGA_SHARD_UNLOCK(oldest);
+    }
+
+}
+
+
+TARGA_CACHE* targaCacheCreate(size_t budget)
+{
+
+    TARGA_CACHE* cache = calloc(1, sizeof(TARGA_CACHE));
+    size_t i;
+
+    if (!cache)
+        return NULL;
+
+    cache->budget = budget;
+
+#ifdef TARGA_HAVE_PTHREAD
+    for (i = 0; i < TGA_CACHE_SHARDS; i++)
+    {
+        pthread_mutex_init(&cache->shards[i].lock, NULL);
+        pthread_cond_init(&cache->shards[i].loaded, NULL);
+    }
+#else
+    (void)i;
+#endif
+
+    return cache;
+
+}
+
+
+int targaCacheGet(
+        TARGA_CACHE*                cache,
+        const char*                 fileName,
+        const TARGA_LOAD_OPTIONS*   options,
+        const TARGA_IMAGE**         image)
+{
+
+    TARGA_LOAD_OPTIONS key;
+    TGA_FILE_ID id;
+    TGA_CACHE_ENTRY* entry;
+
+    *image = NULL;
+
+    if (targaFileIdentity(fileName, &id) != TARGA_OK)
+        return TARGA_ERR_OPEN;
+
+    targaCacheOptions(options, &key);
+
+    uint64_t hash = targaCacheHash(fileName, &key);
+    unsigned int shardIndex = (unsigned int)(hash % TGA_CACHE_SHARDS);
+    TGA_CACHE_SHARD* shard = &cache->shards[shardIndex];
+    TGA_CACHE_ENTRY** bucket = targaCacheBucket(shard, hash);
+
+    TGA_SHARD_LOCK(shard);
+
+    for (entry = *bucket; entry; entry = entry->next)
+        if (targaCacheSameKey(entry, hash, fileName, &key))
+            break;
+
+    /* the file changed since it was loaded */
+    if (entry && entry->state != TGA_ENTRY_LOADING && memcmp(&entry->id, &id, sizeof(id)) != 0)
+    {
+        targaCacheUnlink(cache, shard, entry);
+        shard->stale++;
+        entry = NULL;
+    }
+
+    if (entry)
+    {
+        entry->refs++;
+        targaCacheTouch(shard, entry);
+
+        if (entry->state == TGA_ENTRY_LOADING)
+        {
+            shard->waits++;
+#ifdef TARGA_HAVE_PTHREAD
+            while (entry->state == TGA_ENTRY_LOADING)
+                pthread_cond_wait(&shard->loaded, &shard->lock);
+#endif
+        }
+        else
+        {
+            shard->hits++;
+        }
+
+        int status = entry->status;
+        if (status != TARGA_OK)
+            targaCacheUnref(entry);
+        else
+            *image = &entry->image;
+
+        TGA_SHARD_UNLOCK(shard);
+        return status;
+    }
+
+    /* miss: the entry is published while it loads, for the next requests to wait on */
+    size_t length = strlen(fileName);
+
+    entry = calloc(1, sizeof(TGA_CACHE_ENTRY));
+    if (entry && !(entry->fileName = malloc(length + 1)))
+    {
+        free(entry);
+        entry = NULL;
+    }
+
+    if (!entry)
+    {
+        TGA_SHARD_UNLOCK(shard);
+        return TARGA_ERR_NO_MEMORY;
+    }
+
+    memcpy(entry->fileName, fileName, length + 1);
+    entry->options = key;
+    entry->id      = id;
+    entry->hash    = hash;
+    entry->shard   = shardIndex;
+    entry->state   = TGA_ENTRY_LOADING;
+    entry->refs    = 1;
+    entry->linked  = 1;
+    entry->next    = *bucket;
+    *bucket = entry;
+    targaCacheTouch(shard, entry);
+    shard->entries++;
+    shard->misses++;
+
+    TGA_SHARD_UNLOCK(shard);
+
+    int status = targaLoadImage(fileName, options, &entry->image);
+
+    TGA_SHARD_LOCK(shard);
+
+    entry->status = status;
+    if (status == TARGA_OK)
+    {
+        entry->state = TGA_ENTRY_READY;
+        entry->bytes = entry->image.mapped
+            ? entry->image.memorySize
+            : targaImageSize(&entry->image);
+        TGA_ATOMIC_ADD(&cache->bytes, (uint64_t)entry->bytes);
+        *image = &entry->image;
+    }
+    else
+    {
+        entry->state = TGA_ENTRY_FAILED;
+        targaCacheUnlink(cache, shard, entry);
+        targaCacheUnref(entry);
+    }
+
+#ifdef TARGA_HAVE_PTHREAD
+    pthread_cond_broadcast(&shard->loaded);
+#endif
+    TGA_SHARD_UNLOCK(shard);
+
+    if (status == TARGA_OK)
+        targaCacheTrim(cache);
+
+    return status;
+
+}
+
+
+void targaCacheRelease(TARGA_CACHE* cache, const TARGA_IMAGE* image)
+{
+
+    TGA_CACHE_ENTRY* entry = (TGA_CACHE_ENTRY*)image;
+    TGA_CACHE_SHARD* shard;
+
+    if (!image)
+        return;
+
+    shard = &cache->shards[entry->shard];
+
+    TGA_SHARD_LOCK(shard);
+    targaCacheUnref(entry);
+    TGA_SHARD_UNLOCK(shard);
+
+    targaCacheTrim(cache);
+
+}
+
+
+void targaCacheStats(TARGA_CACHE* cache, TARGA_CACHE_STATS* stats)
+{
+
+    size_t i;
+
+    memset(stats, 0, sizeof(*stats));
+
+    for (i = 0; i < TGA_CACHE_SHARDS; i++)
+    {
+        TGA_CACHE_SHARD* shard = &cache->shards[i];
+
+        TGA_SHARD_LOCK(shard);
+        stats->hits      += shard->hits;
+        stats->misses    += shard->misses;
+        stats->waits     += shard->waits;
+        stats->evictions += shard->evictions;
+        stats->stale     += shard->stale;
+        stats->entries   += shard->entries;
+        TGA_SHARD_UNLOCK(shard);
+    }
+
+    stats->bytes = TGA_ATOMIC_LOAD(&cache->bytes);
+
+}
+
+
+void targaCacheDestroy(TARGA_CACHE* cache)
+{
+
+    size_t i, j;
+
+    if (!cache)
+        return;
+
+    for (i = 0; i < TGA_CACHE_SHARDS; i++)
+    {
+        TGA_CACHE_SHARD* shard = &cache->shards[i];
+
+        for (j = 0; j < TGA_CACHE_BUCKETS; j++)
+        {
+            while (shard->buckets[j])
+            {
+                TGA_CACHE_ENTRY* entry = shard->buckets[j];
+
+                shard->buckets[j] = entry->next;
+                targaCacheFree(entry);
+            }
+        }
+
+#ifdef TARGA_HAVE_PTHREAD
+        pthread_cond_destroy(&shard->loaded);
+        pthread_mutex_destroy(&shard->lock);
+#endif
+    }
+
+    free(cache);
+
+}
+
+
+/*
+ * Sidecar files
+ *
+ * A decoded image is stored once in options->cacheDir, in a file named
+ * after the hash of its path and load options: a small header, then the
+ * rows as returned, page aligned so that later loads map the file and
+ * hand its pixels out without decoding. The header records the source
+ * size, a hash of its bytes, its device, inode and modification time: a
+ * source with another size gives a new decode. One of the same size that
+ * is another file (a relative path from another directory, a file
+ * replaced) or was touched is hashed again, and keeps the sidecar, its
+ * identity updated, if its bytes are the same.
+ *
+ * The header fields are little endian:
+ *
+ *     0   8   "TGACACHE"
+ *     8   4   version
+ *     12  4   format, width, height, origin
+ *     28  4   mip levels
+ *     32  8   pitch, offset of the pixels
+ *     48  8   hash of the path and options
+ *     56  8   source size, hash
+ *     72  8   source device, inode, modification time
+ */
+#define TGA_SIDECAR_VERSION  2
+#define TGA_SIDECAR_HEADER   96
+#define TGA_SIDECAR_PIXELS   4096
+#define TGA_SIDECAR_IDENTITY 72
+
+static const char targaSidecarMagic[8] = { 'T', 'G', 'A', 'C', 'A', 'C', 'H', 'E' };
+
+
+static void targaPut32(uint8_t* p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+
+static void targaPut64(uint8_t* p, uint64_t v)
+{
+    targaPut32(p, (uint32_t)v);
+    targaPut32(p + 4, (uint32_t)(v >> 32));
+}
+
+
+static uint32_t targaGet32(const uint8_t* p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+
+static uint64_t targaGet64(const uint8_t* p)
+{
+    return (uint64_t)targaGet32(p) | (uint64_t)targaGet32(p + 4) << 32;
+}
+
+
+/*
+ * Hash of the bytes of fileName, by 8 bytes words: about as fast as the
+ * file can be read, much faster than decoding it. Its reads count in
+ * stats if not NULL.
+ */
+static int targaHashFile(const char* fileName, uint64_t* hash, TARGA_STATS* stats)
+{
+
+    FILE* file = fopen(fileName, "rb");
+    uint8_t* block = malloc(64 * 1024);
+    uint64_t h = 14695981039346656037u;
+    size_t got, i;
+
+    if (!file || !block)
+    {
+        if (file)
+            fclose(file);
+        free(block);
+        return TARGA_ERR_READ;
+    }
+
+    if (stats)
+        stats->allocations++;
+
+    while ((got = fread(block, 1, 64 * 1024, file)) > 0)
+    {
+        if (stats)
+        {
+            stats->readCalls++;
+            stats->bytesRead += got;
+        }
+
+        for (i = 0; i + 8 <= got; i += 8)
+        {
+            uint64_t word;
+            memcpy(&word, block + i, 8);
+            h = (h ^ word) * 1099511628211u;
+            h ^= h >> 32;
+        }
+
+        for (; i < got; i++)
+            h = (h ^ block[i]) * 1099511628211u;
+    }
+
+    int failed = ferror(file);
+    fclose(file);
+    free(block);
+
+    *hash = h;
+    return failed ? TARGA_ERR_READ : TARGA_OK;
+
+}
+
+
+/*
+ * Path of the sidecar of fileName loaded with options, NULL if out of
+ * memory. Return its key hash in key.
+ */
+static char* targaSidecarPath(
+        const char*                 fileName,
+        const TARGA_LOAD_OPTIONS*   options,
+        uint64_t*                   keyHash)
+{
+
+    TARGA_LOAD_OPTIONS key;
+    size_t length = strlen(options->cacheDir);
+    char* path = malloc(length + 1 + 16 + 4 + 1);
+
+    targaCacheOptions(options, &key);
+    *keyHash = targaCacheHash(fileName, &key);
+
+    if (path)
+        sprintf(path, "%s/%08lx%08lx.tgc", options->cacheDir,
+                (unsigned long)(*keyHash >> 32), (unsigned long)(*keyHash & 0xFFFFFFFFu));
+
+    return path;
+
+}
+
+
+int targaSidecarLoad(
+        const char*                 fileName,
+        const TARGA_LOAD_OPTIONS*   options,
+        TGA_FILE_ID*                id,
+        TARGA_STATS*                stats,
+        TARGA_IMAGE*                image)
+{
+
+    uint64_t keyHash;
+    void* mapping;
+    size_t mappingSize;
+
+    memset(id, 0, sizeof(*id));
+    if (targaFileIdentity(fileName, id) != TARGA_OK)
+        return TARGA_ERR_OPEN;
+
+    if (options->alignment > TGA_SIDECAR_PIXELS)
+        return TARGA_ERR_UNSUPPORTED;
+
+    char* path = targaSidecarPath(fileName, options, &keyHash);
+    if (!path)
+        return TARGA_ERR_NO_MEMORY;
+
+    if (stats)
+        stats->allocations++;
+
+    int result = targaMapFile(path, &mapping, &mappingSize);
+    if (result != TARGA_OK)
+    {
+        free(path);
+        return result;
+    }
+
+    const uint8_t* header = mapping;
+    uint64_t offset = 0;
+
+    result = TARGA_ERR_FORMAT;
+    if (mappingSize >= TGA_SIDECAR_HEADER &&
+        memcmp(header, targaSidecarMagic, 8) == 0 &&
+        targaGet32(header + 8) == TGA_SIDECAR_VERSION &&
+        targaGet64(header + 48) == keyHash &&
+        targaGet64(header + 56) == id->size)
+    {
+        image->format = targaGet32(header + 12);
+        image->width  = targaGet32(header + 16);
+        image->height = targaGet32(header + 20);
+        image->origin = targaGet32(header + 24);
+        image->levels = targaGet32(header + 28);
+        image->pitch  = (size_t)targaGet64(header + 32);
+        offset        = targaGet64(header + 40);
+
+        if (offset >= TGA_SIDECAR_HEADER && offset <= mappingSize &&
+            image->levels >= 1 && image->levels <= targaMipLevels(image->width, image->height) &&
+            (image->height == 0 || image->pitch <= mappingSize / image->height) &&
+            (uint64_t)mappingSize - offset >= targaImageSize(image) &&
+            (!options->alignment || ((uintptr_t)header + offset) % options->alignment == 0))
+            result = TARGA_OK;
+    }
+
+    /* same size, another file or time: the same source only if the bytes are */
+    if (result == TARGA_OK &&
+        (targaGet64(header + TGA_SIDECAR_IDENTITY) != id->device ||
+         targaGet64(header + TGA_SIDECAR_IDENTITY + 8) != id->inode ||
+         targaGet64(header + TGA_SIDECAR_IDENTITY + 16) != id->mtime))
+    {
+        uint64_t hash;
+        FILE* file;
+
+        result = TARGA_ERR_FORMAT;
+        if (targaHashFile(fileName, &hash, stats) == TARGA_OK &&
+            hash == targaGet64(header + 64) &&
+            (file = fopen(path, "r+b")) != NULL)
+        {
+            uint8_t identity[24];
+
+            targaPut64(identity, id->device);
+            targaPut64(identity + 8, id->inode);
+            targaPut64(identity + 16, id->mtime);
+            if (fseek(file, TGA_SIDECAR_IDENTITY, SEEK_SET) == 0 &&
+                fwrite(identity, 1, sizeof(identity), file) == sizeof(identity))
+                result = TARGA_OK;
+            fclose(file);
+        }
+    }
+
+    free(path);
+
+    if (result != TARGA_OK)
+    {
+        targaUnmapFile(mapping, mappingSize);
+        memset(image, 0, sizeof(*image));
+        return result;
+    }
+
+    if (stats)
+        stats->bytesRead += targaImageSize(image);
+
+    image->pixels     = (uint8_t*)mapping + offset;
+    image->mapped     = 1;
+    image->memory     = mapping;
+    image->memorySize = mappingSize;
+    return TARGA_OK;
+
+}
+
+
+void targaSidecarStore(
+        const char*                 fileName,
+        const TARGA_LOAD_OPTIONS*   options,
+        const TGA_FILE_ID*          id,
+        TARGA_STATS*                stats,
+        const TARGA_IMAGE*          image)
+{
+
+    uint8_t header[TGA_SIDECAR_PIXELS] = {0};
+    uint64_t keyHash, hash;
+
+    if (options->alignment > TGA_SIDECAR_PIXELS ||
+        targaHashFile(fileName, &hash, stats) != TARGA_OK)
+        return;
+
+    char* path = targaSidecarPath(fileName, options, &keyHash);
+    char* temporary = path ? malloc(strlen(path) + 64) : NULL;
+    if (!temporary)
+    {
+        free(path);
+        return;
+    }
+
+    if (stats)
+        stats->allocations += 2;
+
+    memcpy(header, targaSidecarMagic, 8);
+    targaPut32(header + 8,  TGA_SIDECAR_VERSION);
+    targaPut32(header + 12, image->format);
+    targaPut32(header + 16, image->width);
+    targaPut32(header + 20, image->height);
+    targaPut32(header + 24, image->origin);
+    targaPut32(header + 28, image->levels);
+    targaPut64(header + 32, image->pitch);
+    targaPut64(header + 40, TGA_SIDECAR_PIXELS);
+    targaPut64(header + 48, keyHash);
+    targaPut64(header + 56, id->size);
+    targaPut64(header + 64, hash);
+    targaPut64(header + 72, id->device);
+    targaPut64(header + 80, id->inode);
+    targaPut64(header + 88, id->mtime);
+
+    /* written aside then renamed: readers only ever see whole files */
+    sprintf(temporary, "%s.%lu.%p.tmp", path, TGA_PID, (void*)&header);
+
+    FILE* file = fopen(temporary, "wb");
+    int written = file != NULL &&
+        fwrite(header, 1, sizeof(header), file) == sizeof(header) &&
+        fwrite(image->pixels, 1, targaImageSize(image), file) == targaImageSize(image);
+
+    if (file && fclose(file) != 0)
+        written = 0;
+
+#ifdef _WIN32
+    if (written)
+        remove(path);
+#endif
+
+    if (!written || rename(temporary, path) != 0)
+        remove(temporary);
+
+    free(temporary);
+    free(path);
+
+}
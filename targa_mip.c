@@ -0,0 +1,985 @@
+/*
+ * MIT License
+ *
+ * TARGA Copyright (c) 2016 Sebastien Serre <ssbx@sysmo.io>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Mip chains
+ *
+ * The levels follow the image in the same allocation, each packed and
+ * starting 16 bytes aligned from the pixels. Every level is filtered from
+ * the one above it, row by row as its rows are complete: decoding a row
+ * of the image feeds level 1, which feeds level 2 once one of its rows is
+ * done, so the first downsample reads rows that were just written.
+ *
+ * Rows are numbered in the order they are decoded, the flip of the image
+ * turning them into memory rows. The filters are symmetric, so filtering
+ * in that order gives the same levels as filtering top to bottom.
+ *
+ * Each axis is resampled from n to m = max(1, n / 2) pixels, destination
+ * pixel j centered on (j + 0.5) * n / m in the source: odd sizes give
+ * taps straddling three source pixels rather than dropping one. The taps
+ * of a level are computed once, rows are filtered horizontally into a
+ * ring of float rows, then vertically from that ring. Exact halvings with
+ * the box filter average 2x2 blocks of bytes directly.
+ */
+#include "targa_private.h"
+#include <math.h>
+#include <string.h>
+
+#define TGA_MIP_MAX_LEVELS 33
+#define TGA_MIP_ALIGN      16
+#define TGA_MIP_RADIUS     3.0          /* lobes of the windowed sinc filters */
+#define TGA_MIP_KAISER     4.0          /* alpha of the Kaiser window */
+#define TGA_MIP_PI         3.14159265358979323846
+
+
+/*
+ * Source pixels [first, first + count[ weighted by weights[0, count[.
+ */
+typedef struct {
+    uint32_t    first;
+    uint32_t    count;
+    size_t      weights;        /* index in the weights of the level */
+} TGA_MIP_TAP;
+
+
+typedef void (*TGA_HALVE_FN)(
+        uint8_t* dst, const uint8_t* top, const uint8_t* bottom,
+        size_t width, size_t bpp);
+
+
+typedef struct {
+    uint8_t*        pixels;
+    size_t          pitch;
+    size_t          width;
+    size_t          height;
+
+    /* filtering from the level above, all but level 0 */
+    TGA_HALVE_FN    halve;      /* exact 2x2 box, NULL for the taps */
+    TGA_MIP_TAP*    columns;
+    TGA_MIP_TAP*    rows;
+    float*          weights;
+    float*          ring;       /* ringRows horizontally filtered rows */
+    size_t          ringRows;
+    size_t          received;   /* rows of the level above seen */
+    size_t          produced;   /* rows of this level written */
+} TGA_MIP_LEVEL;
+
+
+/*
+ * The taps of a row of level, a weighted row added to a sum, and the
+ * conversions of rows between bytes and floats.
+ */
+typedef void (*TGA_COLUMNS_FN)(
+        float* dst, const float* src, const TGA_MIP_LEVEL* level, size_t bpp);
+
+typedef void (*TGA_ACCUMULATE_FN)(
+        float* sum, const float* row, float weight, size_t size, int first);
+
+typedef void (*TGA_TO_FLOAT_FN)(float* dst, const uint8_t* src, size_t size);
+
+typedef void (*TGA_TO_BYTES_FN)(uint8_t* dst, const float* src, size_t size);
+
+
+struct TGA_MIP {
+    unsigned int    levels;
+    size_t          bpp;
+    int             srgb;
+    int             flip;
+
+    TGA_MIP_LEVEL   level[TGA_MIP_MAX_LEVELS];
+    float*          line;       /* a row of the level above, linear */
+    float*          sum;        /* a row being filtered vertically */
+
+    TGA_COLUMNS_FN      columns;
+    TGA_ACCUMULATE_FN   accumulate;
+    TGA_TO_FLOAT_FN     toFloat;
+    TGA_TO_BYTES_FN     toBytes;
+
+    float           toLinear[256];  /* sRGB color channels */
+    float           bounds[255];    /* linear value rounding to code i + 1 */
+    uint8_t         fromLinear[4096];
+};
+
+
+unsigned int targaMipLevels(unsigned int width, unsigned int height)
+{
+
+    unsigned int size = width > height ? width : height;
+    unsigned int levels = 1;
+
+    while (size > 1)
+    {
+        size >>= 1;
+        levels++;
+    }
+
+    return levels;
+
+}
+
+
+size_t targaMipOffset(const TARGA_IMAGE* image, unsigned int level)
+{
+
+    size_t bpp = targaFormatBpp(image->format);
+    size_t width = image->width;
+    size_t height = image->height;
+    size_t offset = image->pitch * image->height;
+    unsigned int i;
+
+    if (level == 0)
+        return 0;
+
+    for (i = 1; i < level; i++)
+    {
+        width  = width > 1 ? width / 2 : 1;
+        height = height > 1 ? height / 2 : 1;
+        offset = (offset + TGA_MIP_ALIGN - 1) & ~(size_t)(TGA_MIP_ALIGN - 1);
+        offset += width * bpp * height;
+    }
+
+    return level < image->levels
+        ? (offset + TGA_MIP_ALIGN - 1) & ~(size_t)(TGA_MIP_ALIGN - 1)
+        : offset;
+
+}
+
+
+size_t targaImageSize(const TARGA_IMAGE* image)
+{
+    size_t rows = targaBlockSize(image->format) ? (image->height + 3) / 4 : image->height;
+
+    return image->levels > 1
+        ? targaMipOffset(image, image->levels)
+        : image->pitch * rows;
+}
+
+
+int targaImageLevel(const TARGA_IMAGE* image, unsigned int level, TARGA_IMAGE* view)
+{
+
+    unsigned int levels = image->levels ? image->levels : 1;
+
+    if (level >= levels)
+        return TARGA_ERR_ARGUMENT;
+
+    memset(view, 0, sizeof(*view));
+    view->width  = image->width;
+    view->height = image->height;
+    view->format = image->format;
+    view->origin = image->origin;
+    view->pitch  = image->pitch;
+    view->levels = 1;
+    view->pixels = image->pixels + targaMipOffset(image, level);
+
+    if (level > 0)
+    {
+        view->width  = image->width >> level ? image->width >> level : 1;
+        view->height = image->height >> level ? image->height >> level : 1;
+        view->pitch  = view->width * targaFormatBpp(image->format);
+    }
+
+    return TARGA_OK;
+
+}
+
+
+/*
+ * Filters, t in destination pixels from the center
+ */
+static double targaSinc(double x)
+{
+    return x == 0.0 ? 1.0 : sin(TGA_MIP_PI * x) / (TGA_MIP_PI * x);
+}
+
+
+static double targaBesselI0(double x)
+{
+
+    double sum = 1.0, term = 1.0;
+    int k;
+
+    for (k = 1; k < 32; k++)
+    {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+
+    return sum;
+
+}
+
+
+static double targaMipKernel(unsigned int filter, double t)
+{
+
+    if (t <= -TGA_MIP_RADIUS || t >= TGA_MIP_RADIUS)
+        return 0.0;
+
+    if (filter == TARGA_MIP_LANCZOS)
+        return targaSinc(t) * targaSinc(t / TGA_MIP_RADIUS);
+
+    double r = t / TGA_MIP_RADIUS;
+    return targaSinc(t) * targaBesselI0(TGA_MIP_KAISER * sqrt(1.0 - r * r))
+        / targaBesselI0(TGA_MIP_KAISER);
+
+}
+
+
+/*
+ * Taps resampling src pixels to dst, the positions outside of the source
+ * clamped to its edges. Return the largest tap count, 0 if out of memory.
+ */
+static size_t targaMipTaps(
+        unsigned int    filter,
+        size_t          src,
+        size_t          dst,
+        TGA_MIP_TAP**   taps,
+        float**         weights)
+{
+
+    double ratio = (double)src / dst;
+    double radius = filter == TARGA_MIP_BOX
+        ? ratio / 2 : TGA_MIP_RADIUS * (ratio > 1.0 ? ratio : 1.0);
+    size_t span = (size_t)ceil(2 * radius) + 2;
+    size_t used = 0, widest = 0, j;
+
+    *taps = malloc(dst * sizeof(TGA_MIP_TAP));
+    *weights = malloc(dst * span * sizeof(float));
+    if (!*taps || !*weights)
+        return 0;
+
+    for (j = 0; j < dst; j++)
+    {
+        double center = (j + 0.5) * ratio;
+        double total = 0.0;
+        long low  = (long)floor(center - radius);
+        long high = (long)ceil(center + radius);
+        long first = low < 0 ? 0 : low;
+        long last  = high > (long)src - 1 ? (long)src - 1 : high;
+        float* w = *weights + used;
+        long i;
+
+        for (i = 0; i <= last - first; i++)
+            w[i] = 0.0f;
+
+        for (i = low; i <= high; i++)
+        {
+            double weight;
+
+            if (filter == TARGA_MIP_BOX)
+            {
+                /* coverage of pixel [i, i + 1[ by the box */
+                double left  = i > center - radius ? i : center - radius;
+                double right = i + 1 < center + radius ? i + 1 : center + radius;
+                weight = right > left ? right - left : 0.0;
+            }
+            else
+            {
+                weight = targaMipKernel(filter, (i + 0.5 - center) / (ratio > 1.0 ? ratio : 1.0));
+            }
+
+            long clamped = i < first ? first : i > last ? last : i;
+            w[clamped - first] += (float)weight;
+            total += weight;
+        }
+
+        /* drop the zero weights at both ends */
+        while (last > first && w[0] == 0.0f)
+        {
+            memmove(w, w + 1, (size_t)(last - first) * sizeof(float));
+            first++;
+        }
+        while (last > first && w[last - first] == 0.0f)
+            last--;
+
+        for (i = 0; i <= last - first; i++)
+            w[i] = (float)(w[i] / total);
+
+        (*taps)[j].first   = (uint32_t)first;
+        (*taps)[j].count   = (uint32_t)(last - first + 1);
+        (*taps)[j].weights = used;
+
+        used += (*taps)[j].count;
+        if ((*taps)[j].count > widest)
+            widest = (*taps)[j].count;
+    }
+
+    return widest;
+
+}
+
+
+/*
+ * Exact halvings: the rounded mean of 2x2 blocks
+ */
+static void targaHalve(
+        uint8_t* dst, const uint8_t* top, const uint8_t* bottom,
+        size_t width, size_t bpp)
+{
+
+    size_t x, c;
+
+    for (x = 0; x < width; x++)
+    {
+        for (c = 0; c < bpp; c++)
+            dst[c] = (uint8_t)((top[c] + top[bpp + c] + bottom[c] + bottom[bpp + c] + 2) >> 2);
+
+        dst += bpp;
+        top += 2 * bpp;
+        bottom += 2 * bpp;
+    }
+
+}
+
+
+#ifdef TGA_X86
+
+/*
+ * 1 and 4 bytes pixels: the channels of two neighbours are made adjacent
+ * and summed by maddubs, 16 bytes written per step.
+ */
+TGA_TARGET("avx2")
+static void targaHalveAvx2(
+        uint8_t* dst, const uint8_t* top, const uint8_t* bottom,
+        size_t width, size_t bpp)
+{
+
+    const __m256i pairs = bpp == 4
+        ? _mm256_setr_epi8(0, 4, 1, 5, 2, 6, 3, 7, 8, 12, 9, 13, 10, 14, 11, 15,
+                           0, 4, 1, 5, 2, 6, 3, 7, 8, 12, 9, 13, 10, 14, 11, 15)
+        : _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+                           0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m256i ones = _mm256_set1_epi8(1);
+    const __m256i two = _mm256_set1_epi16(2);
+    size_t size = width * bpp;
+    size_t i;
+
+    for (i = 0; i + 16 <= size; i += 16)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(top + 2 * i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(bottom + 2 * i));
+
+        a = _mm256_maddubs_epi16(_mm256_shuffle_epi8(a, pairs), ones);
+        b = _mm256_maddubs_epi16(_mm256_shuffle_epi8(b, pairs), ones);
+
+        __m256i mean = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(a, b), two), 2);
+        mean = _mm256_permute4x64_epi64(_mm256_packus_epi16(mean, mean), 0x08);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm256_castsi256_si128(mean));
+    }
+
+    targaHalve(dst + i, top + 2 * i, bottom + 2 * i, (size - i) / bpp, bpp);
+
+}
+
+#endif
+
+
+static TGA_HALVE_FN targaHalveKernel(size_t bpp)
+{
+
+#ifdef TGA_X86
+    if ((bpp == 1 || bpp == 4) && (targaCpuFeatures() & CPU_AVX2))
+        return targaHalveAvx2;
+#else
+    (void)bpp;
+#endif
+
+    return targaHalve;
+
+}
+
+
+/*
+ * Conversions between bytes and the filtered values: sRGB color channels
+ * are filtered in linear light, alpha and the other formats as they are.
+ */
+static double targaSrgbDecode(double x)
+{
+    return x <= 0.04045 ? x / 12.92 : pow((x + 0.055) / 1.055, 2.4);
+}
+
+
+static void targaMipTables(TGA_MIP* mip)
+{
+
+    unsigned int i, code = 0;
+
+    for (i = 0; i < 256; i++)
+        mip->toLinear[i] = (float)targaSrgbDecode(i / 255.0);
+
+    for (i = 0; i < 255; i++)
+        mip->bounds[i] = (float)targaSrgbDecode((i + 0.5) / 255.0);
+
+    for (i = 0; i < 4096; i++)
+    {
+        while (code < 255 && i / 4095.0f >= mip->bounds[code])
+            code++;
+        mip->fromLinear[i] = (uint8_t)code;
+    }
+
+}
+
+
+/*
+ * Plain conversions, [0, 255] to [0, 1] and back, rounded and clamped.
+ */
+static void targaMipToFloat(float* dst, const uint8_t* src, size_t size)
+{
+
+    size_t i;
+
+    for (i = 0; i < size; i++)
+        dst[i] = src[i] * (1.0f / 255);
+
+}
+
+
+static void targaMipToBytes(uint8_t* dst, const float* src, size_t size)
+{
+
+    size_t i;
+
+    for (i = 0; i < size; i++)
+    {
+        float value = src[i] < 0.0f ? 0.0f : src[i] > 1.0f ? 1.0f : src[i];
+        dst[i] = (uint8_t)(value * 255 + 0.5f);
+    }
+
+}
+
+
+#ifdef TGA_X86
+
+TGA_TARGET("avx2")
+static void targaMipToFloatAvx2(float* dst, const uint8_t* src, size_t size)
+{
+
+    const __m256 scale = _mm256_set1_ps(1.0f / 255);
+    size_t i;
+
+    for (i = 0; i + 8 <= size; i += 8)
+    {
+        __m256i bytes = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + i)));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(bytes), scale));
+    }
+
+    targaMipToFloat(dst + i, src + i, size - i);
+
+}
+
+
+TGA_TARGET("avx2")
+static void targaMipToBytesAvx2(uint8_t* dst, const float* src, size_t size)
+{
+
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 scale = _mm256_set1_ps(255.0f);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    size_t i;
+
+    for (i = 0; i + 16 <= size; i += 16)
+    {
+        __m256 a = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(src + i), zero), one);
+        __m256 b = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(src + i + 8), zero), one);
+        __m256i ia = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(a, scale), half));
+        __m256i ib = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(b, scale), half));
+
+        /* packs work within lanes: put the four quarters back in order */
+        __m256i words = _mm256_permute4x64_epi64(_mm256_packs_epi32(ia, ib), 0xD8);
+        __m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(words),
+                _mm256_extracti128_si256(words, 1));
+        _mm_storeu_si128((__m128i*)(dst + i), bytes);
+    }
+
+    targaMipToBytes(dst + i, src + i, size - i);
+
+}
+
+#endif
+
+
+static void targaMipLoad(const TGA_MIP* mip, float* dst, const uint8_t* src, size_t width)
+{
+
+    const float* toLinear = mip->toLinear;
+    size_t size = width * mip->bpp;
+    size_t i;
+
+    if (!mip->srgb)
+    {
+        mip->toFloat(dst, src, size);
+    }
+    else if (mip->bpp == 4)
+    {
+        for (i = 0; i < size; i += 4)
+        {
+            dst[i]     = toLinear[src[i]];
+            dst[i + 1] = toLinear[src[i + 1]];
+            dst[i + 2] = toLinear[src[i + 2]];
+            dst[i + 3] = src[i + 3] * (1.0f / 255);
+        }
+    }
+    else
+    {
+        for (i = 0; i < size; i++)
+            dst[i] = toLinear[src[i]];
+    }
+
+}
+
+
+static uint8_t targaMipEncode(const TGA_MIP* mip, float value)
+{
+
+    /* nearest code, from a close guess */
+    unsigned int code = mip->fromLinear[(size_t)(value * 4095)];
+
+    while (code < 255 && value >= mip->bounds[code])
+        code++;
+    while (code > 0 && value < mip->bounds[code - 1])
+        code--;
+
+    return (uint8_t)code;
+
+}
+
+
+static void targaMipStore(const TGA_MIP* mip, uint8_t* dst, const float* src, size_t width)
+{
+
+    size_t size = width * mip->bpp;
+    size_t i, c;
+
+    mip->toBytes(dst, src, size);
+
+    if (!mip->srgb)
+        return;
+
+    /* the color channels again, alpha (4th channel) stays linear */
+    for (i = 0; i < size; i += mip->bpp)
+        for (c = 0; c < mip->bpp && c < 3; c++)
+        {
+            float value = src[i + c] < 0.0f ? 0.0f : src[i + c] > 1.0f ? 1.0f : src[i + c];
+            dst[i + c] = targaMipEncode(mip, value);
+        }
+
+}
+
+
+/*
+ * Filter kernels. The scalar taps are inlined for each pixel size so
+ * that the channel loops unroll.
+ */
+static inline void targaMipColumnsN(
+        float* dst, const float* src, const TGA_MIP_LEVEL* level, size_t bpp)
+{
+
+    size_t x, c, i;
+
+    for (x = 0; x < level->width; x++, dst += bpp)
+    {
+        const TGA_MIP_TAP* tap = &level->columns[x];
+        const float* weights = level->weights + tap->weights;
+        const float* pixel = src + tap->first * bpp;
+        float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+        for (i = 0; i < tap->count; i++, pixel += bpp)
+            for (c = 0; c < bpp; c++)
+                sum[c] += weights[i] * pixel[c];
+
+        for (c = 0; c < bpp; c++)
+            dst[c] = sum[c];
+    }
+
+}
+
+
+static void targaMipColumns(
+        float* dst, const float* src, const TGA_MIP_LEVEL* level, size_t bpp)
+{
+    switch (bpp)
+    {
+        case 1:
+            targaMipColumnsN(dst, src, level, 1);
+            break;
+        case 3:
+            targaMipColumnsN(dst, src, level, 3);
+            break;
+        default:
+            targaMipColumnsN(dst, src, level, 4);
+            break;
+    }
+}
+
+
+static void targaMipAccumulate(
+        float* sum, const float* row, float weight, size_t size, int first)
+{
+
+    size_t i;
+
+    if (first)
+        for (i = 0; i < size; i++)
+            sum[i] = weight * row[i];
+    else
+        for (i = 0; i < size; i++)
+            sum[i] += weight * row[i];
+
+}
+
+
+#ifdef TGA_X86
+
+/*
+ * 4 bytes pixels, one pixel per vector.
+ */
+TGA_TARGET("avx2")
+static void targaMipColumnsAvx2(
+        float* dst, const float* src, const TGA_MIP_LEVEL* level, size_t bpp)
+{
+
+    size_t x, i;
+
+    if (bpp != 4)
+    {
+        targaMipColumns(dst, src, level, bpp);
+        return;
+    }
+
+    /* two pixels per vector, while they have as many taps */
+    for (x = 0; x + 1 < level->width; x += 2, dst += 8)
+    {
+        const TGA_MIP_TAP* tapA = &level->columns[x];
+        const TGA_MIP_TAP* tapB = &level->columns[x + 1];
+
+        if (tapA->count != tapB->count)
+            break;
+
+        const float* weightsA = level->weights + tapA->weights;
+        const float* weightsB = level->weights + tapB->weights;
+        const float* pixelA = src + tapA->first * 4;
+        const float* pixelB = src + tapB->first * 4;
+        __m256 sum = _mm256_setzero_ps();
+
+        for (i = 0; i < tapA->count; i++, pixelA += 4, pixelB += 4)
+        {
+            __m256 weight = _mm256_setr_m128(_mm_set1_ps(weightsA[i]), _mm_set1_ps(weightsB[i]));
+            __m256 pixels = _mm256_setr_m128(_mm_loadu_ps(pixelA), _mm_loadu_ps(pixelB));
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(weight, pixels));
+        }
+
+        _mm256_storeu_ps(dst, sum);
+    }
+
+    for (; x < level->width; x++, dst += 4)
+    {
+        const TGA_MIP_TAP* tap = &level->columns[x];
+        const float* weights = level->weights + tap->weights;
+        const float* pixel = src + tap->first * 4;
+        __m128 sum = _mm_setzero_ps();
+
+        for (i = 0; i < tap->count; i++, pixel += 4)
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[i]), _mm_loadu_ps(pixel)));
+
+        _mm_storeu_ps(dst, sum);
+    }
+
+}
+
+
+TGA_TARGET("avx2")
+static void targaMipAccumulateAvx2(
+        float* sum, const float* row, float weight, size_t size, int first)
+{
+
+    __m256 w = _mm256_set1_ps(weight);
+    size_t i;
+
+    for (i = 0; i + 8 <= size; i += 8)
+    {
+        __m256 term = _mm256_mul_ps(w, _mm256_loadu_ps(row + i));
+        _mm256_storeu_ps(sum + i, first ? term : _mm256_add_ps(_mm256_loadu_ps(sum + i), term));
+    }
+
+    targaMipAccumulate(sum + i, row + i, weight, size - i, first);
+
+}
+
+#endif
+
+
+static uint8_t* targaMipRowAt(const TGA_MIP* mip, const TGA_MIP_LEVEL* level, size_t y)
+{
+    if (mip->flip)
+        y = level->height - 1 - y;
+
+    return level->pixels + y * level->pitch;
+}
+
+
+/*
+ * Row y of level index is complete: filter it into the level below and
+ * write the rows of that level it completes, down the chain.
+ */
+static void targaMipPush(TGA_MIP* mip, unsigned int index, size_t y)
+{
+
+    if (index + 1 >= mip->levels)
+        return;
+
+    const TGA_MIP_LEVEL* src = &mip->level[index];
+    TGA_MIP_LEVEL* dst = &mip->level[index + 1];
+    size_t bpp = mip->bpp;
+
+    if (dst->halve)
+    {
+        if (y & 1)
+        {
+            dst->halve(targaMipRowAt(mip, dst, y / 2),
+                    targaMipRowAt(mip, src, y - 1), targaMipRowAt(mip, src, y),
+                    dst->width, bpp);
+            targaMipPush(mip, index + 1, y / 2);
+        }
+        return;
+    }
+
+    /*
+     * Horizontal pass into the ring
+     */
+    size_t size = dst->width * bpp;
+
+    targaMipLoad(mip, mip->line, targaMipRowAt(mip, src, y), src->width);
+    mip->columns(dst->ring + (y % dst->ringRows) * size, mip->line, dst, bpp);
+    dst->received = y + 1;
+
+    /*
+     * Vertical pass, for every row whose source rows are all there
+     */
+    while (dst->produced < dst->height)
+    {
+        const TGA_MIP_TAP* tap = &dst->rows[dst->produced];
+        const float* weights = dst->weights + tap->weights;
+        size_t i;
+
+        if (tap->first + tap->count > dst->received)
+            break;
+
+        for (i = 0; i < tap->count; i++)
+            mip->accumulate(mip->sum, dst->ring + ((tap->first + i) % dst->ringRows) * size,
+                    weights[i], size, i == 0);
+
+        size_t row = dst->produced++;
+        targaMipStore(mip, targaMipRowAt(mip, dst, row), mip->sum, dst->width);
+        targaMipPush(mip, index + 1, row);
+    }
+
+}
+
+
+void targaMipRow(TGA_MIP* mip, size_t y)
+{
+    targaMipPush(mip, 0, y);
+}
+
+
+void targaMipDestroy(TGA_MIP* mip)
+{
+
+    unsigned int i;
+
+    if (!mip)
+        return;
+
+    for (i = 1; i < mip->levels; i++)
+    {
+        free(mip->level[i].columns);
+        free(mip->level[i].rows);
+        free(mip->level[i].weights);
+        free(mip->level[i].ring);
+    }
+
+    free(mip->line);
+    free(mip->sum);
+    free(mip);
+
+}
+
+
+/*
+ * Weights of both axes in one array: the columns first, then the rows.
+ */
+static int targaMipPrepare(
+        TGA_MIP_LEVEL*          level,
+        const TGA_MIP_LEVEL*    above,
+        unsigned int            filter,
+        size_t                  bpp)
+{
+
+    TGA_MIP_TAP* columns;
+    TGA_MIP_TAP* rows;
+    float* columnWeights;
+    float* rowWeights;
+    size_t i;
+
+    size_t widest = targaMipTaps(filter, above->width, level->width, &columns, &columnWeights);
+    level->columns = columns;
+    level->weights = columnWeights;
+    if (!widest)
+        return TARGA_ERR_NO_MEMORY;
+
+    level->ringRows = targaMipTaps(filter, above->height, level->height, &rows, &rowWeights);
+    level->rows = rows;
+    if (!level->ringRows)
+    {
+        free(rowWeights);
+        return TARGA_ERR_NO_MEMORY;
+    }
+
+    size_t columnCount = columns[level->width - 1].weights + columns[level->width - 1].count;
+    size_t rowCount = rows[level->height - 1].weights + rows[level->height - 1].count;
+    float* weights = realloc(columnWeights, (columnCount + rowCount) * sizeof(float));
+
+    if (!weights)
+    {
+        free(rowWeights);
+        return TARGA_ERR_NO_MEMORY;
+    }
+
+    memcpy(weights + columnCount, rowWeights, rowCount * sizeof(float));
+    free(rowWeights);
+    level->weights = weights;
+
+    for (i = 0; i < level->height; i++)
+        rows[i].weights += columnCount;
+
+    level->ring = malloc(level->ringRows * level->width * bpp * sizeof(float));
+    return level->ring ? TARGA_OK : TARGA_ERR_NO_MEMORY;
+
+}
+
+
+int targaMipCreate(
+        const TARGA_IMAGE*          image,
+        const TARGA_LOAD_OPTIONS*   options,
+        int                         flip,
+        TARGA_STATS*                stats,
+        TGA_MIP**                   result)
+{
+
+    unsigned int filter = options ? options->mipFilter : TARGA_MIP_BOX;
+    unsigned int i;
+
+    *result = NULL;
+    if (image->format == TARGA_FORMAT_INDEX8 || filter > TARGA_MIP_LANCZOS)
+        return TARGA_ERR_ARGUMENT;
+
+    TGA_MIP* mip = calloc(1, sizeof(TGA_MIP));
+    if (!mip)
+        return TARGA_ERR_NO_MEMORY;
+
+    mip->levels = image->levels;
+    mip->bpp    = targaFormatBpp(image->format);
+    mip->srgb   = options && (options->flags & TARGA_LOAD_SRGB);
+    mip->flip   = flip;
+
+    mip->columns    = targaMipColumns;
+    mip->accumulate = targaMipAccumulate;
+    mip->toFloat    = targaMipToFloat;
+    mip->toBytes    = targaMipToBytes;
+#ifdef TGA_X86
+    if (targaCpuFeatures() & CPU_AVX2)
+    {
+        mip->columns    = targaMipColumnsAvx2;
+        mip->accumulate = targaMipAccumulateAvx2;
+        mip->toFloat    = targaMipToFloatAvx2;
+        mip->toBytes    = targaMipToBytesAvx2;
+    }
+#endif
+
+    if (mip->srgb)
+        targaMipTables(mip);
+
+    mip->level[0].pixels = image->pixels;
+    mip->level[0].pitch  = image->pitch;
+    mip->level[0].width  = image->width;
+    mip->level[0].height = image->height;
+
+    mip->line = malloc((image->width ? image->width : 1) * mip->bpp * sizeof(float));
+    mip->sum  = malloc((image->width ? image->width : 1) * mip->bpp * sizeof(float));
+    int status = mip->line && mip->sum ? TARGA_OK : TARGA_ERR_NO_MEMORY;
+
+    for (i = 1; i < mip->levels && status == TARGA_OK; i++)
+    {
+        TGA_MIP_LEVEL* level = &mip->level[i];
+        const TGA_MIP_LEVEL* above = &mip->level[i - 1];
+
+        level->width  = above->width > 1 ? above->width / 2 : 1;
+        level->height = above->height > 1 ? above->height / 2 : 1;
+        level->pitch  = level->width * mip->bpp;
+        level->pixels = image->pixels + targaMipOffset(image, i);
+
+        if (filter == TARGA_MIP_BOX && !mip->srgb &&
+            above->width == 2 * level->width && above->height == 2 * level->height)
+            level->halve = targaHalveKernel(mip->bpp);
+        else
+            status = targaMipPrepare(level, above, filter, mip->bpp);
+
+        if (stats && !level->halve)
+            stats->allocations += 4;
+    }
+
+    if (status != TARGA_OK)
+    {
+        targaMipDestroy(mip);
+        return status;
+    }
+
+    if (stats)
+        stats->allocations += 3;
+
+    *result = mip;
+    return TARGA_OK;
+
+}
+
+
+int targaMipBuild(const TARGA_IMAGE* image, const TARGA_LOAD_OPTIONS* options)
+{
+
+    TGA_MIP* mip;
+    size_t y;
+
+    int result = targaMipCreate(image, options, 0, NULL, &mip);
+    if (result != TARGA_OK)
+        return result;
+
+    for (y = 0; y < image->height; y++)
+        targaMipRow(mip, y);
+
+    targaMipDestroy(mip);
+    return TARGA_OK;
+
+}
@@ -0,0 +1,167 @@
+/*
+ * MIT License
+ *
+ * TARGA Copyright (c) 2016 Sebastien Serre <ssbx@sysmo.io>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Atlas packer
+ *
+ * Packs TGA images into one atlas with targaAtlasBuild(), writes it as a
+ * TGA file and prints where every image went, one line per image:
+ *
+ *   file x y width height trimX trimY sourceWidth sourceHeight
+ *
+ * The images that failed are reported on the error output and left out.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <targa.h>
+
+
+static void packUsage(const char* program)
+{
+    fprintf(stderr,
+        "usage: %s [options] atlas.tga image.tga...\n"
+        "  --trim                 cut the fully transparent borders\n"
+        "  --padding n            empty pixels around every image (0)\n"
+        "  --max-width n          widest atlas (16384)\n"
+        "  --threads n            decoding threads, one per CPU by default\n"
+        "  --rle                  run-length encode the atlas\n"
+        "  --table file.txt       the placements, standard output by default\n",
+        program);
+}
+
+
+int main(int argc, char* argv[])
+{
+
+    TARGA_ATLAS_OPTIONS options = { TARGA_FORMAT_RGBA8, 0, 0, 0 };
+    TARGA_WRITE_OPTIONS writeOptions = {0};
+    unsigned int threads = 0;
+    const char* table = NULL;
+    int i;
+
+    for (i = 1; i < argc && strncmp(argv[i], "--", 2) == 0; i++)
+    {
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (strcmp(argv[i], "--trim") == 0)
+        {
+            options.flags |= TARGA_ATLAS_TRIM;
+            continue;
+        }
+        if (strcmp(argv[i], "--rle") == 0)
+        {
+            writeOptions.flags |= TARGA_WRITE_RLE;
+            continue;
+        }
+
+        if (!value)
+        {
+            packUsage(argv[0]);
+            return 1;
+        }
+
+        if (strcmp(argv[i], "--padding") == 0)
+            options.padding = (unsigned int)atoi(value);
+        else if (strcmp(argv[i], "--max-width") == 0)
+            options.maxWidth = (unsigned int)atoi(value);
+        else if (strcmp(argv[i], "--threads") == 0)
+            threads = (unsigned int)atoi(value);
+        else if (strcmp(argv[i], "--table") == 0)
+            table = value;
+        else
+        {
+            packUsage(argv[0]);
+            return 1;
+        }
+
+        i++;
+    }
+
+    if (argc - i < 2)
+    {
+        packUsage(argv[0]);
+        return 1;
+    }
+
+    const char* output = argv[i++];
+    size_t count = (size_t)(argc - i);
+    TARGA_ATLAS_ITEM* items = calloc(count, sizeof(TARGA_ATLAS_ITEM));
+    TARGA_POOL* pool = targaPoolCreate(threads, 0);
+    TARGA_IMAGE atlas;
+    size_t k;
+
+    if (!items || !pool)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    for (k = 0; k < count; k++)
+        items[k].fileName = argv[i + (int)k];
+
+    int status = targaAtlasBuild(pool, items, count, &options, &atlas);
+    targaPoolDestroy(pool);
+
+    if (atlas.pixels)
+        status = targaWriteImage(output, &atlas, &writeOptions) == TARGA_OK ? status : TARGA_ERR_WRITE;
+    else if (status == TARGA_OK)
+        status = TARGA_ERR_ARGUMENT;
+
+    FILE* out = table ? fopen(table, "w") : stdout;
+    if (!out)
+    {
+        fprintf(stderr, "cannot write %s\n", table);
+        return 1;
+    }
+
+    for (k = 0; k < count; k++)
+    {
+        const TARGA_ATLAS_ITEM* item = &items[k];
+
+        if (item->status != TARGA_OK)
+        {
+            fprintf(stderr, "%s: error %d\n", item->fileName, item->status);
+            continue;
+        }
+
+        fprintf(out, "%s %u %u %u %u %u %u %u %u\n", item->fileName,
+                item->rect.x, item->rect.y, item->rect.width, item->rect.height,
+                item->trimX, item->trimY, item->width, item->height);
+    }
+
+    if (out != stdout)
+        fclose(out);
+
+    if (status == TARGA_ERR_WRITE)
+        fprintf(stderr, "cannot write %s\n", output);
+    else if (atlas.pixels)
+        fprintf(stderr, "%s: %ux%u, %zu images\n", output, atlas.width, atlas.height, count);
+
+    targaImageFree(&atlas);
+    free(items);
+    return status == TARGA_OK ? 0 : 1;
+
+}
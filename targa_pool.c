@@ -0,0 +1,426 @@
+/*
+ * MIT License
+ *
+ * TARGA Copyright (c) 2016 Sebastien Serre <ssbx@sysmo.io>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "targa_private.h"
+
+#ifdef TARGA_HAVE_PTHREAD
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+
+#ifdef TARGA_HAVE_PTHREAD
+
+typedef struct {
+    TGA_TASK_FN     task;
+    void*           context;
+    size_t          count;
+    size_t          next;       /* next task index to hand out */
+    pthread_mutex_t lock;
+} TGA_PARALLEL_FOR;
+
+
+static void* targaParallelWorker(void* arg)
+{
+
+    TGA_PARALLEL_FOR* job = arg;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&job->lock);
+        size_t index = job->next++;
+        pthread_mutex_unlock(&job->lock);
+
+        if (index >= job->count)
+            break;
+
+        job->task(job->context, index);
+    }
+
+    return NULL;
+
+}
+
+#endif // TARGA_HAVE_PTHREAD
+
+
+void targaParallelFor(
+        unsigned int threads,
+        size_t count,
+        TGA_TASK_FN task,
+        void* context)
+{
+
+    size_t i;
+
+#ifdef TARGA_HAVE_PTHREAD
+    if (threads > count)
+        threads = (unsigned int)count;
+
+    if (threads > 1)
+    {
+        TGA_PARALLEL_FOR job;
+        pthread_t* workers = malloc(sizeof(pthread_t) * (threads - 1));
+        unsigned int started = 0;
+
+        job.task    = task;
+        job.context = context;
+        job.count   = count;
+        job.next    = 0;
+        pthread_mutex_init(&job.lock, NULL);
+
+        if (workers)
+            for (; started < threads - 1; started++)
+                if (pthread_create(&workers[started], NULL,
+                            targaParallelWorker, &job) != 0)
+                    break;
+
+        /* the calling thread works too, alone if no thread could start */
+        targaParallelWorker(&job);
+
+        for (i = 0; i < started; i++)
+            pthread_join(workers[i], NULL);
+
+        pthread_mutex_destroy(&job.lock);
+        free(workers);
+        return;
+    }
+#else
+    (void)threads;
+#endif
+
+    for (i = 0; i < count; i++)
+        task(context, i);
+
+}
+
+
+/*
+ * Work-stealing pool
+ *
+ * Every worker owns a deque of task indices. A job hands the tasks out
+ * round-robin in the given order, workers take their own tasks from the
+ * front and, once out of work, steal from the back of the other deques.
+ * One job runs at a time; the caller waits for all its tasks.
+ */
+#ifdef TARGA_HAVE_PTHREAD
+
+typedef struct {
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    size_t*         tasks;
+    size_t          front;
+    size_t          back;          /* tasks[front..back[ are left */
+    unsigned int    generation;    /* job the tasks belong to */
+    TARGA_POOL*     pool;
+    unsigned int    index;
+} TGA_WORKER;
+
+#endif // TARGA_HAVE_PTHREAD
+
+
+struct TARGA_POOL {
+    unsigned int    threads;
+#ifdef TARGA_HAVE_PTHREAD
+    unsigned int    flags;
+    TGA_WORKER*     workers;
+
+    pthread_mutex_t run;            /* one job at a time */
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+    pthread_cond_t  done;
+    unsigned int    generation;     /* bumped for every job */
+    int             stop;
+
+    TGA_TASK_FN     task;
+    void*           context;
+    size_t          pending;        /* tasks not finished */
+#endif
+};
+
+
+unsigned int targaCpuCount(void)
+{
+
+#if defined(TARGA_HAVE_PTHREAD) && defined(_SC_NPROCESSORS_ONLN)
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (count > 0)
+        return (unsigned int)count;
+#endif
+
+    return 1;
+
+}
+
+
+#ifdef TARGA_HAVE_PTHREAD
+
+static int targaPoolTake(
+        TGA_WORKER* worker,
+        int steal,
+        unsigned int generation,
+        size_t* index)
+{
+
+    int found = 0;
+
+    /* a worker late on the previous job must not run the tasks of the next */
+    pthread_mutex_lock(&worker->lock);
+    if (worker->generation == generation && worker->front < worker->back)
+    {
+        *index = steal
+            ? worker->tasks[--worker->back]
+            : worker->tasks[worker->front++];
+        found = 1;
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    return found;
+
+}
+
+
+static void* targaPoolWorker(void* arg)
+{
+
+    TGA_WORKER* self = arg;
+    TARGA_POOL* pool = self->pool;
+    unsigned int seen = 0;
+
+#ifdef __linux__
+    if (pool->flags & TARGA_POOL_PIN)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(self->index % targaCpuCount(), &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+#endif
+
+    for (;;)
+    {
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->stop && pool->generation == seen)
+            pthread_cond_wait(&pool->wake, &pool->lock);
+
+        if (pool->stop)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+
+        seen = pool->generation;
+        TGA_TASK_FN task = pool->task;
+        void* context = pool->context;
+        pthread_mutex_unlock(&pool->lock);
+
+        for (;;)
+        {
+            size_t index;
+            unsigned int i;
+            int found = targaPoolTake(self, 0, seen, &index);
+
+            for (i = 1; !found && i < pool->threads; i++)
+                found = targaPoolTake(
+                        &pool->workers[(self->index + i) % pool->threads], 1, seen, &index);
+
+            if (!found)
+                break;
+
+            task(context, index);
+
+            pthread_mutex_lock(&pool->lock);
+            if (--pool->pending == 0)
+                pthread_cond_signal(&pool->done);
+            pthread_mutex_unlock(&pool->lock);
+        }
+    }
+
+}
+
+#endif // TARGA_HAVE_PTHREAD
+
+
+TARGA_POOL* targaPoolCreate(unsigned int threads, unsigned int flags)
+{
+
+    TARGA_POOL* pool = calloc(1, sizeof(TARGA_POOL));
+    if (!pool)
+        return NULL;
+
+    if (threads == 0)
+        threads = targaCpuCount();
+
+#ifdef TARGA_HAVE_PTHREAD
+    unsigned int i;
+
+    pool->flags   = flags;
+    pool->workers = calloc(threads, sizeof(TGA_WORKER));
+    if (!pool->workers)
+    {
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->run, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (i = 0; i < threads; i++)
+    {
+        TGA_WORKER* worker = &pool->workers[i];
+
+        worker->pool  = pool;
+        worker->index = i;
+        pthread_mutex_init(&worker->lock, NULL);
+
+        if (pthread_create(&worker->thread, NULL, targaPoolWorker, worker) != 0)
+        {
+            pthread_mutex_destroy(&worker->lock);
+            break;
+        }
+
+        pool->threads++;
+    }
+
+    if (pool->threads == 0)
+    {
+        targaPoolDestroy(pool);
+        return NULL;
+    }
+#else
+    (void)flags;
+    pool->threads = 1;
+#endif
+
+    return pool;
+
+}
+
+
+void targaPoolDestroy(TARGA_POOL* pool)
+{
+
+    if (!pool)
+        return;
+
+#ifdef TARGA_HAVE_PTHREAD
+    unsigned int i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->threads; i++)
+    {
+        pthread_join(pool->workers[i].thread, NULL);
+        pthread_mutex_destroy(&pool->workers[i].lock);
+    }
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_mutex_destroy(&pool->run);
+    free(pool->workers);
+#endif
+
+    free(pool);
+
+}
+
+
+unsigned int targaPoolThreads(const TARGA_POOL* pool)
+{
+
+    return pool->threads;
+
+}
+
+
+void targaPoolRun(
+        TARGA_POOL* pool,
+        size_t count,
+        const size_t* order,
+        TGA_TASK_FN task,
+        void* context)
+{
+
+    size_t i;
+
+#ifdef TARGA_HAVE_PTHREAD
+    size_t* tasks = count ? malloc(sizeof(size_t) * count) : NULL;
+
+    if (tasks)
+    {
+        unsigned int threads = pool->threads;
+        unsigned int w;
+        size_t start = 0;
+
+        pthread_mutex_lock(&pool->run);
+
+        /* worker w gets the tasks w, w + threads, w + 2 * threads... */
+        for (w = 0; w < threads; w++)
+        {
+            TGA_WORKER* worker = &pool->workers[w];
+
+            pthread_mutex_lock(&worker->lock);
+            worker->tasks      = tasks + start;
+            worker->generation = pool->generation + 1;
+            worker->front      = 0;
+            worker->back       = 0;
+            for (i = w; i < count; i += threads)
+                worker->tasks[worker->back++] = order ? order[i] : i;
+            start += worker->back;
+            pthread_mutex_unlock(&worker->lock);
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        pool->task    = task;
+        pool->context = context;
+        pool->pending = count;
+        pool->generation++;
+        pthread_cond_broadcast(&pool->wake);
+
+        while (pool->pending)
+            pthread_cond_wait(&pool->done, &pool->lock);
+        pthread_mutex_unlock(&pool->lock);
+
+        pthread_mutex_unlock(&pool->run);
+        free(tasks);
+        return;
+    }
+#else
+    (void)pool;
+#endif
+
+    for (i = 0; i < count; i++)
+        task(context, order ? order[i] : i);
+
+}
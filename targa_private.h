@@ -0,0 +1,274 @@
+/*
+ * MIT License
+ *
+ * TARGA Copyright (c) 2016 Sebastien Serre <ssbx@sysmo.io>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Internal declarations shared by the library sources.
+ */
+#ifndef TARGA_PRIVATE_H
+#define TARGA_PRIVATE_H
+
+#include "targa.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define TGA_X86
+#define TGA_TARGET(isa) __attribute__((target(isa)))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <immintrin.h>
+#include <intrin.h>
+#define TGA_X86
+#define TGA_TARGET(isa)
+#endif
+
+/*
+ * TGA file layout
+ */
+#define CMT_TRUE_COLOR   0
+#define CMT_COLOR_MAPPED 1
+
+#define IMG_TYPE_NO_IMAGE_DATA                0
+#define IMG_TYPE_UNCOMPRESSED_COLOR_MAPPED    1
+#define IMG_TYPE_UNCOMPRESSED_TRUE_COLOR      2
+#define IMG_TYPE_UNCOMPRESSED_BLACK_AND_WHITE 3
+#define IMG_TYPE_RLE_COLOR_MAPPED             9
+#define IMG_TYPE_RLE_TRUE_COLOR               10
+#define IMG_TYPE_RLE_BLACK_AND_WHITE          11 
+
+#define TGA_HEADER_SIZE 18
+
+/*
+ * Image descriptor origin bits
+ */
+#define TGA_ORIGIN_RIGHT 0x10
+#define TGA_ORIGIN_TOP   0x20
+#define TGA_ORIGIN_MASK  0x30
+
+/*
+ * TGA 2.0 footer and extension area
+ */
+#define TGA_FOOTER_SIZE          26
+#define TGA_EXTENSION_SIZE       495
+#define TGA_SIGNATURE            "TRUEVISION-XFILE."
+#define TGA_EXT_SOFTWARE_ID      426
+#define TGA_EXT_KEY_COLOR        470
+#define TGA_EXT_STAMP_OFFSET     486
+#define TGA_EXT_SCANLINE_OFFSET  490
+#define TGA_EXT_ATTRIBUTES_TYPE  494
+
+#define CPU_SSSE3 0x1
+#define CPU_AVX2  0x2
+
+/*
+ * CPU_* features of the running CPU.
+ */
+unsigned int targaCpuFeatures(void);
+
+/*
+ * Convert count pixels from src to dst. Buffers must not overlap.
+ * converter holds the state of the kernels that need one (the key color,
+ * the color map table), the other kernels ignore it and accept NULL.
+ */
+typedef struct TGA_CONVERTER TGA_CONVERTER;
+
+typedef void (*TGA_SWIZZLE_FN)(
+        uint8_t* dst, const uint8_t* src, size_t count,
+        const TGA_CONVERTER* converter);
+
+/*
+ * Bytes per pixel of a TARGA_FORMAT_* (not AUTO).
+ */
+size_t targaFormatBpp(unsigned int format);
+
+/*
+ * Fastest kernel exchanging the first and third bytes of 3 or 4 bytes
+ * pixels (RGB to BGR and back).
+ */
+TGA_SWIZZLE_FN targaSwapKernel(size_t bpp);
+
+/*
+ * Run task(context, i) for every i in [0, count[ on up to threads
+ * threads, the calling thread included, and wait for all of them. Without
+ * thread support the tasks run serially.
+ */
+typedef void (*TGA_TASK_FN)(void* context, size_t index);
+
+void targaParallelFor(
+        unsigned int threads,
+        size_t count,
+        TGA_TASK_FN task,
+        void* context);
+
+/*
+ * Run task(context, i) for every i in [0, count[ on the pool, started in
+ * the given order (NULL for 0, 1, 2...), and wait for all of them.
+ */
+void targaPoolRun(
+        TARGA_POOL* pool,
+        size_t count,
+        const size_t* order,
+        TGA_TASK_FN task,
+        void* context);
+
+unsigned int targaCpuCount(void);
+
+/*
+ * Monotonic clock, in nanoseconds.
+ */
+uint64_t targaNanoseconds(void);
+
+/*
+ * What tells a file apart from its previous versions: any change of a
+ * field means the file changed.
+ */
+typedef struct {
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    uint64_t mtime;             /* nanoseconds where the system has them */
+} TGA_FILE_ID;
+
+int targaFileIdentity(const char* fileName, TGA_FILE_ID* id);
+
+/*
+ * Map a whole file, copy on write, or read it into memory where mmap is
+ * missing. Release it with targaUnmapFile().
+ */
+int targaMapFile(const char* fileName, void** data, size_t* size);
+
+void targaUnmapFile(void* data, size_t size);
+
+/*
+ * Sidecar files (options->cacheDir): serve image from the decoded copy of
+ * fileName if it is still valid, else return an error and leave in id the
+ * identity of the source to store the decoded copy with. The reads and
+ * allocations count in stats if not NULL.
+ */
+int targaSidecarLoad(
+        const char*                 fileName,
+        const TARGA_LOAD_OPTIONS*   options,
+        TGA_FILE_ID*                id,
+        TARGA_STATS*                stats,
+        TARGA_IMAGE*                image);
+
+void targaSidecarStore(
+        const char*                 fileName,
+        const TARGA_LOAD_OPTIONS*   options,
+        const TGA_FILE_ID*          id,
+        TARGA_STATS*                stats,
+        const TARGA_IMAGE*          image);
+
+/*
+ * Mip chains (targa_mip.c). image->levels and the layout of the levels
+ * follow from the size, format and pitch of the image.
+ */
+typedef struct TGA_MIP TGA_MIP;
+
+unsigned int targaMipLevels(unsigned int width, unsigned int height);
+
+/*
+ * Offset of level from image->pixels, the size of the chain for
+ * image->levels.
+ */
+size_t targaMipOffset(const TARGA_IMAGE* image, unsigned int level);
+
+/*
+ * Bytes from image->pixels to the end of its last level.
+ */
+size_t targaImageSize(const TARGA_IMAGE* image);
+
+/*
+ * Build the levels of image while its rows are written: targaMipRow() is
+ * given every row once complete, y counting from the last row when flip
+ * is set, in order.
+ */
+int targaMipCreate(
+        const TARGA_IMAGE*          image,
+        const TARGA_LOAD_OPTIONS*   options,
+        int                         flip,
+        TARGA_STATS*                stats,
+        TGA_MIP**                   mip);
+
+void targaMipRow(TGA_MIP* mip, size_t y);
+
+void targaMipDestroy(TGA_MIP* mip);
+
+/*
+ * Build the levels of a complete image.
+ */
+int targaMipBuild(const TARGA_IMAGE* image, const TARGA_LOAD_OPTIONS* options);
+
+/*
+ * Block compression (targa_bc.c). Rows are decoded into the band returned
+ * by targaBcBand() and targaBcRow() is given every row once complete, y
+ * counting from the last row when flip is set, in order; the blocks are
+ * written into image->pixels.
+ */
+typedef struct TGA_BC TGA_BC;
+
+/*
+ * Bytes per block of a block format, 0 for the other formats.
+ */
+size_t targaBlockSize(unsigned int format);
+
+int targaBcCreate(
+        const TARGA_IMAGE*  image,
+        unsigned int        threads,
+        int                 flip,
+        TGA_BC**            bc);
+
+uint8_t* targaBcBand(TGA_BC* bc, size_t y);
+
+void targaBcRow(TGA_BC* bc, size_t y);
+
+void targaBcDestroy(TGA_BC* bc);
+
+/*
+ * Thumbnails and postage stamps keep the middle pixel of every step x step
+ * square of the image, step the smallest for them to fit in maxSize; the
+ * last squares may be cut by the edges. targaDecimate() is the pixel, row
+ * or column, kept for pixel i of the thumbnail.
+ */
+unsigned int targaDecimateStep(unsigned int width, unsigned int height, unsigned int maxSize);
+
+size_t targaDecimate(size_t i, unsigned int step, size_t size);
+
+/*
+ * Relaxed atomic access to uint64_t counters shared by threads.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define TGA_ATOMIC_ADD(p, v)   __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+#define TGA_ATOMIC_LOAD(p)     __atomic_load_n((p), __ATOMIC_RELAXED)
+#define TGA_ATOMIC_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#elif defined(_MSC_VER) && defined(_WIN64)
+#include <intrin.h>
+#define TGA_ATOMIC_ADD(p, v)   _InterlockedExchangeAdd64((volatile __int64*)(p), (__int64)(v))
+#define TGA_ATOMIC_LOAD(p)     (*(volatile uint64_t*)(p))
+#define TGA_ATOMIC_STORE(p, v) (*(volatile uint64_t*)(p) = (v))
+#else
+#define TGA_ATOMIC_ADD(p, v)   (*(p) += (v))
+#define TGA_ATOMIC_LOAD(p)     (*(p))
+#define TGA_ATOMIC_STORE(p, v) (*(p) = (v))
+#endif
+
+#endif // TARGA_PRIVATE_H
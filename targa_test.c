@@ -25,8 +25,20 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
 #include <targa.h>
 
+#ifdef TARGA_HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#define TEST_UTIME
+#endif
+
 // Minunit include BEGIN
 /* Copyright (C) 2002 John Brewer */
 #define mu_assert(message, test) do { \
@@ -41,35 +53,2874 @@ int tests_run = 0;
 // Minunit include END
 
 
+static const char* dataFile = NULL;
+static const char* dataFile2 = NULL;
+
+
+static void truncateFile(const char* fileName, long length)
+{
+    FILE* file = fopen(fileName, "rb");
+    uint8_t* data = malloc((size_t)length);
+    fread(data, 1, (size_t)length, file);
+    fclose(file);
+
+    file = fopen(fileName, "wb");
+    fwrite(data, 1, (size_t)length, file);
+    fclose(file);
+    free(data);
+}
+
+
+/*
+ * Write a small uncompressed image with pseudo random pixels, the raw
+ * pixel data is returned for reference.
+ */
+static uint8_t* writeTestImage(
+        const char* fileName,
+        uint8_t imageType,
+        uint8_t pixelDepth,
+        unsigned int width,
+        unsigned int height)
+{
+    size_t size = (size_t)width * height * ((pixelDepth + 7) >> 3);
+    uint8_t* pixels = malloc(size);
+    uint8_t header[18] = {0};
+    unsigned int seed = 12345;
+    size_t i;
+
+    for (i = 0; i < size; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        pixels[i] = (uint8_t)(seed >> 16);
+    }
+
+    header[2]  = imageType;
+    header[12] = width & 0xFF;
+    header[13] = width >> 8;
+    header[14] = height & 0xFF;
+    header[15] = height >> 8;
+    header[16] = pixelDepth;
+
+    FILE* file = fopen(fileName, "wb");
+    fwrite(header, 1, sizeof(header), file);
+    fwrite(pixels, 1, size, file);
+    fclose(file);
+
+    return pixels;
+}
+
+
+/*
+ * RLE compress size pixels of bpp bytes into file, packets may cross
+ * rows.
+ */
+static void writeRle(FILE* file, const uint8_t* pixels, size_t size, size_t bpp)
+{
+    size_t i = 0;
+
+    while (i < size)
+    {
+        size_t n = 1;
+
+        while (i + n < size && n < 128 &&
+               memcmp(pixels + (i + n) * bpp, pixels + i * bpp, bpp) == 0)
+            n++;
+
+        if (n > 1)
+        {
+            fputc(0x80 | (int)(n - 1), file);
+            fwrite(pixels + i * bpp, 1, bpp, file);
+        }
+        else
+        {
+            while (i + n < size && n < 128 &&
+                   memcmp(pixels + (i + n) * bpp, pixels + (i + n - 1) * bpp, bpp) != 0)
+                n++;
+
+            fputc((int)(n - 1), file);
+            fwrite(pixels + i * bpp, 1, n * bpp, file);
+        }
+
+        i += n;
+    }
+}
+
+
+/*
+ * Same as writeTestImage, for RLE types: one pixel out of two repeats the
+ * previous one so that the stream has both kinds of packets. truncate
+ * bytes are cut from the end of the file.
+ */
+static uint8_t* writeTestRle(
+        const char* fileName,
+        uint8_t imageType,
+        uint8_t pixelDepth,
+        unsigned int width,
+        unsigned int height,
+        size_t truncate)
+{
+    size_t bpp = (pixelDepth + 7) >> 3;
+    size_t count = (size_t)width * height;
+    uint8_t* pixels = malloc(count * bpp);
+    uint8_t header[18] = {0};
+    unsigned int seed = 6789;
+    size_t i, j;
+
+    for (i = 0; i < count; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        if (i > 0 && (seed >> 16) % 2 == 0)
+        {
+            memcpy(pixels + i * bpp, pixels + (i - 1) * bpp, bpp);
+            continue;
+        }
+
+        for (j = 0; j < bpp; j++)
+        {
+            seed = seed * 1103515245 + 12345;
+            pixels[i * bpp + j] = (uint8_t)(seed >> 16);
+        }
+    }
+
+    header[2]  = imageType;
+    header[12] = width & 0xFF;
+    header[13] = width >> 8;
+    header[14] = height & 0xFF;
+    header[15] = height >> 8;
+    header[16] = pixelDepth;
+
+    FILE* file = fopen(fileName, "wb+");
+    fwrite(header, 1, sizeof(header), file);
+    writeRle(file, pixels, count, bpp);
+
+    long length = ftell(file);
+    fclose(file);
+
+    if (truncate)
+        truncateFile(fileName, length - (long)truncate);
+
+    return pixels;
+}
+
+
 static char* test_targaLoad() {
 
+    int status;
+    unsigned int w, h;
+    uint8_t* texture = targaLoad(dataFile, &status, &w, &h);
+
+    mu_assert("load failed", texture != NULL && status == TARGA_OK);
+    mu_assert("bad size", w == 640 && h == 400);
+
+    FILE* file = fopen(dataFile, "rb");
+    uint8_t header[18];
+    fread(header, 1, sizeof(header), file);
+    fseek(file, header[0], SEEK_CUR);
+
+    size_t i;
+    for (i = 0; i < (size_t)w * h; i++)
+    {
+        uint8_t bgr[3];
+        fread(bgr, 1, 3, file);
+        if (texture[i * 3 + 0] != bgr[2] ||
+            texture[i * 3 + 1] != bgr[1] ||
+            texture[i * 3 + 2] != bgr[0])
+            break;
+    }
+    fclose(file);
+    free(texture);
+
+    mu_assert("bad pixel", i == (size_t)w * h);
     return NULL;
 
 }
 
-static char* targa_test(char* test_name) {
 
+static char* test_targaLoadMissing() {
+
+    int status;
+    unsigned int w, h;
+    void* texture = targaLoad("missing.tga", &status, &w, &h);
+
+    mu_assert("load should fail", texture == NULL);
+    mu_assert("bad status", status == TARGA_ERR_OPEN);
     return NULL;
 
 }
 
-int main(int argc, char* argv[])
-{
 
-    int loadStatus;
+static char* test_targaLoad32() {
+
+    int status;
     unsigned int w, h;
-    targaLoad(argv[1], &loadStatus, &w, &h);
+    uint8_t* pixels = writeTestImage("test32.tga", 2, 32, 37, 5);
+    uint8_t* texture = targaLoad("test32.tga", &status, &w, &h);
+    size_t i;
 
-    printf("status is: %d\n", loadStatus);
+    mu_assert("load failed", texture != NULL && status == TARGA_OK);
+    mu_assert("bad size", w == 37 && h == 5);
 
-    /*
-    char* result = obj_test(argv[1]);
+    for (i = 0; i < (size_t)w * h; i++)
+        if (texture[i * 4 + 0] != pixels[i * 4 + 2] ||
+            texture[i * 4 + 1] != pixels[i * 4 + 1] ||
+            texture[i * 4 + 2] != pixels[i * 4 + 0] ||
+            texture[i * 4 + 3] != pixels[i * 4 + 3])
+            break;
 
-    if (result != 0)
-        printf("%s\n", result);
+    free(texture);
+    free(pixels);
+    mu_assert("bad pixel", i == (size_t)w * h);
+    return NULL;
 
-    return result != NULL;
-    */
+}
+
+
+static char* test_targaLoad16() {
+
+    int status;
+    unsigned int w, h;
+    uint8_t* pixels = writeTestImage("test16.tga", 2, 16, 37, 5);
+    uint8_t* texture = targaLoad("test16.tga", &status, &w, &h);
+    size_t i;
+
+    mu_assert("load failed", texture != NULL && status == TARGA_OK);
+
+    for (i = 0; i < (size_t)w * h; i++)
+    {
+        unsigned int c = pixels[i * 2] | (pixels[i * 2 + 1] << 8);
+        unsigned int r = (c >> 10) & 0x1F, g = (c >> 5) & 0x1F, b = c & 0x1F;
+
+        if (texture[i * 3 + 0] != ((r << 3) | (r >> 2)) ||
+            texture[i * 3 + 1] != ((g << 3) | (g >> 2)) ||
+            texture[i * 3 + 2] != ((b << 3) | (b >> 2)))
+            break;
+    }
+
+    free(texture);
+    free(pixels);
+    mu_assert("bad pixel", i == (size_t)w * h);
+    return NULL;
+
+}
+
+
+static char* test_targaLoadMapped() {
+
+    int status;
+    unsigned int w, h;
+    uint8_t* texture = targaLoad(dataFile, &status, &w, &h);
+
+    TARGA_LOAD_OPTIONS options = {0};
+    TARGA_IMAGE image;
+
+    /* decoded from the mapping */
+    options.flags = TARGA_LOAD_MAPPED;
+    status = targaLoadImage(dataFile, &options, &image);
+
+    mu_assert("mapped load failed", status == TARGA_OK && !image.mapped);
+    mu_assert("bad format", image.format == TARGA_FORMAT_RGB8);
+    mu_assert("bad pitch", image.pitch == w * 3);
+    mu_assert("bad pixels", memcmp(image.pixels, texture, (size_t)w * h * 3) == 0);
+    targaImageFree(&image);
+
+    /* zero copy view */
+    options.format = TARGA_FORMAT_BGR8;
+    status = targaLoadImage(dataFile, &options, &image);
+
+    mu_assert("view load failed", status == TARGA_OK && image.mapped);
+
+    size_t i;
+    for (i = 0; i < (size_t)w * h; i++)
+        if (image.pixels[i * 3 + 0] != texture[i * 3 + 2] ||
+            image.pixels[i * 3 + 2] != texture[i * 3 + 0])
+            break;
+
+    targaImageFree(&image);
+    free(texture);
+    mu_assert("bad view pixels", i == (size_t)w * h);
+    return NULL;
+
+}
+
+
+static char* test_targaLoadRle() {
+
+    int status;
+    unsigned int w, h, w2, h2;
+    uint8_t* raw = targaLoad(dataFile, &status, &w, &h);
+    uint8_t* rle = targaLoad(dataFile2, &status, &w2, &h2);
+
+    mu_assert("rle load failed", rle != NULL && status == TARGA_OK);
+    mu_assert("bad size", w == w2 && h == h2);
+    mu_assert("bad pixels", memcmp(raw, rle, (size_t)w * h * 3) == 0);
+
+    free(raw);
+    free(rle);
+    return NULL;
+
+}
+
+
+static char* test_targaLoadRle32() {
+
+    int status;
+    unsigned int w, h;
+    uint8_t* pixels = writeTestRle("rle32.tga", 10, 32, 301, 77, 0);
+    uint8_t* texture = targaLoad("rle32.tga", &status, &w, &h);
+    size_t i;
+
+    mu_assert("load failed", texture != NULL && status == TARGA_OK);
+
+    for (i = 0; i < (size_t)w * h; i++)
+        if (texture[i * 4 + 0] != pixels[i * 4 + 2] ||
+            texture[i * 4 + 1] != pixels[i * 4 + 1] ||
+            texture[i * 4 + 2] != pixels[i * 4 + 0] ||
+            texture[i * 4 + 3] != pixels[i * 4 + 3])
+            break;
+
+    free(texture);
+    free(pixels);
+    mu_assert("bad pixel", i == (size_t)w * h);
+    return NULL;
+
+}
+
+
+static char* test_targaLoadRleGray() {
+
+    int status;
+    unsigned int w, h;
+    uint8_t* pixels = writeTestRle("rlegray.tga", 11, 8, 513, 129, 0);
+    uint8_t* texture = targaLoad("rlegray.tga", &status, &w, &h);
+    size_t i;
+
+    mu_assert("load failed", texture != NULL && status == TARGA_OK);
+
+    for (i = 0; i < (size_t)w * h; i++)
+        if (texture[i * 3 + 0] != pixels[i] ||
+            texture[i * 3 + 1] != pixels[i] ||
+            texture[i * 3 + 2] != pixels[i])
+            break;
+
+    free(texture);
+    free(pixels);
+    mu_assert("bad pixel", i == (size_t)w * h);
+
+    /* a truncated stream is an error, not a read past the data */
+    free(writeTestRle("rletrunc.tga", 10, 24, 200, 200, 10));
+    texture = targaLoad("rletrunc.tga", &status, &w, &h);
+    mu_assert("truncated load should fail", !texture && status == TARGA_ERR_READ);
+
+    return NULL;
+
+}
+
+
+static char* test_targaLoadRleParallel() {
+
+    TARGA_LOAD_OPTIONS options = {0};
+    TARGA_IMAGE serial, parallel;
+    unsigned int flags;
+
+    free(writeTestRle("rlepar.tga", 10, 32, 1031, 300, 0));
+
+    for (flags = 0; flags <= TARGA_LOAD_MAPPED; flags += TARGA_LOAD_MAPPED)
+    {
+        options.flags   = flags;
+        options.threads = 0;
+        mu_assert("serial load failed",
+                targaLoadImage("rlepar.tga", &options, &serial) == TARGA_OK);
+
+        options.threads = 4;
+        mu_assert("parallel load failed",
+                targaLoadImage("rlepar.tga", &options, &parallel) == TARGA_OK);
+
+        int same = memcmp(serial.pixels, parallel.pixels,
+                serial.pitch * serial.height) == 0;
+
+        targaImageFree(&serial);
+        targaImageFree(&parallel);
+        mu_assert("bad pixels", same);
+    }
+
+    /* truncated streams fail the same way */
+    free(writeTestRle("rlepar.tga", 10, 24, 1031, 300, 100));
+    mu_assert("truncated load should fail",
+            targaLoadImage("rlepar.tga", &options, &parallel) == TARGA_ERR_READ);
+
+    /* no pixel in a row: nothing to split */
+    uint8_t header[18] = {0};
+    uint8_t type;
+
+    header[14] = 8;
+    for (type = 10; type <= 11; type++)
+    {
+        header[2]  = type;
+        header[16] = type == 10 ? 24 : 8;
+        mu_assert("empty rows failed",
+                targaLoadMemory(header, sizeof(header), &options, &parallel) == TARGA_OK);
+        mu_assert("bad empty rows", parallel.width == 0 && parallel.height == 8);
+        targaImageFree(&parallel);
+    }
+
+    return NULL;
 
 }
 
+
+/*
+ * Feed fileName to a push decoder by pieces of 1 to chunk bytes and
+ * compare the rows with a normal load.
+ */
+static char* streamFile(const char* fileName, size_t chunk) {
+
+    TARGA_IMAGE image;
+    mu_assert("load failed", targaLoadImage(fileName, NULL, &image) == TARGA_OK);
+
+    FILE* file = fopen(fileName, "rb");
+    fseek(file, 0, SEEK_END);
+    size_t size = (size_t)ftell(file);
+    uint8_t* data = malloc(size);
+    fseek(file, 0, SEEK_SET);
+    fread(data, 1, size, file);
+    fclose(file);
+
+    TARGA_DECODER* decoder = targaDecoderCreate(NULL);
+    unsigned int seed = 42, rows = 0, y;
+    int status = TARGA_OK, same = 1;
+    size_t used = 0;
+
+    while (used < size && status == TARGA_OK)
+    {
+        seed = seed * 1103515245 + 12345;
+        size_t n = 1 + (seed >> 16) % chunk;
+        if (n > size - used)
+            n = size - used;
+
+        size_t fed = 0;
+        while (fed < n && status == TARGA_OK)
+        {
+            const uint8_t* row;
+
+            fed += targaDecoderFeed(decoder, data + used + fed, n - fed, &status);
+            while ((row = targaDecoderRow(decoder, &y)))
+            {
+                same &= y == rows++;
+                same &= memcmp(row, image.pixels + y * image.pitch, image.pitch) == 0;
+            }
+        }
+        used += n;
+    }
+
+    status = targaDecoderFinish(decoder);
+    same &= rows == image.height;
+
+    targaDecoderDestroy(decoder);
+    free(data);
+    targaImageFree(&image);
+
+    mu_assert("stream decode failed", status == TARGA_OK);
+    mu_assert("bad rows", same);
+    return NULL;
+
+}
+
+
+static char* test_targaDecoder() {
+
+    char* result;
+
+    if ((result = streamFile(dataFile, 4096)))
+        return result;
+    if ((result = streamFile(dataFile2, 97)))
+        return result;
+
+    free(writeTestRle("rlestream.tga", 10, 32, 61, 17, 0));
+    if ((result = streamFile("rlestream.tga", 1)))
+        return result;
+
+    /* a truncated stream does not finish */
+    free(writeTestRle("rlestream.tga", 10, 24, 61, 17, 3));
+    mu_assert("truncated stream should fail", streamFile("rlestream.tga", 7) != NULL);
+
+    return NULL;
+
+}
+
+
+static char* test_targaLoadInto() {
+
+    TARGA_LOAD_OPTIONS options = {0};
+    TARGA_IMAGE packed, image;
+    size_t size, y;
+    int same = 1;
+
+    mu_assert("load failed", targaLoadImage(dataFile, NULL, &packed) == TARGA_OK);
+
+    /* 256 bytes aligned rows */
+    options.alignment = 256;
+    mu_assert("query failed",
+            targaQueryImage(dataFile, &options, &image, &size) == TARGA_OK);
+    mu_assert("bad pitch", image.pitch % 256 == 0 && image.pitch >= packed.pitch);
+    mu_assert("bad size", size == image.pitch * packed.height);
+
+    uint8_t* memory = malloc(size * 2 + 256);
+    uint8_t* buffer = memory + (256 - (uintptr_t)memory % 256);
+
+    mu_assert("misaligned buffer accepted",
+            targaLoadInto(dataFile, &options, buffer + 1, size, &image) == TARGA_ERR_ARGUMENT);
+    mu_assert("small buffer accepted",
+            targaLoadInto(dataFile, &options, buffer, size - 1, &image) == TARGA_ERR_ARGUMENT);
+    mu_assert("load into failed",
+            targaLoadInto(dataFile, &options, buffer, size, &image) == TARGA_OK);
+    mu_assert("bad image", image.pixels == buffer && !image.memory);
+
+    for (y = 0; y < packed.height; y++)
+        same &= memcmp(buffer + y * image.pitch,
+                packed.pixels + y * packed.pitch, packed.pitch) == 0;
+    mu_assert("bad rows", same);
+
+    /* explicit pitch, parallel RLE */
+    options.alignment = 0;
+    options.pitch     = packed.pitch + 5;
+    options.threads   = 3;
+    mu_assert("load into failed",
+            targaLoadInto(dataFile2, &options, memory, size * 2, &image) == TARGA_OK);
+
+    TARGA_IMAGE rle;
+    mu_assert("load failed", targaLoadImage(dataFile2, NULL, &rle) == TARGA_OK);
+    for (y = 0; y < rle.height; y++)
+        same &= memcmp(memory + y * options.pitch,
+                rle.pixels + y * rle.pitch, rle.pitch) == 0;
+    mu_assert("bad rle rows", same);
+
+    /* owned aligned allocation */
+    options.pitch     = 0;
+    options.threads   = 0;
+    options.alignment = 64;
+    mu_assert("aligned load failed",
+            targaLoadImage(dataFile, &options, &image) == TARGA_OK);
+    mu_assert("misaligned pixels", (uintptr_t)image.pixels % 64 == 0);
+
+    targaImageFree(&image);
+    targaImageFree(&rle);
+    targaImageFree(&packed);
+    free(memory);
+    return NULL;
+
+}
+
+
+static char* test_targaProbe() {
+
+    TARGA_INFO info, info2;
+
+    mu_assert("probe failed",
+            targaProbe(dataFile, TARGA_PROBE_EXTENSION, &info) == TARGA_OK);
+    mu_assert("bad geometry", info.width == 640 && info.height == 400);
+    mu_assert("bad type", info.imageType == 2 && info.pixelDepth == 24);
+    mu_assert("bad origin", info.origin == TARGA_ORIGIN_BOTTOM_LEFT);
+    mu_assert("bad data offset", info.dataOffset == 18);
+    mu_assert("no footer", info.version == 2 && info.extensionOffset == 0);
+
+    mu_assert("probe missing",
+            targaProbe("missing.tga", 0, &info2) == TARGA_ERR_OPEN);
+
+    /* header only from memory and from a descriptor */
+    FILE* file = fopen(dataFile, "rb");
+    uint8_t header[18];
+    fread(header, 1, sizeof(header), file);
+
+    mu_assert("memory probe failed",
+            targaProbeMemory(header, sizeof(header), 0, &info2) == TARGA_OK);
+    mu_assert("bad memory probe", info2.width == 640 && info2.version == 0);
+
+#if defined(__unix__) || defined(__APPLE__)
+    mu_assert("fd probe failed",
+            targaProbeFd(fileno(file), TARGA_PROBE_EXTENSION, &info2) == TARGA_OK);
+    mu_assert("bad fd probe", memcmp(&info, &info2, sizeof(info)) == 0);
+#endif
+    fclose(file);
+
+    /* extension area appended to a generated image */
+    free(writeTestImage("probe.tga", 2, 32, 3, 2));
+
+    uint8_t extension[495] = {0};
+    uint8_t footer[26] = {0};
+
+    extension[0]   = 495 & 0xFF;
+    extension[1]   = 495 >> 8;
+    extension[486] = 0x34;
+    extension[487] = 0x12;
+    extension[494] = 3;
+    footer[0]      = 18 + 3 * 2 * 4;
+    memcpy(footer + 8, "TRUEVISION-XFILE.", 18);
+
+    file = fopen("probe.tga", "ab");
+    fwrite(extension, 1, sizeof(extension), file);
+    fwrite(footer, 1, sizeof(footer), file);
+    fclose(file);
+
+    mu_assert("probe failed",
+            targaProbe("probe.tga", TARGA_PROBE_EXTENSION, &info) == TARGA_OK);
+    mu_assert("bad extension", info.extensionOffset == 42 &&
+            info.stampOffset == 0x1234 && info.attributesType == 3);
+
+    return NULL;
+
+}
+
+
+static char* test_targaNoImageData() {
+
+    TARGA_LOAD_OPTIONS options = {0};
+    TARGA_DECODER* decoder;
+    TARGA_IMAGE image;
+    TARGA_INFO info;
+    unsigned int width = 1, height = 1;
+    int status;
+    void* pixels;
+
+    /* type 0: a header announcing 16x8 pixels, followed by none */
+    uint8_t header[18 + 3] = {0};
+    header[12] = 16;
+    header[14] = 8;
+    header[16] = 24;
+
+    mu_assert("probe failed", targaProbeMemory(header, 18, 0, &info) == TARGA_OK);
+    mu_assert("bad header", info.imageType == 0 && info.width == 16 && info.height == 8);
+
+    mu_assert("load failed", targaLoadMemory(header, 18, NULL, &image) == TARGA_OK);
+    mu_assert("not empty", image.width == 0 && image.height == 0 &&
+            image.format == TARGA_FORMAT_RGB8 && image.pixels != NULL);
+    targaImageFree(&image);
+
+    FILE* file = fopen("no_image_data.tga", "wb");
+    fwrite(header, 1, 18, file);
+    fclose(file);
+
+    options.format = TARGA_FORMAT_BGRA8;
+    options.flags  = TARGA_LOAD_TOP_LEFT;
+    mu_assert("load failed", targaLoadImage("no_image_data.tga", &options, &image) == TARGA_OK);
+    mu_assert("not empty", image.width == 0 && image.height == 0 &&
+            image.format == TARGA_FORMAT_BGRA8 && image.origin == TARGA_ORIGIN_TOP_LEFT);
+    targaImageFree(&image);
+
+    pixels = targaLoad("no_image_data.tga", &status, &width, &height);
+    mu_assert("load failed", status == TARGA_OK && width == 0 && height == 0);
+    free(pixels);
+
+    /* the push decoder is done after the header */
+    decoder = targaDecoderCreate(NULL);
+    mu_assert("decoder failed", decoder != NULL);
+    mu_assert("feed failed", targaDecoderFeed(decoder, header, 18, &status) == 18 &&
+            status == TARGA_OK);
+    mu_assert("not finished", targaDecoderFinish(decoder) == TARGA_OK);
+    targaDecoderDestroy(decoder);
+
+    options.format = TARGA_FORMAT_BC7;
+    mu_assert("load failed", targaLoadMemory(header, 18, &options, &image) == TARGA_OK);
+    mu_assert("not empty", image.width == 0 && image.height == 0);
+    targaImageFree(&image);
+    mu_assert("thumbnail failed",
+            targaLoadThumbnail("no_image_data.tga", 0, NULL, &image) == TARGA_OK);
+    mu_assert("not empty", image.width == 0 && image.height == 0);
+    targaImageFree(&image);
+
+    options.format = 99;
+    mu_assert("bad format accepted",
+            targaLoadMemory(header, 18, &options, &image) == TARGA_ERR_ARGUMENT);
+
+    return NULL;
+
+}
+
+
+static char* test_targaLoadBatch() {
+
+    TARGA_BATCH_ITEM items[6];
+    TARGA_IMAGE reference[2];
+    size_t i, pass;
+
+    mu_assert("load failed", targaLoadImage(dataFile, NULL, &reference[0]) == TARGA_OK);
+    mu_assert("load failed", targaLoadImage(dataFile2, NULL, &reference[1]) == TARGA_OK);
+
+    FILE* file = fopen(dataFile, "rb");
+    fseek(file, 0, SEEK_END);
+    size_t size = (size_t)ftell(file);
+    uint8_t* data = malloc(size);
+    fseek(file, 0, SEEK_SET);
+    fread(data, 1, size, file);
+    fclose(file);
+
+    free(writeTestImage("batch.tga", 2, 32, 5, 3));
+
+    TARGA_POOL* pool = targaPoolCreate(3, TARGA_POOL_PIN);
+    mu_assert("pool failed", pool && targaPoolThreads(pool) >= 1);
+
+    /* twice on the same pool, then on a temporary one */
+    for (pass = 0; pass < 3; pass++)
+    {
+        memset(items, 0, sizeof(items));
+        items[0].fileName = "batch.tga";
+        items[1].fileName = dataFile2;
+        items[2].fileName = "missing.tga";
+        items[3].data     = data;
+        items[3].size     = size;
+        items[4].fileName = dataFile;
+        items[5].data     = data;
+        items[5].size     = 10;
+
+        int status = targaLoadBatch(pass < 2 ? pool : NULL, items, 6, NULL);
+        mu_assert("bad batch status", status == TARGA_ERR_OPEN);
+
+        mu_assert("bad item status",
+                items[0].status == TARGA_OK && items[1].status == TARGA_OK &&
+                items[2].status == TARGA_ERR_OPEN && items[3].status == TARGA_OK &&
+                items[4].status == TARGA_OK && items[5].status == TARGA_ERR_READ);
+        mu_assert("failed item has pixels", !items[2].image.pixels && !items[5].image.pixels);
+        mu_assert("bad small image",
+                items[0].image.width == 5 && items[0].image.format == TARGA_FORMAT_RGBA8);
+
+        mu_assert("bad rle image", memcmp(items[1].image.pixels, reference[1].pixels,
+                reference[1].pitch * reference[1].height) == 0);
+        mu_assert("bad memory image", memcmp(items[3].image.pixels, reference[0].pixels,
+                reference[0].pitch * reference[0].height) == 0);
+        mu_assert("bad file image", memcmp(items[4].image.pixels, reference[0].pixels,
+                reference[0].pitch * reference[0].height) == 0);
+
+        for (i = 0; i < 6; i++)
+            targaImageFree(&items[i].image);
+    }
+
+    targaPoolDestroy(pool);
+    targaImageFree(&reference[0]);
+    targaImageFree(&reference[1]);
+    free(data);
+    return NULL;
+
+}
+
+
+static char* test_targaFormats() {
+
+    TARGA_LOAD_OPTIONS options = {0};
+    TARGA_IMAGE image, rle;
+    size_t i, count = 37 * 5;
+    int same = 1;
+
+    uint8_t* pixels = writeTestImage("formats.tga", 2, 32, 37, 5);
+    uint8_t* rlePixels = writeTestRle("formats_rle.tga", 10, 32, 37, 5, 0);
+
+    /* every output format from 32 bits pixels */
+    for (options.format = TARGA_FORMAT_RGB8;
+         options.format <= TARGA_FORMAT_RGBA8_KEYED; options.format++)
+    {
+        options.colorKey = pixels[2] << 16 | pixels[1] << 8 | pixels[0];
+
+        mu_assert("load failed",
+                targaLoadImage("formats.tga", &options, &image) == TARGA_OK);
+        mu_assert("bad format", image.format == options.format);
+
+        size_t bpp = image.pitch / image.width;
+        for (i = 0; i < count; i++)
+        {
+            const uint8_t* p = pixels + i * 4;
+            const uint8_t* q = image.pixels + i * bpp;
+            unsigned int b = p[0], g = p[1], r = p[2], a = p[3];
+
+            switch (options.format)
+            {
+                case TARGA_FORMAT_RGB8:
+                    same &= q[0] == r && q[1] == g && q[2] == b;
+                    break;
+                case TARGA_FORMAT_BGR8:
+                    same &= q[0] == b && q[1] == g && q[2] == r;
+                    break;
+                case TARGA_FORMAT_BGRA8:
+                    same &= memcmp(q, p, 4) == 0;
+                    break;
+                case TARGA_FORMAT_GRAY8:
+                    same &= q[0] == (77 * r + 150 * g + 29 * b + 128) >> 8;
+                    break;
+                case TARGA_FORMAT_RGBA8_PREMULTIPLIED:
+                    same &= q[0] == (r * a * 2 + 255) / 510 &&
+                            q[1] == (g * a * 2 + 255) / 510 &&
+                            q[2] == (b * a * 2 + 255) / 510 && q[3] == a;
+                    break;
+                case TARGA_FORMAT_RGBA8_KEYED:
+                    same &= q[0] == r && q[3] ==
+                        ((r << 16 | g << 8 | b) == options.colorKey ? 0 : a);
+                    break;
+                default:
+                    same &= q[0] == r && q[1] == g && q[2] == b && q[3] == a;
+            }
+        }
+        mu_assert("bad pixels", same);
+        mu_assert("key not applied", options.format != TARGA_FORMAT_RGBA8_KEYED ||
+                image.pixels[3] == 0);
+
+        targaImageFree(&image);
+    }
+
+    /* the RLE path against the same pixels stored raw */
+    uint8_t header[18] = {0, 0, 2};
+    header[12] = 37;
+    header[14] = 5;
+    header[16] = 32;
+
+    FILE* file = fopen("formats_raw.tga", "wb");
+    fwrite(header, 1, sizeof(header), file);
+    fwrite(rlePixels, 1, count * 4, file);
+    fclose(file);
+
+    for (options.format = TARGA_FORMAT_RGB8;
+         options.format <= TARGA_FORMAT_RGBA8_KEYED; options.format++)
+    {
+        options.colorKey = rlePixels[2] << 16 | rlePixels[1] << 8 | rlePixels[0];
+
+        mu_assert("load failed",
+                targaLoadImage("formats_raw.tga", &options, &image) == TARGA_OK);
+        mu_assert("rle load failed",
+                targaLoadImage("formats_rle.tga", &options, &rle) == TARGA_OK);
+        same &= memcmp(image.pixels, rle.pixels, image.pitch * image.height) == 0;
+
+        targaImageFree(&rle);
+        targaImageFree(&image);
+    }
+    mu_assert("bad rle pixels", same);
+
+    /* gray source */
+    free(pixels);
+    pixels = writeTestImage("formats_gray.tga", 3, 8, 37, 5);
+
+    options.format = TARGA_FORMAT_GRAY8;
+    mu_assert("gray load failed",
+            targaLoadImage("formats_gray.tga", &options, &image) == TARGA_OK);
+    mu_assert("bad gray", memcmp(image.pixels, pixels, count) == 0);
+    targaImageFree(&image);
+
+    options.format = TARGA_FORMAT_RGBA8;
+    mu_assert("gray load failed",
+            targaLoadImage("formats_gray.tga", &options, &image) == TARGA_OK);
+    for (i = 0; i < count; i++)
+        same &= image.pixels[i * 4] == pixels[i] && image.pixels[i * 4 + 3] == 0xFF;
+    mu_assert("bad gray rgba", same);
+    targaImageFree(&image);
+
+    options.format = TARGA_FORMAT_RGBA8_KEYED + 1;
+    mu_assert("bad format accepted",
+            targaLoadImage("formats.tga", &options, &image) == TARGA_ERR_ARGUMENT);
+
+    free(rlePixels);
+    free(pixels);
+    return NULL;
+
+}
+
+
+/*
+ * Check that image holds the pixels of a file stored from fileOrigin, with
+ * its first pixel at image->origin.
+ */
+static int checkOrigin(
+        const TARGA_IMAGE* image,
+        const uint8_t* pixels,
+        unsigned int fileOrigin)
+{
+    unsigned int flip = fileOrigin ^ image->origin;
+    unsigned int x, y;
+
+    for (y = 0; y < image->height; y++)
+        for (x = 0; x < image->width; x++)
+        {
+            unsigned int fx = flip & TARGA_ORIGIN_BOTTOM_RIGHT ? image->width - 1 - x : x;
+            unsigned int fy = flip & TARGA_ORIGIN_TOP_LEFT ? image->height - 1 - y : y;
+
+            if (memcmp(image->pixels + y * image->pitch + x * 3,
+                       pixels + ((size_t)fy * image->width + fx) * 3, 3) != 0)
+                return 0;
+        }
+
+    return 1;
+}
+
+
+static void setOrigin(const char* fileName, unsigned int origin)
+{
+    FILE* file = fopen(fileName, "r+b");
+    fseek(file, 17, SEEK_SET);
+    fputc((int)origin, file);
+    fclose(file);
+}
+
+
+static char* test_targaOrigin() {
+
+    TARGA_LOAD_OPTIONS options = {0};
+    TARGA_IMAGE image;
+    unsigned int origin, force;
+    int same = 1;
+
+    uint8_t* raw = writeTestImage("origin.tga", 2, 24, 37, 5);
+    uint8_t* rle = writeTestRle("origin_rle.tga", 10, 24, 300, 500, 0);
+
+    options.format = TARGA_FORMAT_BGR8;
+
+    for (origin = 0; origin <= TARGA_ORIGIN_TOP_RIGHT; origin += 0x10)
+    {
+        setOrigin("origin.tga", origin);
+        setOrigin("origin_rle.tga", origin);
+
+        /* file order, forced top left and forced bottom left */
+        for (force = 0; force <= TARGA_LOAD_BOTTOM_LEFT; force += TARGA_LOAD_TOP_LEFT)
+        {
+            options.flags = force;
+            options.threads = 0;
+
+            mu_assert("load failed",
+                    targaLoadImage("origin.tga", &options, &image) == TARGA_OK);
+            mu_assert("bad origin", image.origin ==
+                    (force == TARGA_LOAD_TOP_LEFT ? TARGA_ORIGIN_TOP_LEFT :
+                     force == TARGA_LOAD_BOTTOM_LEFT ? TARGA_ORIGIN_BOTTOM_LEFT : origin));
+            same &= checkOrigin(&image, raw, origin);
+            targaImageFree(&image);
+
+            mu_assert("rle load failed",
+                    targaLoadImage("origin_rle.tga", &options, &image) == TARGA_OK);
+            same &= checkOrigin(&image, rle, origin);
+            targaImageFree(&image);
+
+            options.threads = 3;
+            mu_assert("parallel load failed",
+                    targaLoadImage("origin_rle.tga", &options, &image) == TARGA_OK);
+            same &= checkOrigin(&image, rle, origin);
+            targaImageFree(&image);
+        }
+        mu_assert("bad pixels", same);
+
+        /* rows streamed by the decoder land at their final index */
+        options.flags = TARGA_LOAD_TOP_LEFT;
+        options.threads = 0;
+        mu_assert("load failed",
+                targaLoadImage("origin.tga", &options, &image) == TARGA_OK);
+
+        FILE* file = fopen("origin.tga", "rb");
+        uint8_t data[18 + 37 * 5 * 3];
+        size_t size = fread(data, 1, sizeof(data), file);
+        fclose(file);
+
+        TARGA_DECODER* decoder = targaDecoderCreate(&options);
+        const uint8_t* row;
+        unsigned int y, rows = 0;
+        size_t used = 0;
+        int status = TARGA_OK;
+
+        while (used < size && status == TARGA_OK)
+        {
+            used += targaDecoderFeed(decoder, data + used, size - used, &status);
+            while ((row = targaDecoderRow(decoder, &y)))
+            {
+                same &= memcmp(row, image.pixels + y * image.pitch, image.pitch) == 0;
+                rows++;
+            }
+        }
+
+        mu_assert("stream decode failed",
+                targaDecoderFinish(decoder) == TARGA_OK && rows == 5);
+        mu_assert("bad streamed rows", same);
+        targaDecoderDestroy(decoder);
+        targaImageFree(&image);
+    }
+
+    options.flags = TARGA_LOAD_TOP_LEFT | TARGA_LOAD_BOTTOM_LEFT;
+    mu_assert("conflicting flags accepted",
+            targaLoadImage("origin.tga", &options, &image) == TARGA_ERR_ARGUMENT);
+
+    free(raw);
+    free(rle);
+    return NULL;
+
+}
+
+
+/*
+ * Compare every region of a list with the same pixels of the whole image.
+ */
+static int checkRegions(const char* fileName, TARGA_LOAD_OPTIONS* options)
+{
+    static const TARGA_RECT regions[] = {
+        { 0, 0, 1, 1 }, { 5, 3, 17, 9 }, { 0, 0, 61, 36 }, { 1, 0, 60, 37 },
+        { 60, 36, 1, 1 }, { 44, 20, 17, 17 }, { 0, 30, 61, 7 }
+    };
+    TARGA_IMAGE whole, image;
+    size_t i, y;
+    int same = 1;
+
+    options->region.width = 0;
+    if (targaLoadImage(fileName, options, &whole) != TARGA_OK)
+        return 0;
+
+    size_t bpp = whole.pitch / whole.width;
+
+    for (i = 0; i < sizeof(regions) / sizeof(regions[0]); i++)
+    {
+        options->region = regions[i];
+        if (targaLoadImage(fileName, options, &image) != TARGA_OK)
+            return 0;
+
+        same &= image.width == regions[i].width && image.height == regions[i].height;
+        for (y = 0; y < image.height; y++)
+            same &= memcmp(image.pixels + y * image.pitch,
+                    whole.pixels + (regions[i].y + y) * whole.pitch + regions[i].x * bpp,
+                    image.width * bpp) == 0;
+
+        targaImageFree(&image);
+    }
+
+    options->region.width = 0;
+    targaImageFree(&whole);
+    return same;
+}
+
+
+static char* test_targaRegion() {
+
+    TARGA_LOAD_OPTIONS options = {0};
+    TARGA_IMAGE image;
+    unsigned int origin;
+    size_t size;
+
+    free(writeTestImage("region.tga", 2, 24, 61, 37));
+    free(writeTestRle("region_rle.tga", 10, 32, 61, 37, 0));
+
+    for (origin = 0; origin <= TARGA_ORIGIN_TOP_RIGHT; origin += 0x10)
+    {
+        setOrigin("region.tga", origin);
+        setOrigin("region_rle.tga", origin);
+
+        options.flags = 0;
+        mu_assert("bad raw region", checkRegions("region.tga", &options));
+        mu_assert("bad rle region", checkRegions("region_rle.tga", &options));
+
+        options.flags = TARGA_LOAD_TOP_LEFT | TARGA_LOAD_MAPPED;
+        mu_assert("bad mapped region", checkRegions("region.tga", &options));
+        mu_assert("bad mapped rle region", checkRegions("region_rle.tga", &options));
+
+        options.flags = TARGA_LOAD_BOTTOM_LEFT;
+        options.format = TARGA_FORMAT_GRAY8;
+        mu_assert("bad gray region", checkRegions("region_rle.tga", &options));
+        options.format = TARGA_FORMAT_AUTO;
+    }
+
+    /* the size of the region is reported and checked */
+    options.flags = 0;
+    options.region.x = 10;
+    options.region.y = 20;
+    options.region.width = 8;
+    options.region.height = 4;
+    mu_assert("query failed",
+            targaQueryImage("region.tga", &options, &image, &size) == TARGA_OK);
+    mu_assert("bad query", image.width == 8 && image.height == 4 && size == 8 * 4 * 3);
+
+    options.region.width = 52;
+    mu_assert("region out of the image accepted",
+            targaLoadImage("region.tga", &options, &image) == TARGA_ERR_ARGUMENT);
+
+    /* a region of a truncated RLE image stops before the missing data */
+    free(writeTestRle("region_rle.tga", 10, 24, 61, 37, 300));
+    options.region.width = 8;
+    mu_assert("truncated region failed",
+            targaLoadImage("region_rle.tga", &options, &image) == TARGA_OK);
+    targaImageFree(&image);
+    options.region.y = 33;
+    mu_assert("truncated region loaded",
+            targaLoadImage("region_rle.tga", &options, &image) == TARGA_ERR_READ);
+
+    return NULL;
+
+}
+
+
+static uint32_t get32(const uint8_t* p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+
+/*
+ * Walk the RLE packets of a file written with a scan line table: every
+ * row must start on a packet boundary, at the offset of the table.
+ */
+static int checkScanLines(const uint8_t* data, size_t size, size_t bpp)
+{
+    TARGA_INFO info;
+    size_t pos, y;
+
+    if (targaProbeMemory(data, size, TARGA_PROBE_EXTENSION, &info) != TARGA_OK ||
+        info.scanLineOffset == 0)
+        return 0;
+
+    pos = info.dataOffset;
+    for (y = 0; y < info.height; y++)
+    {
+        size_t x = 0;
+
+        if (get32(data + info.scanLineOffset + y * 4) != pos)
+            return 0;
+
+        while (x < info.width)
+        {
+            size_t n = (data[pos] & 0x7F) + 1;
+            pos += 1 + (data[pos] & 0x80 ? 1 : n) * bpp;
+            x += n;
+        }
+
+        if (x != info.width)
+            return 0;
+    }
+
+    return 1;
+}
+
+
+static char* test_targaWrite() {
+
+    TARGA_WRITE_OPTIONS write = {0};
+    TARGA_LOAD_OPTIONS options = {0};
+    TARGA_IMAGE source, image;
+    TARGA_INFO info;
+    void* data;
+    size_t size, raw, y;
+    unsigned int format;
+    int same = 1;
+
+    /* 24 bits: uncompressed and RLE files decode to the same pixels */
+    mu_assert("load failed", targaLoadImage(dataFile, NULL, &source) == TARGA_OK);
+
+    mu_assert("write failed", targaWriteImage("write.tga", &source, NULL) == TARGA_OK);
+    mu_assert("load failed", targaLoadImage("write.tga", NULL, &image) == TARGA_OK);
+    same &= memcmp(image.pixels, source.pixels, source.pitch * source.height) == 0;
+    targaImageFree(&image);
+
+    write.flags = TARGA_WRITE_RLE | TARGA_WRITE_SCANLINE_TABLE;
+    mu_assert("write failed", targaWriteImage("write.tga", &source, &write) == TARGA_OK);
+    mu_assert("load failed", targaLoadImage("write.tga", NULL, &image) == TARGA_OK);
+    same &= memcmp(image.pixels, source.pixels, source.pitch * source.height) == 0;
+    targaImageFree(&image);
+    mu_assert("bad rle pixels", same);
+
+    mu_assert("probe failed",
+            targaProbe("write.tga", TARGA_PROBE_EXTENSION, &info) == TARGA_OK);
+    mu_assert("bad header", info.imageType == 10 && info.pixelDepth == 24 &&
+            info.version == 2 && info.attributesType == 0);
+
+    mu_assert("write failed",
+            targaWriteMemory(&source, &write, &data, &size) == TARGA_OK);
+    mu_assert("bad scan lines", checkScanLines(data, size, 3));
+    mu_assert("not compressed", size < 18 + source.pitch * source.height);
+    free(data);
+    targaImageFree(&source);
+
+    /* every format through memory, rows with padding and runs */
+    uint8_t* pixels = writeTestRle("write_rle.tga", 10, 32, 61, 17, 0);
+    free(pixels);
+
+    for (format = TARGA_FORMAT_RGB8; format <= TARGA_FORMAT_RGBA8_KEYED; format++)
+    {
+        options.format    = format;
+        options.alignment = 16;
+        options.colorKey  = 0x123456;
+        mu_assert("load failed",
+                targaLoadImage("write_rle.tga", &options, &source) == TARGA_OK);
+
+        write.flags = TARGA_WRITE_RLE | TARGA_WRITE_SCANLINE_TABLE;
+        mu_assert("write failed",
+                targaWriteMemory(&source, &write, &data, &size) == TARGA_OK);
+        mu_assert("bad scan lines",
+                checkScanLines(data, size, format == TARGA_FORMAT_GRAY8 ? 1 :
+                    format == TARGA_FORMAT_RGB8 || format == TARGA_FORMAT_BGR8 ? 3 : 4));
+
+        options.alignment = 0;
+        options.format    = format;
+        if (format == TARGA_FORMAT_RGBA8_PREMULTIPLIED || format == TARGA_FORMAT_RGBA8_KEYED)
+            options.format = TARGA_FORMAT_RGBA8;    /* stored as they are */
+        mu_assert("load failed", targaLoadMemory(data, size, &options, &image) == TARGA_OK);
+
+        for (y = 0; y < image.height; y++)
+            same &= memcmp(image.pixels + y * image.pitch,
+                    source.pixels + y * source.pitch, image.pitch) == 0;
+
+        targaProbeMemory(data, size, TARGA_PROBE_EXTENSION, &info);
+        same &= info.attributesType ==
+            (format == TARGA_FORMAT_RGBA8_PREMULTIPLIED ? 4 : image.pitch / image.width == 4 ? 3 : 0);
+
+        free(data);
+        targaImageFree(&image);
+        targaImageFree(&source);
+    }
+    mu_assert("bad round trip", same);
+
+    /* origin and footer without table */
+    options.format = TARGA_FORMAT_AUTO;
+    options.flags  = TARGA_LOAD_TOP_LEFT;
+    mu_assert("load failed", targaLoadImage(dataFile, &options, &source) == TARGA_OK);
+
+    write.flags = TARGA_WRITE_FOOTER;
+    mu_assert("write failed", targaWriteMemory(&source, &write, &data, &size) == TARGA_OK);
+    raw = size;
+    mu_assert("load failed", targaLoadMemory(data, size, NULL, &image) == TARGA_OK);
+    mu_assert("bad origin", image.origin == TARGA_ORIGIN_TOP_LEFT &&
+            memcmp(image.pixels, source.pixels, source.pitch * source.height) == 0);
+    mu_assert("bad footer", raw == 18 + source.pitch * source.height + 495 + 26);
+    free(data);
+    targaImageFree(&image);
+    targaImageFree(&source);
+
+    /* palette images */
+    uint8_t palette[3 * 4] = { 255, 0, 0, 0, 255, 0, 0, 0, 255, 9, 9, 9 };
+    uint8_t indices[5 * 3] = { 0, 0, 0, 1, 2, 3, 3, 3, 3, 3, 1, 1, 0, 2, 2 };
+
+    source.width  = 5;
+    source.height = 3;
+    source.pitch  = 5;
+    source.format = TARGA_FORMAT_INDEX8;
+    source.origin = TARGA_ORIGIN_TOP_LEFT;
+    source.pixels = indices;
+
+    write.flags = TARGA_WRITE_RLE;
+    mu_assert("palette required",
+            targaWriteMemory(&source, &write, &data, &size) == TARGA_ERR_ARGUMENT);
+
+    write.palette       = palette;
+    write.paletteFormat = TARGA_FORMAT_RGB8;
+    write.paletteSize   = 4;
+    mu_assert("write failed", targaWriteMemory(&source, &write, &data, &size) == TARGA_OK);
+    mu_assert("probe failed", targaProbeMemory(data, size, 0, &info) == TARGA_OK);
+    mu_assert("bad palette header", info.imageType == 9 && info.colorMapType == 1 &&
+            info.colorMapLength == 4 && info.colorMapEntrySize == 24 &&
+            info.pixelDepth == 8 && info.dataOffset == 18 + 12);
+    mu_assert("bad palette", ((uint8_t*)data)[18] == 0 && ((uint8_t*)data)[20] == 255);
+    free(data);
+
+    source.format = TARGA_FORMAT_AUTO;
+    mu_assert("bad format accepted",
+            targaWriteMemory(&source, &write, &data, &size) == TARGA_ERR_ARGUMENT);
+
+    return NULL;
+
+}
+
+
+static uint8_t* readFile(const char* fileName, size_t* size)
+{
+    FILE* file = fopen(fileName, "rb");
+    fseek(file, 0, SEEK_END);
+    *size = (size_t)ftell(file);
+    uint8_t* data = malloc(*size);
+    fseek(file, 0, SEEK_SET);
+    fread(data, 1, *size, file);
+    fclose(file);
+    return data;
+}
+
+
+static char* test_targaWriteParallel() {
+
+    TARGA_WRITE_OPTIONS write = {0};
+    TARGA_LOAD_OPTIONS options = {0};
+    TARGA_IMAGE source;
+    unsigned int height, threads;
+    int same = 1;
+
+    free(writeTestRle("write_par.tga", 10, 32, 301, 211, 0));
+    options.format = TARGA_FORMAT_RGBA8;
+    mu_assert("load failed", targaLoadImage("write_par.tga", &options, &source) == TARGA_OK);
+
+    /* the bands join into the same bytes as a serial encode */
+    for (height = 1; height <= source.height; height += 70)
+    {
+        TARGA_IMAGE image = source;
+        uint8_t *serial, *parallel;
+        size_t serialSize, parallelSize;
+        void* memory;
+        size_t memorySize;
+
+        image.height = height;
+        write.flags = TARGA_WRITE_RLE | TARGA_WRITE_SCANLINE_TABLE;
+        write.threads = 0;
+        mu_assert("write failed", targaWriteImage("serial.tga", &image, &write) == TARGA_OK);
+        serial = readFile("serial.tga", &serialSize);
+
+        for (threads = 2; threads <= 8; threads *= 2)
+        {
+            write.threads = threads;
+            mu_assert("parallel write failed",
+                    targaWriteImage("parallel.tga", &image, &write) == TARGA_OK);
+            parallel = readFile("parallel.tga", &parallelSize);
+            same &= parallelSize == serialSize &&
+                memcmp(parallel, serial, serialSize) == 0;
+            free(parallel);
+
+            mu_assert("parallel write failed",
+                    targaWriteMemory(&image, &write, &memory, &memorySize) == TARGA_OK);
+            same &= memorySize == serialSize && memcmp(memory, serial, serialSize) == 0;
+            free(memory);
+        }
+
+        free(serial);
+    }
+
+    targaImageFree(&source);
+    mu_assert("parallel output differs", same);
+    return NULL;
+
+}
+
+
+/*
+ * Write a color mapped image (type 1, or 9 with rle) of indexDepth bits
+ * indices into a map of length entries starting at index first. Indices
+ * run a little past the map. The expected RGBA pixels are returned, zero
+ * for the indices outside of the map.
+ */
+static uint8_t* writeTestColorMapped(
+        const char* fileName,
+        int rle,
+        uint8_t indexDepth,
+        uint8_t entrySize,
+        unsigned int first,
+        unsigned int length,
+        unsigned int width,
+        unsigned int height)
+{
+    size_t indexBpp = indexDepth / 8, entryBpp = (entrySize + 7) / 8;
+    size_t count = (size_t)width * height;
+    uint8_t* map = malloc(length * entryBpp);
+    uint8_t* indices = malloc(count * indexBpp);
+    uint8_t* expected = calloc(count, 4);
+    uint8_t header[18] = {0};
+    unsigned int seed = 4242;
+    size_t i;
+
+    for (i = 0; i < length * entryBpp; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        map[i] = (uint8_t)(seed >> 16);
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        unsigned int index = (seed >> 16) % (first + length + 3);
+        if (i > 0 && (seed >> 8) % 3 == 0)
+            index = indices[(i - 1) * indexBpp] | (indexBpp == 2 ? indices[i * 2 - 1] << 8 : 0);
+
+        indices[i * indexBpp] = index & 0xFF;
+        if (indexBpp == 2)
+            indices[i * 2 + 1] = (uint8_t)(index >> 8);
+
+        if (index < first || index >= first + length)
+            continue;
+
+        const uint8_t* entry = map + (index - first) * entryBpp;
+        uint8_t* pixel = expected + i * 4;
+        if (entryBpp == 2)
+        {
+            unsigned int color = entry[0] | (entry[1] << 8);
+            unsigned int r = (color >> 10) & 0x1F, g = (color >> 5) & 0x1F, b = color & 0x1F;
+            pixel[0] = (uint8_t)((r << 3) | (r >> 2));
+            pixel[1] = (uint8_t)((g << 3) | (g >> 2));
+            pixel[2] = (uint8_t)((b << 3) | (b >> 2));
+            pixel[3] = 255;
+        }
+        else
+        {
+            pixel[0] = entry[2];
+            pixel[1] = entry[1];
+            pixel[2] = entry[0];
+            pixel[3] = entryBpp == 4 ? entry[3] : 255;
+        }
+    }
+
+    header[1]  = 1;
+    header[2]  = rle ? 9 : 1;
+    header[3]  = first & 0xFF;
+    header[4]  = first >> 8;
+    header[5]  = length & 0xFF;
+    header[6]  = length >> 8;
+    header[7]  = entrySize;
+    header[12] = width & 0xFF;
+    header[13] = width >> 8;
+    header[14] = height & 0xFF;
+    header[15] = height >> 8;
+    header[16] = indexDepth;
+
+    FILE* file = fopen(fileName, "wb");
+    fwrite(header, 1, sizeof(header), file);
+    fwrite(map, 1, length * entryBpp, file);
+    if (rle)
+        writeRle(file, indices, count, indexBpp);
+    else
+        fwrite(indices, 1, count * indexBpp, file);
+    fclose(file);
+
+    free(map);
+    free(indices);
+    return expected;
+}
+
+
+static char* test_targaColorMapped() {
+
+    static const uint8_t depths[][2] = { {8, 24}, {8, 32}, {8, 15}, {16, 16}, {16, 32} };
+    TARGA_LOAD_OPTIONS options = {0};
+    TARGA_IMAGE image;
+    char* result;
+    size_t i, j;
+
+    for (i = 0; i < sizeof(depths) / sizeof(depths[0]); i++)
+    {
+        int rle;
+        for (rle = 0; rle < 2; rle++)
+        {
+            unsigned int first = depths[i][0] == 8 ? 5 : 700;
+            uint8_t* expected = writeTestColorMapped("colormap.tga", rle,
+                    depths[i][0], depths[i][1], first, 200, 61, 17);
+            int same = 1;
+
+            options.format  = TARGA_FORMAT_RGBA8;
+            options.threads = rle ? 4 : 0;
+            mu_assert("load failed",
+                    targaLoadImage("colormap.tga", &options, &image) == TARGA_OK);
+            same &= memcmp(image.pixels, expected, 61 * 17 * 4) == 0;
+            targaImageFree(&image);
+
+            options.format  = TARGA_FORMAT_RGB8;
+            options.threads = 0;
+            mu_assert("load failed",
+                    targaLoadImage("colormap.tga", &options, &image) == TARGA_OK);
+            for (j = 0; j < 61 * 17; j++)
+                same &= memcmp(image.pixels + j * 3, expected + j * 4, 3) == 0;
+            targaImageFree(&image);
+
+            options.format = TARGA_FORMAT_GRAY8;
+            mu_assert("load failed",
+                    targaLoadImage("colormap.tga", &options, &image) == TARGA_OK);
+            for (j = 0; j < 61 * 17; j++)
+            {
+                const uint8_t* p = expected + j * 4;
+                same &= image.pixels[j] == (77 * p[0] + 150 * p[1] + 29 * p[2] + 128) >> 8;
+            }
+            targaImageFree(&image);
+
+            free(expected);
+            mu_assert("bad color mapped pixels", same);
+
+            if ((result = streamFile("colormap.tga", 13)))
+                return result;
+        }
+    }
+
+    /* 8 bits indices can be kept as they are */
+    free(writeTestColorMapped("colormap.tga", 0, 8, 24, 0, 16, 7, 3));
+    options.format = TARGA_FORMAT_INDEX8;
+    mu_assert("index load failed",
+            targaLoadImage("colormap.tga", &options, &image) == TARGA_OK);
+    mu_assert("bad index image", image.pitch == 7 && image.height == 3);
+    targaImageFree(&image);
+
+    free(writeTestColorMapped("colormap.tga", 0, 16, 24, 0, 16, 7, 3));
+    mu_assert("16 bits indices accepted",
+            targaLoadImage("colormap.tga", &options, &image) == TARGA_ERR_UNSUPPORTED);
+
+    /* a truncated color map is a read error */
+    truncateFile("colormap.tga", 18 + 20);
+    options.format = TARGA_FORMAT_AUTO;
+    mu_assert("truncated map loaded",
+            targaLoadImage("colormap.tga", &options, &image) == TARGA_ERR_READ);
+
+    /* the images written with a palette load back through it */
+    uint8_t palette[3 * 4] = { 255, 0, 0, 0, 255, 0, 0, 0, 255, 9, 9, 9 };
+    uint8_t indices[5 * 3] = { 0, 0, 0, 1, 2, 3, 3, 3, 3, 3, 1, 1, 0, 2, 2 };
+    TARGA_WRITE_OPTIONS write = {0};
+    TARGA_IMAGE source = {0};
+    void* data;
+    size_t size;
+
+    source.width  = 5;
+    source.height = 3;
+    source.pitch  = 5;
+    source.format = TARGA_FORMAT_INDEX8;
+    source.origin = TARGA_ORIGIN_TOP_LEFT;
+    source.pixels = indices;
+
+    write.palette       = palette;
+    write.paletteFormat = TARGA_FORMAT_RGB8;
+    write.paletteSize   = 4;
+
+    for (i = 0; i < 2; i++)
+    {
+        int same = 1;
+
+        write.flags = i ? TARGA_WRITE_RLE : 0;
+        mu_assert("write failed", targaWriteMemory(&source, &write, &data, &size) == TARGA_OK);
+
+        options.format = TARGA_FORMAT_AUTO;
+        mu_assert("palette load failed",
+                targaLoadMemory(data, size, &options, &image) == TARGA_OK);
+        for (j = 0; j < 15; j++)
+            same &= memcmp(image.pixels + j * 3, palette + indices[j] * 3, 3) == 0;
+        targaImageFree(&image);
+
+        options.format = TARGA_FORMAT_INDEX8;
+        mu_assert("index load failed",
+                targaLoadMemory(data, size, &options, &image) == TARGA_OK);
+        same &= memcmp(image.pixels, indices, 15) == 0;
+        targaImageFree(&image);
+
+        free(data);
+        mu_assert("bad palette round trip", same);
+    }
+
+    return NULL;
+
+}
+
+
+/*
+ * Check every output format of a 16 bits image against the expansion of
+ * its count pixels, with or without the alpha bit.
+ */
+static int check16(const char* fileName, const uint8_t* pixels, size_t count, int alpha)
+{
+    TARGA_LOAD_OPTIONS options = {0};
+    TARGA_IMAGE image;
+    unsigned int format;
+    size_t i;
+    int same = 1;
+
+    for (format = TARGA_FORMAT_AUTO; format <= TARGA_FORMAT_RGBA8_KEYED; format++)
+    {
+        options.format   = format;
+        options.colorKey = 0;
+
+        if (targaLoadImage(fileName, &options, &image) != TARGA_OK)
+            return 0;
+
+        for (i = 0; i < count; i++)
+        {
+            unsigned int c = pixels[i * 2] | (pixels[i * 2 + 1] << 8);
+            unsigned int r = (c >> 10) & 0x1F, g = (c >> 5) & 0x1F, b = c & 0x1F;
+            unsigned int a = alpha && !(c & 0x8000) ? 0 : 255;
+            const uint8_t* p = image.pixels + i * (image.pitch / image.width);
+
+            r = (r << 3) | (r >> 2);
+            g = (g << 3) | (g >> 2);
+            b = (b << 3) | (b >> 2);
+
+            switch (image.format)
+            {
+                case TARGA_FORMAT_RGB8:
+                    same &= p[0] == r && p[1] == g && p[2] == b;
+                    break;
+                case TARGA_FORMAT_RGBA8:
+                    same &= p[0] == r && p[1] == g && p[2] == b && p[3] == a;
+                    break;
+                case TARGA_FORMAT_BGR8:
+                    same &= p[0] == b && p[1] == g && p[2] == r;
+                    break;
+                case TARGA_FORMAT_BGRA8:
+                    same &= p[0] == b && p[1] == g && p[2] == r && p[3] == a;
+                    break;
+                case TARGA_FORMAT_GRAY8:
+                    same &= p[0] == (77 * r + 150 * g + 29 * b + 128) >> 8;
+                    break;
+                case TARGA_FORMAT_RGBA8_PREMULTIPLIED:
+                    same &= p[0] == (a ? r : 0) && p[1] == (a ? g : 0) &&
+                            p[2] == (a ? b : 0) && p[3] == a;
+                    break;
+                case TARGA_FORMAT_RGBA8_KEYED:
+                    same &= p[0] == r && p[1] == g && p[2] == b && p[3] == (c & 0x7FFF ? a : 0);
+                    break;
+            }
+        }
+
+        same &= image.format == (alpha ? TARGA_FORMAT_RGBA8 : TARGA_FORMAT_RGB8) || format;
+        targaImageFree(&image);
+    }
+
+    return same;
+}
+
+
+static char* test_targaLoad16Alpha() {
+
+    /* small images use the kernels, large ones a table of the 65536 values */
+    static const unsigned int sizes[][2] = { {61, 37}, {512, 260} };
+    size_t i;
+
+    for (i = 0; i < 2; i++)
+    {
+        size_t count = (size_t)sizes[i][0] * sizes[i][1];
+        uint8_t* pixels = writeTestImage("test16a.tga", 2, 16, sizes[i][0], sizes[i][1]);
+
+        mu_assert("bad opaque pixels", check16("test16a.tga", pixels, count, 0));
+
+        /* 1 attribute bit: the top bit is alpha */
+        setOrigin("test16a.tga", 1);
+        mu_assert("bad alpha pixels", check16("test16a.tga", pixels, count, 1));
+        free(pixels);
+
+        pixels = writeTestRle("test16a.tga", 10, 16, sizes[i][0], sizes[i][1], 0);
+        setOrigin("test16a.tga", 1);
+        mu_assert("bad rle alpha pixels", check16("test16a.tga", pixels, count, 1));
+        free(pixels);
+    }
+
+    return NULL;
+
+}
+
+
+static char* test_targaStats() {
+
+    TARGA_LOAD_OPTIONS options = {0};
+    TARGA_STATS stats, other, global;
+    TARGA_IMAGE image;
+    TARGA_BATCH_ITEM items[2];
+    unsigned int w, h;
+    int status;
+    size_t size;
+
+    free(writeTestRle("stats.tga", 10, 32, 1031, 300, 0));
+    uint8_t* data = readFile("stats.tga", &size);
+    uint64_t pixels = 1031 * 300;
+
+    options.stats = &stats;
+    mu_assert("load failed", targaLoadImage("stats.tga", &options, &image) == TARGA_OK);
+    targaImageFree(&image);
+
+    mu_assert("bad counts", stats.loads == 1 && stats.failures == 0 &&
+            stats.pixels == pixels && stats.bytesRead == size && stats.readCalls > 0);
+    mu_assert("no packets", stats.runPackets > 0 && stats.rawPackets > 0);
+    mu_assert("no allocations", stats.allocations >= 2);
+    mu_assert("bad times", stats.totalNs > 0 && stats.pixelsNs > 0 &&
+            stats.openNs + stats.headerNs + stats.colorMapNs + stats.pixelsNs <= stats.totalNs &&
+            stats.readNs <= stats.totalNs);
+
+    /* every path sees the same packets */
+    options.stats = &other;
+    mu_assert("memory load failed",
+            targaLoadMemory(data, size, &options, &image) == TARGA_OK);
+    targaImageFree(&image);
+    mu_assert("bad memory stats", other.readCalls == 0 && other.bytesRead == size &&
+            other.runPackets == stats.runPackets && other.rawPackets == stats.rawPackets);
+
+    options.threads = 4;
+    mu_assert("parallel load failed",
+            targaLoadImage("stats.tga", &options, &image) == TARGA_OK);
+    targaImageFree(&image);
+    mu_assert("bad parallel stats", other.bytesRead == size && other.pixels == pixels &&
+            other.runPackets == stats.runPackets && other.rawPackets == stats.rawPackets);
+    options.threads = 0;
+
+    TARGA_DECODER* decoder = targaDecoderCreate(&options);
+    size_t used = 0;
+    unsigned int y;
+
+    while (used < size)
+    {
+        used += targaDecoderFeed(decoder, data + used, size - used, &status);
+        while (targaDecoderRow(decoder, &y))
+            ;
+    }
+    mu_assert("stream decode failed", targaDecoderFinish(decoder) == TARGA_OK);
+    targaDecoderDestroy(decoder);
+    mu_assert("bad decoder stats", other.bytesRead == size && other.pixels == pixels &&
+            other.runPackets == stats.runPackets && other.rawPackets == stats.rawPackets);
+
+    items[0].fileName = "stats.tga";
+    items[1].fileName = NULL;
+    items[1].data = data;
+    items[1].size = size;
+    mu_assert("batch failed", targaLoadBatch(NULL, items, 2, &options) == TARGA_OK);
+    targaImageFree(&items[0].image);
+    targaImageFree(&items[1].image);
+    mu_assert("bad batch stats", other.loads == 2 && other.pixels == pixels * 2 &&
+            other.runPackets == stats.runPackets * 2);
+
+    /* the aggregate counts the loads without options too */
+    targaStatsReset();
+    targaStatsEnable(1);
+    free(targaLoad("stats.tga", &status, &w, &h));
+    free(targaLoad("missing.tga", &status, &w, &h));
+    mu_assert("load failed", targaLoadImage("stats.tga", &options, &image) == TARGA_OK);
+    targaImageFree(&image);
+    targaStatsEnable(0);
+    free(targaLoad("stats.tga", &status, &w, &h));
+
+    targaStatsGlobal(&global);
+    mu_assert("bad aggregate", global.loads == 3 && global.failures == 1 &&
+            global.pixels == pixels * 2 && global.bytesRead == size * 2 &&
+            global.runPackets == stats.runPackets * 2);
+
+    free(data);
+    return NULL;
+
+}
+
+
+static char* test_targaAsync() {
+
+    static const char* files[] = {
+        "async_rle.tga", "async_raw.tga", "async_small.tga", "async_cut.tga", "missing.tga"
+    };
+    TARGA_LOAD_OPTIONS options = {0};
+    TARGA_ASYNC_RESULT results[3];
+    unsigned int flags;
+    size_t i, n;
+    int same = 1;
+
+    free(writeTestRle("async_rle.tga", 10, 32, 1031, 300, 0));
+    free(writeTestImage("async_raw.tga", 2, 24, 701, 263));
+    free(writeTestRle("async_small.tga", 10, 16, 7, 3, 0));
+    free(writeTestRle("async_cut.tga", 10, 24, 1031, 300, 1000));
+    options.format = TARGA_FORMAT_RGBA8;
+    options.flags  = TARGA_LOAD_TOP_LEFT;
+
+    for (flags = 0; flags <= TARGA_ASYNC_NO_URING; flags++)
+    {
+        TARGA_ASYNC* async = targaAsyncCreate(2, flags);
+        int done[10] = {0};
+
+        mu_assert("create failed", async != NULL);
+        if (flags)
+            mu_assert("bad backend", targaAsyncBackend(async) == TARGA_ASYNC_THREADS);
+
+        /* more files than slots, each twice */
+        for (i = 0; i < 10; i++)
+            mu_assert("submit failed",
+                    targaAsyncSubmit(async, files[i % 5], &options, &done[i]) == TARGA_OK);
+
+        while ((n = targaAsyncWait(async, results, 3)) > 0)
+        {
+            size_t j;
+
+            for (j = 0; j < n; j++)
+            {
+                size_t index = (size_t)((int*)results[j].user - done);
+                TARGA_IMAGE image;
+                int status = targaLoadImage(files[index % 5], &options, &image);
+
+                same &= results[j].status == status;
+                if (status == TARGA_OK)
+                    same &= results[j].image.width == image.width &&
+                        results[j].image.height == image.height &&
+                        memcmp(results[j].image.pixels, image.pixels,
+                                image.pitch * image.height) == 0;
+
+                done[index]++;
+                targaImageFree(&image);
+                targaImageFree(&results[j].image);
+            }
+        }
+
+        mu_assert("loads left", targaAsyncPending(async) == 0);
+        for (i = 0; i < 10; i++)
+            same &= done[i] == 1;
+
+        /* pending loads are cancelled */
+        for (i = 0; i < 4; i++)
+            targaAsyncSubmit(async, files[i], &options, NULL);
+        mu_assert("no result", targaAsyncWait(async, results, 1) == 1);
+        targaImageFree(&results[0].image);
+        targaAsyncDestroy(async);
+    }
+
+    mu_assert("async loads differ", same);
+    return NULL;
+
+}
+
+
+static char* test_targaLoadPipelined() {
+
+    TARGA_LOAD_OPTIONS options = {0};
+    TARGA_STATS stats;
+    TARGA_IMAGE image, pipelined;
+    int same = 1;
+    size_t i;
+
+    /* several times the ring of chunks, raw and rle */
+    free(writeTestImage("pipe_raw.tga", 2, 32, 1031, 1300));
+    free(writeTestRle("pipe_rle.tga", 10, 24, 1031, 1300, 0));
+    free(writeTestRle("pipe_cut.tga", 10, 24, 1031, 1300, 1000));
+
+    for (i = 0; i < 4; i++)
+    {
+        const char* fileName = i % 2 ? "pipe_rle.tga" : "pipe_raw.tga";
+
+        options.flags   = TARGA_LOAD_TOP_LEFT;
+        options.threads = i < 2 ? 0 : 4;
+        options.stats   = NULL;
+        mu_assert("load failed", targaLoadImage(fileName, &options, &image) == TARGA_OK);
+
+        options.flags |= TARGA_LOAD_PIPELINED;
+        options.stats  = &stats;
+        mu_assert("pipelined load failed",
+                targaLoadImage(fileName, &options, &pipelined) == TARGA_OK);
+
+        same &= memcmp(image.pixels, pipelined.pixels, image.pitch * image.height) == 0;
+        same &= stats.readCalls > 1 && stats.bytesRead > image.width * image.height;
+        targaImageFree(&image);
+        targaImageFree(&pipelined);
+    }
+
+    /* a region stops reading early, the reader thread with it */
+    options.stats  = NULL;
+    options.region.x = 100;
+    options.region.y = 200;
+    options.region.width  = 300;
+    options.region.height = 50;
+    options.threads = 0;
+    for (i = 0; i < 2; i++)
+    {
+        const char* fileName = i ? "pipe_rle.tga" : "pipe_raw.tga";
+
+        options.flags = TARGA_LOAD_TOP_LEFT;
+        mu_assert("region load failed", targaLoadImage(fileName, &options, &image) == TARGA_OK);
+        options.flags |= TARGA_LOAD_PIPELINED;
+        mu_assert("pipelined region load failed",
+                targaLoadImage(fileName, &options, &pipelined) == TARGA_OK);
+
+        same &= memcmp(image.pixels, pipelined.pixels, image.pitch * image.height) == 0;
+        targaImageFree(&image);
+        targaImageFree(&pipelined);
+    }
+    mu_assert("pipelined pixels differ", same);
+
+    memset(&options.region, 0, sizeof(options.region));
+    mu_assert("truncated load should fail",
+            targaLoadImage("pipe_cut.tga", &options, &image) == TARGA_ERR_READ);
+
+    return NULL;
+
+}
+
+
+#ifdef TARGA_HAVE_PTHREAD
+
+typedef struct {
+    TARGA_CACHE*        cache;
+    const TARGA_IMAGE*  image;
+    int                 status;
+} TEST_CACHE_REQUEST;
+
+
+static void* cacheRequest(void* arg)
+{
+    TEST_CACHE_REQUEST* request = arg;
+
+    request->status = targaCacheGet(request->cache, "cache_big.tga", NULL, &request->image);
+    return NULL;
+}
+
+#endif
+
+
+static char* test_targaCache() {
+
+    TARGA_LOAD_OPTIONS options = {0};
+    TARGA_CACHE_STATS stats;
+    const TARGA_IMAGE *first, *second, *other;
+    TARGA_IMAGE image;
+
+    free(writeTestRle("cache_a.tga", 10, 24, 301, 211, 0));
+    free(writeTestImage("cache_b.tga", 2, 32, 300, 200));
+
+    /* room for about one image */
+    TARGA_CACHE* cache = targaCacheCreate(301 * 211 * 4);
+    mu_assert("create failed", cache != NULL);
+
+    options.format = TARGA_FORMAT_RGBA8;
+    mu_assert("get failed", targaCacheGet(cache, "cache_a.tga", &options, &first) == TARGA_OK);
+    mu_assert("get failed", targaCacheGet(cache, "cache_a.tga", &options, &second) == TARGA_OK);
+    mu_assert("not shared", first == second);
+
+    mu_assert("load failed", targaLoadImage("cache_a.tga", &options, &image) == TARGA_OK);
+    int same = memcmp(first->pixels, image.pixels, image.pitch * image.height) == 0;
+    targaImageFree(&image);
+    mu_assert("bad cached pixels", same);
+
+    /* other options, other entry; both are in use: none is evicted */
+    options.flags = TARGA_LOAD_TOP_LEFT;
+    mu_assert("get failed", targaCacheGet(cache, "cache_a.tga", &options, &other) == TARGA_OK);
+    mu_assert("options shared", other != first);
+    targaCacheStats(cache, &stats);
+    mu_assert("bad counts", stats.hits == 1 && stats.misses == 2 &&
+            stats.entries == 2 && stats.evictions == 0 &&
+            stats.bytes == (uint64_t)301 * 211 * 4 * 2);
+
+    /* released and over budget: the least recently used goes */
+    targaCacheRelease(cache, first);
+    targaCacheRelease(cache, second);
+    targaCacheRelease(cache, other);
+    targaCacheStats(cache, &stats);
+    mu_assert("no eviction", stats.evictions == 1 && stats.entries == 1);
+    mu_assert("get failed", targaCacheGet(cache, "cache_a.tga", &options, &other) == TARGA_OK);
+    targaCacheRelease(cache, other);
+    targaCacheStats(cache, &stats);
+    mu_assert("wrong entry evicted", stats.hits == 2);
+
+    /* a new version of the file is loaded again */
+    free(writeTestImage("cache_a.tga", 2, 24, 30, 20));
+    mu_assert("get failed", targaCacheGet(cache, "cache_a.tga", &options, &other) == TARGA_OK);
+    mu_assert("stale image", other->width == 30 && other->height == 20);
+    targaCacheRelease(cache, other);
+    targaCacheStats(cache, &stats);
+    mu_assert("bad stale count", stats.stale == 1 && stats.entries == 1);
+
+    mu_assert("missing file",
+            targaCacheGet(cache, "missing.tga", NULL, &other) == TARGA_ERR_OPEN && !other);
+    targaCacheDestroy(cache);
+
+#ifdef TARGA_HAVE_PTHREAD
+    /* concurrent requests load the image once */
+    TEST_CACHE_REQUEST requests[8];
+    pthread_t threads[8];
+    size_t i;
+
+    free(writeTestRle("cache_big.tga", 10, 32, 1031, 700, 0));
+    cache = targaCacheCreate(0);
+
+    for (i = 0; i < 8; i++)
+    {
+        requests[i].cache = cache;
+        pthread_create(&threads[i], NULL, cacheRequest, &requests[i]);
+    }
+
+    same = 1;
+    for (i = 0; i < 8; i++)
+    {
+        pthread_join(threads[i], NULL);
+        same &= requests[i].status == TARGA_OK && requests[i].image == requests[0].image;
+    }
+
+    targaCacheStats(cache, &stats);
+    for (i = 0; i < 8; i++)
+        targaCacheRelease(cache, requests[i].image);
+    mu_assert("not shared", same);
+    mu_assert("loaded twice", stats.misses == 1 && stats.hits + stats.waits == 7);
+
+    /* a zero budget keeps nothing unused */
+    targaCacheStats(cache, &stats);
+    mu_assert("kept", stats.entries == 0 && stats.bytes == 0);
+    targaCacheDestroy(cache);
+#endif
+
+    return NULL;
+
+}
+
+
+static int sameImage(const TARGA_IMAGE* a, const TARGA_IMAGE* b)
+{
+
+    return a->width == b->width && a->height == b->height && a->pitch == b->pitch &&
+        memcmp(a->pixels, b->pixels, a->pitch * a->height) == 0;
+
+}
+
+
+static char* test_targaSidecar() {
+
+    TARGA_LOAD_OPTIONS options = {0};
+    TARGA_IMAGE reference, image;
+    int same;
+
+    free(writeTestImage("sidecar.tga", 2, 24, 301, 211));
+
+    options.format = TARGA_FORMAT_RGBA8;
+    mu_assert("load failed", targaLoadImage("sidecar.tga", &options, &reference) == TARGA_OK);
+
+    /* decoded and stored (or served from a previous run), then served */
+    options.cacheDir = ".";
+    mu_assert("load failed", targaLoadImage("sidecar.tga", &options, &image) == TARGA_OK);
+    same = sameImage(&image, &reference);
+    targaImageFree(&image);
+    mu_assert("bad pixels", same);
+
+    mu_assert("load failed", targaLoadImage("sidecar.tga", &options, &image) == TARGA_OK);
+    same = sameImage(&image, &reference) && image.mapped;
+    targaImageFree(&image);
+    mu_assert("not served from the sidecar", same);
+
+#ifdef TEST_UTIME
+    struct utimbuf times = { 1000000000, 1000000000 };
+
+    /* touched only: checked against the hash and still served */
+    mu_assert("utime failed", utime("sidecar.tga", &times) == 0);
+    mu_assert("load failed", targaLoadImage("sidecar.tga", &options, &image) == TARGA_OK);
+    same = sameImage(&image, &reference) && image.mapped;
+    targaImageFree(&image);
+    mu_assert("touched file not served", same);
+
+    /* same size, other bytes: decoded again */
+    FILE* file = fopen("sidecar.tga", "r+b");
+    mu_assert("open failed", file != NULL);
+    fseek(file, 18 + 3 * 1000, SEEK_SET);
+    fputc(0x5A, file);
+    fclose(file);
+    times.modtime = 1000000001;
+    mu_assert("utime failed", utime("sidecar.tga", &times) == 0);
+
+    mu_assert("load failed", targaLoadImage("sidecar.tga", &options, &image) == TARGA_OK);
+    same = !image.mapped && !sameImage(&image, &reference);
+    targaImageFree(&image);
+    mu_assert("changed file served", same);
+
+    /* the same relative name from two directories, same size and time, other bytes */
+    TARGA_IMAGE other;
+
+    mkdir("sidecar_a", 0755);
+    mkdir("sidecar_b", 0755);
+    free(writeTestImage("sidecar_a/same.tga", 2, 24, 64, 48));
+    free(writeTestImage("sidecar_b/same.tga", 2, 24, 64, 48));
+    file = fopen("sidecar_b/same.tga", "r+b");
+    mu_assert("open failed", file != NULL);
+    fseek(file, 18 + 3 * 100, SEEK_SET);
+    fputc(0xA5, file);
+    fclose(file);
+    mu_assert("utime failed", utime("sidecar_a/same.tga", &times) == 0 &&
+            utime("sidecar_b/same.tga", &times) == 0);
+
+    options.cacheDir = "..";
+    mu_assert("chdir failed", chdir("sidecar_a") == 0);
+    mu_assert("load failed", targaLoadImage("same.tga", &options, &image) == TARGA_OK);
+    targaImageFree(&image);
+    mu_assert("load failed", targaLoadImage("same.tga", &options, &image) == TARGA_OK);
+    mu_assert("chdir failed", chdir("../sidecar_b") == 0);
+    options.cacheDir = NULL;
+    targaImageFree(&reference);
+    mu_assert("load failed", targaLoadImage("same.tga", &options, &reference) == TARGA_OK);
+    options.cacheDir = "..";
+    mu_assert("load failed", targaLoadImage("same.tga", &options, &other) == TARGA_OK);
+    mu_assert("chdir failed", chdir("..") == 0);
+    options.cacheDir = ".";
+
+    same = image.mapped && !sameImage(&image, &reference) && sameImage(&other, &reference);
+    targaImageFree(&other);
+    targaImageFree(&image);
+    targaImageFree(&reference);
+    mu_assert("other file served", same);
+
+    options.cacheDir = NULL;
+    mu_assert("load failed", targaLoadImage("sidecar.tga", &options, &reference) == TARGA_OK);
+    options.cacheDir = ".";
+#endif
+
+    /* another size: decoded again */
+    targaImageFree(&reference);
+    free(writeTestImage("sidecar.tga", 2, 32, 30, 20));
+    options.cacheDir = NULL;
+    mu_assert("load failed", targaLoadImage("sidecar.tga", &options, &reference) == TARGA_OK);
+    /* one load in the stats: decode, hashed twice (lookup, store), written */
+    TARGA_STATS stats;
+    size_t fileSize = 18 + 30 * 20 * 4;
+
+    options.cacheDir = ".";
+    options.stats    = &stats;
+    mu_assert("load failed", targaLoadImage("sidecar.tga", &options, &image) == TARGA_OK);
+    same = sameImage(&image, &reference);
+    targaImageFree(&image);
+    mu_assert("stale pixels", same);
+    mu_assert("bad miss stats", stats.loads == 1 && stats.failures == 0 &&
+            stats.bytesRead >= 2 * fileSize && stats.allocations >= 4 &&
+            stats.totalNs >= stats.openNs + stats.pixelsNs);
+
+    mu_assert("load failed", targaLoadImage("sidecar.tga", &options, &image) == TARGA_OK);
+    same = sameImage(&image, &reference) && image.mapped;
+    targaImageFree(&image);
+    targaImageFree(&reference);
+    mu_assert("new version not served", same);
+    mu_assert("bad hit stats", stats.loads == 1 && stats.bytesRead == 30 * 20 * 4 &&
+            stats.pixelsNs == 0 && stats.totalNs >= stats.openNs);
+    options.stats = NULL;
+
+    /* a missing directory only costs the decode */
+    options.cacheDir = "missing_dir";
+    mu_assert("load failed", targaLoadImage("sidecar.tga", &options, &image) == TARGA_OK);
+    targaImageFree(&image);
+
+    return 0;
+
+}
+
+
+/*
+ * Largest difference between the levels of a and those of b, rows of b
+ * taken from the bottom when flip is set.
+ */
+static int compareLevels(const TARGA_IMAGE* a, const TARGA_IMAGE* b, int flip)
+{
+    TARGA_IMAGE la, lb;
+    unsigned int level, y;
+    size_t x;
+    int worst = 0;
+
+    if (a->levels != b->levels)
+        return 256;
+
+    for (level = 0; level < a->levels; level++)
+    {
+        targaImageLevel(a, level, &la);
+        targaImageLevel(b, level, &lb);
+
+        for (y = 0; y < la.height; y++)
+        {
+            const uint8_t* ra = la.pixels + y * la.pitch;
+            const uint8_t* rb = lb.pixels + (flip ? la.height - 1 - y : y) * lb.pitch;
+
+            for (x = 0; x < la.width * 4; x++)
+            {
+                int d = ra[x] > rb[x] ? ra[x] - rb[x] : rb[x] - ra[x];
+                if (d > worst)
+                    worst = d;
+            }
+        }
+    }
+
+    return worst;
+}
+
+
+static char* test_targaMipmaps() {
+
+    TARGA_LOAD_OPTIONS options = {0};
+    TARGA_IMAGE image, other, level;
+    unsigned int i, filter;
+    size_t x, y, size;
+    int ok;
+
+    /* exact halvings: means of 2x2 blocks */
+    free(writeTestImage("mip_even.tga", 2, 32, 64, 32));
+    options.format = TARGA_FORMAT_RGBA8;
+    options.flags = TARGA_LOAD_MIPMAPS;
+    mu_assert("load failed", targaLoadImage("mip_even.tga", &options, &image) == TARGA_OK);
+    mu_assert("bad level count", image.levels == 7);
+
+    ok = targaImageLevel(&image, 1, &level) == TARGA_OK &&
+        level.width == 32 && level.height == 16 && level.pitch == 32 * 4;
+    for (y = 0; ok && y < level.height; y++)
+        for (x = 0; x < level.width * 4; x++)
+        {
+            const uint8_t* top = image.pixels + 2 * y * image.pitch + (x / 4) * 8 + x % 4;
+            const uint8_t* bottom = top + image.pitch;
+
+            ok &= level.pixels[y * level.pitch + x] ==
+                ((top[0] + top[4] + bottom[0] + bottom[4] + 2) >> 2);
+        }
+    mu_assert("bad box level", ok);
+
+    ok = targaImageLevel(&image, 6, &level) == TARGA_OK &&
+        level.width == 1 && level.height == 1 &&
+        targaImageLevel(&image, 7, &level) == TARGA_ERR_ARGUMENT;
+    targaImageFree(&image);
+    mu_assert("bad last level", ok);
+
+    /* odd sizes, every filter: rows decoded from either end agree */
+    free(writeTestImage("mip_odd.tga", 2, 32, 301, 211));
+    for (filter = TARGA_MIP_BOX; filter <= TARGA_MIP_LANCZOS; filter++)
+    {
+        options.mipFilter = filter;
+        options.flags = TARGA_LOAD_MIPMAPS | TARGA_LOAD_TOP_LEFT;
+        mu_assert("load failed", targaLoadImage("mip_odd.tga", &options, &image) == TARGA_OK);
+        options.flags = TARGA_LOAD_MIPMAPS | TARGA_LOAD_BOTTOM_LEFT;
+        mu_assert("load failed", targaLoadImage("mip_odd.tga", &options, &other) == TARGA_OK);
+
+        ok = image.levels == 9 && compareLevels(&image, &other, 1) <= 1;
+        for (i = 0; i < image.levels; i++)
+        {
+            targaImageLevel(&image, i, &level);
+            ok &= level.width == (301u >> i ? 301u >> i : 1) &&
+                level.height == (211u >> i ? 211u >> i : 1) &&
+                ((uintptr_t)level.pixels - (uintptr_t)image.pixels) % 16 == 0;
+        }
+
+        targaImageFree(&image);
+        targaImageFree(&other);
+        mu_assert("bad odd levels", ok);
+    }
+
+    /* the parallel RLE decode builds the same levels afterwards */
+    free(writeTestRle("mip_rle.tga", 10, 32, 1031, 300, 0));
+    options.flags = TARGA_LOAD_MIPMAPS;
+    options.mipFilter = TARGA_MIP_KAISER;
+    mu_assert("load failed", targaLoadImage("mip_rle.tga", &options, &image) == TARGA_OK);
+    options.threads = 4;
+    mu_assert("load failed", targaLoadImage("mip_rle.tga", &options, &other) == TARGA_OK);
+    ok = compareLevels(&image, &other, 0) == 0;
+    targaImageFree(&image);
+    targaImageFree(&other);
+    options.threads = 0;
+    mu_assert("parallel levels differ", ok);
+
+    /* into a buffer sized by the query, with a region */
+    options.flags = TARGA_LOAD_MIPMAPS;
+    options.region.x = 10;
+    options.region.y = 5;
+    options.region.width = 100;
+    options.region.height = 51;
+    mu_assert("query failed", targaQueryImage("mip_odd.tga", &options, &image, &size) == TARGA_OK);
+    /* 100x51 to 1x1, every level 16 bytes aligned */
+    mu_assert("bad query", image.levels == 7 && size == 26996);
+    uint8_t* buffer = malloc(size);
+    mu_assert("load failed",
+            targaLoadInto("mip_odd.tga", &options, buffer, size - 1, &image) == TARGA_ERR_ARGUMENT);
+    mu_assert("load failed",
+            targaLoadInto("mip_odd.tga", &options, buffer, size, &image) == TARGA_OK);
+    free(buffer);
+    memset(&options.region, 0, sizeof(options.region));
+
+    /* black and white columns average to middle gray in linear light */
+    uint8_t stripes[2 * 2 * 4] = {
+        0, 0, 0, 255,  255, 255, 255, 255,
+        0, 0, 0, 255,  255, 255, 255, 255 };
+    TARGA_IMAGE source = {0};
+    void* data;
+
+    source.width  = 2;
+    source.height = 2;
+    source.format = TARGA_FORMAT_RGBA8;
+    source.pitch  = 8;
+    source.pixels = stripes;
+    mu_assert("write failed", targaWriteMemory(&source, NULL, &data, &size) == TARGA_OK);
+
+    for (filter = TARGA_MIP_BOX; filter <= TARGA_MIP_LANCZOS; filter++)
+    {
+        options.mipFilter = filter;
+        options.flags = TARGA_LOAD_MIPMAPS;
+        mu_assert("load failed", targaLoadMemory(data, size, &options, &image) == TARGA_OK);
+        targaImageLevel(&image, 1, &level);
+        ok = level.pixels[0] >= 127 && level.pixels[0] <= 128 && level.pixels[3] == 255;
+        targaImageFree(&image);
+        mu_assert("bad linear mean", ok);
+
+        options.flags = TARGA_LOAD_MIPMAPS | TARGA_LOAD_SRGB;
+        mu_assert("load failed", targaLoadMemory(data, size, &options, &image) == TARGA_OK);
+        targaImageLevel(&image, 1, &level);
+        ok = level.pixels[0] == 188 && level.pixels[1] == 188 && level.pixels[3] == 255;
+        targaImageFree(&image);
+        mu_assert("bad sRGB mean", ok);
+    }
+    free(data);
+
+    /* indices have no levels */
+    free(writeTestImage("mip_gray.tga", 3, 8, 16, 16));
+    options.format = TARGA_FORMAT_INDEX8;
+    options.flags = TARGA_LOAD_MIPMAPS;
+    mu_assert("indices accepted",
+            targaLoadImage("mip_gray.tga", &options, &image) == TARGA_ERR_ARGUMENT);
+
+    return 0;
+
+}
+
+
+static char* test_targaAtlas() {
+
+    TARGA_ATLAS_ITEM items[41];
+    char names[40][32];
+    TARGA_ATLAS_OPTIONS options = {0};
+    TARGA_LOAD_OPTIONS load = {0};
+    TARGA_IMAGE atlas, image;
+    unsigned int seed = 7;
+    size_t i, j;
+    int ok = 1;
+
+    /* odd sizes, RLE or not, some with transparent borders */
+    for (i = 0; i < 40; i++)
+    {
+        unsigned int width, height;
+
+        seed = seed * 1103515245 + 12345;
+        width = 1 + (seed >> 16) % 47;
+        seed = seed * 1103515245 + 12345;
+        height = 1 + (seed >> 16) % 31;
+        sprintf(names[i], "atlas_%u.tga", (unsigned int)i);
+
+        if (i % 3 == 0)
+            free(writeTestRle(names[i], 10, 24, width, height, 0));
+        else if (i % 3 == 1)
+            free(writeTestImage(names[i], 2, 32, width, height));
+        else
+        {
+            /* a 3 pixels transparent frame, 2 on the right */
+            TARGA_IMAGE framed = {0};
+            uint8_t* pixels = calloc((size_t)(width + 5) * (height + 6) * 4, 1);
+            unsigned int x, y;
+
+            framed.width  = width + 5;
+            framed.height = height + 6;
+            framed.format = TARGA_FORMAT_RGBA8;
+            framed.pitch  = framed.width * 4;
+            framed.pixels = pixels;
+
+            for (y = 0; y < height; y++)
+                for (x = 0; x < width; x++)
+                    memset(pixels + (y + 3) * framed.pitch + (x + 3) * 4, 0x40 + (int)i, 4);
+
+            targaWriteImage(names[i], &framed, NULL);
+            free(pixels);
+        }
+
+        items[i].fileName = names[i];
+    }
+    items[40].fileName = "missing.tga";
+
+    options.flags = TARGA_ATLAS_TRIM;
+    options.padding = 1;
+    options.maxWidth = 128;
+    mu_assert("missing file not reported",
+            targaAtlasBuild(NULL, items, 41, &options, &atlas) == TARGA_ERR_OPEN);
+    mu_assert("bad atlas", atlas.pixels && atlas.width <= 128 &&
+            atlas.format == TARGA_FORMAT_RGBA8 && atlas.origin == TARGA_ORIGIN_TOP_LEFT);
+    mu_assert("missing file placed", items[40].status == TARGA_ERR_OPEN && items[40].rect.width == 0);
+
+    load.format = TARGA_FORMAT_RGBA8;
+    load.flags = TARGA_LOAD_TOP_LEFT;
+
+    for (i = 0; ok && i < 40; i++)
+    {
+        const TARGA_RECT* rect = &items[i].rect;
+        unsigned int y;
+
+        ok &= items[i].status == TARGA_OK &&
+            rect->x >= 1 && rect->x + rect->width + 1 <= atlas.width &&
+            rect->y >= 1 && rect->y + rect->height + 1 <= atlas.height;
+
+        /* trimmed exactly to the frame, the others whole */
+        if (i % 3 == 2)
+            ok &= items[i].trimX == 3 && items[i].trimY == 3 &&
+                rect->width == items[i].width - 5 && rect->height == items[i].height - 6;
+        else
+            ok &= items[i].trimX == 0 && items[i].trimY == 0 &&
+                rect->width == items[i].width && rect->height == items[i].height;
+
+        /* apart, padding included */
+        for (j = 0; ok && j < i; j++)
+        {
+            const TARGA_RECT* other = &items[j].rect;
+            ok &= rect->x >= other->x + other->width + 1 || other->x >= rect->x + rect->width + 1 ||
+                rect->y >= other->y + other->height + 1 || other->y >= rect->y + rect->height + 1;
+        }
+
+        ok &= targaLoadImage(names[i], &load, &image) == TARGA_OK;
+        for (y = 0; ok && y < rect->height; y++)
+            ok &= memcmp(atlas.pixels + (rect->y + y) * atlas.pitch + rect->x * 4,
+                    image.pixels + (items[i].trimY + y) * image.pitch + items[i].trimX * 4,
+                    rect->width * 4) == 0;
+        targaImageFree(&image);
+    }
+
+    targaImageFree(&atlas);
+    mu_assert("bad placement", ok);
+
+    /* too wide for the atlas */
+    options.maxWidth = 16;
+    targaAtlasBuild(NULL, items, 40, &options, &atlas);
+    for (i = 0; i < 40; i++)
+        ok &= items[i].status == TARGA_OK
+            ? items[i].rect.width + 2 <= 16
+            : items[i].status == TARGA_ERR_ARGUMENT && items[i].rect.width == 0;
+    targaImageFree(&atlas);
+    mu_assert("image wider than the atlas placed", ok);
+
+    return 0;
+
+}
+
+
+/*
+ * Reference decoders of the block formats: block into 16 RGBA pixels,
+ * the channels a format lacks left as they are.
+ */
+static void decodeBc1(const uint8_t* in, uint8_t* pixels)
+{
+    unsigned int c[2] = { in[0] | in[1] << 8u, in[2] | in[3] << 8u };
+    int palette[4][3], i, k;
+
+    for (i = 0; i < 2; i++)
+    {
+        int r = (c[i] >> 11) & 31, g = (c[i] >> 5) & 63, b = c[i] & 31;
+        palette[i][0] = (r << 3) | (r >> 2);
+        palette[i][1] = (g << 2) | (g >> 4);
+        palette[i][2] = (b << 3) | (b >> 2);
+    }
+
+    for (k = 0; k < 3; k++)
+    {
+        palette[2][k] = (2 * palette[0][k] + palette[1][k]) / 3;
+        palette[3][k] = (palette[0][k] + 2 * palette[1][k]) / 3;
+    }
+
+    for (i = 0; i < 16; i++)
+        for (k = 0; k < 3; k++)
+            pixels[i * 4 + k] = (uint8_t)palette[(in[4 + i / 4] >> (2 * (i % 4))) & 3][k];
+}
+
+
+static void decodeBc4(const uint8_t* in, uint8_t* pixels, int channel)
+{
+    int e0 = in[0], e1 = in[1], i;
+    uint64_t bits = 0;
+
+    for (i = 0; i < 6; i++)
+        bits |= (uint64_t)in[2 + i] << (8 * i);
+
+    for (i = 0; i < 16; i++)
+    {
+        int index = (int)(bits >> (3 * i)) & 7;
+        int value = index == 0 ? e0 : index == 1 ? e1
+            : e0 > e1 ? ((8 - index) * e0 + (index - 1) * e1) / 7
+            : index == 6 ? 0 : index == 7 ? 255 : ((6 - index) * e0 + (index - 1) * e1) / 5;
+
+        pixels[i * 4 + channel] = (uint8_t)value;
+    }
+}
+
+
+static void decodeBc7(const uint8_t* in, uint8_t* pixels)
+{
+    static const int weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+    unsigned int position = 7, i, k;
+    int ends[2][4];
+
+    #define BITS(n) (position += (n), \
+        (int)((in[(position - (n)) / 8] | in[(position - (n)) / 8 + 1 < 16 ? (position - (n)) / 8 + 1 : 15] << 8) \
+            >> ((position - (n)) % 8)) & ((1 << (n)) - 1))
+
+    if ((in[0] & 0x7F) != 0x40)
+    {
+        memset(pixels, 0, 64);
+        return;
+    }
+
+    for (k = 0; k < 4; k++)
+    {
+        ends[0][k] = BITS(7) << 1;
+        ends[1][k] = BITS(7) << 1;
+    }
+    for (i = 0; i < 2; i++)
+    {
+        int p = BITS(1);
+        for (k = 0; k < 4; k++)
+            ends[i][k] |= p;
+    }
+
+    for (i = 0; i < 16; i++)
+    {
+        int w = weights[BITS(i == 0 ? 3 : 4)];
+        for (k = 0; k < 4; k++)
+            pixels[i * 4 + k] = (uint8_t)((ends[0][k] * (64 - w) + ends[1][k] * w + 32) >> 6);
+    }
+
+    #undef BITS
+}
+
+
+/*
+ * Mean squared error of the channels of a block compressed image against
+ * the RGBA8 image it was encoded from.
+ */
+static double blockError(const TARGA_IMAGE* image, const TARGA_IMAGE* source)
+{
+    size_t blockSize = image->format == TARGA_FORMAT_BC1 || image->format == TARGA_FORMAT_BC4 ? 8 : 16;
+    int channels = image->format == TARGA_FORMAT_BC1 ? 3
+        : image->format == TARGA_FORMAT_BC4 ? 1 : image->format == TARGA_FORMAT_BC5 ? 2 : 4;
+    double error = 0;
+    unsigned int x, y, i;
+    int k;
+
+    for (y = 0; y < image->height; y += 4)
+        for (x = 0; x < image->width; x += 4)
+        {
+            const uint8_t* in = image->pixels + y / 4 * image->pitch + x / 4 * blockSize;
+            uint8_t pixels[64] = {0};
+
+            switch (image->format)
+            {
+                case TARGA_FORMAT_BC1: decodeBc1(in, pixels); break;
+                case TARGA_FORMAT_BC3: decodeBc4(in, pixels, 3); decodeBc1(in + 8, pixels); break;
+                case TARGA_FORMAT_BC4: decodeBc4(in, pixels, 0); break;
+                case TARGA_FORMAT_BC5: decodeBc4(in, pixels, 0); decodeBc4(in + 8, pixels, 1); break;
+                default: decodeBc7(in, pixels); break;
+            }
+
+            for (i = 0; i < 16; i++)
+            {
+                if (x + i % 4 >= image->width || y + i / 4 >= image->height)
+                    continue;
+
+                const uint8_t* pixel = source->pixels + (y + i / 4) * source->pitch + (x + i % 4) * 4;
+                for (k = 0; k < channels; k++)
+                    error += (pixels[i * 4 + k] - pixel[k]) * (pixels[i * 4 + k] - pixel[k]);
+            }
+        }
+
+    return error / ((double)image->width * image->height * channels);
+}
+
+
+static char* test_targaBlocks() {
+
+    static const unsigned int formats[5] = {
+        TARGA_FORMAT_BC1, TARGA_FORMAT_BC3, TARGA_FORMAT_BC4, TARGA_FORMAT_BC5, TARGA_FORMAT_BC7
+    };
+    static const double limits[5] = { 6, 5, 1, 1, 2.5 };    /* mean squared errors */
+    TARGA_LOAD_OPTIONS options = {0};
+    TARGA_WRITE_OPTIONS write = {0};
+    TARGA_IMAGE source = {0}, flipped, reference, image, other;
+    unsigned int x, y, f, seed = 99;
+    size_t size;
+
+    /* smooth gradients, some noise, a hard edge: 4x4 blocks cut at both edges */
+    source.width  = 203;
+    source.height = 97;
+    source.format = TARGA_FORMAT_RGBA8;
+    source.origin = TARGA_ORIGIN_TOP_LEFT;
+    source.pitch  = source.width * 4;
+    source.pixels = malloc(source.pitch * source.height);
+
+    for (y = 0; y < source.height; y++)
+        for (x = 0; x < source.width; x++)
+        {
+            uint8_t* pixel = source.pixels + y * source.pitch + x * 4;
+
+            seed = seed * 1103515245 + 12345;
+            pixel[0] = (uint8_t)(x + (seed >> 16) % 5);
+            pixel[1] = (uint8_t)(y * 2 + (x > 120 ? 40 : 0));
+            pixel[2] = (uint8_t)((x + y) / 2);
+            pixel[3] = (uint8_t)(255 - y);
+        }
+
+    /* the same image, bottom up and RLE */
+    flipped = source;
+    flipped.origin = TARGA_ORIGIN_BOTTOM_LEFT;
+    flipped.pixels = malloc(source.pitch * source.height);
+    for (y = 0; y < source.height; y++)
+        memcpy(flipped.pixels + y * source.pitch,
+                source.pixels + (source.height - 1 - y) * source.pitch, source.pitch);
+
+    write.flags = TARGA_WRITE_RLE;
+    targaWriteImage("blocks_top.tga", &source, NULL);
+    targaWriteImage("blocks_bottom.tga", &flipped, &write);
+    free(source.pixels);
+    free(flipped.pixels);
+
+    options.format = TARGA_FORMAT_RGBA8;
+    mu_assert("load failed", targaLoadImage("blocks_top.tga", &options, &reference) == TARGA_OK);
+
+    for (f = 0; f < 5; f++)
+    {
+        size_t blockSize = formats[f] == TARGA_FORMAT_BC1 || formats[f] == TARGA_FORMAT_BC4 ? 8 : 16;
+        double error;
+
+        options.format  = formats[f];
+        options.threads = 0;
+        mu_assert("query failed", targaQueryImage("blocks_top.tga", &options, &image, &size) == TARGA_OK);
+        mu_assert("bad block size", image.pitch == 51 * blockSize && size == 25 * image.pitch);
+
+        mu_assert("load failed", targaLoadImage("blocks_top.tga", &options, &image) == TARGA_OK);
+        error = blockError(&image, &reference);
+        mu_assert("poor block encoding", error < limits[f]);
+
+        /* rows decoded from the bottom, by threads, give the same blocks */
+        options.threads = 3;
+        options.flags = TARGA_LOAD_TOP_LEFT;
+        mu_assert("load failed", targaLoadImage("blocks_bottom.tga", &options, &other) == TARGA_OK);
+        mu_assert("bad blocks", other.origin == TARGA_ORIGIN_TOP_LEFT &&
+                memcmp(image.pixels, other.pixels, size) == 0);
+        targaImageFree(&other);
+        targaImageFree(&image);
+        options.flags = 0;
+    }
+
+    /* a region: blocks of its own */
+    options.format = TARGA_FORMAT_BC7;
+    options.flags = TARGA_LOAD_TOP_LEFT;
+    options.region.x = 8;
+    options.region.y = 4;
+    options.region.width = 9;
+    options.region.height = 6;
+    mu_assert("load failed", targaLoadImage("blocks_bottom.tga", &options, &image) == TARGA_OK);
+    mu_assert("bad region", image.width == 9 && image.height == 6 && image.pitch == 3 * 16);
+    memset(&options.region, 0, sizeof(options.region));
+    options.format = TARGA_FORMAT_RGBA8;
+    mu_assert("load failed", targaLoadImage("blocks_top.tga", &options, &other) == TARGA_OK);
+    other.pixels += 4 * other.pitch + 8 * 4;
+    mu_assert("poor region encoding", blockError(&image, &other) < 2.5);
+    other.pixels -= 4 * other.pitch + 8 * 4;
+    targaImageFree(&other);
+
+    /* pixels only */
+    mu_assert("blocks written", targaWriteImage("blocks_out.tga", &image, NULL) != TARGA_OK);
+    targaImageFree(&image);
+
+    options.format = TARGA_FORMAT_BC3;
+    options.flags = TARGA_LOAD_MIPMAPS;
+    mu_assert("mip chain of blocks",
+            targaLoadImage("blocks_top.tga", &options, &image) == TARGA_ERR_ARGUMENT);
+
+    targaImageFree(&reference);
+    return 0;
+
+}
+
+
+/*
+ * Middle pixel of square i of step pixels, see targaLoadThumbnail().
+ */
+static size_t decimate(size_t i, unsigned int step, size_t size)
+{
+    size_t pixel = i * step + step / 2;
+    return pixel < size ? pixel : size - 1;
+}
+
+
+/*
+ * Pixel (x, y) of a thumbnail decimated by step from image, both in the
+ * same origin, rows picked in file order: bottom up when flipped.
+ */
+static const uint8_t* thumbnailSource(
+        const TARGA_IMAGE* image,
+        const TARGA_IMAGE* thumbnail,
+        unsigned int step,
+        size_t x,
+        size_t y,
+        int flip)
+{
+    size_t bpp = image->pitch / image->width;
+    size_t row = flip
+        ? image->height - 1 - decimate(thumbnail->height - 1 - y, step, image->height)
+        : decimate(y, step, image->height);
+
+    return image->pixels + row * image->pitch + decimate(x, step, image->width) * bpp;
+}
+
+
+static int checkThumbnail(
+        const TARGA_IMAGE* image,
+        const TARGA_IMAGE* thumbnail,
+        unsigned int step,
+        int flip)
+{
+    size_t bpp = image->pitch / image->width;
+    size_t x, y;
+
+    if (thumbnail->width != (image->width + step - 1) / step ||
+        thumbnail->height != (image->height + step - 1) / step ||
+        thumbnail->format != image->format || thumbnail->origin != image->origin)
+        return 0;
+
+    for (y = 0; y < thumbnail->height; y++)
+        for (x = 0; x < thumbnail->width; x++)
+            if (memcmp(thumbnail->pixels + y * thumbnail->pitch + x * bpp,
+                        thumbnailSource(image, thumbnail, step, x, y, flip), bpp) != 0)
+                return 0;
+
+    return 1;
+}
+
+
+static char* test_targaThumbnail() {
+
+    TARGA_LOAD_OPTIONS options = {0};
+    TARGA_WRITE_OPTIONS write = {0};
+    TARGA_IMAGE source = {0}, stamp, thumbnail;
+    TARGA_INFO info;
+    unsigned int x, y;
+    uint8_t* data;
+    size_t size;
+
+    /* 300x200 with runs and noise: steps of 5 for 64, 10 for 32 */
+    source.width  = 300;
+    source.height = 200;
+    source.format = TARGA_FORMAT_RGBA8;
+    source.origin = TARGA_ORIGIN_BOTTOM_LEFT;
+    source.pitch  = source.width * 4;
+    source.pixels = malloc(source.pitch * source.height);
+
+    for (y = 0; y < source.height; y++)
+        for (x = 0; x < source.width; x++)
+        {
+            uint8_t* pixel = source.pixels + y * source.pitch + x * 4;
+
+            pixel[0] = (uint8_t)(x < 100 ? y : x * 7 + y);
+            pixel[1] = (uint8_t)(x / 3);
+            pixel[2] = (uint8_t)(x * y);
+            pixel[3] = (uint8_t)(255 - x / 2);
+        }
+
+    /* the stamp is written and returned as it is, whatever the image */
+    write.flags = TARGA_WRITE_STAMP;
+    mu_assert("write failed",
+            targaWriteMemory(&source, &write, (void**)&data, &size) == TARGA_OK);
+    mu_assert("probe failed",
+            targaProbeMemory(data, size, TARGA_PROBE_EXTENSION, &info) == TARGA_OK);
+    mu_assert("no stamp", info.stampOffset == 18 + source.pitch * source.height &&
+            data[info.stampOffset] == 60 && data[info.stampOffset + 1] == 40);
+
+    memset(data + 18, 0, source.pitch * source.height);
+    options.format = TARGA_FORMAT_RGBA8;
+    mu_assert("thumbnail failed",
+            targaLoadThumbnailMemory(data, size, 0, &options, &stamp) == TARGA_OK);
+    mu_assert("bad stamp", checkThumbnail(&source, &stamp, 5, 0));
+
+    /* a smaller preview decimates the stamp */
+    mu_assert("thumbnail failed",
+            targaLoadThumbnailMemory(data, size, 32, &options, &thumbnail) == TARGA_OK);
+    mu_assert("bad stamp decimation", checkThumbnail(&stamp, &thumbnail, 2, 0));
+    targaImageFree(&thumbnail);
+    targaImageFree(&stamp);
+    free(data);
+
+    /* without stamp: RLE through the scan line table, then the packets */
+    write.flags = TARGA_WRITE_RLE | TARGA_WRITE_SCANLINE_TABLE;
+    mu_assert("write failed",
+            targaWriteMemory(&source, &write, (void**)&data, &size) == TARGA_OK);
+    mu_assert("thumbnail failed",
+            targaLoadThumbnailMemory(data, size, 32, &options, &thumbnail) == TARGA_OK);
+    mu_assert("bad rle thumbnail", checkThumbnail(&source, &thumbnail, 10, 0));
+    targaImageFree(&thumbnail);
+    free(data);
+
+    write.flags = TARGA_WRITE_RLE;
+    targaWriteImage("thumbnail.tga", &source, &write);
+    mu_assert("thumbnail failed",
+            targaLoadThumbnail("thumbnail.tga", 100, &options, &thumbnail) == TARGA_OK);
+    mu_assert("bad rle thumbnail", checkThumbnail(&source, &thumbnail, 3, 0));
+    targaImageFree(&thumbnail);
+
+    /* flipped, in another format: the rows of the full image, picked bottom up */
+    write.flags = 0;
+    targaWriteImage("thumbnail.tga", &source, &write);
+    options.format = TARGA_FORMAT_BGR8;
+    options.flags  = TARGA_LOAD_TOP_LEFT;
+    mu_assert("load failed", targaLoadImage("thumbnail.tga", &options, &stamp) == TARGA_OK);
+    mu_assert("thumbnail failed",
+            targaLoadThumbnail("thumbnail.tga", 64, &options, &thumbnail) == TARGA_OK);
+    mu_assert("bad flipped thumbnail", checkThumbnail(&stamp, &thumbnail, 5, 1));
+    targaImageFree(&thumbnail);
+    targaImageFree(&stamp);
+
+    /* a truncated file fails, blocks are not previews */
+    mu_assert("write failed",
+            targaWriteMemory(&source, &write, (void**)&data, &size) == TARGA_OK);
+    mu_assert("truncated thumbnail",
+            targaLoadThumbnailMemory(data, size / 2, 0, NULL, &thumbnail) == TARGA_ERR_READ);
+    options.format = TARGA_FORMAT_BC1;
+    mu_assert("block thumbnail",
+            targaLoadThumbnailMemory(data, size, 0, &options, &thumbnail) == TARGA_ERR_ARGUMENT);
+    free(data);
+
+    free(source.pixels);
+    return 0;
+
+}
+
+
+static char* targa_test(char* test_name) {
+
+    if (strcmp(test_name, "load") == 0)
+        mu_run_test(test_targaLoad);
+    else if (strcmp(test_name, "load_missing") == 0)
+        mu_run_test(test_targaLoadMissing);
+    else if (strcmp(test_name, "load32") == 0)
+        mu_run_test(test_targaLoad32);
+    else if (strcmp(test_name, "load16") == 0)
+        mu_run_test(test_targaLoad16);
+    else if (strcmp(test_name, "load_mapped") == 0)
+        mu_run_test(test_targaLoadMapped);
+    else if (strcmp(test_name, "load_rle") == 0)
+        mu_run_test(test_targaLoadRle);
+    else if (strcmp(test_name, "load_rle32") == 0)
+        mu_run_test(test_targaLoadRle32);
+    else if (strcmp(test_name, "load_rle_gray") == 0)
+        mu_run_test(test_targaLoadRleGray);
+    else if (strcmp(test_name, "load_rle_parallel") == 0)
+        mu_run_test(test_targaLoadRleParallel);
+    else if (strcmp(test_name, "decoder") == 0)
+        mu_run_test(test_targaDecoder);
+    else if (strcmp(test_name, "load_into") == 0)
+        mu_run_test(test_targaLoadInto);
+    else if (strcmp(test_name, "probe") == 0)
+        mu_run_test(test_targaProbe);
+    else if (strcmp(test_name, "load_batch") == 0)
+        mu_run_test(test_targaLoadBatch);
+    else if (strcmp(test_name, "formats") == 0)
+        mu_run_test(test_targaFormats);
+    else if (strcmp(test_name, "origin") == 0)
+        mu_run_test(test_targaOrigin);
+    else if (strcmp(test_name, "region") == 0)
+        mu_run_test(test_targaRegion);
+    else if (strcmp(test_name, "write") == 0)
+        mu_run_test(test_targaWrite);
+    else if (strcmp(test_name, "write_parallel") == 0)
+        mu_run_test(test_targaWriteParallel);
+    else if (strcmp(test_name, "color_mapped") == 0)
+        mu_run_test(test_targaColorMapped);
+    else if (strcmp(test_name, "load16_alpha") == 0)
+        mu_run_test(test_targaLoad16Alpha);
+    else if (strcmp(test_name, "stats") == 0)
+        mu_run_test(test_targaStats);
+    else if (strcmp(test_name, "async") == 0)
+        mu_run_test(test_targaAsync);
+    else if (strcmp(test_name, "load_pipelined") == 0)
+        mu_run_test(test_targaLoadPipelined);
+    else if (strcmp(test_name, "cache") == 0)
+        mu_run_test(test_targaCache);
+    else if (strcmp(test_name, "sidecar") == 0)
+        mu_run_test(test_targaSidecar);
+    else if (strcmp(test_name, "mipmaps") == 0)
+        mu_run_test(test_targaMipmaps);
+    else if (strcmp(test_name, "atlas") == 0)
+        mu_run_test(test_targaAtlas);
+    else if (strcmp(test_name, "blocks") == 0)
+        mu_run_test(test_targaBlocks);
+    else if (strcmp(test_name, "thumbnail") == 0)
+        mu_run_test(test_targaThumbnail);
+    else if (strcmp(test_name, "no_image_data") == 0)
+        mu_run_test(test_targaNoImageData);
+    else
+        return "unknown test";
+
+    return NULL;
+
+}
+
+int main(int argc, char* argv[])
+{
+
+    if (argc < 2)
+    {
+        printf("usage: %s test_name [file.tga [file2.tga]]\n", argv[0]);
+        return 1;
+    }
+
+    if (argc > 2)
+        dataFile = argv[2];
+    if (argc > 3)
+        dataFile2 = argv[3];
+
+    char* result = targa_test(argv[1]);
+
+    if (result != 0)
+        printf("%s\n", result);
+
+    printf("Tests run: %d\n", tests_run);
+
+    return result != NULL;
+
+}
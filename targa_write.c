@@ -0,0 +1,971 @@
+/*
+ * MIT License
+ *
+ * TARGA Copyright (c) 2016 Sebastien Serre <ssbx@sysmo.io>.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * TGA writer
+ */
+#include "targa_private.h"
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#define TGA_WRITEV
+#define TGA_IOV_COUNT 64
+#endif
+
+#if defined(_MSC_VER)
+static __inline unsigned int targaCtz64(uint64_t x)
+{
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return (unsigned int)index;
+}
+#else
+#define targaCtz64(x) ((unsigned int)__builtin_ctzll(x))
+#endif
+
+
+static void targaPut16(uint8_t* p, unsigned int value)
+{
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+}
+
+
+static void targaPut32(uint8_t* p, uint32_t value)
+{
+    targaPut16(p, value & 0xFFFF);
+    targaPut16(p + 2, value >> 16);
+}
+
+
+/*
+ * Destination: a FILE or a memory buffer growing as needed. The first
+ * error is kept and the following writes are ignored.
+ */
+typedef struct {
+    FILE*       file;
+    uint8_t*    data;
+    size_t      size;
+    size_t      capacity;
+    uint64_t    offset;         /* bytes written so far */
+    int         status;
+} TGA_WRITER;
+
+
+static void targaWriteBytes(TGA_WRITER* writer, const void* bytes, size_t size)
+{
+
+    if (writer->status != TARGA_OK || size == 0)
+        return;
+
+    if (writer->file)
+    {
+        if (fwrite(bytes, 1, size, writer->file) != size)
+            writer->status = TARGA_ERR_WRITE;
+    }
+    else
+    {
+        if (size > writer->capacity - writer->size)
+        {
+            size_t capacity = writer->capacity ? writer->capacity : 4096;
+
+            while (capacity - writer->size < size)
+            {
+                if (capacity > (size_t)-1 / 2)
+                {
+                    writer->status = TARGA_ERR_NO_MEMORY;
+                    return;
+                }
+                capacity *= 2;
+            }
+
+            uint8_t* data = realloc(writer->data, capacity);
+            if (!data)
+            {
+                writer->status = TARGA_ERR_NO_MEMORY;
+                return;
+            }
+
+            writer->data     = data;
+            writer->capacity = capacity;
+        }
+
+        memcpy(writer->data + writer->size, bytes, size);
+        writer->size += size;
+    }
+
+    writer->offset += size;
+
+}
+
+
+/*
+ * File layout for an image format.
+ */
+typedef struct {
+    uint8_t         imageType;
+    uint8_t         pixelDepth;
+    uint8_t         alphaBits;
+    uint8_t         attributesType;     /* extension area */
+    size_t          bpp;                /* bytes per pixel, in and out */
+    TGA_SWIZZLE_FN  convert;            /* NULL if stored as it is */
+} TGA_LAYOUT;
+
+
+static int targaWriteLayout(
+        const TARGA_IMAGE*          image,
+        const TARGA_WRITE_OPTIONS*  options,
+        TGA_LAYOUT*                 layout)
+{
+
+    int rle = options && (options->flags & TARGA_WRITE_RLE);
+
+    memset(layout, 0, sizeof(*layout));
+
+    switch (image->format)
+    {
+        case TARGA_FORMAT_RGB8:
+        case TARGA_FORMAT_BGR8:
+            layout->imageType = IMG_TYPE_UNCOMPRESSED_TRUE_COLOR;
+            layout->bpp       = 3;
+            break;
+        case TARGA_FORMAT_RGBA8:
+        case TARGA_FORMAT_RGBA8_KEYED:
+        case TARGA_FORMAT_RGBA8_PREMULTIPLIED:
+        case TARGA_FORMAT_BGRA8:
+            layout->imageType      = IMG_TYPE_UNCOMPRESSED_TRUE_COLOR;
+            layout->bpp            = 4;
+            layout->alphaBits      = 8;
+            layout->attributesType =
+                image->format == TARGA_FORMAT_RGBA8_PREMULTIPLIED ? 4 : 3;
+            break;
+        case TARGA_FORMAT_GRAY8:
+            layout->imageType = IMG_TYPE_UNCOMPRESSED_BLACK_AND_WHITE;
+            layout->bpp       = 1;
+            break;
+        case TARGA_FORMAT_INDEX8:
+            if (!options || !options->palette ||
+                options->paletteSize < 1 || options->paletteSize > 256)
+                return TARGA_ERR_ARGUMENT;
+
+            switch (options->paletteFormat)
+            {
+                case TARGA_FORMAT_RGB8:
+                case TARGA_FORMAT_RGBA8:
+                case TARGA_FORMAT_BGR8:
+                case TARGA_FORMAT_BGRA8:
+                    break;
+                default:
+                    return TARGA_ERR_ARGUMENT;
+            }
+
+
+            layout->imageType = IMG_TYPE_UNCOMPRESSED_COLOR_MAPPED;
+            layout->bpp       = 1;
+            break;
+        default:
+            return TARGA_ERR_ARGUMENT;
+    }
+
+    if (image->format != TARGA_FORMAT_BGR8 && image->format != TARGA_FORMAT_BGRA8 &&
+        layout->bpp > 1)
+        layout->convert = targaSwapKernel(layout->bpp);
+
+    if (rle)
+        layout->imageType += IMG_TYPE_RLE_COLOR_MAPPED - IMG_TYPE_UNCOMPRESSED_COLOR_MAPPED;
+
+    layout->pixelDepth = (uint8_t)(layout->bpp * 8);
+
+    if (image->width > 0xFFFF || image->height > 0xFFFF ||
+        image->pitch < image->width * layout->bpp ||
+        (!image->pixels && image->width && image->height))
+        return TARGA_ERR_ARGUMENT;
+
+    return TARGA_OK;
+
+}
+
+
+/*
+ * Run detection
+ *
+ * A bitmap with bit i set when pixel i equals pixel i + 1 is built first,
+ * 8 to 32 pixels per compare with AVX2. Packets are then cut by counting
+ * set and clear bits.
+ */
+typedef void (*TGA_EQUAL_FN)(uint64_t* bits, const uint8_t* row, size_t width);
+
+
+/*
+ * OR the (at most 32) bits of value into bits from bit i.
+ */
+static void targaSetBits(uint64_t* bits, size_t i, uint64_t value)
+{
+    unsigned int shift = i & 63;
+
+    bits[i >> 6] |= value << shift;
+    if (shift > 32)
+        bits[(i >> 6) + 1] |= value >> (64 - shift);
+}
+
+
+static void targaEqualScalar(
+        uint64_t* bits, const uint8_t* row, size_t start, size_t width, size_t bpp)
+{
+    size_t i;
+
+    for (i = start; i + 1 < width; i++)
+    {
+        const uint8_t* p = row + i * bpp;
+        int same = p[0] == p[bpp];
+
+        if (bpp > 1)
+            same &= p[1] == p[bpp + 1] && p[2] == p[bpp + 2];
+        if (bpp > 3)
+            same &= p[3] == p[bpp + 3];
+
+        if (same)
+            bits[i >> 6] |= (uint64_t)1 << (i & 63);
+    }
+}
+
+static void targaEqual8(uint64_t* bits, const uint8_t* row, size_t width)
+{
+    targaEqualScalar(bits, row, 0, width, 1);
+}
+
+static void targaEqual24(uint64_t* bits, const uint8_t* row, size_t width)
+{
+    targaEqualScalar(bits, row, 0, width, 3);
+}
+
+static void targaEqual32(uint64_t* bits, const uint8_t* row, size_t width)
+{
+    targaEqualScalar(bits, row, 0, width, 4);
+}
+
+
+#ifdef TGA_X86
+/*
+ * Each pixel is compared with the next one by comparing the row with
+ * itself loaded one pixel further.
+ */
+TGA_TARGET("avx2")
+static void targaEqual8Avx2(uint64_t* bits, const uint8_t* row, size_t width)
+{
+    size_t i;
+
+    for (i = 0; i + 33 <= width; i += 32)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(row + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(row + i + 1));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+
+        targaSetBits(bits, i, mask);
+    }
+
+    targaEqualScalar(bits, row, i, width, 1);
+}
+
+TGA_TARGET("avx2")
+static void targaEqual24Avx2(uint64_t* bits, const uint8_t* row, size_t width)
+{
+    size_t i;
+
+    /*
+     * 10 pixels per iteration: a pixel equals the next one when its 3
+     * bytes equal the 3 bytes that follow.
+     */
+    for (i = 0; i * 3 + 35 <= width * 3; i += 10)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(row + i * 3));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(row + i * 3 + 3));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+        uint32_t pixels = 0;
+        unsigned int k;
+
+        mask &= (mask >> 1) & (mask >> 2);
+        for (k = 0; k < 10; k++)
+            pixels |= ((mask >> (k * 3)) & 1) << k;
+
+        targaSetBits(bits, i, pixels);
+    }
+
+    targaEqualScalar(bits, row, i, width, 3);
+}
+
+TGA_TARGET("avx2")
+static void targaEqual32Avx2(uint64_t* bits, const uint8_t* row, size_t width)
+{
+    size_t i;
+
+    for (i = 0; i + 9 <= width; i += 8)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(row + i * 4));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(row + i * 4 + 4));
+        uint32_t mask = (uint32_t)_mm256_movemask_ps(
+                _mm256_castsi256_ps(_mm256_cmpeq_epi32(a, b)));
+
+        targaSetBits(bits, i, mask);
+    }
+
+    targaEqualScalar(bits, row, i, width, 4);
+}
+#endif // TGA_X86
+
+
+static TGA_EQUAL_FN targaEqualKernel(size_t bpp)
+{
+    unsigned int features = targaCpuFeatures();
+
+#ifdef TGA_X86
+    if (features & CPU_AVX2)
+        return bpp == 1 ? targaEqual8Avx2 : bpp == 3 ? targaEqual24Avx2 : targaEqual32Avx2;
+#else
+    (void)features;
+#endif
+
+    return bpp == 1 ? targaEqual8 : bpp == 3 ? targaEqual24 : targaEqual32;
+}
+
+
+/*
+ * Number of consecutive bits equal to set from bit i, at most limit.
+ */
+static size_t targaBitSpan(const uint64_t* bits, size_t i, size_t limit, int set)
+{
+    size_t n = 0;
+
+    while (n < limit)
+    {
+        size_t pos = i + n;
+        unsigned int shift = pos & 63;
+        uint64_t word = set ? ~bits[pos >> 6] : bits[pos >> 6];
+
+        /* the bits looked for are 0 now, the ones shifted in too */
+        word >>= shift;
+
+        size_t span = word ? targaCtz64(word) : 64;
+        if (span > 64 - shift)
+            span = 64 - shift;
+
+        n += span;
+        if (span < 64 - shift)
+            break;
+    }
+
+    return n < limit ? n : limit;
+}
+
+
+/*
+ * Per row scratch buffers.
+ */
+typedef struct {
+    uint8_t*    row;            /* row in file layout */
+    uint8_t*    packets;        /* encoded row */
+    uint64_t*   equal;          /* pixel i equals pixel i + 1 */
+    uint64_t*   starts;         /* a run packet may start at pixel i */
+} TGA_ROW_BUFFERS;
+
+
+static int targaAllocRowBuffers(TGA_ROW_BUFFERS* buffers, size_t width, size_t bpp)
+{
+    size_t words = (width + 63) / 64 + 1;
+
+    buffers->row     = malloc(width * bpp + 1);
+    buffers->packets = malloc(width * bpp + (width + 127) / 128 + 1);
+    buffers->equal   = malloc(words * sizeof(uint64_t));
+    buffers->starts  = malloc(words * sizeof(uint64_t));
+
+    if (!buffers->row || !buffers->packets || !buffers->equal || !buffers->starts)
+        return TARGA_ERR_NO_MEMORY;
+
+    return TARGA_OK;
+}
+
+
+static void targaFreeRowBuffers(TGA_ROW_BUFFERS* buffers)
+{
+    free(buffers->row);
+    free(buffers->packets);
+    free(buffers->equal);
+    free(buffers->starts);
+}
+
+
+/*
+ * RLE encode one row of width pixels into dst and return the encoded
+ * size. Two equal pixels already make a run packet (1 + bpp bytes instead
+ * of 2 * bpp), three for 1 byte pixels.
+ */
+static size_t targaRleEncodeRow(
+        uint8_t*            dst,
+        const uint8_t*      row,
+        size_t              width,
+        size_t              bpp,
+        TGA_EQUAL_FN        equal,
+        TGA_ROW_BUFFERS*    buffers)
+{
+
+    size_t words = (width + 63) / 64 + 1;
+    uint64_t* starts = buffers->starts;
+    uint8_t* out = dst;
+    size_t i;
+
+    memset(buffers->equal, 0, words * sizeof(uint64_t));
+    equal(buffers->equal, row, width);
+
+    if (bpp == 1)
+    {
+        for (i = 0; i + 1 < words; i++)
+            starts[i] = buffers->equal[i] &
+                ((buffers->equal[i] >> 1) | (buffers->equal[i + 1] << 63));
+        starts[i] = 0;
+    }
+    else
+    {
+        starts = buffers->equal;
+    }
+
+    i = 0;
+    while (i < width)
+    {
+        size_t left = width - i;
+        size_t n;
+
+        if ((starts[i >> 6] >> (i & 63)) & 1)
+        {
+            n = 1 + targaBitSpan(buffers->equal, i, left - 1 < 127 ? left - 1 : 127, 1);
+
+            *out++ = (uint8_t)(0x80 | (n - 1));
+            memcpy(out, row + i * bpp, bpp);
+            out += bpp;
+        }
+        else
+        {
+            n = targaBitSpan(starts, i, left < 128 ? left : 128, 0);
+
+            *out++ = (uint8_t)(n - 1);
+            memcpy(out, row + i * bpp, n * bpp);
+            out += n * bpp;
+        }
+
+        i += n;
+    }
+
+    return (size_t)(out - dst);
+
+}
+
+
+/*
+ * Encode row y of image in file layout, return its bytes in *data.
+ */
+static size_t targaEncodeRow(
+        const TARGA_IMAGE*  image,
+        const TGA_LAYOUT*   layout,
+        TGA_EQUAL_FN        equal,
+        TGA_ROW_BUFFERS*    buffers,
+        size_t              y,
+        const uint8_t**     data)
+{
+
+    const uint8_t* row = image->pixels + y * image->pitch;
+    size_t width = image->width;
+
+    if (layout->convert)
+    {
+        layout->convert(buffers->row, row, width, NULL);
+        row = buffers->row;
+    }
+
+    if (layout->imageType < IMG_TYPE_RLE_COLOR_MAPPED)
+    {
+        *data = row;
+        return width * layout->bpp;
+    }
+
+    *data = buffers->packets;
+    return targaRleEncodeRow(buffers->packets, row, width, layout->bpp, equal, buffers);
+
+}
+
+
+/*
+ * Parallel RLE
+ *
+ * Packets never cross rows, so bands of rows are encoded independently
+ * into their own buffers, then joined by a single gathered write.
+ */
+typedef struct {
+    uint8_t*    data;
+    size_t      size;
+    int         result;
+} TGA_BAND;
+
+
+typedef struct {
+    const TARGA_IMAGE*  image;
+    const TGA_LAYOUT*   layout;
+    TGA_EQUAL_FN        equal;
+    size_t              bandRows;
+    TGA_BAND*           bands;
+    uint64_t*           rows;           /* row offsets in their band */
+} TGA_BAND_JOB;
+
+
+static void targaEncodeBand(void* context, size_t index)
+{
+
+    TGA_BAND_JOB* job = context;
+    TGA_BAND* band = &job->bands[index];
+    TGA_ROW_BUFFERS buffers = {0};
+    size_t width = job->image->width;
+    size_t first = index * job->bandRows;
+    size_t last  = first + job->bandRows;
+    size_t y;
+
+    if (last > job->image->height)
+        last = job->image->height;
+
+    band->result = TARGA_ERR_NO_MEMORY;
+    band->data   = malloc((last - first) *
+            (width * job->layout->bpp + (width + 127) / 128) + 1);
+
+    if (band->data &&
+        targaAllocRowBuffers(&buffers, width, job->layout->bpp) == TARGA_OK)
+    {
+        for (y = first; y < last; y++)
+        {
+            const uint8_t* data;
+            size_t size = targaEncodeRow(job->image, job->layout, job->equal,
+                    &buffers, y, &data);
+
+            if (job->rows)
+                job->rows[y] = band->size;
+
+            memcpy(band->data + band->size, data, size);
+            band->size += size;
+        }
+
+        band->result = TARGA_OK;
+    }
+
+    targaFreeRowBuffers(&buffers);
+
+}
+
+
+#ifdef TGA_WRITEV
+static int targaWritev(int fd, struct iovec* iov, int count)
+{
+
+    while (count)
+    {
+        ssize_t written = writev(fd, iov, count);
+
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return TARGA_ERR_WRITE;
+        }
+
+        /* partial write: skip what went out */
+        while (count && (size_t)written >= iov->iov_len)
+        {
+            written -= (ssize_t)iov->iov_len;
+            iov++;
+            count--;
+        }
+
+        if (count)
+        {
+            iov->iov_base = (uint8_t*)iov->iov_base + written;
+            iov->iov_len -= (size_t)written;
+        }
+    }
+
+    return TARGA_OK;
+
+}
+#endif // TGA_WRITEV
+
+
+static void targaWriteBands(TGA_WRITER* writer, const TGA_BAND* bands, size_t count)
+{
+
+    size_t i;
+
+#ifdef TGA_WRITEV
+    if (writer->file && writer->status == TARGA_OK)
+    {
+        struct iovec iov[TGA_IOV_COUNT];
+
+        /* what is buffered goes first */
+        if (fflush(writer->file) != 0)
+            writer->status = TARGA_ERR_WRITE;
+
+        for (i = 0; i < count && writer->status == TARGA_OK; )
+        {
+            int n = 0;
+
+            for (; i < count && n < TGA_IOV_COUNT; i++, n++)
+            {
+                iov[n].iov_base = bands[i].data;
+                iov[n].iov_len  = bands[i].size;
+                writer->offset += bands[i].size;
+            }
+
+            writer->status = targaWritev(fileno(writer->file), iov, n);
+        }
+
+        return;
+    }
+#endif
+
+    for (i = 0; i < count; i++)
+        targaWriteBytes(writer, bands[i].data, bands[i].size);
+
+}
+
+
+static void targaWriteParallel(
+        TGA_WRITER*         writer,
+        const TARGA_IMAGE*  image,
+        const TGA_LAYOUT*   layout,
+        unsigned int        threads,
+        uint64_t*           rows)
+{
+
+    TGA_BAND_JOB job;
+    size_t count, i, y;
+
+    /* a few bands per thread for balance */
+    job.bandRows = (image->height + threads * 4 - 1) / (threads * 4);
+    count = (image->height + job.bandRows - 1) / job.bandRows;
+
+    job.image  = image;
+    job.layout = layout;
+    job.equal  = targaEqualKernel(layout->bpp);
+    job.rows   = rows;
+    job.bands  = calloc(count, sizeof(TGA_BAND));
+
+    if (!job.bands)
+    {
+        writer->status = TARGA_ERR_NO_MEMORY;
+        return;
+    }
+
+    targaParallelFor(threads, count, targaEncodeBand, &job);
+
+    uint64_t offset = writer->offset;
+    for (i = 0; i < count; i++)
+    {
+        if (job.bands[i].result != TARGA_OK)
+            writer->status = job.bands[i].result;
+
+        for (y = i * job.bandRows; rows && y < (i + 1) * job.bandRows && y < image->height; y++)
+            rows[y] += offset;
+
+        offset += job.bands[i].size;
+    }
+
+    targaWriteBands(writer, job.bands, count);
+
+    for (i = 0; i < count; i++)
+        free(job.bands[i].data);
+    free(job.bands);
+
+}
+
+
+static void targaWriteHeader(
+        TGA_WRITER*                 writer,
+        const TARGA_IMAGE*          image,
+        const TARGA_WRITE_OPTIONS*  options,
+        const TGA_LAYOUT*           layout)
+{
+
+    uint8_t header[TGA_HEADER_SIZE] = {0};
+    int mapped = image->format == TARGA_FORMAT_INDEX8;
+    size_t entryBpp = mapped ? targaFormatBpp(options->paletteFormat) : 0;
+
+    header[1] = mapped ? CMT_COLOR_MAPPED : CMT_TRUE_COLOR;
+    header[2] = layout->imageType;
+    if (mapped)
+    {
+        targaPut16(header + 5, options->paletteSize);
+        header[7] = (uint8_t)(entryBpp * 8);
+    }
+    targaPut16(header + 12, image->width);
+    targaPut16(header + 14, image->height);
+    header[16] = layout->pixelDepth;
+    header[17] = (uint8_t)(layout->alphaBits | (image->origin & TGA_ORIGIN_MASK));
+
+    targaWriteBytes(writer, header, sizeof(header));
+
+    if (mapped)
+    {
+        size_t size = options->paletteSize * entryBpp;
+        uint8_t palette[256 * 4];
+
+        if (options->paletteFormat == TARGA_FORMAT_RGB8 ||
+            options->paletteFormat == TARGA_FORMAT_RGBA8)
+            targaSwapKernel(entryBpp)(palette, options->palette, options->paletteSize, NULL);
+        else
+            memcpy(palette, options->palette, size);
+
+        targaWriteBytes(writer, palette, size);
+    }
+
+}
+
+
+/*
+ * Postage stamp: a byte of width, a byte of height and the image
+ * decimated to fit TARGA_STAMP_SIZE, uncompressed, in the file layout.
+ */
+static void targaWriteStamp(
+        TGA_WRITER*                 writer,
+        const TARGA_IMAGE*          image,
+        const TGA_LAYOUT*           layout)
+{
+
+    uint8_t gather[TARGA_STAMP_SIZE * 4];
+    uint8_t converted[TARGA_STAMP_SIZE * 4];
+    unsigned int step = targaDecimateStep(image->width, image->height, TARGA_STAMP_SIZE);
+    size_t bpp = layout->bpp;
+    size_t x, y;
+
+    uint8_t size[2];
+    size[0] = (uint8_t)((image->width + step - 1) / step);
+    size[1] = (uint8_t)((image->height + step - 1) / step);
+    targaWriteBytes(writer, size, sizeof(size));
+
+    for (y = 0; y < size[1]; y++)
+    {
+        const uint8_t* row = image->pixels
+            + targaDecimate(y, step, image->height) * image->pitch;
+
+        for (x = 0; x < size[0]; x++)
+            memcpy(gather + x * bpp, row + targaDecimate(x, step, image->width) * bpp, bpp);
+
+        if (layout->convert)
+        {
+            layout->convert(converted, gather, size[0], NULL);
+            targaWriteBytes(writer, converted, size[0] * bpp);
+        }
+        else
+        {
+            targaWriteBytes(writer, gather, size[0] * bpp);
+        }
+    }
+
+}
+
+
+/*
+ * Postage stamp, scan line table, extension area and footer. Offsets are
+ * 32 bits.
+ */
+static void targaWriteFooter(
+        TGA_WRITER*                 writer,
+        const TARGA_IMAGE*          image,
+        const TARGA_WRITE_OPTIONS*  options,
+        const TGA_LAYOUT*           layout,
+        const uint64_t*             rows)
+{
+
+    uint8_t extension[TGA_EXTENSION_SIZE] = {0};
+    uint8_t footer[TGA_FOOTER_SIZE] = {0};
+    uint64_t stamp = 0;
+    uint64_t table = 0;
+    size_t y;
+
+    if ((options->flags & TARGA_WRITE_STAMP) && image->width && image->height)
+    {
+        stamp = writer->offset;
+        targaWriteStamp(writer, image, layout);
+    }
+
+    if (options->flags & TARGA_WRITE_SCANLINE_TABLE)
+    {
+        uint8_t entry[4];
+
+        table = writer->offset;
+        for (y = 0; y < image->height; y++)
+        {
+            if (rows[y] > 0xFFFFFFFF)
+                writer->status = TARGA_ERR_UNSUPPORTED;
+
+            targaPut32(entry, (uint32_t)rows[y]);
+            targaWriteBytes(writer, entry, sizeof(entry));
+        }
+    }
+
+    uint64_t offset = writer->offset;
+    if (offset > 0xFFFFFFFF)
+        writer->status = TARGA_ERR_UNSUPPORTED;
+
+    targaPut16(extension, TGA_EXTENSION_SIZE);
+    memcpy(extension + TGA_EXT_SOFTWARE_ID, "targa", 5);
+    targaPut32(extension + TGA_EXT_STAMP_OFFSET, (uint32_t)stamp);
+    targaPut32(extension + TGA_EXT_SCANLINE_OFFSET, (uint32_t)table);
+    extension[TGA_EXT_ATTRIBUTES_TYPE] = layout->attributesType;
+    targaWriteBytes(writer, extension, sizeof(extension));
+
+    targaPut32(footer, (uint32_t)offset);
+    memcpy(footer + 8, TGA_SIGNATURE, sizeof(TGA_SIGNATURE));
+    targaWriteBytes(writer, footer, sizeof(footer));
+
+}
+
+
+static int targaWrite(
+        TGA_WRITER*                 writer,
+        const TARGA_IMAGE*          image,
+        const TARGA_WRITE_OPTIONS*  options)
+{
+
+    static const TARGA_WRITE_OPTIONS defaults = {0};
+    TGA_ROW_BUFFERS buffers = {0};
+    TGA_LAYOUT layout;
+    uint64_t* rows = NULL;
+    size_t y;
+
+    if (!options)
+        options = &defaults;
+
+    int result = targaWriteLayout(image, options, &layout);
+    if (result != TARGA_OK)
+        return result;
+
+    int footer = (options->flags &
+            (TARGA_WRITE_FOOTER | TARGA_WRITE_SCANLINE_TABLE | TARGA_WRITE_STAMP)) != 0;
+    size_t packed = image->width * layout.bpp;
+
+    if (options->flags & TARGA_WRITE_SCANLINE_TABLE)
+    {
+        rows = malloc(sizeof(uint64_t) * (image->height ? image->height : 1));
+        if (!rows)
+            return TARGA_ERR_NO_MEMORY;
+    }
+
+    targaWriteHeader(writer, image, options, &layout);
+
+    if (!layout.convert && layout.imageType < IMG_TYPE_RLE_COLOR_MAPPED &&
+        image->pitch == packed)
+    {
+        /* already in file layout: a single write */
+        for (y = 0; rows && y < image->height; y++)
+            rows[y] = writer->offset + y * packed;
+
+        targaWriteBytes(writer, image->pixels, packed * image->height);
+    }
+    else if (options->threads > 1 && layout.imageType >= IMG_TYPE_RLE_COLOR_MAPPED &&
+             image->height > 1)
+    {
+        targaWriteParallel(writer, image, &layout, options->threads, rows);
+    }
+    else
+    {
+        TGA_EQUAL_FN equal = targaEqualKernel(layout.bpp);
+
+        if (targaAllocRowBuffers(&buffers, image->width, layout.bpp) != TARGA_OK)
+            writer->status = TARGA_ERR_NO_MEMORY;
+
+        for (y = 0; y < image->height && writer->status == TARGA_OK; y++)
+        {
+            const uint8_t* data;
+            size_t size = targaEncodeRow(image, &layout, equal, &buffers, y, &data);
+
+            if (rows)
+                rows[y] = writer->offset;
+            targaWriteBytes(writer, data, size);
+        }
+
+        targaFreeRowBuffers(&buffers);
+    }
+
+    if (footer)
+        targaWriteFooter(writer, image, options, &layout, rows);
+
+    free(rows);
+    return writer->status;
+
+}
+
+
+int targaWriteImage(
+        const char*                 fileName,
+        const TARGA_IMAGE*          image,
+        const TARGA_WRITE_OPTIONS*  options)
+{
+
+    TGA_WRITER writer = {0};
+
+    writer.file = fopen(fileName, "wb");
+    if (!writer.file)
+        return TARGA_ERR_OPEN;
+
+    int result = targaWrite(&writer, image, options);
+
+    if (fclose(writer.file) != 0 && result == TARGA_OK)
+        result = TARGA_ERR_WRITE;
+
+    if (result != TARGA_OK)
+        remove(fileName);
+
+    return result;
+
+}
+
+
+int targaWriteMemory(
+        const TARGA_IMAGE*          image,
+        const TARGA_WRITE_OPTIONS*  options,
+        void**                      data,
+        size_t*                     size)
+{
+
+    TGA_WRITER writer = {0};
+
+    int result = targaWrite(&writer, image, options);
+    if (result != TARGA_OK)
+    {
+        free(writer.data);
+        return result;
+    }
+
+    *data = writer.data;
+    *size = writer.size;
+    return TARGA_OK;
+
+}
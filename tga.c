@@ -155,9 +155,9 @@ ReadTGA16bits (FILE *fp, gl_texture_t *texinfo)
         color = fgetc (fp) + (fgetc (fp) << 8);
 
         /* convert BGR to RGB */
-        texinfo->texels[(i * 3) + 0] = (GLubyte)(((color & 0x7C00) >> 10) << 3);
-        texinfo->texels[(i * 3) + 1] = (GLubyte)(((color & 0x03E0) >>  5) << 3);
-        texinfo->texels[(i * 3) + 2] = (GLubyte)(((color & 0x001F) >>  0) << 3);
+        texinfo->texels[(i * 3) + 0] = (GLubyte)(((color & 0x7C00) >> 7) | ((color & 0x7000) >> 12));
+        texinfo->texels[(i * 3) + 1] = (GLubyte)(((color & 0x03E0) >> 2) | ((color & 0x0380) >>  7));
+        texinfo->texels[(i * 3) + 2] = (GLubyte)(((color & 0x001F) << 3) | ((color & 0x001C) >>  2));
     }
 }
 
@@ -283,9 +283,9 @@ ReadTGA16bitsRLE (FILE *fp, gl_texture_t *texinfo)
 
             for (i = 0; i < size; ++i, ptr += 3)
             {
-                ptr[0] = (GLubyte)(((color & 0x7C00) >> 10) << 3);
-                ptr[1] = (GLubyte)(((color & 0x03E0) >>  5) << 3);
-                ptr[2] = (GLubyte)(((color & 0x001F) >>  0) << 3);
+                ptr[0] = (GLubyte)(((color & 0x7C00) >> 7) | ((color & 0x7000) >> 12));
+                ptr[1] = (GLubyte)(((color & 0x03E0) >> 2) | ((color & 0x0380) >>  7));
+                ptr[2] = (GLubyte)(((color & 0x001F) << 3) | ((color & 0x001C) >>  2));
             }
         }
         else
@@ -295,9 +295,9 @@ ReadTGA16bitsRLE (FILE *fp, gl_texture_t *texinfo)
             {
                 color = fgetc (fp) + (fgetc (fp) << 8);
 
-                ptr[0] = (GLubyte)(((color & 0x7C00) >> 10) << 3);
-                ptr[1] = (GLubyte)(((color & 0x03E0) >>  5) << 3);
-                ptr[2] = (GLubyte)(((color & 0x001F) >>  0) << 3);
+                ptr[0] = (GLubyte)(((color & 0x7C00) >> 7) | ((color & 0x7000) >> 12));
+                ptr[1] = (GLubyte)(((color & 0x03E0) >> 2) | ((color & 0x0380) >>  7));
+                ptr[2] = (GLubyte)(((color & 0x001F) << 3) | ((color & 0x001C) >>  2));
             }
         }
     }